@@ -0,0 +1,304 @@
+/**
+* @file:       PIXISAcquisitionTuning.cpp
+*
+* Purpose:     Implements the affinity, priority and buffer settings of the acquisition path.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISAcquisitionTuning.h"
+#include "PIXISAdaptorProps.h"
+#include "picam_advanced.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+// Page size used to round buffers that are not allocated from large pages
+#define PIXIS_SMALL_PAGE_BYTES 4096
+
+PIXISAcquisitionTuning::PIXISAcquisitionTuning() :
+	_buffer(NULL),
+	_bufferBytes(0),
+	_bufferMode(PIXISAcquisitionBuffer_Sdk),
+	_acquisitionAffinity(0),
+	_workerAffinity(0),
+	_priority(THREAD_PRIORITY_NORMAL){
+}
+
+void PIXISAcquisitionTuning::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	// Comma separated processor numbers and ranges, e.g. "0,2,4-7". Empty allows every processor.
+	hProp = devicePropFact->createStringProperty("Acquisition_Affinity", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createStringProperty("Worker_Affinity", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// The workers get the same priority, since the acquisition thread waits for them
+	hProp = devicePropFact->createEnumProperty("Acquisition_Priority", "normal", THREAD_PRIORITY_NORMAL);
+	devicePropFact->addEnumValue(hProp, "above_normal", THREAD_PRIORITY_ABOVE_NORMAL);
+	devicePropFact->addEnumValue(hProp, "highest", THREAD_PRIORITY_HIGHEST);
+	devicePropFact->addEnumValue(hProp, "time_critical", THREAD_PRIORITY_TIME_CRITICAL);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createEnumProperty("Acquisition_Buffer", "sdk", PIXISAcquisitionBuffer_Sdk);
+	devicePropFact->addEnumValue(hProp, "locked", PIXISAcquisitionBuffer_Locked);
+	devicePropFact->addEnumValue(hProp, "large_pages", PIXISAcquisitionBuffer_LargePages);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Acquisition_Buffer_Readouts", 1, 1024, 8);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Element n is 1 if processor n is used
+	int processors[PIXIS_AFFINITY_PROCESSORS] = { 0 };
+	hProp = devicePropFact->createIntArrayProperty("Acquisition_Affinity_Applied", 0, 1, PIXIS_AFFINITY_PROCESSORS, processors);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AcquisitionAffinityApplied);
+
+	hProp = devicePropFact->createIntArrayProperty("Worker_Affinity_Applied", 0, 1, PIXIS_AFFINITY_PROCESSORS, processors);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_WorkerAffinityApplied);
+
+	hProp = devicePropFact->createIntProperty("Acquisition_Priority_Applied", THREAD_PRIORITY_NORMAL);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AcquisitionPriorityApplied);
+
+	hProp = devicePropFact->createEnumProperty("Acquisition_Buffer_Applied", "sdk", PIXISAcquisitionBuffer_Sdk);
+	devicePropFact->addEnumValue(hProp, "locked", PIXISAcquisitionBuffer_Locked);
+	devicePropFact->addEnumValue(hProp, "large_pages", PIXISAcquisitionBuffer_LargePages);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AcquisitionBufferApplied);
+
+	// Bytes, as a double since a large buffer overflows an int
+	hProp = devicePropFact->createDoubleProperty("Acquisition_Buffer_Size", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AcquisitionBufferSize);
+}
+
+DWORD_PTR PIXISAcquisitionTuning::resolveAffinity(const char* requested, const char* propertyName){
+	DWORD_PTR mask = 0;
+	std::string list(requested);
+	size_t begin = 0;
+	while (begin <= list.size()){
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos){
+			end = list.size();
+		}
+		std::string range = list.substr(begin, end - begin);
+		range.erase(0, range.find_first_not_of(" \t"));
+		range.erase(range.find_last_not_of(" \t") + 1);
+		begin = end + 1;
+		if (range.empty()){
+			continue;
+		}
+
+		//A range is first-last, a single processor is both
+		char* stop;
+		long first = strtol(range.c_str(), &stop, 10);
+		long last = first;
+		if (*stop == '-'){
+			const char* lastText = stop + 1;
+			last = strtol(lastText, &stop, 10);
+			if (stop == lastText){
+				last = -1;
+			}
+		}
+		if (stop == range.c_str() || *stop != '\0' || first < 0 || last < first || last >= PIXIS_AFFINITY_PROCESSORS){
+			char message[200];
+			sprintf_s(message, sizeof(message), "%s entry \"%s\" is not a processor number or range from 0 to %d. Every processor is allowed instead.",
+				propertyName, range.c_str(), PIXIS_AFFINITY_PROCESSORS - 1);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:tuning", message);
+			mask = 0;
+			break;
+		}
+		for (long processor = first; processor <= last; ++processor){
+			mask |= (DWORD_PTR)1 << processor;
+		}
+	}
+	if (mask){
+		return mask;
+	}
+	DWORD_PTR processMask = 0;
+	DWORD_PTR systemMask = 0;
+	GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+	return processMask;
+}
+
+void PIXISAcquisitionTuning::writeAffinity(DWORD_PTR mask, int* flags){
+	for (int processor = 0; processor < PIXIS_AFFINITY_PROCESSORS; ++processor){
+		flags[processor] = (mask >> processor) & 1 ? 1 : 0;
+	}
+}
+
+void PIXISAcquisitionTuning::configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, HANDLE acquireThread, PIXISWorkerPool* workers){
+	const char* acquisitionAffinity = static_cast<const char*>(propContainer->getPropValue("Acquisition_Affinity"));
+	const char* workerAffinity = static_cast<const char*>(propContainer->getPropValue("Worker_Affinity"));
+	int* priority = static_cast<int*>(propContainer->getPropValue("Acquisition_Priority"));
+	int* bufferMode = static_cast<int*>(propContainer->getPropValue("Acquisition_Buffer"));
+	int* bufferReadouts = static_cast<int*>(propContainer->getPropValue("Acquisition_Buffer_Readouts"));
+
+	//SetThreadAffinityMask fails for processors outside the process affinity
+	_acquisitionAffinity = resolveAffinity(acquisitionAffinity, "Acquisition_Affinity");
+	if (SetThreadAffinityMask(acquireThread, _acquisitionAffinity) == 0){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:tuning", "Acquisition_Affinity selects no processor this process may use. It was not applied.");
+		_acquisitionAffinity = 0;
+	}
+	_workerAffinity = resolveAffinity(workerAffinity, "Worker_Affinity");
+	if (!workers->setAffinity(_workerAffinity)){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:tuning", "Worker_Affinity selects no processor this process may use. It was not applied.");
+		_workerAffinity = 0;
+	}
+
+	if (!SetThreadPriority(acquireThread, *priority) || !workers->setPriority(*priority)){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:tuning", "Acquisition_Priority could not be applied.");
+	}
+	_priority = GetThreadPriority(acquireThread);
+
+	allocateBuffer(camera, *bufferMode, *bufferReadouts);
+}
+
+/**
+* allocateBuffer keeps the current buffer when it is of the requested mode and large
+* enough. Large pages fall back to a locked buffer, and a buffer that cannot be locked
+* or handed to PICam falls back to the SDK's own, with a warning in each case.
+*/
+void PIXISAcquisitionTuning::allocateBuffer(PicamHandle camera, int mode, int readouts){
+	piint stride = 0;
+	Picam_GetParameterIntegerValue(camera, PicamParameter_ReadoutStride, &stride);
+	SIZE_T bytes = (SIZE_T)stride * readouts;
+
+	if (mode == PIXISAcquisitionBuffer_Sdk || bytes == 0){
+		release(camera);
+		return;
+	}
+	if (_buffer && (_bufferMode == mode || _bufferMode == PIXISAcquisitionBuffer_LargePages) && bytes <= _bufferBytes){
+		return;
+	}
+	release(camera);
+
+	void* memory = NULL;
+	SIZE_T size = 0;
+	int applied = PIXISAcquisitionBuffer_Sdk;
+
+	if (mode == PIXISAcquisitionBuffer_LargePages){
+		SIZE_T largePage = GetLargePageMinimum();
+		if (largePage && enableLockMemoryPrivilege()){
+			size = (bytes + largePage - 1) / largePage * largePage;
+			memory = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		}
+		if (memory){
+			applied = PIXISAcquisitionBuffer_LargePages;
+		}
+		else{
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:tuning", "Large pages are not available. They need the \"Lock pages in memory\" user right. Using a locked buffer instead.");
+		}
+	}
+
+	if (!memory){
+		size = (bytes + PIXIS_SMALL_PAGE_BYTES - 1) / PIXIS_SMALL_PAGE_BYTES * PIXIS_SMALL_PAGE_BYTES;
+		memory = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+		//VirtualLock is limited by the minimum working set, so grow it by the buffer size first
+		SIZE_T minimumSet, maximumSet;
+		GetProcessWorkingSetSize(GetCurrentProcess(), &minimumSet, &maximumSet);
+		SetProcessWorkingSetSize(GetCurrentProcess(), minimumSet + size, maximumSet + size);
+		if (memory && VirtualLock(memory, size)){
+			applied = PIXISAcquisitionBuffer_Locked;
+		}
+		else{
+			if (memory){
+				VirtualFree(memory, 0, MEM_RELEASE);
+				memory = NULL;
+			}
+			SetProcessWorkingSetSize(GetCurrentProcess(), minimumSet, maximumSet);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:tuning", "The acquisition buffer could not be locked in memory. Using the SDK buffer instead.");
+			return;
+		}
+	}
+
+	PicamAcquisitionBuffer buffer;
+	buffer.memory = memory;
+	buffer.memory_size = (pi64s)size;
+	if (PicamAdvanced_SetAcquisitionBuffer(camera, &buffer) != PicamError_None){
+		_buffer = memory;
+		_bufferBytes = size;
+		_bufferMode = applied;
+		release(camera);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:tuning", "PICam did not accept the acquisition buffer. Using the SDK buffer instead.");
+		return;
+	}
+
+	_buffer = memory;
+	_bufferBytes = size;
+	_bufferMode = applied;
+}
+
+void PIXISAcquisitionTuning::release(PicamHandle camera){
+	if (_buffer == NULL){
+		return;
+	}
+
+	//A null buffer returns PICam to its own allocation
+	PicamAcquisitionBuffer buffer;
+	buffer.memory = NULL;
+	buffer.memory_size = 0;
+	PicamAdvanced_SetAcquisitionBuffer(camera, &buffer);
+
+	if (_bufferMode == PIXISAcquisitionBuffer_Locked){
+		VirtualUnlock(_buffer, _bufferBytes);
+		SIZE_T minimumSet, maximumSet;
+		GetProcessWorkingSetSize(GetCurrentProcess(), &minimumSet, &maximumSet);
+		if (minimumSet > _bufferBytes && maximumSet > _bufferBytes){
+			SetProcessWorkingSetSize(GetCurrentProcess(), minimumSet - _bufferBytes, maximumSet - _bufferBytes);
+		}
+	}
+	VirtualFree(_buffer, 0, MEM_RELEASE);
+
+	_buffer = NULL;
+	_bufferBytes = 0;
+	_bufferMode = PIXISAcquisitionBuffer_Sdk;
+}
+
+bool PIXISAcquisitionTuning::enableLockMemoryPrivilege(){
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)){
+		return false;
+	}
+
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled = false;
+	if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)){
+		//AdjustTokenPrivileges succeeds without the right, so the last error tells whether it was granted
+		enabled = AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+	}
+	CloseHandle(token);
+	return enabled;
+}
+
+bool PIXISAcquisitionTuning::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_AcquisitionAffinityApplied:
+		writeAffinity(_acquisitionAffinity, reinterpret_cast<int*>(value));
+		return true;
+	case PIXISStatus_WorkerAffinityApplied:
+		writeAffinity(_workerAffinity, reinterpret_cast<int*>(value));
+		return true;
+	case PIXISStatus_AcquisitionPriorityApplied:
+		*reinterpret_cast<int*>(value) = _priority;
+		return true;
+	case PIXISStatus_AcquisitionBufferApplied:
+		*reinterpret_cast<int*>(value) = _bufferMode;
+		return true;
+	case PIXISStatus_AcquisitionBufferSize:
+		*reinterpret_cast<double*>(value) = (double)_bufferBytes;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,92 @@
+/**
+* @file:       PIXISAcquisitionTuning.h
+*
+* Purpose:     Class declaration for PIXISAcquisitionTuning.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_ACQUISITION_TUNING_HEADER__
+#define __PIXIS_ACQUISITION_TUNING_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include "PIXISWorkerPool.h"
+
+// Processors an affinity can select, one per bit of a thread affinity mask
+#define PIXIS_AFFINITY_PROCESSORS ((int)sizeof(DWORD_PTR) * 8)
+
+/**
+* Where the acquisition buffer PICam reads out into comes from.
+*/
+enum PIXISAcquisitionBufferMode{
+	PIXISAcquisitionBuffer_Sdk = 0,           // Allocated by PICam
+	PIXISAcquisitionBuffer_Locked = 1,        // Allocated by the adaptor and locked in physical memory
+	PIXISAcquisitionBuffer_LargePages = 2     // Allocated by the adaptor from large pages, which are always locked
+};
+
+/**
+* Class PIXISAcquisitionTuning
+*
+* @brief:  Applies the scheduling and memory settings of the acquisition path in
+*          startCapture(): processor affinity of the acquisition thread and of the
+*          worker pool, their thread priority, and the acquisition buffer handed to
+*          PICam with PicamAdvanced_SetAcquisitionBuffer.
+*
+*          Affinities are lists of processor numbers and ranges, e.g. "0,2,4-7", so
+*          any of the PIXIS_AFFINITY_PROCESSORS processors of the process's group
+*          can be selected. The settings that actually took effect are read back into the *_Applied
+*          status properties, so a setting refused by Windows (e.g. large pages
+*          without SeLockMemoryPrivilege) shows up there instead of failing the start.
+*/
+class PIXISAcquisitionTuning{
+
+public:
+	PIXISAcquisitionTuning();
+
+	// addProperties adds the affinity, priority and buffer properties and their *_Applied status
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure applies the settings to the acquisition thread, the workers and the camera. Called from startCapture().
+	void configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, HANDLE acquireThread, PIXISWorkerPool* workers);
+
+	// release gives the acquisition buffer back to PICam and frees it. Called before the camera is closed.
+	void release(PicamHandle camera);
+
+	// getWorkerAffinity and getPriority return the worker settings that took effect, for other processing threads
+	DWORD_PTR getWorkerAffinity() const { return _workerAffinity; }
+	int getPriority() const { return _priority; }
+
+	// getStatus writes the value of a *_Applied status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// allocateBuffer provides a buffer of the requested mode for readouts readouts, falling back as needed
+	void allocateBuffer(PicamHandle camera, int mode, int readouts);
+
+	// enableLockMemoryPrivilege enables SeLockMemoryPrivilege, which large page allocations require
+	static bool enableLockMemoryPrivilege();
+
+	/**
+	* resolveAffinity turns an affinity property value into a mask. An empty list means
+	* every processor of the process, as does a list that cannot be read, after a warning.
+	*/
+	static DWORD_PTR resolveAffinity(const char* requested, const char* propertyName);
+
+	// writeAffinity writes mask as PIXIS_AFFINITY_PROCESSORS flags, 1 for each processor it selects
+	static void writeAffinity(DWORD_PTR mask, int* flags);
+
+	void* _buffer;
+	SIZE_T _bufferBytes;
+	int _bufferMode;
+
+	/// Values reported by the *_Applied status properties
+	DWORD_PTR _acquisitionAffinity;
+	DWORD_PTR _workerAffinity;
+	int _priority;
+};
+#endif
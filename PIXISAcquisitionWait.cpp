@@ -0,0 +1,354 @@
+/**
+* @file:       PIXISAcquisitionWait.cpp
+*
+* Purpose:     Implements the blocking and polling waits for readouts.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISAcquisitionWait.h"
+#include "PIXISAdaptorProps.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Wait for the camera to stop after Picam_StopAcquisition, in ms per update
+#define PIXIS_WAIT_STOP_TIMEOUT 1000
+
+PIXISAcquisitionWait::PIXISAcquisitionWait() :
+	_mode(PIXISWait_Block),
+	_continuous(false),
+	_spinTicks(0),
+	_pending(NULL),
+	_pendingCount(0),
+	_laterReadout(false),
+	_stride(0),
+	_savedReadoutCount(1),
+	_running(false),
+	_errorsWarned(false),
+	_stampOffset(0),
+	_stampBytes(0),
+	_ticksPerStamp(0.0),
+	_originTicks(0),
+	_lastWake(0),
+	_intervals(0),
+	_intervalMean(0.0),
+	_intervalSquares(0.0),
+	_latencyTicks(0),
+	_latencyMaxTicks(0),
+	_latencyCount(0),
+	_errors(0){
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	_usPerTick = 1000000.0 / frequency.QuadPart;
+	_ticksPerMs = frequency.QuadPart / 1000;
+}
+
+void PIXISAcquisitionWait::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Acquisition_Wait", "block", PIXISWait_Block);
+	devicePropFact->addEnumValue(hProp, "poll", PIXISWait_Poll);
+	devicePropFact->addEnumValue(hProp, "hybrid", PIXISWait_Hybrid);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Time before the expected readout at which the hybrid wait starts polling, in us
+	hProp = devicePropFact->createDoubleProperty("Acquisition_Spin_Time", 0.0, 1.0e6, 500.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Time from the end of the exposure, or from picking up the readout without time stamps, to the send stage handing it on, in us
+	hProp = devicePropFact->createDoubleProperty("Wait_Latency_Mean", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_WaitLatencyMean);
+
+	hProp = devicePropFact->createDoubleProperty("Wait_Latency_Max", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_WaitLatencyMax);
+
+	// Standard deviation of the interval between readouts, in us
+	hProp = devicePropFact->createDoubleProperty("Wait_Interval_Jitter", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_WaitIntervalJitter);
+
+	// Updates of the continuous acquisition that reported errors such as lost readouts
+	hProp = devicePropFact->createIntProperty("Wait_Errors", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_WaitErrors);
+}
+
+void PIXISAcquisitionWait::configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, bool continuous){
+	int* mode = static_cast<int*>(propContainer->getPropValue("Acquisition_Wait"));
+	double* spinTime = static_cast<double*>(propContainer->getPropValue("Acquisition_Spin_Time"));
+	_mode = *mode;
+	_continuous = continuous;
+	_spinTicks = (LONG64)(*spinTime / _usPerTick);
+
+	_lastWake = 0;
+	_intervals = 0;
+	_intervalMean = 0.0;
+	_intervalSquares = 0.0;
+	_latencyTicks = 0;
+	_latencyMaxTicks = 0;
+	_latencyCount = 0;
+	_errors = 0;
+	_errorsWarned = false;
+
+	//The time stamps follow the pixels of each frame, exposure started before exposure ended
+	_ticksPerStamp = 0.0;
+	_originTicks = 0;
+	piint timeStamps = PicamTimeStampsMask_None;
+	if (camera && Picam_GetParameterIntegerValue(camera, PicamParameter_TimeStamps, &timeStamps) == PicamError_None &&
+		timeStamps != PicamTimeStampsMask_None){
+		pi64s resolution = 0;
+		piint bitDepth = 0, frameSize = 0, frameStride = 0, frames = 1;
+		Picam_GetParameterLargeIntegerValue(camera, PicamParameter_TimeStampResolution, &resolution);
+		Picam_GetParameterIntegerValue(camera, PicamParameter_TimeStampBitDepth, &bitDepth);
+		Picam_GetParameterIntegerValue(camera, PicamParameter_FrameSize, &frameSize);
+		Picam_GetParameterIntegerValue(camera, PicamParameter_FrameStride, &frameStride);
+		Picam_GetParameterIntegerValue(camera, PicamParameter_FramesPerReadout, &frames);
+		_stampBytes = bitDepth / 8;
+		if (resolution > 0 && _stampBytes > 0 && _stampBytes <= (int)sizeof(pi64u) && frames > 0){
+			_stampOffset = (size_t)(frames - 1) * frameStride + frameSize;
+			if ((timeStamps & PicamTimeStampsMask_ExposureStarted) && (timeStamps & PicamTimeStampsMask_ExposureEnded)){
+				_stampOffset += _stampBytes;
+			}
+			_ticksPerStamp = 1000000.0 / (_usPerTick * resolution);
+		}
+	}
+}
+
+/**
+* begin makes the readout count 0, which PICam takes as acquiring until stopped, and
+* starts the acquisition. Readouts then land in the circular acquisition buffer, sized
+* by Acquisition_Buffer_Readouts, until they are picked up.
+*/
+bool PIXISAcquisitionWait::begin(PicamHandle camera){
+	_pending = NULL;
+	_pendingCount = 0;
+	Picam_GetParameterIntegerValue(camera, PicamParameter_ReadoutStride, &_stride);
+	Picam_GetParameterLargeIntegerValue(camera, PicamParameter_ReadoutCount, &_savedReadoutCount);
+	Picam_SetParameterLargeIntegerValue(camera, PicamParameter_ReadoutCount, 0);
+
+	const PicamParameter* failedParameterArray;
+	piint failedParameterCount;
+	Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+	Picam_DestroyParameters(failedParameterArray);
+
+	acquiring();
+	if (failedParameterCount || Picam_StartAcquisition(camera) != PicamError_None){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:wait", "The continuous acquisition for Acquisition_Wait could not be started.");
+		Picam_SetParameterLargeIntegerValue(camera, PicamParameter_ReadoutCount, _savedReadoutCount);
+		Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+		Picam_DestroyParameters(failedParameterArray);
+		return false;
+	}
+	_running = true;
+	return true;
+}
+
+PicamError PIXISAcquisitionWait::poll(PicamHandle camera, LONG64 deadline, PicamAvailableData* available){
+	for (;;){
+		PicamAcquisitionStatus status;
+		status.errors = PicamAcquisitionErrorsMask_None;
+		PicamError error = Picam_WaitForAcquisitionUpdate(camera, 0, available, &status);
+		if (status.errors != PicamAcquisitionErrorsMask_None){
+			InterlockedIncrement(&_errors);
+		}
+		if (error == PicamError_None && available->readout_count > 0){
+			return PicamError_None;
+		}
+		if (error != PicamError_None && error != PicamError_TimeOutOccurred){
+			return error;
+		}
+
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		if (now.QuadPart >= deadline){
+			return PicamError_TimeOutOccurred;
+		}
+		YieldProcessor();
+	}
+}
+
+PicamError PIXISAcquisitionWait::next(PicamHandle camera, piint timeout, PicamAvailableData* data){
+	bool fetched = false;
+	if (_pendingCount == 0){
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		LONG64 deadline = now.QuadPart + timeout * _ticksPerMs;
+		PicamAvailableData available;
+		available.readout_count = 0;
+		PicamError error = PicamError_TimeOutOccurred;
+
+		//The hybrid wait sleeps through most of the interval and polls only near its end
+		if (_mode == PIXISWait_Hybrid && _intervals > 0){
+			LONG64 pollFrom = _lastWake + (LONG64)_intervalMean - _spinTicks;
+			if (pollFrom - now.QuadPart >= _ticksPerMs){
+				LONG64 sleep = (pollFrom - now.QuadPart) / _ticksPerMs;
+				PicamAcquisitionStatus status;
+				status.errors = PicamAcquisitionErrorsMask_None;
+				error = Picam_WaitForAcquisitionUpdate(camera, (piint)(sleep < timeout ? sleep : timeout), &available, &status);
+				if (status.errors != PicamAcquisitionErrorsMask_None){
+					InterlockedIncrement(&_errors);
+				}
+				if (error != PicamError_None || available.readout_count == 0){
+					available.readout_count = 0;
+				}
+			}
+		}
+		//A continuous block wait sleeps until the readout arrives
+		if (_mode == PIXISWait_Block){
+			PicamAcquisitionStatus status;
+			status.errors = PicamAcquisitionErrorsMask_None;
+			error = Picam_WaitForAcquisitionUpdate(camera, timeout, &available, &status);
+			if (status.errors != PicamAcquisitionErrorsMask_None){
+				InterlockedIncrement(&_errors);
+			}
+			if (error == PicamError_None && available.readout_count == 0){
+				error = PicamError_TimeOutOccurred;
+			}
+		}
+		else if (available.readout_count == 0){
+			error = poll(camera, deadline, &available);
+		}
+
+		if (_errors && !_errorsWarned){
+			_errorsWarned = true;
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:wait", "The continuous acquisition reported errors, such as readouts lost to a full acquisition buffer. See Wait_Errors.");
+		}
+		if (error != PicamError_None){
+			if (error != PicamError_TimeOutOccurred){
+				char message[128];
+				sprintf_s(message, sizeof(message), "The continuous acquisition failed with PICam error %d.", (int)error);
+				imaqkit::adaptorWarn("PIXISCameraAdaptor:wait", message);
+			}
+			return error;
+		}
+		_pending = static_cast<const pibyte*>(available.initial_readout);
+		_pendingCount = available.readout_count;
+		fetched = true;
+	}
+
+	//An update may carry several readouts, handed out one per call. Only the first was woken for.
+	_laterReadout = !fetched;
+	data->initial_readout = const_cast<pibyte*>(_pending);
+	data->readout_count = 1;
+	_pending += _stride;
+	_pendingCount--;
+	return PicamError_None;
+}
+
+void PIXISAcquisitionWait::end(PicamHandle camera){
+	if (!_running){
+		return;
+	}
+	Picam_StopAcquisition(camera);
+
+	//The camera finishes the readout in progress before it reports that it stopped. An update
+	//that fails or times out leaves nothing to wait for.
+	PicamAcquisitionStatus status;
+	memset(&status, 0, sizeof(status));
+	do{
+		PicamAvailableData available;
+		if (Picam_WaitForAcquisitionUpdate(camera, PIXIS_WAIT_STOP_TIMEOUT, &available, &status) != PicamError_None){
+			break;
+		}
+	} while (status.running);
+
+	Picam_SetParameterLargeIntegerValue(camera, PicamParameter_ReadoutCount, _savedReadoutCount);
+	const PicamParameter* failedParameterArray;
+	piint failedParameterCount;
+	Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+	Picam_DestroyParameters(failedParameterArray);
+
+	_running = false;
+	_pending = NULL;
+	_pendingCount = 0;
+}
+
+void PIXISAcquisitionWait::acquiring(){
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	_originTicks = now.QuadPart;
+}
+
+LONG64 PIXISAcquisitionWait::woke(const void* readout){
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	bool laterReadout = _laterReadout;
+	_laterReadout = false;
+
+	//The time stamp is little endian and counts from the start of the acquisition
+	if (_ticksPerStamp > 0.0 && _originTicks && readout){
+		pi64u stamp = 0;
+		memcpy(&stamp, static_cast<const pibyte*>(readout) + _stampOffset, _stampBytes);
+		LONG64 ended = _originTicks + (LONG64)(stamp * _ticksPerStamp);
+		if (laterReadout){
+			return ended < now.QuadPart ? ended : 0;
+		}
+		updateInterval(now.QuadPart);
+		return ended < now.QuadPart ? ended : now.QuadPart;
+	}
+
+	//The later readouts of an update arrived with the first, so there is no wake to charge them
+	if (laterReadout){
+		return 0;
+	}
+	updateInterval(now.QuadPart);
+	return now.QuadPart;
+}
+
+void PIXISAcquisitionWait::updateInterval(LONG64 now){
+	if (_lastWake){
+		double interval = (double)(now - _lastWake);
+		_intervals++;
+		double delta = interval - _intervalMean;
+		_intervalMean += delta / _intervals;
+		_intervalSquares += delta * (interval - _intervalMean);
+	}
+	_lastWake = now;
+}
+
+void PIXISAcquisitionWait::delivered(LONG64 wakeTicks){
+	//Readouts held from before the trigger were not picked up by this wait
+	if (wakeTicks == 0){
+		return;
+	}
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	LONG64 latency = now.QuadPart - wakeTicks;
+	InterlockedExchangeAdd64(&_latencyTicks, latency);
+	InterlockedIncrement64(&_latencyCount);
+
+	//Readouts may be delivered from more than one thread, so no update may be lost
+	LONG64 maximum = _latencyMaxTicks;
+	while (latency > maximum){
+		LONG64 seen = InterlockedCompareExchange64(&_latencyMaxTicks, latency, maximum);
+		if (seen == maximum){
+			break;
+		}
+		maximum = seen;
+	}
+}
+
+bool PIXISAcquisitionWait::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_WaitLatencyMean:{
+		LONG64 count = _latencyCount;
+		*reinterpret_cast<double*>(value) = count ? _latencyTicks * _usPerTick / count : 0.0;
+		return true;
+	}
+	case PIXISStatus_WaitLatencyMax:
+		*reinterpret_cast<double*>(value) = _latencyMaxTicks * _usPerTick;
+		return true;
+	case PIXISStatus_WaitIntervalJitter:
+		*reinterpret_cast<double*>(value) = _intervals > 1 ? sqrt(_intervalSquares / (_intervals - 1)) * _usPerTick : 0.0;
+		return true;
+	case PIXISStatus_WaitErrors:
+		*reinterpret_cast<int*>(value) = _errors;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,142 @@
+/**
+* @file:       PIXISAcquisitionWait.h
+*
+* Purpose:     Class declaration for PIXISAcquisitionWait.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_ACQUISITION_WAIT_HEADER__
+#define __PIXIS_ACQUISITION_WAIT_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+
+/**
+* How the acquisition thread waits for a readout.
+*/
+enum PIXISAcquisitionWaitMode{
+	PIXISWait_Block = 0,        // Picam_Acquire per readout, sleeping until it is done
+	PIXISWait_Poll = 1,         // Continuous acquisition, polled with zero timeouts
+	PIXISWait_Hybrid = 2        // Continuous acquisition, blocking until shortly before the next readout is due, then polling
+};
+
+/**
+* Class PIXISAcquisitionWait
+*
+* @brief:  Waits for readouts on the acquisition thread. Acquisition_Wait block, the
+*          default, calls Picam_Acquire for every readout as the adaptor always has.
+*          poll and hybrid run one continuous acquisition and query it with
+*          Picam_WaitForAcquisitionUpdate, so a readout is picked up without waiting
+*          for the OS to wake the thread: poll with zero timeouts throughout, hybrid
+*          blocking until Acquisition_Spin_Time before the readout is expected (from
+*          the interval between the previous two) and polling from there. Polling
+*          keeps a processor busy, so it belongs with Acquisition_Affinity pinning
+*          the acquisition thread to a core of its own. An acquisition started by a
+*          hardware trigger is always continuous, as every Picam_Acquire would wait
+*          for an edge of its own; with block it waits in Picam_WaitForAcquisitionUpdate.
+*
+*          For every mode the time from the end of a readout's exposure to the send
+*          stage handing it on, and the jitter of the intervals between readouts, are
+*          reported in the Wait_* status properties. The exposure end is taken from
+*          the camera's time stamp when TimeStamps are on; without one the time
+*          starts when the readout is picked up.
+*/
+class PIXISAcquisitionWait{
+
+public:
+	PIXISAcquisitionWait();
+
+	// addProperties adds the Acquisition_Wait properties and the Wait_* status properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* configure reads the Acquisition_Wait properties and resets the measurements.
+	* continuous makes the acquisition continuous even with block, as a hardware
+	* trigger needs. The time stamp layout of the readouts is read from camera, which
+	* may be NULL. Called from startCapture().
+	*/
+	void configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, bool continuous);
+
+	// isContinuous returns true if readouts come from one continuous acquisition, without stops in between
+	bool isContinuous() const { return _mode != PIXISWait_Block || _continuous; }
+
+	// begin starts the continuous acquisition
+	bool begin(PicamHandle camera);
+
+	/**
+	* next waits up to timeout ms for a readout of the continuous acquisition and fills
+	* data with it, one readout at a time.
+	*
+	* @return: PicamError_TimeOutOccurred if none arrived, PicamError_None otherwise.
+	*/
+	PicamError next(PicamHandle camera, piint timeout, PicamAvailableData* data);
+
+	// end stops the continuous acquisition and waits for the camera to finish
+	void end(PicamHandle camera);
+
+	// acquiring records that a Picam_Acquire is about to start, which the camera's time stamps count from
+	void acquiring();
+
+	/**
+	* woke records that readout was picked up. The later readouts of an update that
+	* carried several were not woken for, so they do not count towards the jitter.
+	*
+	* @return: When its exposure ended by the camera's time stamp, or else when it was picked up, in QueryPerformanceCounter ticks.
+	*          0 for a later readout of an update without a time stamp, which delivered() does not count.
+	*/
+	LONG64 woke(const void* readout);
+
+	// delivered records that the readout picked up at wakeTicks was handed on by the send stage. 0 is not counted.
+	void delivered(LONG64 wakeTicks);
+
+	// getStatus writes the value of a Wait_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// updateInterval adds the interval since the last wake to the jitter
+	void updateInterval(LONG64 now);
+
+	// poll queries the acquisition until it has data or deadline (in ticks) has passed
+	PicamError poll(PicamHandle camera, LONG64 deadline, PicamAvailableData* available);
+
+	/// Configured values
+	int _mode;
+	bool _continuous;
+	LONG64 _spinTicks;
+
+	/// Readouts of the last update not handed out yet
+	const pibyte* _pending;
+	pi64s _pendingCount;
+	bool _laterReadout;         // The readout next() handed out was not the first of its update
+	piint _stride;
+	pi64s _savedReadoutCount;
+	bool _running;
+	bool _errorsWarned;
+
+	/// Time stamp of the last frame of a readout: where it is, its size and its unit in ticks
+	size_t _stampOffset;
+	int _stampBytes;
+	double _ticksPerStamp;      // 0 without time stamps
+	LONG64 _originTicks;        // Start of the acquisition the time stamps count from
+
+	/// Interval between readouts, for the hybrid wait and the jitter
+	LONG64 _lastWake;
+	LONG64 _intervals;
+	double _intervalMean;
+	double _intervalSquares;    // Sum of squared differences from the mean, Welford's method
+
+	/// Wake to delivery, updated with Interlocked operations
+	volatile LONG64 _latencyTicks;
+	volatile LONG64 _latencyMaxTicks;
+	volatile LONG64 _latencyCount;
+
+	volatile LONG _errors;
+	double _usPerTick;
+	LONG64 _ticksPerMs;
+};
+#endif
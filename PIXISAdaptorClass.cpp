@@ -17,6 +17,7 @@
 
 #include "PIXISAdaptorClass.h"
 #include "PIXISPropSetListener.h"
+#include "PIXISAdaptorProps.h"
 
 #include "mwadaptorimaq.h"
 #include "picam.h"
@@ -30,7 +31,12 @@ PIXISAdaptorClass::PIXISAdaptorClass(imaqkit::IEngine* engine,
 	const imaqkit::IDeviceInfo* deviceInfo,
 	const char* formatName):imaqkit::IAdaptor(engine){
 
-	if (Picam_OpenFirstCamera(&_camera) == PicamError_None)    //Attempts to open the first camera it sees
+	//A replayed file stands in for the camera, so none is opened and camera parameters are not applied
+	if (PIXISReplaySource::isReplayFormat(formatName)){
+		_camera = NULL;
+		_id = PicamCameraID();
+	}
+	else if (Picam_OpenFirstCamera(&_camera) == PicamError_None)    //Attempts to open the first camera it sees
 		Picam_GetCameraID(_camera, &_id);
 	else                                                       //If no cameras found, connect a demo camera
 	{
@@ -45,6 +51,14 @@ PIXISAdaptorClass::PIXISAdaptorClass(imaqkit::IEngine* engine,
 	_acquisitionActiveGuard = imaqkit::createCriticalSection();       //Creates critical sections which guards code from being
 																	  //accessed simultaneously
 	_grabSection = imaqkit::createCriticalSection();
+	_acquisitionActive = 0;
+
+	//A format other than the camera's is a recorded capture to replay. It is opened now so
+	//that the engine sees its geometry.
+	if (PIXISReplaySource::isReplayFormat(formatName)){
+		_replayFile = formatName;
+		_replay.open(formatName);
+	}
 
 	//Creates IPropContainer which contains all of the device properties added in
 	//PIXISAdaptor_fncs
@@ -59,7 +73,15 @@ PIXISAdaptorClass::PIXISAdaptorClass(imaqkit::IEngine* engine,
 	for (int i = 0; i < numDeviceProps; i++){
 		imaqkit::IPropInfo* propInfo = propContainer->getIPropInfo(devicePropNames[i]);
 		int id = propInfo->getPropertyIdentifier();
-		if (id){
+		if (isAdaptorStatusProperty(id)){
+			//Status properties are read only, so they only need a get function
+			propContainer->setCustomGetFcn(devicePropNames[i], new PIXISPropGetListener(this));
+		}
+		else if (isAdaptorCommandProperty(id)){
+			//Command properties keep the value they were set to, so they only need a set listener
+			propContainer->addListener(devicePropNames[i], new PIXISPropSetListener(this));
+		}
+		else if (id){
 			propContainer->addListener(devicePropNames[i], new PIXISPropSetListener(this));
 			propContainer->setCustomGetFcn(devicePropNames[i], new PIXISPropGetListener(this));
 		}
@@ -71,7 +93,10 @@ PIXISAdaptorClass::PIXISAdaptorClass(imaqkit::IEngine* engine,
 
 // Class destructor
 PIXISAdaptorClass::~PIXISAdaptorClass(){
-	Picam_CloseCamera(_camera);
+	if (_camera){
+		_tuning.release(_camera);
+		Picam_CloseCamera(_camera);
+	}
 }
 
 // Device driver information functions
@@ -87,6 +112,64 @@ PicamAvailableData PIXISAdaptorClass::getCameraData() const{
 PicamCameraID PIXISAdaptorClass::getCameraID() const{
 	return _id;
 }
+
+//getAdaptorStatus asks each adaptor feature in turn for the status property id
+bool PIXISAdaptorClass::getAdaptorStatus(int id, void* value) const{
+	return _frameStats.getStatus(id, value) ||
+		_frameGate.getStatus(id, value) ||
+		_cosmicRayFilter.getStatus(id, value) ||
+		_planner.getStatus(id, value) ||
+		_sequence.getStatus(id, value) ||
+		_onlineUpdates.getStatus(id, value) ||
+		_sharedRing.getStatus(id, value) ||
+		_tuning.getStatus(id, value) ||
+		_kinetics.getStatus(id, value) ||
+		_replay.getStatus(id, value) ||
+		_pipeline.getStatus(id, value) ||
+		_autoExposure.getStatus(id, value) ||
+		_peakFinder.getStatus(id, value) ||
+		_delivery.getStatus(id, value) ||
+		_wait.getStatus(id, value) ||
+		_photonCounter.getStatus(id, value) ||
+		_defectMap.getStatus(id, value) ||
+		_accumulator.getStatus(id, value) ||
+		_hdrMerge.getStatus(id, value) ||
+		_apertures.getStatus(id, value) ||
+		_preTrigger.getStatus(id, value) ||
+		_preview.getStatus(id, value) ||
+		PIXISTraceRecorder::getStatus(id, value);
+}
+
+//applyAdaptorCommand hands the command property id to the adaptor feature that owns it
+bool PIXISAdaptorClass::applyAdaptorCommand(int id, void* newValue){
+	imaqkit::IPropContainer* propContainer = getEngine()->getAdaptorPropContainer();
+	if (PIXISTraceRecorder::applyCommand(id, newValue)){
+		return true;
+	}
+	//The others work on the camera, which a replayed file has none of
+	if (_camera == NULL){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:replay", "Readout planning and kinetics setup have no effect while replaying a file.");
+		return true;
+	}
+	//The others may commit camera parameters, which the pre-trigger ring would be in the way of
+	holdPreTrigger();
+	bool applied = _planner.applyCommand(id, newValue, _camera, propContainer, isAcquiring()) ||
+		_kinetics.applyCommand(id, _camera, propContainer, isKineticsMode());
+	releasePreTrigger(applied);
+	return applied;
+}
+
+//setupKinetics configures kinetics readout once Readout_Control_Mode is Kinetics
+bool PIXISAdaptorClass::setupKinetics(){
+	imaqkit::IPropContainer* propContainer = getEngine()->getAdaptorPropContainer();
+	return _kinetics.apply(_camera, propContainer);
+}
+
+//onlineParameterChanged notes the readout in flight when a parameter was changed online
+void PIXISAdaptorClass::onlineParameterChanged(){
+	_onlineUpdates.record(_readoutCount + 1);
+}
+
 const char* PIXISAdaptorClass::getDriverDescription() const{
 	return "PIXISCamera_Driver";
 }
@@ -96,11 +179,11 @@ const char* PIXISAdaptorClass::getDriverVersion() const {
 
 //isAcquisitionActive returns _acquisitionActive, which flags whether we are actively acquiring.
 bool PIXISAdaptorClass::isAcquisitionActive(void) const {
-	return _acquisitionActive;
+	return InterlockedCompareExchange(const_cast<volatile LONG*>(&_acquisitionActive), 0, 0) != 0;
 }
 //isAcquisitionActive sets _acquisitionActive, which flags whether we are actively acquiring.
 void PIXISAdaptorClass::setAcquisitionActive(bool state) {
-	_acquisitionActive = state;
+	InterlockedExchange(&_acquisitionActive, state ? 1 : 0);
 }
 
 //isKineticsMode returns true if the current Readout Control Mode parameter is Kinetics
@@ -120,9 +203,24 @@ int PIXISAdaptorClass::getFramesPerReadout() const{
 	int* output = static_cast<int*>(propContainer->getPropValue("Frames_per_Readout"));
 	return *output;
 }
-//getMaxWidth returns the ROI width
+//getMaxWidth returns the width of the frames sent to the engine
 int PIXISAdaptorClass::getMaxWidth() const{
 	imaqkit::IPropContainer* propContainer = getEngine()->getAdaptorPropContainer();
+	return PIXISPreview::binnedSize(getReadoutWidth(), PIXISPreview::getBinning(propContainer));
+}
+
+//getMaxHeight returns the height of the frames sent to the engine
+int PIXISAdaptorClass::getMaxHeight() const{
+	imaqkit::IPropContainer* propContainer = getEngine()->getAdaptorPropContainer();
+	return PIXISPreview::binnedSize(getReadoutHeight(), PIXISPreview::getBinning(propContainer));
+}
+
+//getReadoutWidth returns the ROI width, or the width of the replayed file
+int PIXISAdaptorClass::getReadoutWidth() const{
+	imaqkit::IPropContainer* propContainer = getEngine()->getAdaptorPropContainer();
+	if (_replay.isOpen()){
+		return _replay.getWidth(propContainer);
+	}
 	//int* output = static_cast<int*>(propContainer->getPropValue("ROIWidth"));
 	int* width = static_cast<int*>(propContainer->getPropValue("ROIWidth"));
 	int* xBinning = static_cast<int*>(propContainer->getPropValue("ROIXBinning"));
@@ -132,9 +230,12 @@ int PIXISAdaptorClass::getMaxWidth() const{
 
 }
 
-//getMaxHeight returns the ROI height
-int PIXISAdaptorClass::getMaxHeight() const{
+//getReadoutHeight returns the ROI height, or the height of the replayed file
+int PIXISAdaptorClass::getReadoutHeight() const{
 	imaqkit::IPropContainer* propContainer = getEngine()->getAdaptorPropContainer();
+	if (_replay.isOpen()){
+		return _replay.getHeight(propContainer);
+	}
 	//int* output = static_cast<int*>(propContainer->getPropValue("ROIHeight"));
 	int* height = static_cast<int*>(propContainer->getPropValue("ROIHeight"));
 	int* yBinning = static_cast<int*>(propContainer->getPropValue("ROIYBinning"));
@@ -169,6 +270,13 @@ int PIXISAdaptorClass::getNumberOfBands() const { return 1; }
 
 imaqkit::frametypes::FRAMETYPE PIXISAdaptorClass::getFrameType()
 const {
+	imaqkit::IPropContainer* propContainer = getEngine()->getAdaptorPropContainer();
+	if (PIXISPreview::getBinning(propContainer) > 1){
+		return imaqkit::frametypes::MONO8;
+	}
+	if (PIXISFlatField::isFloatOutput(propContainer) || PIXISHdrMerge::isEnabled(propContainer)){
+		return imaqkit::frametypes::SINGLE;
+	}
 	return imaqkit::frametypes::MONO16;
 }
 
@@ -183,65 +291,182 @@ DWORD WINAPI PIXISAdaptorClass::acquireThread(void* param) {
 	MSG msg;
 	pi64s NUM_FRAMES = 1;        //The PIXIS camera will only acquire one frame per trigger/readout
 	piint TIMEOUT =3000;      //We set the timeout to 3s so we do not get stuck in Picam_Acquire() waiting for a trigger
+	int REPLAY_TIMEOUT = 100; //A replay waits for its next readout in short steps so that a stop is seen quickly
+	piint POLL_TIMEOUT = 100; //So does a polled continuous acquisition
+	PIXISTraceRecorder::nameThread("Acquisition");
 	
 	// While the msg is not WM_QUIT
 	while (GetMessage(&msg, NULL, 0, 0) > 0) {
 		switch (msg.message) {
+		case WM_USER + 2:{
+			//Runs one continuous acquisition into the pre-trigger ring until hold() stops it
+			PIXISTraceScope armScope("PreTrigger");
+			PicamHandle camera = adaptor->getCameraHandle();
+			if (adaptor->_preTrigger.begin(camera)){
+				PicamAcquisitionStatus status;
+				status.running = TRUE;
+				while (status.running && adaptor->_preTrigger.keepArmed()){
+					PicamAvailableData data;
+					data.readout_count = 0;
+					status.errors = PicamAcquisitionErrorsMask_None;
+					PicamError acquired = Picam_WaitForAcquisitionUpdate(camera, TIMEOUT, &data, &status);
+					if (acquired == PicamError_None && data.readout_count > 0){
+						adaptor->_preTrigger.push(data, imaqkit::getCurrentTime());
+					}
+					else if (acquired != PicamError_None && acquired != PicamError_TimeOutOccurred){
+						imaqkit::adaptorWarn("PIXISCameraAdaptor:preTrigger", "The camera stopped acquiring into the pre-trigger ring.");
+						break;
+					}
+				}
+				adaptor->_preTrigger.end();
+			}
+			adaptor->_preTrigger.disarmed();
+			break;
+		}
 		case WM_USER:
 			// Create the autoCriticalSection
 			std::auto_ptr<imaqkit::IAutoCriticalSection> acquisitionActiveGuard(imaqkit::createAutoCriticalSection(adaptor->_acquisitionActiveGuard, true));
 			PicamHandle _camera = adaptor->getCameraHandle();
 			PicamAvailableData _data;
 			PicamAcquisitionErrorsMask _errors = adaptor->getCameraErrors();
+			PIXISPipelineItem inlineItem;
+			adaptor->_enginePending = 0;
+			adaptor->_pipeline.start(runStage, adaptor, adaptor->getReadoutWidth() * adaptor->getReadoutHeight());
+			adaptor->_delivery.start(deliverFrame, adaptor);
+			adaptor->_preview.start(sendPreview, adaptor, &adaptor->_workers);
+
+			//Readouts held from before the trigger go first, oldest first and with the times they were acquired at
+			if (adaptor->_preTrigger.getWidth() == adaptor->getReadoutWidth() && adaptor->_preTrigger.getHeight() == adaptor->getReadoutHeight()){
+				for (int i = 0; i < adaptor->_preTrigger.getHeldCount(); ++i){
+					double heldTime;
+					const pi16u* heldPixels = adaptor->_preTrigger.getHeld(i, &heldTime);
+					adaptor->_readoutCount++;
+					PIXISPipelineItem* item = &inlineItem;
+					if (adaptor->_pipeline.isRunning()){
+						item = NULL;
+						while (item == NULL && adaptor->isAcquisitionActive()){
+							item = adaptor->_pipeline.nextItem(100);
+						}
+					}
+					if (item == NULL){
+						break;
+					}
+					item->reset(adaptor->_readoutCount, adaptor->getReadoutWidth(), adaptor->getReadoutHeight(), heldTime, -1);
+					item->setPixels(heldPixels);
+					if (adaptor->_pipeline.isRunning()){
+						adaptor->_pipeline.submit(item);
+					}
+					else{
+						adaptor->_pipeline.process(item);
+					}
+				}
+			}
+			adaptor->_preTrigger.sent();
+
+			bool continuous = adaptor->_wait.isContinuous() && !adaptor->_replay.isOpen();
+			if (continuous && !adaptor->_wait.begin(_camera)){
+				adaptor->setAcquisitionActive(false);
+			}
 
 			//While we still need to acquire
 			while (adaptor->isAcquisitionNotComplete() && adaptor->isAcquisitionActive()) {
 				//Enter the autoCriticalSection
 				acquisitionActiveGuard->enter();
 
-				//Calls Picam_Acquire.  If Picam_Acquire does not time out, go on to sendFrame, otherwise continue through the loop
-				if (PicamError_TimeOutOccurred != Picam_Acquire(_camera, NUM_FRAMES, TIMEOUT, &_data, &_errors)){
-					if (adaptor->isSendFrame()) {
-						// Get frame type & dimensions.
-						imaqkit::frametypes::FRAMETYPE frameType =
-							adaptor->getFrameType();
-						int imWidth = adaptor->getMaxWidth();
-						int imHeight = adaptor->getMaxHeight();						
-
-						int imBands = adaptor->getNumberOfBands();
-						int XOffset = adaptor->getXOffset();
-						int YOffset = adaptor->getYOffset();
-						// Create a frame object.
-						imaqkit::IAdaptorFrame* frame =
-							adaptor->getEngine()->makeFrame(frameType,
-							imWidth,
-							imHeight);
-
-						// Copy data from buffer into frame object.
-						frame->setImage((pibyte*)_data.initial_readout,
-							imWidth,
-							imHeight,
-							0, // X Offset from origin
-							0); // Y Offset from origin
-
-						// Set image's timestamp.
-						frame->setTime(imaqkit::getCurrentTime());
-
-						// Send frame object to engine.
-						adaptor->getEngine()->receiveFrame(frame);
+				//Commit the next sequence step between readouts. Picam_Acquire has stopped the
+				//camera on return, so this needs no stop/restart of the engine. A replayed
+				//readout has no camera, and the step only labels it.
+				if (adaptor->_sequence.isEnabled()){
+					adaptor->_sequence.prepare(_camera);
+				}
+
+				//Calls Picam_Acquire, or takes the next readout of the replayed file.  If it does not time out, go on to sendFrame, otherwise continue through the loop
+				PicamError acquired;
+				{
+					PIXISTraceScope acquireScope("Acquire");
+					if (adaptor->_replay.isOpen()){
+						_data.initial_readout = (void*)adaptor->_replay.next(REPLAY_TIMEOUT);
+						_data.readout_count = _data.initial_readout ? 1 : 0;
+						acquired = _data.initial_readout ? PicamError_None : PicamError_TimeOutOccurred;
+					}
+					else if (continuous){
+						acquired = adaptor->_wait.next(_camera, POLL_TIMEOUT, &_data);
+						//A continuous acquisition that failed, and was warned about, ends this one
+						if (acquired != PicamError_None && acquired != PicamError_TimeOutOccurred){
+							adaptor->setAcquisitionActive(false);
+							acquired = PicamError_TimeOutOccurred;
+						}
 					}
 					else{
-						imaqkit::adaptorWarn("PIXISCameraAdaptor:hoot", "Not sending that frame!");
+						adaptor->_wait.acquiring();
+						acquired = Picam_Acquire(_camera, NUM_FRAMES, TIMEOUT, &_data, &_errors);
+					}
+				}
+				if (PicamError_TimeOutOccurred != acquired){
+					LONG64 wakeTicks = adaptor->_wait.woke(adaptor->_replay.isOpen() ? NULL : _data.initial_readout);
+					adaptor->_readoutCount++;
+					PIXISTraceScope readoutScope("Readout", adaptor->_readoutCount);
+					int sequenceStep = adaptor->_sequence.isEnabled() ? adaptor->_sequence.readoutDone() : -1;
+
+					//The raw readout is metered here, so the next Picam_Acquire already uses the new exposure
+					if (adaptor->_autoExposure.isEnabled()){
+						PIXISTraceScope scope("AutoExposure");
+						adaptor->_autoExposure.process(_camera, (const pi16u*)_data.initial_readout, adaptor->getReadoutWidth(), adaptor->_readoutCount);
+					}
+
+					//With the pipeline running the readout is copied into a free item and handed
+					//to the stage threads, otherwise the stages run here on Picam's buffer
+					PIXISPipelineItem* item = &inlineItem;
+					if (adaptor->_pipeline.isRunning()){
+						item = NULL;
+						while (item == NULL && adaptor->isAcquisitionActive()){
+							PIXISTraceScope scope("WaitForItem");
+							item = adaptor->_pipeline.nextItem(100);
+						}
+					}
+					if (item){
+						item->reset(adaptor->_readoutCount, adaptor->getReadoutWidth(), adaptor->getReadoutHeight(),
+							imaqkit::getCurrentTime(), sequenceStep);
+						item->wakeTicks = wakeTicks;
+						item->setPixels((const pi16u*)_data.initial_readout);
+						if (adaptor->_pipeline.isRunning()){
+							adaptor->_pipeline.submit(item);
+						}
+						else{
+							adaptor->_pipeline.process(item);
+						}
 					}
-					// if isSendFrame()
-					// Increment the frame count.
-					adaptor->incrementFrameCount();
 				}
-				if (adaptor->getFrameCount() >= adaptor->getTotalFramesPerTrigger()){
+				//A finished replay ends the acquisition once its last readouts are through the pipeline, and so
+				//does the last of FramesPerTrigger readouts when none are sent to the engine
+				if (adaptor->_replay.isFinished() || (adaptor->_reducedOnly && adaptor->_readoutCount >= (pi64s)adaptor->getTotalFramesPerTrigger())){
+					adaptor->_pipeline.drain();
+					adaptor->_preview.drain();
+					adaptor->_delivery.drain();
 					adaptor->setAcquisitionActive(false);
 				}
 				acquisitionActiveGuard->leave();   //Leave the criticalSection
 			} // while(isAcquisitionNotComplete() 
+
+			//Readouts still in the pipeline are only sent if the acquisition is still active.
+			//They are copies, so the camera can be stopped first.
+			if (continuous){
+				adaptor->_wait.end(_camera);
+			}
+			adaptor->_pipeline.stop();
+			adaptor->_preview.stop();
+			adaptor->_delivery.stop();
+			if (adaptor->_sequence.isEnabled()){
+				adaptor->_sequence.finish(_camera);
+			}
+			adaptor->_hardwareTrigger.finish(_camera);
+			adaptor->_autoExposure.finish();
+			adaptor->_sharedRing.finish();
+			adaptor->_peakFinder.finish();
+			adaptor->_photonCounter.finish();
+			adaptor->_accumulator.finish();
+			adaptor->_apertures.finish();
+			adaptor->releasePreTrigger(false);
 			break;
 		} //switch-case WM_USER
 
@@ -250,6 +475,253 @@ DWORD WINAPI PIXISAdaptorClass::acquireThread(void* param) {
 	return 0;
 }
 
+//runStage is the PIXISPipeline::StageFunction, run on the acquisition thread or a stage thread
+void PIXISAdaptorClass::runStage(void* context, int stage, PIXISPipelineItem* item){
+	reinterpret_cast<PIXISAdaptorClass*>(context)->processStage(stage, item);
+}
+
+//processStage applies one processing stage to a readout
+void PIXISAdaptorClass::processStage(int stage, PIXISPipelineItem* item){
+	switch (stage){
+	case PIXISStage_Stats:
+		//Statistics are computed on every readout that reaches them, including the ones not sent to the engine
+		if (_frameStats.isEnabled()){
+			PIXISTraceScope scope("FrameStats");
+			_frameStats.process(item->pixels, item->width * item->height, item->readout);
+		}
+		break;
+
+	case PIXISStage_Accumulate:
+		if (_accumulator.isEnabled()){
+			PIXISTraceScope scope("PixelAccumulator");
+			_accumulator.process(item->pixels, item->width, item->height, &_workers);
+			if (!_accumulator.sendsImages()){
+				withholdFromEngine(item);
+			}
+		}
+		break;
+
+	case PIXISStage_Defects:
+		//Readouts of a dark series only build the map and are not delivered
+		if (_defectMap.isEnabled()){
+			PIXISTraceScope scope("DefectMap");
+			item->dropped = !_defectMap.process(item->writablePixels(), item->width, item->height);
+		}
+		break;
+
+	case PIXISStage_Hdr:
+		//Only the merged frame of a bracket goes on; the readouts before it are dropped
+		if (_hdrMerge.isEnabled()){
+			PIXISTraceScope scope("HdrMerge");
+			const float* merged = _hdrMerge.process(item->pixels, item->width, item->height, item->sequenceStep, &_workers);
+			if (merged == NULL){
+				item->dropped = true;
+			}
+			else{
+				item->setImage(reinterpret_cast<const pibyte*>(merged), (size_t)item->width * item->height * sizeof(float));
+			}
+		}
+		break;
+
+	case PIXISStage_Photons:
+		if (_photonCounter.isEnabled()){
+			PIXISTraceScope scope("PhotonCounter");
+			_photonCounter.process(item->pixels, item->width, item->height, item->readout, item->time);
+			if (!_photonCounter.sendsImages()){
+				withholdFromEngine(item);
+			}
+		}
+		break;
+
+	case PIXISStage_FlatField:
+		if (_flatField.isEnabled()){
+			PIXISTraceScope scope("FlatField");
+			item->setPixels(_flatField.process(item->pixels, item->width, item->height, &_workers));
+			if (_flatField.isFloatOutput()){
+				item->setImage(reinterpret_cast<const pibyte*>(_flatField.getFloatImage()),
+					(size_t)item->width * item->height * sizeof(float));
+			}
+		}
+		break;
+
+	case PIXISStage_CosmicRay:
+		//Cosmic rays are removed before gating so that a hit cannot open the gate
+		if (_cosmicRayFilter.isEnabled()){
+			PIXISTraceScope scope("CosmicRayFilter");
+			const pi16u* cleaned = _cosmicRayFilter.process(item->pixels, item->width, item->height, item->readout, &_workers);
+			//The first readouts only fill the filter window
+			if (cleaned == NULL){
+				item->dropped = true;
+			}
+			else{
+				item->setPixels(cleaned);
+			}
+		}
+		break;
+
+	case PIXISStage_Apertures:
+		if (_apertures.isEnabled()){
+			PIXISTraceScope scope("Apertures");
+			_apertures.process(item->pixels, item->width, item->height, item->readout, item->time);
+			if (!_apertures.sendsImages()){
+				withholdFromEngine(item);
+			}
+		}
+		break;
+
+	case PIXISStage_Peaks:
+		if (_peakFinder.isEnabled()){
+			PIXISTraceScope scope("PeakFinder");
+			_peakFinder.process(item->pixels, item->width, item->height, item->readout, item->time);
+			if (!_peakFinder.sendsImages()){
+				withholdFromEngine(item);
+			}
+		}
+		break;
+
+	case PIXISStage_Gate:
+		//Readouts rejected by the gate are dropped before any engine allocation and
+		//do not count towards FramesPerTrigger
+		if (_frameGate.isEnabled()){
+			PIXISTraceScope scope("FrameGate");
+			item->dropped = !_frameGate.accept(item->pixels, item->width, item->height);
+		}
+		break;
+
+	case PIXISStage_SharedMemory:
+		//External readers get every readout that reaches them, whether or not the engine is sent a frame
+		if (_sharedRing.isEnabled()){
+			PIXISTraceScope scope("SharedMemoryPublish");
+			decideToEngine(item);
+			pi64s frame = item->toEngine && isSendFrame() ? getFrameCount() + _enginePending : 0;
+			_sharedRing.publish(item->pixels, item->width, item->height, item->readout, frame, item->time);
+		}
+		break;
+
+	case PIXISStage_Preview:
+		if (_preview.isEnabled()){
+			decideToEngine(item);
+			//The preview thread bins the readout and sends the frame itself, so the send stage has nothing to do
+			if (item->toEngine){
+				item->toEngine = false;
+				if (!_preview.offer(item->pixels, item->width, item->height, item->time)){
+					InterlockedDecrement(&_enginePending);
+				}
+				else{
+					_onlineUpdates.reached(item->readout, getFrameCount() + _enginePending);
+				}
+			}
+		}
+		break;
+
+	case PIXISStage_Send:
+		if (!item->dropped){
+			decideToEngine(item);
+		}
+		if (item->toEngine){
+			const pibyte* image = item->image ? item->image : (const pibyte*)item->pixels;
+			//Readouts still in flight when the acquisition ends are not sent
+			if (!item->dropped && isAcquisitionActive()){
+				_onlineUpdates.reached(item->readout, getFrameCount() + _enginePending);
+				if (_delivery.isEnabled()){
+					//A queued frame stays pending until the delivery thread has sent it
+					LONG discarded = _delivery.offer(image, item->time, item->sequenceStep);
+					InterlockedExchangeAdd(&_enginePending, -discarded);
+					_wait.delivered(item->wakeTicks);
+					break;
+				}
+				sendFrame(image, item->time, item->sequenceStep);
+				_wait.delivered(item->wakeTicks);
+			}
+			InterlockedDecrement(&_enginePending);
+		}
+		break;
+	}
+}
+
+//decideToEngine decides, once per readout, whether it goes to the engine. With a preview only some readouts do.
+void PIXISAdaptorClass::decideToEngine(PIXISPipelineItem* item){
+	if (item->engineDecided){
+		return;
+	}
+	item->engineDecided = true;
+	item->toEngine = !_preview.isEnabled() || _preview.isDue(item->time);
+	if (item->toEngine){
+		InterlockedIncrement(&_enginePending);
+	}
+}
+
+//withholdFromEngine keeps a readout reduced to its results from the engine, unless it was already decided.
+//It does not count towards FramesPerTrigger; with every readout reduced, the acquisition thread counts readouts instead.
+void PIXISAdaptorClass::withholdFromEngine(PIXISPipelineItem* item){
+	if (item->engineDecided){
+		return;
+	}
+	item->engineDecided = true;
+	item->toEngine = false;
+}
+
+//deliverFrame is the PIXISDeliveryQueue::DeliverFunction, sending a queued frame unless the acquisition has ended
+void PIXISAdaptorClass::deliverFrame(void* context, const PIXISDeliveryFrame& frame){
+	PIXISAdaptorClass* adaptor = reinterpret_cast<PIXISAdaptorClass*>(context);
+	if (adaptor->isAcquisitionActive()){
+		adaptor->sendFrame(&frame.image[0], frame.time, frame.sequenceStep);
+	}
+	InterlockedDecrement(&adaptor->_enginePending);
+}
+
+//sendPreview is the PIXISPreview::SendFunction, sending a binned frame as the send stage would
+void PIXISAdaptorClass::sendPreview(void* context, const pibyte* image, double time){
+	PIXISAdaptorClass* adaptor = reinterpret_cast<PIXISAdaptorClass*>(context);
+	if (adaptor->isAcquisitionActive()){
+		if (adaptor->_delivery.isEnabled()){
+			//A queued frame stays pending until the delivery thread has sent it
+			LONG discarded = adaptor->_delivery.offer(image, time, -1);
+			InterlockedExchangeAdd(&adaptor->_enginePending, -discarded);
+			return;
+		}
+		adaptor->sendFrame(image, time, -1);
+	}
+	InterlockedDecrement(&adaptor->_enginePending);
+}
+
+//sendFrame sends a readout, or its preview image, to the engine and counts it
+void PIXISAdaptorClass::sendFrame(const pibyte* image, double time, int sequenceStep){
+	if (isSendFrame()) {
+		PIXISTraceScope scope("SendFrame");
+		// Get frame type & dimensions.
+		imaqkit::frametypes::FRAMETYPE frameType = getFrameType();
+		int imWidth = getMaxWidth();
+		int imHeight = getMaxHeight();
+
+		// Create a frame object.
+		imaqkit::IAdaptorFrame* frame = getEngine()->makeFrame(frameType, imWidth, imHeight);
+
+		// Copy data from buffer into frame object.
+		frame->setImage(const_cast<pibyte*>(image),
+			imWidth,
+			imHeight,
+			0, // X Offset from origin
+			0); // Y Offset from origin
+
+		// Set image's timestamp.
+		frame->setTime(time);
+
+		// Send frame object to engine.
+		getEngine()->receiveFrame(frame);
+
+		// Tag the frame with the sequence step it was acquired with
+		if (sequenceStep >= 0){
+			_sequence.frameDelivered(getFrameCount() + 1, sequenceStep, time);
+		}
+	}
+	// Increment the frame count.
+	incrementFrameCount();
+	if (getFrameCount() >= getTotalFramesPerTrigger()){
+		setAcquisitionActive(false);
+	}
+}
+
 // Set up the device for acquisition.
 bool PIXISAdaptorClass::openDevice() { 
 
@@ -257,6 +729,10 @@ bool PIXISAdaptorClass::openDevice() {
 	if (isOpen()){
 		return true;
 	}
+	//The replay file was opened, and warned about, in the constructor
+	if (!_replayFile.empty() && !_replay.isOpen()){
+		return false;
+	}
 	_acquireThread = CreateThread(NULL, 0, acquireThread, this, 0, &_acquireThreadID);  //Creates the image acquisition thread
 	if (_acquireThread == NULL){
 		closeDevice();
@@ -264,6 +740,10 @@ bool PIXISAdaptorClass::openDevice() {
 	}
 	while (PostThreadMessage(_acquireThreadID, WM_USER + 1, 0, 0) == 0)
 		Sleep(1);
+
+	//One worker per processor besides the acquisition thread, which works on tiles too
+	_workers.start(-1);
+	armPreTrigger();
 	return true;
 }
 
@@ -273,6 +753,8 @@ bool PIXISAdaptorClass::closeDevice(){
 	if (!isOpen())
 		return true;
 	if (_acquireThread){
+		//The thread must not be left in the pre-trigger ring
+		_preTrigger.hold();
 		//Send WM_QUIT message to thread
 		PostThreadMessage(_acquireThreadID, WM_QUIT, 0, 0);
 		// Give the thread a chance to finish
@@ -280,7 +762,9 @@ bool PIXISAdaptorClass::closeDevice(){
 		//Close thread handle
 		CloseHandle(_acquireThread);
 		_acquireThread = NULL;
+		_preTrigger.release(true);
 	}
+	_workers.stop();
 	return true;
 }
 
@@ -290,12 +774,187 @@ bool PIXISAdaptorClass::startCapture(){
 	if (isAcquiring())
 		return false;
 
-	PostThreadMessage(_acquireThreadID, WM_USER, 0, 0);
+	//An exposure the last acquisition converged on, if stopCapture() came before it was kept
+	_autoExposure.writeBack(getEngine()->getAdaptorPropContainer());
+
+	//The start is the trigger: the pre-trigger ring stops here, and the acquisition sends its readouts first
+	_preTrigger.hold();
+	if (!configureCapture()){
+		releasePreTrigger(false);
+		return false;
+	}
+
+	//Active before the thread starts, which sends the held readouts straight away
 	setAcquisitionActive(true);
+	PostThreadMessage(_acquireThreadID, WM_USER, 0, 0);
 
 	return true; 
 }
 
+//configureCapture configures every stage for the acquisition startCapture() is about to start
+bool PIXISAdaptorClass::configureCapture(){
+	imaqkit::IPropContainer* propContainer = getEngine()->getAdaptorPropContainer();
+
+	//useHardwareTrigger() only comes before a start with a hardware trigger, so the request is taken for this start alone
+	bool hardwareTrigger = _hardwareTrigger.takeRequest();
+	if (hardwareTrigger && _replay.isOpen()){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:trigger", "A hardware trigger cannot be used while replaying a file.");
+		return false;
+	}
+	//The camera waits for the edge itself, so there are no readouts from before it to keep
+	if (hardwareTrigger && PIXISPreTrigger::isEnabled(propContainer)){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:preTrigger", "Pre_Trigger_Frames cannot be used with a hardware trigger.");
+		return false;
+	}
+
+	_readoutCount = 0;
+	_onlineUpdates.restart();
+	_frameStats.configure(propContainer, _camera);
+	_frameGate.configure(propContainer);
+	_cosmicRayFilter.configure(propContainer);
+	_sharedRing.configure(propContainer, getReadoutWidth(), getReadoutHeight());
+	_preview.configure(propContainer);
+	_tuning.configure(propContainer, _camera, _acquireThread, &_workers);
+	_pipeline.setScheduling(_tuning.getWorkerAffinity(), _tuning.getPriority());
+	_delivery.setScheduling(_tuning.getWorkerAffinity(), _tuning.getPriority());
+	_preview.setScheduling(_tuning.getWorkerAffinity(), _tuning.getPriority());
+
+	//An invalid stage list fails the start
+	if (!_pipeline.configure(propContainer)){
+		return false;
+	}
+
+	//Uncorrected readouts are never sent on: a missing or unfitting map fails the start
+	if (!_flatField.configure(propContainer, _camera, getReadoutWidth(), getReadoutHeight(), !_replay.isOpen())){
+		return false;
+	}
+
+	if (!_apertures.configure(propContainer, getReadoutWidth(), getReadoutHeight())){
+		return false;
+	}
+
+	_peakFinder.configure(propContainer);
+
+	_accumulator.configure(propContainer, getReadoutWidth(), getReadoutHeight());
+
+	//Defects are never sent on uncorrected: a missing or unfitting map fails the start
+	if (!_defectMap.configure(propContainer, _camera, getReadoutWidth(), getReadoutHeight(), !_replay.isOpen())){
+		return false;
+	}
+
+	//Thresholds come from the dark and noise maps, so a map that does not fit fails the start
+	if (!_photonCounter.configure(propContainer, getReadoutWidth(), getReadoutHeight())){
+		return false;
+	}
+
+	//Every frame for the engine has the same type and size for the whole acquisition
+	imaqkit::frametypes::FRAMETYPE frameType = getFrameType();
+	size_t pixelBytes = frameType == imaqkit::frametypes::MONO8 ? 1 : (frameType == imaqkit::frametypes::SINGLE ? sizeof(float) : sizeof(pi16u));
+	if (!_delivery.configure(propContainer, (size_t)getMaxWidth() * getMaxHeight() * pixelBytes)){
+		return false;
+	}
+
+	if (_replay.isOpen() && !_replay.configure(propContainer)){
+		return false;
+	}
+
+	//Auto exposure needs the camera, and would fight a sequence over the exposure time
+	int* autoExposure = static_cast<int*>(propContainer->getPropValue("Auto_Exposure"));
+	if (*autoExposure != 0 && (_replay.isOpen() || *static_cast<const char*>(propContainer->getPropValue("Sequence_Steps")) != '\0')){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:autoExposure", "Auto_Exposure cannot be used while replaying a file or with Sequence_Steps.");
+		return false;
+	}
+	if (!_autoExposure.configure(propContainer, _camera, getReadoutWidth(), getReadoutHeight())){
+		return false;
+	}
+
+	//An invalid sequence step fails the start instead of stopping part way through
+	if (!_sequence.configure(propContainer, _camera)){
+		return false;
+	}
+
+	//The brackets are the sequence steps, so the merge is configured after them
+	if (!_hdrMerge.configure(propContainer, _sequence, getReadoutWidth(), getReadoutHeight())){
+		return false;
+	}
+	//Every feature that is on needs its stage in Pipeline_Stages
+	struct StageFeature{
+		bool enabled;
+		int stage;
+		const char* id;
+		const char* property;
+		const char* stageName;
+	};
+	const StageFeature stageFeatures[] = {
+		{ _flatField.isEnabled(), PIXISStage_FlatField, "PIXISCameraAdaptor:flatField", "Flat_Field", "flat_field" },
+		{ _apertures.isEnabled(), PIXISStage_Apertures, "PIXISCameraAdaptor:apertures", "Apertures", "apertures" },
+		{ _peakFinder.isEnabled(), PIXISStage_Peaks, "PIXISCameraAdaptor:peaks", "Peak_Finding", "peaks" },
+		{ _accumulator.isEnabled(), PIXISStage_Accumulate, "PIXISCameraAdaptor:accumulator", "Accumulator", "accumulate" },
+		{ _defectMap.isEnabled(), PIXISStage_Defects, "PIXISCameraAdaptor:defects", "Defect_Correction", "defects" },
+		{ _photonCounter.isEnabled(), PIXISStage_Photons, "PIXISCameraAdaptor:photons", "Photon_Counting", "photons" },
+		{ _hdrMerge.isEnabled(), PIXISStage_Hdr, "PIXISCameraAdaptor:hdr", "HDR_Merge", "hdr" }
+	};
+	for (size_t i = 0; i < sizeof(stageFeatures) / sizeof(stageFeatures[0]); ++i){
+		if (stageFeatures[i].enabled && !_pipeline.hasStage(stageFeatures[i].stage)){
+			char message[128];
+			sprintf_s(message, sizeof(message), "%s is on but %s is not in Pipeline_Stages.", stageFeatures[i].property, stageFeatures[i].stageName);
+			imaqkit::adaptorWarn(stageFeatures[i].id, message);
+			return false;
+		}
+	}
+
+	//Readouts reduced to their results never reach the engine, so FramesPerTrigger counts readouts instead
+	_reducedOnly = (_accumulator.isEnabled() && !_accumulator.sendsImages()) || (_photonCounter.isEnabled() && !_photonCounter.sendsImages()) ||
+		(_apertures.isEnabled() && !_apertures.sendsImages()) || (_peakFinder.isEnabled() && !_peakFinder.sendsImages());
+
+	//Later stages work on the readout, so they would correct, measure or preview the last raw bracket instead of the merged frame
+	if (_hdrMerge.isEnabled() && (_flatField.isEnabled() || _cosmicRayFilter.isEnabled() || _apertures.isEnabled() || _peakFinder.isEnabled() || _preview.isEnabled())){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:hdr", "HDR_Merge cannot be used with Flat_Field, Cosmic_Ray_Filter, Apertures, Peak_Finding or Preview_Mode.");
+		return false;
+	}
+
+	//Sequence steps and auto exposure commit parameters between readouts, which a continuous acquisition has no room for.
+	//A hardware trigger needs one, since every Picam_Acquire would wait for an edge of its own.
+	_wait.configure(propContainer, _camera, hardwareTrigger);
+	if (_wait.isContinuous() && !_replay.isOpen() && (_sequence.isEnabled() || _autoExposure.isEnabled())){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:wait", "Acquisition_Wait poll and hybrid, and hardware triggers, cannot be used with Sequence_Steps or Auto_Exposure.");
+		return false;
+	}
+
+	//The trigger is committed last, so a start that fails leaves the camera as it was
+	if (hardwareTrigger && !_hardwareTrigger.apply(_camera)){
+		return false;
+	}
+	return true;
+}
+
+//armPreTrigger starts running the camera into the pre-trigger ring, if Pre_Trigger_Frames asks for one
+void PIXISAdaptorClass::armPreTrigger(){
+	if (_acquireThread == NULL || _replay.isOpen()){
+		return;
+	}
+	if (_preTrigger.arm(getEngine()->getAdaptorPropContainer(), getReadoutWidth(), getReadoutHeight())){
+		PostThreadMessage(_acquireThreadID, WM_USER + 2, 0, 0);
+	}
+}
+
+//holdPreTrigger stops the pre-trigger ring so camera parameters can be committed
+void PIXISAdaptorClass::holdPreTrigger(){
+	_preTrigger.hold();
+}
+
+//releasePreTrigger undoes a holdPreTrigger() and arms the ring again, without the readouts it held if discard is set
+void PIXISAdaptorClass::releasePreTrigger(bool discard){
+	_preTrigger.release(discard);
+	armPreTrigger();
+}
+
+//Takes the hardware trigger the engine is configured with, applied by the startCapture() that follows
+bool PIXISAdaptorClass::useHardwareTrigger(){
+	_hardwareTrigger.request(getEngine()->getEnginePropContainer());
+	return true;
+}
+
 //Stops capture
 bool PIXISAdaptorClass::stopCapture(){ 
 	if (!isOpen()){
@@ -305,5 +964,8 @@ bool PIXISAdaptorClass::stopCapture(){
 	std::auto_ptr<imaqkit::IAutoCriticalSection> GrabSection(imaqkit::createAutoCriticalSection(_grabSection, true));
 	setAcquisitionActive(false);
 	GrabSection->leave();
+
+	//The acquisition thread only keeps the converged exposure; properties are set from this thread
+	_autoExposure.writeBack(getEngine()->getAdaptorPropContainer());
 	return true;
 }
\ No newline at end of file
@@ -4,6 +4,32 @@
 #include "mwadaptorimaq.h" // required header
 #include <Windows.h>
 #include "picam.h"
+#include "PIXISFrameStats.h"
+#include "PIXISFrameGate.h"
+#include "PIXISCosmicRayFilter.h"
+#include "PIXISWorkerPool.h"
+#include "PIXISReadoutPlanner.h"
+#include "PIXISExposureSequence.h"
+#include "PIXISOnlineUpdates.h"
+#include "PIXISSharedFrameRing.h"
+#include "PIXISPreview.h"
+#include "PIXISAcquisitionTuning.h"
+#include "PIXISKineticsSetup.h"
+#include "PIXISReplaySource.h"
+#include "PIXISTraceRecorder.h"
+#include "PIXISPipeline.h"
+#include "PIXISFlatField.h"
+#include "PIXISAutoExposure.h"
+#include "PIXISPeakFinder.h"
+#include "PIXISDeliveryQueue.h"
+#include "PIXISAcquisitionWait.h"
+#include "PIXISPhotonCounter.h"
+#include "PIXISDefectMap.h"
+#include "PIXISPixelAccumulator.h"
+#include "PIXISHdrMerge.h"
+#include "PIXISApertures.h"
+#include "PIXISHardwareTrigger.h"
+#include "PIXISPreTrigger.h"
 
 class PIXISAdaptorClass : public imaqkit::IAdaptor {
 
@@ -42,11 +68,52 @@ public:
 	virtual bool startCapture();
 	virtual bool stopCapture();
 
+	// Takes the TriggerSource and TriggerCondition for a start with a hardware trigger
+	virtual bool useHardwareTrigger();
+
+	// Writes the value of an adaptor status property (see PIXISAdaptorProps.h)
+	bool getAdaptorStatus(int id, void* value) const;
+
+	// Carries out an adaptor command property that was just set (see PIXISAdaptorProps.h)
+	bool applyAdaptorCommand(int id, void* newValue);
+
+	// Records a parameter change applied online by PIXISPropSetListener
+	void onlineParameterChanged();
+
+	// Sets and commits the kinetics parameters from the Kinetics_* properties
+	bool setupKinetics();
+
+	// Stop the pre-trigger ring while camera parameters are committed, and arm it again afterwards
+	void holdPreTrigger();
+	void releasePreTrigger(bool discard);
+
 
 private:
 	// Declereation of acquisition thread function
 	static DWORD WINAPI acquireThread(void* param);
+
+	// Processing of each readout, run by _pipeline
+	static void runStage(void* context, int stage, PIXISPipelineItem* item);
+	void processStage(int stage, PIXISPipelineItem* item);
+	void decideToEngine(PIXISPipelineItem* item);
+	void withholdFromEngine(PIXISPipelineItem* item);
+	void sendFrame(const pibyte* image, double time, int sequenceStep);
+
+	// Configures the stages for startCapture(). Returns false, after warning, if the start is to fail.
+	bool configureCapture();
+
+	// Starts the camera running into _preTrigger, if it is enabled and not held
+	void armPreTrigger();
+
+	// Delivery of the frames queued by _delivery, run on its thread
+	static void deliverFrame(void* context, const PIXISDeliveryFrame& frame);
+
+	// Sending of the frames binned by _preview, run on its thread
+	static void sendPreview(void* context, const pibyte* image, double time);
 	bool PIXISAdaptorClass::isAcquisitionActive(void) const;
+	// Size of the readouts the camera returns. getMaxWidth()/getMaxHeight() give the engine frame size, which is smaller with a preview.
+	int getReadoutWidth() const;
+	int getReadoutHeight() const;
 	void PIXISAdaptorClass::setAcquisitionActive(bool state);
 	// Thread variable
 	HANDLE _acquireThread;
@@ -63,11 +130,58 @@ private:
 	/// Handle to the engine property container.
 	imaqkit::IPropContainer* _enginePropContainer;
 
-	bool _acquisitionActive;
+	/// Set by the engine thread and read by the acquisition, delivery and preview threads, so it is
+	/// only touched through the Interlocked functions.
+	volatile LONG _acquisitionActive;
 
 	PicamHandle _camera;
 	PicamCameraID _id;
 	PicamAvailableData _data;
 	PicamAcquisitionErrorsMask _errors;
+
+	/// Number of readouts returned by the camera since startCapture()
+	pi64s _readoutCount;
+
+	/// True if no readout goes to the engine, so the readouts are counted towards FramesPerTrigger instead
+	bool _reducedOnly;
+
+	PIXISFrameStats _frameStats;
+	PIXISFrameGate _frameGate;
+	PIXISCosmicRayFilter _cosmicRayFilter;
+
+	PIXISReadoutPlanner _planner;
+	PIXISExposureSequence _sequence;
+	PIXISOnlineUpdates _onlineUpdates;
+	PIXISSharedFrameRing _sharedRing;
+	PIXISPreview _preview;
+	PIXISAcquisitionTuning _tuning;
+	PIXISAcquisitionWait _wait;
+	PIXISPhotonCounter _photonCounter;
+	PIXISDefectMap _defectMap;
+	PIXISPixelAccumulator _accumulator;
+	PIXISHdrMerge _hdrMerge;
+	PIXISApertures _apertures;
+	PIXISHardwareTrigger _hardwareTrigger;
+	PIXISPreTrigger _preTrigger;
+	PIXISKineticsSetup _kinetics;
+	PIXISFlatField _flatField;
+	PIXISAutoExposure _autoExposure;
+	PIXISPeakFinder _peakFinder;
+
+	/// Recorded capture replayed in place of the camera, when the format names a file
+	PIXISReplaySource _replay;
+	std::string _replayFile;
+
+	/// Stages between Picam_Acquire and receiveFrame
+	PIXISPipeline _pipeline;
+
+	/// Readouts bound for the engine that have not been sent yet
+	volatile LONG _enginePending;
+
+	/// Frames between the send stage and receiveFrame, with Delivery_Policy other than direct
+	PIXISDeliveryQueue _delivery;
+
+	/// Threads for tiled processing of readouts, running while the device is open
+	PIXISWorkerPool _workers;
 };
 #endif
\ No newline at end of file
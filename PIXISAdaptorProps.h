@@ -0,0 +1,197 @@
+/**
+* @file:       PIXISAdaptorProps.h
+*
+* Purpose:     Identifiers for the properties the adaptor defines itself, as opposed
+*              to the PICam parameters enumerated from the camera.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_ADAPTOR_PROPS_HEADER__
+#define __PIXIS_ADAPTOR_PROPS_HEADER__
+
+#include "mwadaptorimaq.h"
+
+/**
+* PICam parameter identifiers pack the constraint type, value type and an index into
+* the low three bytes, so the adaptor's own properties use a high byte PICam never
+* produces.
+*
+* Status properties are read only. PIXISPropGetListener answers them through
+* PIXISAdaptorClass::getAdaptorStatus without touching the camera, so they are cheap
+* to poll while acquiring.
+*
+* Command properties act as soon as they are set. PIXISPropSetListener hands them to
+* PIXISAdaptorClass::applyAdaptorCommand instead of the camera, and the acquisition is
+* not stopped and restarted for them.
+*
+* Adaptor configuration properties (e.g. Frame_Statistics) keep an identifier of 0,
+* so no listener is attached and the engine stores their values. The adaptor reads
+* them by name in startCapture().
+*/
+enum PIXISAdaptorStatusProperty{
+	PIXISStatus_First = 0x40000000,
+
+	// Per-readout statistics, see PIXISFrameStats
+	PIXISStatus_FrameStatsReadout = PIXISStatus_First,
+	PIXISStatus_FrameStatsMin,
+	PIXISStatus_FrameStatsMax,
+	PIXISStatus_FrameStatsMean,
+	PIXISStatus_FrameStatsSum,
+	PIXISStatus_FrameStatsSaturated,
+	PIXISStatus_FrameStatsHistogram,
+
+	// Content gate counters, see PIXISFrameGate
+	PIXISStatus_FrameGateAccepted,
+	PIXISStatus_FrameGateRejected,
+
+	// Cosmic-ray rejection, see PIXISCosmicRayFilter
+	PIXISStatus_CosmicRayReadout,
+	PIXISStatus_CosmicRayReplaced,
+	PIXISStatus_CosmicRayTotalReplaced,
+
+	// Readout planning, see PIXISReadoutPlanner
+	PIXISStatus_PlanValid,
+	PIXISStatus_PlanReadoutTime,
+	PIXISStatus_PlanFrameRate,
+	PIXISStatus_PlanDataRate,
+
+	// Exposure sequences, see PIXISExposureSequence
+	PIXISStatus_SequenceFrame,
+	PIXISStatus_SequenceStep,
+
+	// Parameters changed during acquisition, see PIXISOnlineUpdates
+	PIXISStatus_OnlineUpdateCount,
+	PIXISStatus_OnlineUpdateReadout,
+	PIXISStatus_OnlineUpdateFrame,
+
+	// Shared-memory frame ring, see PIXISSharedFrameRing
+	PIXISStatus_SharedMemoryPublished,
+
+	// Scheduling and buffer settings in effect, see PIXISAcquisitionTuning
+	PIXISStatus_AcquisitionAffinityApplied,
+	PIXISStatus_WorkerAffinityApplied,
+	PIXISStatus_AcquisitionPriorityApplied,
+	PIXISStatus_AcquisitionBufferApplied,
+	PIXISStatus_AcquisitionBufferSize,
+
+	// Kinetics timing in effect, see PIXISKineticsSetup
+	PIXISStatus_KineticsWindowHeight,
+	PIXISStatus_KineticsFramesPerReadout,
+	PIXISStatus_KineticsSubframeInterval,
+	PIXISStatus_KineticsReadoutTime,
+
+	// File replay progress, see PIXISReplaySource
+	PIXISStatus_ReplayFrame,
+	PIXISStatus_ReplayLag,
+
+	// Trace recording, see PIXISTraceRecorder
+	PIXISStatus_TraceEvents,
+	PIXISStatus_TraceDropped,
+
+	// Per stage timing and queue depth, see PIXISPipeline
+	PIXISStatus_PipelineQueueDepth,
+	PIXISStatus_PipelineStageTime,
+	PIXISStatus_PipelineStageMaxTime,
+
+	// Exposure control, see PIXISAutoExposure
+	PIXISStatus_AutoExposureReadout,
+	PIXISStatus_AutoExposureLevel,
+	PIXISStatus_AutoExposureTime,
+	PIXISStatus_AutoExposureConverged,
+
+	// Spectral peaks of the latest readout, see PIXISPeakFinder
+	PIXISStatus_PeakReadout,
+	PIXISStatus_PeakCount,
+	PIXISStatus_PeakTable,
+
+	// Frames waiting for the engine, see PIXISDeliveryQueue
+	PIXISStatus_DeliveryQueueDepth,
+	PIXISStatus_DeliveryHighWater,
+	PIXISStatus_DeliveryDroppedOldest,
+	PIXISStatus_DeliveryDroppedNewest,
+	PIXISStatus_DeliveryDecimated,
+	PIXISStatus_DeliveryBlockedTime,
+
+	// Readout pick-up latency, see PIXISAcquisitionWait
+	PIXISStatus_WaitLatencyMean,
+	PIXISStatus_WaitLatencyMax,
+	PIXISStatus_WaitIntervalJitter,
+	PIXISStatus_WaitErrors,
+
+	// Photon events, see PIXISPhotonCounter
+	PIXISStatus_PhotonReadout,
+	PIXISStatus_PhotonEventCount,
+	PIXISStatus_PhotonTotalEvents,
+	PIXISStatus_PhotonRejected,
+	PIXISStatus_PhotonEvents,
+
+	// Defective pixels, see PIXISDefectMap
+	PIXISStatus_DefectCount,
+
+	// Per-pixel mean and variance, see PIXISPixelAccumulator
+	PIXISStatus_AccumulatorReadouts,
+	PIXISStatus_AccumulatorMeanLevel,
+	PIXISStatus_AccumulatorMeanVariance,
+
+	// Bracketed exposure merge, see PIXISHdrMerge
+	PIXISStatus_HdrFrames,
+	PIXISStatus_HdrIncomplete,
+	PIXISStatus_HdrSaturatedPixels,
+
+	// Aperture sums of the latest readout, see PIXISApertures
+	PIXISStatus_ApertureCount,
+	PIXISStatus_ApertureReadout,
+	PIXISStatus_ApertureSums,
+
+	// Ring of readouts from before the trigger, see PIXISPreTrigger
+	PIXISStatus_PreTriggerCapacity,
+	PIXISStatus_PreTriggerHeld,
+	PIXISStatus_PreTriggerSent,
+
+	// Binned preview, see PIXISPreview
+	PIXISStatus_PreviewSkipped,
+
+	PIXISStatus_Last
+};
+
+enum PIXISAdaptorCommandProperty{
+	PIXISCommand_First = 0x41000000,
+
+	PIXISCommand_PlanRequest = PIXISCommand_First,
+
+	// Kinetics setup values, re-applied as they are set. Kept contiguous, see PIXISKineticsSetup.
+	PIXISCommand_KineticsWindowHeight,
+	PIXISCommand_KineticsFramesPerReadout,
+	PIXISCommand_KineticsShiftRate,
+	PIXISCommand_KineticsExposureTime,
+	PIXISCommand_KineticsTriggerResponse,
+
+	// Trace recording on/off and export
+	PIXISCommand_Trace,
+	PIXISCommand_TraceDump,
+
+	PIXISCommand_Last
+};
+
+//isAdaptorStatusProperty returns true if id belongs to a read only adaptor status property
+inline bool isAdaptorStatusProperty(int id){
+	return id >= PIXISStatus_First && id < PIXISStatus_Last;
+}
+
+//isAdaptorCommandProperty returns true if id belongs to an adaptor command property
+inline bool isAdaptorCommandProperty(int id){
+	return id >= PIXISCommand_First && id < PIXISCommand_Last;
+}
+
+//addStatusProperty makes hProp read only, tags it with its status identifier and adds it to devicePropFact
+inline void addStatusProperty(imaqkit::IPropFactory* devicePropFact, void* hProp, int id){
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::ALWAYS);
+	devicePropFact->setIdentifier(hProp, id);
+	devicePropFact->addProperty(hProp);
+}
+
+#endif
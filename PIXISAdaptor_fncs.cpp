@@ -20,6 +20,31 @@
 #include "picam.h"
 #include "picam_advanced.h"
 #include "PIXISAdaptorClass.h"
+#include "PIXISFrameStats.h"
+#include "PIXISFrameGate.h"
+#include "PIXISCosmicRayFilter.h"
+#include "PIXISReadoutPlanner.h"
+#include "PIXISExposureSequence.h"
+#include "PIXISOnlineUpdates.h"
+#include "PIXISSharedFrameRing.h"
+#include "PIXISPreview.h"
+#include "PIXISAcquisitionTuning.h"
+#include "PIXISKineticsSetup.h"
+#include "PIXISReplaySource.h"
+#include "PIXISTraceRecorder.h"
+#include "PIXISPipeline.h"
+#include "PIXISFlatField.h"
+#include "PIXISAutoExposure.h"
+#include "PIXISPeakFinder.h"
+#include "PIXISDeliveryQueue.h"
+#include "PIXISAcquisitionWait.h"
+#include "PIXISPhotonCounter.h"
+#include "PIXISDefectMap.h"
+#include "PIXISPixelAccumulator.h"
+#include "PIXISHdrMerge.h"
+#include "PIXISApertures.h"
+#include "PIXISHardwareTrigger.h"
+#include "PIXISPreTrigger.h"
 #include <vector>
 #include <algorithm>
 
@@ -52,10 +77,11 @@ void initializeAdaptor(){
 void getAvailHW(imaqkit::IHardwareInfo* hardwareContainer){
 
 
-	imaqkit::IDeviceInfo* deviceInfo = hardwareContainer->createDeviceInfo(1, "PIXIS_Camera");
+	imaqkit::IDeviceInfo* deviceInfo = hardwareContainer->createDeviceInfo(1, PIXIS_CAMERA_FORMAT);
 
-	deviceInfo->setDeviceFileSupport(false);
-	imaqkit::IDeviceFormat* deviceFormat = deviceInfo->createDeviceFormat(1, "PIXIS_Camera");
+	//A file given as the format is a recorded capture to replay, see PIXISReplaySource
+	deviceInfo->setDeviceFileSupport(true);
+	imaqkit::IDeviceFormat* deviceFormat = deviceInfo->createDeviceFormat(1, PIXIS_CAMERA_FORMAT);
 
 	deviceInfo->addDeviceFormat(deviceFormat, true);
 	hardwareContainer->addDevice(deviceInfo);
@@ -219,7 +245,13 @@ void getDeviceAttributes(const imaqkit::IDeviceInfo* deviceInfo,
 	* Stored in the PIXISAdaptorClass but since the image acquisiton toolbox hasn't created an instance
 	* of that class yet we have to open and then close the camera here to get the parameters from the camera
 	*/
-	Picam_OpenFirstCamera(&camera); 
+	PicamCameraID demoId;
+	bool demo = Picam_OpenFirstCamera(&camera) != PicamError_None;
+	if (demo){
+		//Without a camera, e.g. to replay a file, take the parameters of the demo camera the adaptor falls back to
+		Picam_ConnectDemoCamera(PicamModel_Pixis100F, "0008675309", &demoId);
+		Picam_OpenCamera(&demoId, &camera);
+	}
 	Picam_GetParameters(camera, &parameters, &count);
 	std::vector<PicamParameter> sorted = SortParameters(parameters, count);
 	Picam_DestroyParameters(parameters);
@@ -353,8 +385,40 @@ void getDeviceAttributes(const imaqkit::IDeviceInfo* deviceInfo,
 
 	}
 	
+	// Offers the camera's trigger input as hardware trigger configurations
+	PIXISHardwareTrigger::addConfigurations(hwTriggerInfo, camera);
 
 	Picam_CloseCamera(camera);   //Closes the camera and frees up any memory associated with it
+	if (demo){
+		//The adaptor connects its own demo camera if it needs one
+		Picam_DisconnectDemoCamera(&demoId);
+	}
+
+	// Adds the properties the adaptor defines itself
+	PIXISFrameStats::addProperties(devicePropFact);
+	PIXISFrameGate::addProperties(devicePropFact);
+	PIXISCosmicRayFilter::addProperties(devicePropFact);
+	PIXISReadoutPlanner::addProperties(devicePropFact);
+	PIXISExposureSequence::addProperties(devicePropFact);
+	PIXISOnlineUpdates::addProperties(devicePropFact);
+	PIXISSharedFrameRing::addProperties(devicePropFact);
+	PIXISPreview::addProperties(devicePropFact);
+	PIXISAcquisitionTuning::addProperties(devicePropFact);
+	PIXISKineticsSetup::addProperties(devicePropFact);
+	PIXISReplaySource::addProperties(devicePropFact);
+	PIXISTraceRecorder::addProperties(devicePropFact);
+	PIXISPipeline::addProperties(devicePropFact);
+	PIXISFlatField::addProperties(devicePropFact);
+	PIXISAutoExposure::addProperties(devicePropFact);
+	PIXISPeakFinder::addProperties(devicePropFact);
+	PIXISDeliveryQueue::addProperties(devicePropFact);
+	PIXISAcquisitionWait::addProperties(devicePropFact);
+	PIXISPhotonCounter::addProperties(devicePropFact);
+	PIXISDefectMap::addProperties(devicePropFact);
+	PIXISPixelAccumulator::addProperties(devicePropFact);
+	PIXISHdrMerge::addProperties(devicePropFact);
+	PIXISApertures::addProperties(devicePropFact);
+	PIXISPreTrigger::addProperties(devicePropFact);
 
 	sourceContainer->addAdaptorSource("PIXIS_Camera_Source", 1);
 }
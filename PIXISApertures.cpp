@@ -0,0 +1,320 @@
+/**
+* @file:       PIXISApertures.cpp
+*
+* Purpose:     Implements the per-readout aperture sums.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISApertures.h"
+#include "PIXISAdaptorProps.h"
+#include <emmintrin.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Orders spans by their place in the readout
+static bool spanBefore(const PIXISApertureSpan& a, const PIXISApertureSpan& b){
+	return a.offset < b.offset;
+}
+
+/**
+* sumSpan adds up length pixels. Eight pixels per step are widened to 32 bits, and the
+* four 32 bit lanes cannot overflow for spans shorter than 4 * 65537 pixels, longer
+* than any row.
+*/
+static pi64s sumSpan(const pi16u* pixels, int length){
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lanes = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 8 <= length; i += 8){
+		__m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+		lanes = _mm_add_epi32(lanes, _mm_add_epi32(_mm_unpacklo_epi16(raw, zero), _mm_unpackhi_epi16(raw, zero)));
+	}
+	unsigned int lane[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lane), lanes);
+	pi64s sum = (pi64s)lane[0] + lane[1] + lane[2] + lane[3];
+	for (; i < length; ++i){
+		sum += pixels[i];
+	}
+	return sum;
+}
+
+PIXISApertures::PIXISApertures() :
+	_enabled(false),
+	_sendImages(true),
+	_offset(0.0),
+	_width(0),
+	_height(0),
+	_apertureCount(0),
+	_log(NULL){
+}
+
+PIXISApertures::~PIXISApertures(){
+	finish();
+}
+
+void PIXISApertures::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Apertures", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Rectangles "x,y,width,height" separated by ';', x and y counting from 1
+	hProp = devicePropFact->createStringProperty("Aperture_Rectangles", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw uint8 map the size of the readout, labelling apertures from 1 after the rectangles, up to 64 apertures in all
+	hProp = devicePropFact->createStringProperty("Aperture_Mask_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Counts subtracted from every pixel of a sum, e.g. the bias level
+	hProp = devicePropFact->createDoubleProperty("Aperture_Offset", 0.0, 65535.0, 0.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// With off the readouts are reduced to aperture sums and not sent to the engine
+	hProp = devicePropFact->createEnumProperty("Aperture_Images", "on", 1);
+	devicePropFact->addEnumValue(hProp, "off", 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Binary file of one record per readout: int64 readout, double time, one double per aperture
+	hProp = devicePropFact->createStringProperty("Aperture_Log_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Aperture_Count", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_ApertureCount);
+
+	hProp = devicePropFact->createIntProperty("Aperture_Readout", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_ApertureReadout);
+
+	// Sum of each aperture in turn, zero past Aperture_Count
+	double sums[PIXIS_APERTURE_MAX] = { 0.0 };
+	hProp = devicePropFact->createDoubleArrayProperty("Aperture_Sums", -1.0e18, 1.0e18, PIXIS_APERTURE_MAX, sums);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_ApertureSums);
+}
+
+bool PIXISApertures::addRectangles(const char* text, int width, int height){
+	const char* cursor = text;
+	while (*cursor == ' ') cursor++;
+	while (*cursor){
+		//Four comma separated numbers make a rectangle
+		long fields[4];
+		int count = 0;
+		while (count < 4){
+			char* end;
+			fields[count] = strtol(cursor, &end, 10);
+			if (end == cursor){
+				break;
+			}
+			count++;
+			cursor = end;
+			while (*cursor == ' ') cursor++;
+			if (*cursor != ','){
+				break;
+			}
+			cursor++;
+		}
+
+		while (*cursor == ' ') cursor++;
+		if (count != 4 || (*cursor != ';' && *cursor != 0)){
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:apertures", "Aperture_Rectangles could not be parsed. Rectangles are \"x,y,width,height\" separated by ';'.");
+			return false;
+		}
+		if (*cursor == ';'){
+			cursor++;
+			while (*cursor == ' ') cursor++;
+		}
+
+		//Compared against what is left of the readout, so that large values cannot overflow
+		if (fields[0] < 1 || fields[1] < 1 || fields[0] > width || fields[1] > height ||
+			fields[2] < 1 || fields[3] < 1 || fields[2] > width - (fields[0] - 1) || fields[3] > height - (fields[1] - 1)){
+			char message[160];
+			sprintf_s(message, sizeof(message), "Aperture %d does not lie within the %d x %d readout.", _apertureCount + 1, width, height);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:apertures", message);
+			return false;
+		}
+		int x = (int)fields[0] - 1;
+		int y = (int)fields[1] - 1;
+		if (_apertureCount == PIXIS_APERTURE_MAX){
+			char message[128];
+			sprintf_s(message, sizeof(message), "Aperture_Rectangles has more than %d apertures.", PIXIS_APERTURE_MAX);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:apertures", message);
+			return false;
+		}
+		for (int row = y; row < y + fields[3]; ++row){
+			PIXISApertureSpan span;
+			span.aperture = _apertureCount;
+			span.offset = row * width + x;
+			span.length = (int)fields[2];
+			_spans.push_back(span);
+		}
+		_pixelCounts.push_back((int)(fields[2] * fields[3]));
+		_apertureCount++;
+	}
+	return true;
+}
+
+bool PIXISApertures::addMask(const char* path, int width, int height){
+	size_t pixelCount = (size_t)width * height;
+	std::vector<unsigned char> mask;
+	FILE* file;
+	if (fopen_s(&file, path, "rb") == 0){
+		mask.resize(pixelCount + 1);
+		mask.resize(fread(&mask[0], 1, mask.size(), file));
+		fclose(file);
+	}
+	if (mask.size() != pixelCount){
+		char message[MAX_PATH + 128];
+		sprintf_s(message, sizeof(message), "The aperture mask '%s' could not be read or is not the size of the %d x %d readout.", path, width, height);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:apertures", message);
+		return false;
+	}
+
+	//Labels are numbered after the rectangles; the highest label decides how many there are
+	int first = _apertureCount;
+	int labels = 0;
+	for (size_t i = 0; i < pixelCount; ++i){
+		labels = mask[i] > labels ? mask[i] : labels;
+	}
+	if (first + labels > PIXIS_APERTURE_MAX){
+		char message[MAX_PATH + 128];
+		sprintf_s(message, sizeof(message), "The aperture mask '%s' labels %d apertures, but only %d are left after Aperture_Rectangles.", path, labels, PIXIS_APERTURE_MAX - first);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:apertures", message);
+		return false;
+	}
+	_pixelCounts.resize(first + labels, 0);
+	_apertureCount = first + labels;
+
+	for (int row = 0; row < height; ++row){
+		const unsigned char* line = &mask[(size_t)row * width];
+		int x = 0;
+		while (x < width){
+			int label = line[x];
+			int start = x;
+			while (x < width && line[x] == label){
+				x++;
+			}
+			if (label == 0 || label > labels){
+				continue;
+			}
+			PIXISApertureSpan span;
+			span.aperture = first + label - 1;
+			span.offset = row * width + start;
+			span.length = x - start;
+			_spans.push_back(span);
+			_pixelCounts[span.aperture] += span.length;
+		}
+	}
+	return true;
+}
+
+bool PIXISApertures::configure(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight){
+	finish();
+
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Apertures"));
+	int* images = static_cast<int*>(propContainer->getPropValue("Aperture_Images"));
+	double* offset = static_cast<double*>(propContainer->getPropValue("Aperture_Offset"));
+	const char* rectangles = static_cast<const char*>(propContainer->getPropValue("Aperture_Rectangles"));
+	const char* maskPath = static_cast<const char*>(propContainer->getPropValue("Aperture_Mask_File"));
+	_enabled = (*enabled == 1);
+	_sendImages = (*images == 1);
+	_offset = *offset;
+	_spans.clear();
+	_pixelCounts.clear();
+	_apertureCount = 0;
+	if (!_enabled){
+		return true;
+	}
+
+	_width = readoutWidth;
+	_height = readoutHeight;
+	if (!addRectangles(rectangles, readoutWidth, readoutHeight) ||
+		(maskPath[0] != '\0' && !addMask(maskPath, readoutWidth, readoutHeight))){
+		_enabled = false;
+		return false;
+	}
+	if (_apertureCount == 0){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:apertures", "Apertures is on but neither Aperture_Rectangles nor Aperture_Mask_File gives an aperture.");
+		_enabled = false;
+		return false;
+	}
+	std::sort(_spans.begin(), _spans.end(), spanBefore);
+	_totals.resize(_apertureCount);
+	_record.resize(2 + _apertureCount);
+
+	PIXISApertureSums sums;
+	memset(&sums, 0, sizeof(sums));
+	_latest.publish(sums);
+
+	const char* logFile = static_cast<const char*>(propContainer->getPropValue("Aperture_Log_File"));
+	if (logFile && *logFile && fopen_s(&_log, logFile, "wb") != 0){
+		_log = NULL;
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:apertures", "Could not open Aperture_Log_File.");
+	}
+	return true;
+}
+
+void PIXISApertures::process(const pi16u* pixels, int width, int height, pi64s readout, double time){
+	if (width != _width || height != _height){
+		return;
+	}
+
+	memset(&_totals[0], 0, _totals.size() * sizeof(pi64s));
+	for (size_t i = 0; i < _spans.size(); ++i){
+		const PIXISApertureSpan& span = _spans[i];
+		_totals[span.aperture] += sumSpan(pixels + span.offset, span.length);
+	}
+
+	PIXISApertureSums sums;
+	memset(&sums, 0, sizeof(sums));
+	sums.readout = readout;
+	sums.time = time;
+	for (int a = 0; a < _apertureCount; ++a){
+		sums.sums[a] = (double)_totals[a] - _offset * _pixelCounts[a];
+	}
+	_latest.publish(sums);
+
+	//The readout number goes in the first slot bit for bit, so the record is one write
+	if (_log){
+		memcpy(&_record[0], &readout, sizeof(readout));
+		_record[1] = time;
+		memcpy(&_record[2], sums.sums, _apertureCount * sizeof(double));
+		fwrite(&_record[0], sizeof(double), _record.size(), _log);
+	}
+}
+
+void PIXISApertures::finish(){
+	if (_log){
+		fclose(_log);
+		_log = NULL;
+	}
+}
+
+bool PIXISApertures::getStatus(int id, void* value) const{
+	PIXISApertureSums sums;
+	switch (id){
+	case PIXISStatus_ApertureCount:
+		*reinterpret_cast<int*>(value) = _apertureCount;
+		return true;
+	case PIXISStatus_ApertureReadout:
+		_latest.read(sums);
+		*reinterpret_cast<int*>(value) = (int)sums.readout;
+		return true;
+	case PIXISStatus_ApertureSums:
+		_latest.read(sums);
+		memcpy(value, sums.sums, sizeof(sums.sums));
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,118 @@
+/**
+* @file:       PIXISApertures.h
+*
+* Purpose:     Class declaration for PIXISApertures.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_APERTURES_HEADER__
+#define __PIXIS_APERTURES_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISLatestValue.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Most apertures summed per readout
+#define PIXIS_APERTURE_MAX 64
+
+/**
+* A run of pixels of one aperture within one row of the readout.
+*/
+struct PIXISApertureSpan{
+	int aperture;
+	int offset;                 // Index of the first pixel in the readout
+	int length;
+};
+
+/**
+* The aperture sums of the most recently processed readout.
+*/
+struct PIXISApertureSums{
+	pi64s readout;
+	piflt time;
+	piflt sums[PIXIS_APERTURE_MAX];
+};
+
+/**
+* Class PIXISApertures
+*
+* @brief:  Sums the counts in a set of apertures on every readout, for photometry
+*          that needs a light curve per aperture rather than the frames.
+*
+*          Aperture_Rectangles holds rectangles "x,y,width,height" separated by ';',
+*          with x and y counting from 1 as MATLAB does. Aperture_Mask_File is a raw
+*          uint8 map the size of the readout whose nonzero values label further
+*          apertures, numbered after the rectangles. Together they may define at most
+*          PIXIS_APERTURE_MAX apertures, and more fails the start. configure() turns both into
+*          row spans sorted by their place in the readout, so a readout is read once
+*          in order and each span is summed eight pixels per SSE2 step.
+*          Aperture_Offset is subtracted from every pixel of a sum.
+*
+*          The sums of the latest readout are reported in Aperture_Sums. Every
+*          readout appends one record to Aperture_Log_File, the readout number
+*          (int64) and time (double) followed by one double per aperture, so hours
+*          at the full readout rate take little memory. With Aperture_Images off the
+*          readouts are not sent to the engine at all.
+*/
+class PIXISApertures{
+
+public:
+	PIXISApertures();
+	virtual ~PIXISApertures();
+
+	// addProperties adds the Aperture_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* configure reads the Aperture_* properties, builds the spans for a readoutWidth x
+	* readoutHeight readout and opens the log file. Called from startCapture().
+	*
+	* @return: false, after warning, if an aperture is invalid or outside the readout.
+	*/
+	bool configure(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight);
+
+	bool isEnabled() const { return _enabled; }
+
+	// sendsImages returns false if readouts are only to be reduced to aperture sums
+	bool sendsImages() const { return _sendImages; }
+
+	// process sums the apertures of a width x height readout and publishes them
+	void process(const pi16u* pixels, int width, int height, pi64s readout, double time);
+
+	// finish closes the log file
+	void finish();
+
+	// getStatus writes the value of an Aperture_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// addRectangles adds the spans of the rectangles in text. Returns false, after warning, if one is invalid.
+	bool addRectangles(const char* text, int width, int height);
+
+	// addMask adds the spans of the apertures labelled in the mask file. Returns false, after warning, if it does not fit.
+	bool addMask(const char* path, int width, int height);
+
+	bool _enabled;
+	bool _sendImages;
+	double _offset;
+	int _width;
+	int _height;
+	int _apertureCount;
+
+	std::vector<PIXISApertureSpan> _spans;
+	std::vector<int> _pixelCounts;      // Pixels per aperture, for the offset
+	std::vector<pi64s> _totals;
+	std::vector<double> _record;
+
+	FILE* _log;
+
+	PIXISLatestValue<PIXISApertureSums> _latest;
+};
+#endif
@@ -0,0 +1,369 @@
+/**
+* @file:       PIXISAutoExposure.cpp
+*
+* Purpose:     Implements exposure control from the metered level of each readout.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISAutoExposure.h"
+#include "PIXISAdaptorProps.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Percentile metering uses a histogram of at most 1 << PIXIS_AUTO_EXPOSURE_HISTOGRAM_BITS bins
+#define PIXIS_AUTO_EXPOSURE_HISTOGRAM_BITS 12
+
+// Exposure in ms scaled from when the camera is at 0 ms, which no ratio would move
+#define PIXIS_AUTO_EXPOSURE_FLOOR 0.01
+
+PIXISAutoExposure::PIXISAutoExposure() :
+	_enabled(false),
+	_percentileMetering(true),
+	_percentile(99.0),
+	_target(0.0),
+	_offset(0.0),
+	_tolerance(0.0),
+	_maxStep(1.0),
+	_damping(1.0),
+	_minExposure(0.0),
+	_maxExposure(0.0),
+	_increment(0.0),
+	_x(0),
+	_y(0),
+	_width(0),
+	_height(0),
+	_fullScale(65535),
+	_histogramShift(16 - PIXIS_AUTO_EXPOSURE_HISTOGRAM_BITS),
+	_exposure(0.0),
+	_finalExposure(0.0),
+	_writeBackPending(0){
+}
+
+void PIXISAutoExposure::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Auto_Exposure", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// A percentile ignores the few hot pixels and cosmic rays that would set the maximum
+	hProp = devicePropFact->createEnumProperty("Auto_Exposure_Metric", "percentile", 1);
+	devicePropFact->addEnumValue(hProp, "maximum", 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Percentile", 0.0, 100.0, 99.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Fraction of the ADC full scale the metered level is brought to
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Target", 0.0, 1.0, 0.5);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Counts present at zero exposure (bias and dark), which do not scale with exposure
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Offset", 0.0, 65535.0, 0.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Relative distance from the target within which the exposure is left alone
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Tolerance", 0.0, 1.0, 0.05);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Largest factor the exposure changes by between two readouts
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Max_Step", 1.0, 1000.0, 8.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// 1 applies the whole correction at once, smaller values approach the target more gently
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Damping", 0.0, 1.0, 1.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Min_Time", 0.0, 1.0e7, 0.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Max_Time", 0.0, 1.0e7, 10000.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Metering rectangle in readout pixels. A width or height of 0 reaches to the edge of the readout.
+	hProp = devicePropFact->createIntProperty("Auto_Exposure_ROI_X", 0, 65535, 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Auto_Exposure_ROI_Y", 0, 65535, 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Auto_Exposure_ROI_Width", 0, 65535, 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Auto_Exposure_ROI_Height", 0, 65535, 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Auto_Exposure_Readout", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AutoExposureReadout);
+
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Level", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AutoExposureLevel);
+
+	hProp = devicePropFact->createDoubleProperty("Auto_Exposure_Time", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AutoExposureTime);
+
+	hProp = devicePropFact->createIntProperty("Auto_Exposure_Converged", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AutoExposureConverged);
+}
+
+bool PIXISAutoExposure::configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, int readoutWidth, int readoutHeight){
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Auto_Exposure"));
+	_enabled = (*enabled == 1);
+	if (!_enabled){
+		return true;
+	}
+
+	int* metric = static_cast<int*>(propContainer->getPropValue("Auto_Exposure_Metric"));
+	_percentileMetering = (*metric == 1);
+	_percentile = *static_cast<double*>(propContainer->getPropValue("Auto_Exposure_Percentile"));
+	_offset = *static_cast<double*>(propContainer->getPropValue("Auto_Exposure_Offset"));
+	_tolerance = *static_cast<double*>(propContainer->getPropValue("Auto_Exposure_Tolerance"));
+	_maxStep = *static_cast<double*>(propContainer->getPropValue("Auto_Exposure_Max_Step"));
+	_damping = *static_cast<double*>(propContainer->getPropValue("Auto_Exposure_Damping"));
+	_minExposure = *static_cast<double*>(propContainer->getPropValue("Auto_Exposure_Min_Time"));
+	_maxExposure = *static_cast<double*>(propContainer->getPropValue("Auto_Exposure_Max_Time"));
+
+	//If the camera does not report a bit depth, assume the PIXIS 16 bit ADC
+	piint bitDepth = 16;
+	Picam_GetParameterIntegerValue(camera, PicamParameter_AdcBitDepth, &bitDepth);
+	if (bitDepth < 1 || bitDepth > 16){
+		bitDepth = 16;
+	}
+	_fullScale = (1 << bitDepth) - 1;
+	_histogramShift = bitDepth > PIXIS_AUTO_EXPOSURE_HISTOGRAM_BITS ? bitDepth - PIXIS_AUTO_EXPOSURE_HISTOGRAM_BITS : 0;
+	_histogram.assign((size_t)(_fullScale >> _histogramShift) + 1, 0);
+
+	double target = *static_cast<double*>(propContainer->getPropValue("Auto_Exposure_Target"));
+	_target = target * _fullScale - _offset;
+	if (_target <= 0.0){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:autoExposure", "Auto_Exposure_Target must be above Auto_Exposure_Offset.");
+		_enabled = false;
+		return false;
+	}
+
+	//The limits are narrowed to what the camera can do
+	const PicamRangeConstraint* capable;
+	_increment = 0.0;
+	if (Picam_GetParameterRangeConstraint(camera, PicamParameter_ExposureTime, PicamConstraintCategory_Capable, &capable) == PicamError_None){
+		if (_minExposure < capable->minimum){
+			_minExposure = capable->minimum;
+		}
+		if (_maxExposure > capable->maximum){
+			_maxExposure = capable->maximum;
+		}
+		_increment = capable->increment;
+		Picam_DestroyRangeConstraints(capable);
+	}
+	if (_minExposure > _maxExposure){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:autoExposure", "Auto_Exposure_Min_Time and Auto_Exposure_Max_Time leave no exposure the camera can use.");
+		_enabled = false;
+		return false;
+	}
+
+	_x = *static_cast<int*>(propContainer->getPropValue("Auto_Exposure_ROI_X"));
+	_y = *static_cast<int*>(propContainer->getPropValue("Auto_Exposure_ROI_Y"));
+	_width = *static_cast<int*>(propContainer->getPropValue("Auto_Exposure_ROI_Width"));
+	_height = *static_cast<int*>(propContainer->getPropValue("Auto_Exposure_ROI_Height"));
+	if (_width == 0){
+		_width = readoutWidth - _x;
+	}
+	if (_height == 0){
+		_height = readoutHeight - _y;
+	}
+	if (_width <= 0 || _height <= 0 || _x + _width > readoutWidth || _y + _height > readoutHeight){
+		char message[160];
+		sprintf_s(message, sizeof(message), "The Auto_Exposure_ROI_* rectangle does not fit in the %d x %d readout.", readoutWidth, readoutHeight);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:autoExposure", message);
+		_enabled = false;
+		return false;
+	}
+
+	Picam_GetParameterFloatingPointValue(camera, PicamParameter_ExposureTime, &_exposure);
+
+	PIXISAutoExposureState state;
+	state.readout = 0;
+	state.level = 0.0;
+	state.exposure = _exposure;
+	state.converged = 0;
+	_latest.publish(state);
+	return true;
+}
+
+piflt PIXISAutoExposure::meter(const pi16u* pixels, int width, bool& saturated){
+	if (!_percentileMetering){
+		pi16u maximum = 0;
+		for (int row = _y; row < _y + _height; ++row){
+			const pi16u* line = pixels + (size_t)row * width + _x;
+			for (int col = 0; col < _width; ++col){
+				if (line[col] > maximum){
+					maximum = line[col];
+				}
+			}
+		}
+		saturated = (maximum >= _fullScale);
+		return maximum;
+	}
+
+	//Values above the full scale, which a narrower ADC should not produce, count in the top bin
+	int top = (int)_histogram.size() - 1;
+	memset(&_histogram[0], 0, _histogram.size() * sizeof(piint));
+	for (int row = _y; row < _y + _height; ++row){
+		const pi16u* line = pixels + (size_t)row * width + _x;
+		for (int col = 0; col < _width; ++col){
+			int bin = line[col] >> _histogramShift;
+			_histogram[bin < top ? bin : top]++;
+		}
+	}
+
+	//The level is the middle of the bin holding the pixel of the requested rank
+	pi64s rank = (pi64s)ceil(_percentile / 100.0 * ((pi64s)_width * _height));
+	if (rank < 1){
+		rank = 1;
+	}
+	pi64s count = 0;
+	int bin = 0;
+	for (; bin < top; ++bin){
+		count += _histogram[bin];
+		if (count >= rank){
+			break;
+		}
+	}
+	saturated = (bin == top);
+	return (bin << _histogramShift) + ((1 << _histogramShift) - 1) / 2.0;
+}
+
+/**
+* process assumes the signal above the offset is proportional to exposure, so the ratio
+* of target to signal is the factor the exposure should change by. Damping applies a
+* power of that ratio and Auto_Exposure_Max_Step bounds it, which also covers the
+* readouts that are saturated or show no signal at all.
+*/
+void PIXISAutoExposure::process(PicamHandle camera, const pi16u* pixels, int width, pi64s readout){
+	bool saturated;
+	piflt level = meter(pixels, width, saturated);
+	piflt signal = level - _offset;
+
+	PIXISAutoExposureState state;
+	state.readout = readout;
+	state.level = level;
+	state.exposure = _exposure;
+	state.converged = (!saturated && fabs(signal / _target - 1.0) <= _tolerance) ? 1 : 0;
+	if (state.converged){
+		_latest.publish(state);
+		return;
+	}
+
+	piflt ratio;
+	if (saturated){
+		ratio = 1.0 / _maxStep;
+	}
+	else if (signal < 1.0){
+		ratio = _maxStep;
+	}
+	else{
+		ratio = pow(_target / signal, _damping);
+		if (ratio > _maxStep){
+			ratio = _maxStep;
+		}
+		if (ratio < 1.0 / _maxStep){
+			ratio = 1.0 / _maxStep;
+		}
+	}
+
+	piflt exposure = (_exposure > PIXIS_AUTO_EXPOSURE_FLOOR ? _exposure : PIXIS_AUTO_EXPOSURE_FLOOR) * ratio;
+	if (_increment > 0.0){
+		exposure = floor(exposure / _increment + 0.5) * _increment;
+	}
+	if (exposure < _minExposure){
+		exposure = _minExposure;
+	}
+	if (exposure > _maxExposure){
+		exposure = _maxExposure;
+	}
+
+	//Pinned at a limit, there is nothing to commit
+	if (exposure != _exposure){
+		//Picam_Acquire has stopped the camera on return, so the new exposure is committed
+		//before the next readout starts
+		Picam_SetParameterFloatingPointValue(camera, PicamParameter_ExposureTime, exposure);
+		const PicamParameter* failedParameterArray;
+		piint failedParameterCount;
+		Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+		Picam_DestroyParameters(failedParameterArray);
+		if (failedParameterCount){
+			char message[128];
+			sprintf_s(message, sizeof(message), "Failed to commit an exposure of %g ms. Keeping %g ms.", exposure, _exposure);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:autoExposure", message);
+			Picam_SetParameterFloatingPointValue(camera, PicamParameter_ExposureTime, _exposure);
+		}
+		else{
+			_exposure = exposure;
+		}
+	}
+	state.exposure = _exposure;
+	_latest.publish(state);
+}
+
+void PIXISAutoExposure::finish(){
+	if (!_enabled){
+		return;
+	}
+	_finalExposure = _exposure;
+	InterlockedExchange(&_writeBackPending, 1);
+}
+
+/**
+* writeBack sets Exposure_Time to the exposure the camera already has, so the set listener
+* finds nothing to commit. Should the engine have set the old value again first, the set
+* listener commits the kept exposure back to the camera.
+*/
+void PIXISAutoExposure::writeBack(imaqkit::IPropContainer* propContainer){
+	if (InterlockedExchange(&_writeBackPending, 0) == 0){
+		return;
+	}
+	double exposure = _finalExposure;
+	propContainer->setPropValue("Exposure_Time", &exposure);
+}
+
+bool PIXISAutoExposure::getStatus(int id, void* value) const{
+	PIXISAutoExposureState state;
+	switch (id){
+	case PIXISStatus_AutoExposureReadout:
+		_latest.read(state);
+		*reinterpret_cast<int*>(value) = (int)state.readout;
+		return true;
+	case PIXISStatus_AutoExposureLevel:
+		_latest.read(state);
+		*reinterpret_cast<double*>(value) = state.level;
+		return true;
+	case PIXISStatus_AutoExposureTime:
+		_latest.read(state);
+		*reinterpret_cast<double*>(value) = state.exposure;
+		return true;
+	case PIXISStatus_AutoExposureConverged:
+		_latest.read(state);
+		*reinterpret_cast<int*>(value) = state.converged;
+		return true;
+	}
+	return false;
+}
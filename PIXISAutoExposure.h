@@ -0,0 +1,118 @@
+/**
+* @file:       PIXISAutoExposure.h
+*
+* Purpose:     Class declaration for PIXISAutoExposure.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_AUTO_EXPOSURE_HEADER__
+#define __PIXIS_AUTO_EXPOSURE_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISLatestValue.h"
+#include <vector>
+
+/**
+* The most recent metering result and the exposure it led to.
+*/
+struct PIXISAutoExposureState{
+	pi64s readout;              // Readout that was metered
+	piflt level;                // Metered level in counts
+	piflt exposure;             // Exposure in ms for the readouts after it
+	piint converged;            // 1 if the level was within Auto_Exposure_Tolerance of the target
+};
+
+/**
+* Class PIXISAutoExposure
+*
+* @brief:  Closed-loop exposure control run on the acquisition thread. Each raw
+*          readout is metered as it returns from Picam_Acquire, over the
+*          Auto_Exposure_ROI_* rectangle, by its maximum or by a percentile. The
+*          exposure is then scaled so that the level above Auto_Exposure_Offset
+*          approaches Auto_Exposure_Target (a fraction of the ADC full scale), and
+*          committed before the next readout, as exposure sequence steps are. No
+*          property round trip or engine stop/restart is involved, so a scene
+*          change is followed within a few readouts.
+*
+*          Signal above the offset is taken to grow linearly with exposure. A
+*          saturated readout says nothing about how far over it is, so the exposure
+*          is cut by the largest step allowed. Exposures stay within
+*          Auto_Exposure_Min_Time/Max_Time and the camera's own range. When the
+*          acquisition stops the exposure reached is kept, and written to the
+*          Exposure_Time property from the MATLAB thread on the next stop or start,
+*          so it stays in place instead of the value the property held before.
+*/
+class PIXISAutoExposure{
+
+public:
+	PIXISAutoExposure();
+
+	// addProperties adds the Auto_Exposure_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* configure reads the Auto_Exposure_* properties, the ADC bit depth and the current
+	* exposure. Called from startCapture().
+	*
+	* @return: false, after warning, if the limits or metering rectangle cannot be used.
+	*/
+	bool configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, int readoutWidth, int readoutHeight);
+
+	bool isEnabled() const { return _enabled; }
+
+	// process meters a readout and commits the exposure for the next one if it has to change
+	void process(PicamHandle camera, const pi16u* pixels, int width, pi64s readout);
+
+	// finish keeps the exposure reached for writeBack(). Called by the acquisition thread when the acquisition ends.
+	void finish();
+
+	// writeBack writes the exposure kept by finish() to the Exposure_Time property, once. Called on the MATLAB thread.
+	void writeBack(imaqkit::IPropContainer* propContainer);
+
+	// getStatus writes the value of an Auto_Exposure_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// meter returns the level of the metering rectangle in counts, and whether that level is at the ADC full scale
+	piflt meter(const pi16u* pixels, int width, bool& saturated);
+
+	bool _enabled;
+
+	/// Configured values
+	bool _percentileMetering;
+	piflt _percentile;
+	piflt _target;              // Counts above the offset
+	piflt _offset;
+	piflt _tolerance;
+	piflt _maxStep;
+	piflt _damping;
+	piflt _minExposure;
+	piflt _maxExposure;
+	piflt _increment;           // Camera exposure resolution, 0 if any value will do
+
+	/// Metering rectangle, in readout pixels
+	int _x;
+	int _y;
+	int _width;
+	int _height;
+
+	/// ADC full scale in counts, and the right shift onto a percentile histogram bin
+	piint _fullScale;
+	piint _histogramShift;
+	std::vector<piint> _histogram;
+
+	/// Exposure the camera has committed, in ms
+	piflt _exposure;
+
+	PIXISLatestValue<PIXISAutoExposureState> _latest;
+
+	/// Exposure kept by finish(), and 1 until writeBack() has written it
+	piflt _finalExposure;
+	volatile LONG _writeBackPending;
+};
+#endif
@@ -0,0 +1,221 @@
+/**
+* @file:       PIXISCosmicRayFilter.cpp
+*
+* Purpose:     Implements multi-readout cosmic-ray rejection.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISCosmicRayFilter.h"
+#include "PIXISAdaptorProps.h"
+#include <math.h>
+#include <string.h>
+
+// Rows of the readout cleaned by one worker pool tile
+#define PIXIS_COSMIC_RAY_TILE_ROWS 16
+
+// Scales a median absolute deviation to a gaussian standard deviation
+#define PIXIS_MAD_TO_SIGMA 1.4826
+
+//medianOf sorts the count values in place and returns their median
+static piflt medianOf(piflt* values, int count){
+	for (int i = 1; i < count; ++i){
+		piflt value = values[i];
+		int j = i - 1;
+		while (j >= 0 && values[j] > value){
+			values[j + 1] = values[j];
+			--j;
+		}
+		values[j + 1] = value;
+	}
+	if (count & 1){
+		return values[count / 2];
+	}
+	return 0.5 * (values[count / 2 - 1] + values[count / 2]);
+}
+
+PIXISCosmicRayFilter::PIXISCosmicRayFilter() :
+	_enabled(false),
+	_window(5),
+	_sigma(5.0),
+	_readNoise(3.0),
+	_filled(0),
+	_newest(0),
+	_pixelCount(0),
+	_width(0),
+	_height(0),
+	_totalReplaced(0){
+}
+
+void PIXISCosmicRayFilter::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Cosmic_Ray_Filter", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Number of readouts the per-pixel median is taken over
+	hProp = devicePropFact->createIntProperty("Cosmic_Ray_Window", 3, PIXIS_COSMIC_RAY_MAX_WINDOW, 5);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createDoubleProperty("Cosmic_Ray_Sigma", 0.0, 1000.0, 5.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Lower bound of the per-pixel deviation, in counts
+	hProp = devicePropFact->createDoubleProperty("Cosmic_Ray_Read_Noise", 0.0, 65535.0, 3.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Cosmic_Ray_Readout", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_CosmicRayReadout);
+
+	hProp = devicePropFact->createIntProperty("Cosmic_Ray_Replaced", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_CosmicRayReplaced);
+
+	hProp = devicePropFact->createDoubleProperty("Cosmic_Ray_Total_Replaced", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_CosmicRayTotalReplaced);
+}
+
+void PIXISCosmicRayFilter::configure(imaqkit::IPropContainer* propContainer){
+	_enabled = (*static_cast<int*>(propContainer->getPropValue("Cosmic_Ray_Filter")) == 1);
+	_window = *static_cast<int*>(propContainer->getPropValue("Cosmic_Ray_Window"));
+	_sigma = *static_cast<double*>(propContainer->getPropValue("Cosmic_Ray_Sigma"));
+	_readNoise = *static_cast<double*>(propContainer->getPropValue("Cosmic_Ray_Read_Noise"));
+
+	if (_window < 3) _window = 3;
+	if (_window > PIXIS_COSMIC_RAY_MAX_WINDOW) _window = PIXIS_COSMIC_RAY_MAX_WINDOW;
+
+	_filled = 0;
+	_newest = 0;
+	_pixelCount = 0;
+	InterlockedExchange64(&_totalReplaced, 0);
+}
+
+const pi16u* PIXISCosmicRayFilter::process(const pi16u* pixels, int width, int height, pi64s readout, PIXISWorkerPool* workers){
+	//A change of geometry starts a new window
+	int pixelCount = width * height;
+	if (pixelCount != _pixelCount || width != _width){
+		_width = width;
+		_height = height;
+		_pixelCount = pixelCount;
+		_history.assign((size_t)_window * pixelCount, 0);
+		_cleaned.assign(pixelCount, 0);
+		_filled = 0;
+		_newest = _window - 1;
+	}
+
+	_newest = (_newest + 1) % _window;
+	memcpy(&_history[(size_t)_newest * pixelCount], pixels, pixelCount * sizeof(pi16u));
+	if (_filled < _window){
+		_filled++;
+	}
+	if (_filled < _window){
+		return NULL;
+	}
+
+	int tileCount = (height + PIXIS_COSMIC_RAY_TILE_ROWS - 1) / PIXIS_COSMIC_RAY_TILE_ROWS;
+	_tileReplaced.assign(tileCount, 0);
+	workers->run(cleanTile, this, tileCount);
+
+	PIXISCosmicRayResult result;
+	result.readout = readout;
+	result.replaced = 0;
+	for (int tile = 0; tile < tileCount; ++tile){
+		result.replaced += _tileReplaced[tile];
+	}
+	_latest.publish(result);
+	InterlockedExchangeAdd64(&_totalReplaced, result.replaced);
+
+	return &_cleaned[0];
+}
+
+/**
+* cleanTile works on PIXIS_COSMIC_RAY_TILE_ROWS rows. Most pixels are settled by the
+* first test: if the newest value is within sigma * read noise of the window minimum it
+* cannot be that far above the median. Only the remaining pixels pay for the median and
+* the median absolute deviation.
+*/
+void PIXISCosmicRayFilter::cleanTile(void* context, int tile){
+	PIXISCosmicRayFilter* filter = reinterpret_cast<PIXISCosmicRayFilter*>(context);
+
+	int window = filter->_window;
+	int pixelCount = filter->_pixelCount;
+	int rowEnd = (tile + 1) * PIXIS_COSMIC_RAY_TILE_ROWS;
+	if (rowEnd > filter->_height){
+		rowEnd = filter->_height;
+	}
+	int begin = tile * PIXIS_COSMIC_RAY_TILE_ROWS * filter->_width;
+	int end = rowEnd * filter->_width;
+
+	const pi16u* frames[PIXIS_COSMIC_RAY_MAX_WINDOW];
+	for (int k = 0; k < window; ++k){
+		frames[k] = &filter->_history[(size_t)k * pixelCount];
+	}
+	const pi16u* newest = frames[filter->_newest];
+	pi16u* cleaned = &filter->_cleaned[0];
+
+	piflt floorLimit = filter->_sigma * filter->_readNoise;
+	piflt values[PIXIS_COSMIC_RAY_MAX_WINDOW];
+	piflt deviations[PIXIS_COSMIC_RAY_MAX_WINDOW];
+	LONG replaced = 0;
+
+	for (int p = begin; p < end; ++p){
+		int value = newest[p];
+		int minimum = value;
+		for (int k = 0; k < window; ++k){
+			if (frames[k][p] < minimum) minimum = frames[k][p];
+		}
+		cleaned[p] = (pi16u)value;
+		if (value - minimum <= floorLimit){
+			continue;
+		}
+
+		for (int k = 0; k < window; ++k){
+			values[k] = frames[k][p];
+		}
+		piflt median = medianOf(values, window);
+		piflt deviation = value - median;
+		if (deviation <= floorLimit){
+			continue;
+		}
+
+		for (int k = 0; k < window; ++k){
+			deviations[k] = fabs(values[k] - median);
+		}
+		piflt sigma = PIXIS_MAD_TO_SIGMA * medianOf(deviations, window);
+		if (sigma < filter->_readNoise){
+			sigma = filter->_readNoise;
+		}
+		if (deviation > filter->_sigma * sigma){
+			cleaned[p] = (pi16u)(median + 0.5);
+			replaced++;
+		}
+	}
+
+	filter->_tileReplaced[tile] = replaced;
+}
+
+bool PIXISCosmicRayFilter::getStatus(int id, void* value) const{
+	PIXISCosmicRayResult result;
+	switch (id){
+	case PIXISStatus_CosmicRayReadout:
+		_latest.read(result);
+		*reinterpret_cast<int*>(value) = (int)result.readout;
+		return true;
+	case PIXISStatus_CosmicRayReplaced:
+		_latest.read(result);
+		*reinterpret_cast<int*>(value) = result.replaced;
+		return true;
+	case PIXISStatus_CosmicRayTotalReplaced:
+		*reinterpret_cast<double*>(value) = (double)_totalReplaced;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,92 @@
+/**
+* @file:       PIXISCosmicRayFilter.h
+*
+* Purpose:     Class declaration for PIXISCosmicRayFilter.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_COSMIC_RAY_FILTER_HEADER__
+#define __PIXIS_COSMIC_RAY_FILTER_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include "PIXISLatestValue.h"
+#include "PIXISWorkerPool.h"
+#include <vector>
+
+// Largest sliding window the filter accepts
+#define PIXIS_COSMIC_RAY_MAX_WINDOW 15
+
+/**
+* Result of cleaning one readout.
+*/
+struct PIXISCosmicRayResult{
+	pi64s readout;      // Readout number the count belongs to
+	piint replaced;     // Pixels replaced by the window median
+};
+
+/**
+* Class PIXISCosmicRayFilter
+*
+* @brief:  Removes cosmic-ray hits from each readout using the last K readouts.
+*          A pixel of the newest readout is replaced by its median over the window
+*          when it lies more than Cosmic_Ray_Sigma standard deviations above it.
+*          The deviation is estimated per pixel from the median absolute deviation
+*          of the window, floored at Cosmic_Ray_Read_Noise.
+*
+*          The first K - 1 readouts only fill the window and are not delivered.
+*/
+class PIXISCosmicRayFilter{
+
+public:
+	PIXISCosmicRayFilter();
+
+	// addProperties adds the Cosmic_Ray_* configuration and status properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure reads the Cosmic_Ray_* properties and empties the window. Called from startCapture().
+	void configure(imaqkit::IPropContainer* propContainer);
+
+	bool isEnabled() const { return _enabled; }
+
+	/**
+	* process adds a width x height readout to the window and cleans it.
+	*
+	* @return: The cleaned readout, valid until the next call, or NULL while the window is still filling.
+	*/
+	const pi16u* process(const pi16u* pixels, int width, int height, pi64s readout, PIXISWorkerPool* workers);
+
+	// getStatus writes the value of a Cosmic_Ray_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// cleanTile is the PIXISWorkerPool::TileFunction cleaning one band of rows
+	static void cleanTile(void* context, int tile);
+
+	bool _enabled;
+	int _window;
+	piflt _sigma;
+	piflt _readNoise;
+
+	/// Ring of the last _window readouts
+	std::vector<pi16u> _history;
+	int _filled;
+	int _newest;
+
+	std::vector<pi16u> _cleaned;
+	int _pixelCount;
+	int _width;
+	int _height;
+
+	/// Per tile replaced-pixel counts of the readout being cleaned
+	std::vector<LONG> _tileReplaced;
+
+	PIXISLatestValue<PIXISCosmicRayResult> _latest;
+	volatile LONG64 _totalReplaced;
+};
+#endif
@@ -0,0 +1,316 @@
+/**
+* @file:       PIXISDefectMap.cpp
+*
+* Purpose:     Implements the hot and defective pixel correction.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISDefectMap.h"
+#include "PIXISAdaptorProps.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+// Median absolute deviation of a normal distribution, in standard deviations
+#define PIXIS_DEFECT_MAD_PER_SIGMA 1.4826
+
+// Smallest deviation a dark series is judged by, in counts, for readouts quantised to a few values
+#define PIXIS_DEFECT_MIN_DEVIATION 1.0
+
+//loadMask reads a uint8 map file into mask, unless it is the file already loaded and unchanged
+static bool loadMask(const char* path, PIXISMapFile& loaded, std::vector<unsigned char>& mask){
+	if (!mask.empty() && loaded.isLoaded(path)){
+		return true;
+	}
+	mask.clear();
+
+	FILE* file;
+	if (!loaded.loading(path) || fopen_s(&file, path, "rb") != 0){
+		loaded.clear();
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long bytes = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (bytes > 0){
+		mask.resize(bytes);
+		if (fread(&mask[0], 1, mask.size(), file) != mask.size()){
+			mask.clear();
+		}
+	}
+	fclose(file);
+	if (mask.empty()){
+		loaded.clear();
+		return false;
+	}
+	return true;
+}
+
+PIXISDefectMap::PIXISDefectMap() :
+	_enabled(false),
+	_source(PIXISDefect_File),
+	_darkReadouts(1),
+	_sigma(0.0),
+	_width(0),
+	_height(0),
+	_darkCount(0),
+	_defectCount(0){
+}
+
+void PIXISDefectMap::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Defect_Correction", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createEnumProperty("Defect_Source", "file", PIXISDefect_File);
+	devicePropFact->addEnumValue(hProp, "dark_series", PIXISDefect_DarkSeries);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw uint8 map, nonzero for a defect, the size of the readout or of the active sensor
+	hProp = devicePropFact->createStringProperty("Defect_Map_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Readouts a dark_series map is built from. They must be dark: closing the shutter is up to the user.
+	hProp = devicePropFact->createIntProperty("Defect_Dark_Readouts", 2, 1024, 16);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Robust standard deviations from the median dark level that make a pixel a defect
+	hProp = devicePropFact->createDoubleProperty("Defect_Sigma", 1.0, 1000.0, 6.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Where a dark_series map is written, as a readout-sized Defect_Map_File. Empty does not write it.
+	hProp = devicePropFact->createStringProperty("Defect_Save_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Defective pixels in the readout, -1 while a dark series is being taken
+	hProp = devicePropFact->createIntProperty("Defect_Count", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_DefectCount);
+}
+
+/**
+* fitMap cuts the ROI out of a sensor-sized map. A binned pixel collects the charge of
+* every pixel in its bin, so one defect spoils the bin. Readouts of several kinetics
+* frames repeat the ROI once per frame.
+*/
+bool PIXISDefectMap::fitMap(imaqkit::IPropContainer* propContainer, int sensorWidth, int sensorHeight, int readoutWidth, int readoutHeight){
+	int x0 = *static_cast<int*>(propContainer->getPropValue("ROIXOffset"));
+	int y0 = *static_cast<int*>(propContainer->getPropValue("ROIYOffset"));
+	int width = *static_cast<int*>(propContainer->getPropValue("ROIWidth"));
+	int height = *static_cast<int*>(propContainer->getPropValue("ROIHeight"));
+	int xBinning = *static_cast<int*>(propContainer->getPropValue("ROIXBinning"));
+	int yBinning = *static_cast<int*>(propContainer->getPropValue("ROIYBinning"));
+
+	int binnedHeight = height / yBinning;
+	if (x0 < 0 || y0 < 0 || x0 + width > sensorWidth || y0 + height > sensorHeight ||
+		width / xBinning != readoutWidth || binnedHeight == 0 || readoutHeight % binnedHeight != 0){
+		return false;
+	}
+
+	_mask.assign((size_t)readoutWidth * readoutHeight, 0);
+	for (int by = 0; by < binnedHeight; ++by){
+		for (int bx = 0; bx < readoutWidth; ++bx){
+			unsigned char defect = 0;
+			for (int y = 0; y < yBinning && !defect; ++y){
+				const unsigned char* row = &_mapFile[(size_t)(y0 + by * yBinning + y) * sensorWidth + x0 + bx * xBinning];
+				for (int x = 0; x < xBinning && !defect; ++x){
+					defect = row[x];
+				}
+			}
+			_mask[(size_t)by * readoutWidth + bx] = defect ? 1 : 0;
+		}
+	}
+	for (int frame = 1; frame < readoutHeight / binnedHeight; ++frame){
+		memcpy(&_mask[(size_t)frame * binnedHeight * readoutWidth], &_mask[0], (size_t)binnedHeight * readoutWidth);
+	}
+	return true;
+}
+
+bool PIXISDefectMap::configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, int readoutWidth, int readoutHeight, bool roiGeometry){
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Defect_Correction"));
+	int* source = static_cast<int*>(propContainer->getPropValue("Defect_Source"));
+	int* darkReadouts = static_cast<int*>(propContainer->getPropValue("Defect_Dark_Readouts"));
+	double* sigma = static_cast<double*>(propContainer->getPropValue("Defect_Sigma"));
+	const char* mapPath = static_cast<const char*>(propContainer->getPropValue("Defect_Map_File"));
+	const char* savePath = static_cast<const char*>(propContainer->getPropValue("Defect_Save_File"));
+	_enabled = (*enabled == 1);
+	_source = *source;
+	_darkReadouts = *darkReadouts;
+	_sigma = *sigma;
+	_savePath = savePath ? savePath : "";
+	_defectCount = 0;
+	if (!_enabled){
+		return true;
+	}
+
+	_width = readoutWidth;
+	_height = readoutHeight;
+	size_t pixelCount = (size_t)readoutWidth * readoutHeight;
+
+	//A dark series is taken afresh by every acquisition, as the ROI or temperature may have changed
+	if (_source == PIXISDefect_DarkSeries){
+		_darkSum.assign(pixelCount, 0.0);
+		_darkCount = 0;
+		_fixes.clear();
+		_defectCount = -1;
+		return true;
+	}
+
+	char message[MAX_PATH + 128];
+	if (!loadMask(mapPath, _mapSource, _mapFile)){
+		sprintf_s(message, sizeof(message), "The defect map '%s' could not be read.", mapPath);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:defects", message);
+		return false;
+	}
+	piint sensorWidth = 0, sensorHeight = 0;
+	Picam_GetParameterIntegerValue(camera, PicamParameter_SensorActiveWidth, &sensorWidth);
+	Picam_GetParameterIntegerValue(camera, PicamParameter_SensorActiveHeight, &sensorHeight);
+	if (_mapFile.size() == pixelCount){
+		_mask = _mapFile;
+	}
+	else if (!roiGeometry || _mapFile.size() != (size_t)sensorWidth * sensorHeight ||
+		!fitMap(propContainer, sensorWidth, sensorHeight, readoutWidth, readoutHeight)){
+		sprintf_s(message, sizeof(message), "The defect map holds %u values, which fits neither the %d x %d readout nor the sensor.",
+			(unsigned)_mapFile.size(), readoutWidth, readoutHeight);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:defects", message);
+		return false;
+	}
+	buildFixes();
+	return true;
+}
+
+/**
+* buildFromDarks judges each pixel's mean dark level against the median over the
+* readout, with the median absolute deviation as a spread that the defects themselves
+* barely move.
+*/
+void PIXISDefectMap::buildFromDarks(){
+	size_t pixelCount = _darkSum.size();
+	std::vector<double> means(pixelCount);
+	for (size_t i = 0; i < pixelCount; ++i){
+		means[i] = _darkSum[i] / _darkCount;
+	}
+
+	std::vector<double> sorted(means);
+	std::nth_element(sorted.begin(), sorted.begin() + pixelCount / 2, sorted.end());
+	double median = sorted[pixelCount / 2];
+	for (size_t i = 0; i < pixelCount; ++i){
+		sorted[i] = fabs(means[i] - median);
+	}
+	std::nth_element(sorted.begin(), sorted.begin() + pixelCount / 2, sorted.end());
+	double deviation = PIXIS_DEFECT_MAD_PER_SIGMA * sorted[pixelCount / 2];
+	if (deviation < PIXIS_DEFECT_MIN_DEVIATION){
+		deviation = PIXIS_DEFECT_MIN_DEVIATION;
+	}
+
+	_mask.assign(pixelCount, 0);
+	for (size_t i = 0; i < pixelCount; ++i){
+		_mask[i] = fabs(means[i] - median) > _sigma * deviation ? 1 : 0;
+	}
+	std::vector<double>().swap(_darkSum);
+
+	if (!_savePath.empty()){
+		FILE* file;
+		if (fopen_s(&file, _savePath.c_str(), "wb") == 0){
+			fwrite(&_mask[0], 1, _mask.size(), file);
+			fclose(file);
+		}
+		else{
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:defects", "Could not write Defect_Save_File.");
+		}
+	}
+}
+
+void PIXISDefectMap::buildFixes(){
+	_fixes.clear();
+	LONG count = 0;
+	for (int y = 0; y < _height; ++y){
+		const unsigned char* row = &_mask[(size_t)y * _width];
+		for (int x = 0; x < _width; ++x){
+			if (!row[x]){
+				continue;
+			}
+			count++;
+			int left = x - 1;
+			while (left >= 0 && row[left]){
+				left--;
+			}
+			int right = x + 1;
+			while (right < _width && row[right]){
+				right++;
+			}
+
+			//A row with no good pixel is left as it is
+			PIXISDefectFix fix;
+			fix.index = y * _width + x;
+			if (left < 0 && right >= _width){
+				continue;
+			}
+			else if (left < 0){
+				fix.left = fix.right = y * _width + right;
+				fix.leftWeight = 1.0f;
+			}
+			else if (right >= _width){
+				fix.left = fix.right = y * _width + left;
+				fix.leftWeight = 1.0f;
+			}
+			else{
+				fix.left = y * _width + left;
+				fix.right = y * _width + right;
+				fix.leftWeight = (float)(right - x) / (right - left);
+			}
+			_fixes.push_back(fix);
+		}
+	}
+	_defectCount = count;
+}
+
+bool PIXISDefectMap::process(pi16u* pixels, int width, int height){
+	if (width != _width || height != _height){
+		return true;
+	}
+
+	if (_source == PIXISDefect_DarkSeries && _darkCount < _darkReadouts){
+		size_t pixelCount = (size_t)width * height;
+		double* sum = &_darkSum[0];
+		for (size_t i = 0; i < pixelCount; ++i){
+			sum[i] += pixels[i];
+		}
+		if (++_darkCount == _darkReadouts){
+			buildFromDarks();
+			buildFixes();
+		}
+		return false;
+	}
+
+	//Only defects are written, so the good pixels read on either side are never ones already replaced
+	const PIXISDefectFix* fix = _fixes.empty() ? NULL : &_fixes[0];
+	const PIXISDefectFix* end = fix + _fixes.size();
+	for (; fix != end; ++fix){
+		float value = fix->leftWeight * pixels[fix->left] + (1.0f - fix->leftWeight) * pixels[fix->right];
+		pixels[fix->index] = (pi16u)(value + 0.5f);
+	}
+	return true;
+}
+
+bool PIXISDefectMap::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_DefectCount:
+		*reinterpret_cast<int*>(value) = _defectCount;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,122 @@
+/**
+* @file:       PIXISDefectMap.h
+*
+* Purpose:     Class declaration for PIXISDefectMap.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_DEFECT_MAP_HEADER__
+#define __PIXIS_DEFECT_MAP_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include "PIXISMapFile.h"
+#include <string>
+#include <vector>
+
+/**
+* Where the defect map comes from.
+*/
+enum PIXISDefectSource{
+	PIXISDefect_File = 0,       // Defect_Map_File
+	PIXISDefect_DarkSeries = 1  // Built from the first Defect_Dark_Readouts readouts of the acquisition
+};
+
+/**
+* One defective pixel and the good pixels either side of it in its row.
+*/
+struct PIXISDefectFix{
+	int index;
+	int left;
+	int right;
+	float leftWeight;           // right gets 1 - leftWeight, by distance
+};
+
+/**
+* Class PIXISDefectMap
+*
+* @brief:  Replaces hot and defective pixels by interpolating between the nearest good
+*          pixels to their left and right, which also patches whole hot columns.
+*
+*          Defect_Map_File is a raw uint8 map, nonzero for a defect, either the size
+*          of the readout or of the whole active sensor. A sensor map is cut to the
+*          ROI and a binned pixel is defective if any pixel of its bin is, whenever
+*          the ROI or binning changes. With Defect_Source dark_series the first
+*          Defect_Dark_Readouts readouts are not delivered; pixels whose mean over
+*          them lies more than Defect_Sigma robust deviations from the median are
+*          defects, and the map is written to Defect_Save_File when one is given.
+*          The adaptor does not touch the shutter, so the readouts are only dark if
+*          the light is kept off the sensor for them, e.g. with ShutterTimingMode
+*          set to Always Closed or the input covered, and put back afterwards.
+*
+*          The map is turned into a list of PIXISDefectFix once, so correcting a
+*          readout costs time in proportion to the number of defects, not the size
+*          of the readout.
+*/
+class PIXISDefectMap{
+
+public:
+	PIXISDefectMap();
+
+	// addProperties adds the Defect_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* configure reads the Defect_* properties and fits the map to a readoutWidth x
+	* readoutHeight readout. Sensor-sized maps are only cut to the ROI when roiGeometry
+	* is true, i.e. the readout comes from the camera.
+	*
+	* @return: false, after warning, if the map cannot be used for the readout.
+	*/
+	bool configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, int readoutWidth, int readoutHeight, bool roiGeometry);
+
+	bool isEnabled() const { return _enabled; }
+
+	/**
+	* process corrects a width x height readout in place, or adds it to the dark series.
+	*
+	* @return: false while the readout only went into the dark series.
+	*/
+	bool process(pi16u* pixels, int width, int height);
+
+	// getStatus writes the value of a Defect_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// fitMap cuts a sensor-sized map to the ROI and bins it into _mask
+	bool fitMap(imaqkit::IPropContainer* propContainer, int sensorWidth, int sensorHeight, int readoutWidth, int readoutHeight);
+
+	// buildFromDarks marks the pixels of _mask whose mean over the dark series is an outlier
+	void buildFromDarks();
+
+	// buildFixes turns _mask into _fixes
+	void buildFixes();
+
+	bool _enabled;
+	int _source;
+	int _darkReadouts;
+	double _sigma;
+	std::string _savePath;
+	int _width;
+	int _height;
+
+	/// Map fitted to the readout, nonzero for a defect
+	std::vector<unsigned char> _mask;
+	std::vector<PIXISDefectFix> _fixes;
+
+	/// Map file as loaded, kept so that a change of ROI does not read it again
+	PIXISMapFile _mapSource;
+	std::vector<unsigned char> _mapFile;
+
+	/// Dark series being summed
+	std::vector<double> _darkSum;
+	int _darkCount;
+
+	volatile LONG _defectCount;
+};
+#endif
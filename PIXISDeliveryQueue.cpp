@@ -0,0 +1,324 @@
+/**
+* @file:       PIXISDeliveryQueue.cpp
+*
+* Purpose:     Implements the bounded queue of frames waiting for the engine.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISDeliveryQueue.h"
+#include "PIXISAdaptorProps.h"
+#include "PIXISTraceRecorder.h"
+#include <stdio.h>
+#include <string.h>
+
+// Largest decimation, one frame in this many
+#define PIXIS_DELIVERY_MAX_DECIMATION 1024
+
+// Waits on the queue events are bounded so that a stop is never missed
+#define PIXIS_DELIVERY_WAIT 100
+
+PIXISDeliveryQueue::PIXISDeliveryQueue() :
+	_policy(PIXISDelivery_Direct),
+	_capacity(1),
+	_frameBytes(0),
+	_fn(NULL),
+	_context(NULL),
+	_affinity(0),
+	_priority(THREAD_PRIORITY_NORMAL),
+	_thread(NULL),
+	_quit(0),
+	_head(0),
+	_count(0),
+	_delivering(false),
+	_decimation(1),
+	_offered(0),
+	_highWater(0),
+	_droppedOldest(0),
+	_droppedNewest(0),
+	_decimated(0),
+	_blockedTicks(0){
+	InitializeCriticalSection(&_guard);
+	_queued = CreateEvent(NULL, FALSE, FALSE, NULL);
+	_taken = CreateEvent(NULL, FALSE, FALSE, NULL);
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	_msPerTick = 1000.0 / frequency.QuadPart;
+}
+
+PIXISDeliveryQueue::~PIXISDeliveryQueue(){
+	stop();
+	CloseHandle(_queued);
+	CloseHandle(_taken);
+	DeleteCriticalSection(&_guard);
+}
+
+void PIXISDeliveryQueue::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Delivery_Policy", "direct", PIXISDelivery_Direct);
+	devicePropFact->addEnumValue(hProp, "block", PIXISDelivery_Block);
+	devicePropFact->addEnumValue(hProp, "drop_oldest", PIXISDelivery_DropOldest);
+	devicePropFact->addEnumValue(hProp, "drop_newest", PIXISDelivery_DropNewest);
+	devicePropFact->addEnumValue(hProp, "decimate", PIXISDelivery_Decimate);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Delivery_Max_Frames", 1, 65536, 16);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Bytes of image data the queue may hold, 0 for no limit besides Delivery_Max_Frames
+	hProp = devicePropFact->createDoubleProperty("Delivery_Max_Bytes", 0.0, 1.0e12, 256.0 * 1024 * 1024);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Delivery_Queue_Depth", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_DeliveryQueueDepth);
+
+	hProp = devicePropFact->createIntProperty("Delivery_High_Water", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_DeliveryHighWater);
+
+	hProp = devicePropFact->createIntProperty("Delivery_Dropped_Oldest", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_DeliveryDroppedOldest);
+
+	hProp = devicePropFact->createIntProperty("Delivery_Dropped_Newest", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_DeliveryDroppedNewest);
+
+	hProp = devicePropFact->createIntProperty("Delivery_Decimated", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_DeliveryDecimated);
+
+	// Total time the send stage waited for room, in ms
+	hProp = devicePropFact->createDoubleProperty("Delivery_Blocked_Time", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_DeliveryBlockedTime);
+}
+
+bool PIXISDeliveryQueue::configure(imaqkit::IPropContainer* propContainer, size_t frameBytes){
+	int* policy = static_cast<int*>(propContainer->getPropValue("Delivery_Policy"));
+	int* maxFrames = static_cast<int*>(propContainer->getPropValue("Delivery_Max_Frames"));
+	double* maxBytes = static_cast<double*>(propContainer->getPropValue("Delivery_Max_Bytes"));
+	_policy = *policy;
+	_frameBytes = frameBytes;
+
+	_highWater = 0;
+	_droppedOldest = 0;
+	_droppedNewest = 0;
+	_decimated = 0;
+	_blockedTicks = 0;
+	if (!isEnabled()){
+		return true;
+	}
+
+	_capacity = *maxFrames;
+	if (*maxBytes > 0.0){
+		double fitting = *maxBytes / (double)frameBytes;
+		if (fitting < 1.0){
+			char message[160];
+			sprintf_s(message, sizeof(message), "Delivery_Max_Bytes is smaller than one %.0f byte frame.", (double)frameBytes);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:delivery", message);
+			_policy = PIXISDelivery_Direct;
+			return false;
+		}
+		if (fitting < _capacity){
+			_capacity = (int)fitting;
+		}
+	}
+	return true;
+}
+
+void PIXISDeliveryQueue::start(DeliverFunction fn, void* context){
+	if (!isEnabled() || _thread){
+		return;
+	}
+	_fn = fn;
+	_context = context;
+	_head = 0;
+	_count = 0;
+	_delivering = false;
+	_decimation = 1;
+	_offered = 0;
+	_quit = 0;
+	ResetEvent(_queued);
+	ResetEvent(_taken);
+
+	//Buffers are kept across acquisitions and only allocated when a slot is first used
+	_frames.resize(_capacity);
+	_thread = CreateThread(NULL, 0, deliveryThread, this, 0, NULL);
+
+	//Without a thread to take them off, queued frames would never leave, so they go straight to the engine
+	if (_thread == NULL){
+		_policy = PIXISDelivery_Direct;
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:delivery", "The delivery thread could not be created. Frames are sent directly to the engine instead.");
+		return;
+	}
+	if (_affinity){
+		SetThreadAffinityMask(_thread, _affinity);
+	}
+	SetThreadPriority(_thread, _priority);
+}
+
+void PIXISDeliveryQueue::setScheduling(DWORD_PTR affinity, int priority){
+	_affinity = affinity;
+	_priority = priority;
+}
+
+void PIXISDeliveryQueue::drain(){
+	if (_thread == NULL){
+		return;
+	}
+	for (;;){
+		EnterCriticalSection(&_guard);
+		bool empty = (_count == 0 && !_delivering);
+		LeaveCriticalSection(&_guard);
+		if (empty){
+			return;
+		}
+		WaitForSingleObject(_taken, PIXIS_DELIVERY_WAIT);
+	}
+}
+
+void PIXISDeliveryQueue::stop(){
+	if (_thread == NULL){
+		return;
+	}
+	drain();
+	_quit = 1;
+	SetEvent(_queued);
+	WaitForSingleObject(_thread, INFINITE);
+	CloseHandle(_thread);
+	_thread = NULL;
+}
+
+/**
+* offer copies the frame into the next slot while holding the guard. The delivery
+* thread swaps a frame's buffer out before delivering it, so the slots in the ring are
+* never being read while the guard is free, and dropping the oldest frame is just a
+* move of the head.
+*/
+int PIXISDeliveryQueue::offer(const pibyte* image, double time, int sequenceStep){
+	EnterCriticalSection(&_guard);
+	int discarded = 0;
+
+	if (_policy == PIXISDelivery_Decimate){
+		if (_offered++ % _decimation != 0){
+			LeaveCriticalSection(&_guard);
+			InterlockedIncrement(&_decimated);
+			return 1;
+		}
+		//Each queued frame sets the rate of the ones after it: halved above half full, doubled below a quarter
+		if (_count * 2 > _capacity && _decimation < PIXIS_DELIVERY_MAX_DECIMATION){
+			_decimation *= 2;
+		}
+		else if (_count * 4 < _capacity && _decimation > 1){
+			_decimation /= 2;
+		}
+	}
+
+	if (_count == _capacity){
+		switch (_policy){
+		case PIXISDelivery_Block:{
+			PIXISTraceScope scope("DeliveryBlocked");
+			LARGE_INTEGER begin;
+			LARGE_INTEGER end;
+			QueryPerformanceCounter(&begin);
+			while (_count == _capacity){
+				LeaveCriticalSection(&_guard);
+				WaitForSingleObject(_taken, PIXIS_DELIVERY_WAIT);
+				EnterCriticalSection(&_guard);
+			}
+			QueryPerformanceCounter(&end);
+			_blockedTicks = _blockedTicks + (end.QuadPart - begin.QuadPart);
+			break;
+		}
+		case PIXISDelivery_DropOldest:
+			_head = (_head + 1) % _capacity;
+			_count--;
+			discarded++;
+			InterlockedIncrement(&_droppedOldest);
+			break;
+		default:
+			//A decimated queue that is still full drops like drop_newest
+			LeaveCriticalSection(&_guard);
+			InterlockedIncrement(_policy == PIXISDelivery_Decimate ? &_decimated : &_droppedNewest);
+			return 1;
+		}
+	}
+
+	PIXISDeliveryFrame& frame = _frames[(_head + _count) % _capacity];
+	if (frame.image.size() != _frameBytes){
+		frame.image.resize(_frameBytes);
+	}
+	memcpy(&frame.image[0], image, _frameBytes);
+	frame.time = time;
+	frame.sequenceStep = sequenceStep;
+	_count++;
+	if (_count > _highWater){
+		_highWater = _count;
+	}
+	LeaveCriticalSection(&_guard);
+	SetEvent(_queued);
+	return discarded;
+}
+
+DWORD WINAPI PIXISDeliveryQueue::deliveryThread(void* param){
+	PIXISDeliveryQueue* queue = reinterpret_cast<PIXISDeliveryQueue*>(param);
+	PIXISTraceRecorder::nameThread("Delivery");
+	PIXISDeliveryFrame frame;
+
+	for (;;){
+		EnterCriticalSection(&queue->_guard);
+		if (queue->_count == 0){
+			LeaveCriticalSection(&queue->_guard);
+			if (queue->_quit){
+				break;
+			}
+			WaitForSingleObject(queue->_queued, PIXIS_DELIVERY_WAIT);
+			continue;
+		}
+		//The slot takes this thread's previous buffer, to be reused by a later offer
+		PIXISDeliveryFrame& head = queue->_frames[queue->_head];
+		frame.image.swap(head.image);
+		frame.time = head.time;
+		frame.sequenceStep = head.sequenceStep;
+		queue->_head = (queue->_head + 1) % queue->_capacity;
+		queue->_count--;
+		queue->_delivering = true;
+		LeaveCriticalSection(&queue->_guard);
+
+		queue->_fn(queue->_context, frame);
+
+		EnterCriticalSection(&queue->_guard);
+		queue->_delivering = false;
+		LeaveCriticalSection(&queue->_guard);
+		SetEvent(queue->_taken);
+	}
+	return 0;
+}
+
+bool PIXISDeliveryQueue::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_DeliveryQueueDepth:
+		*reinterpret_cast<int*>(value) = _thread ? _count : 0;
+		return true;
+	case PIXISStatus_DeliveryHighWater:
+		*reinterpret_cast<int*>(value) = _highWater;
+		return true;
+	case PIXISStatus_DeliveryDroppedOldest:
+		*reinterpret_cast<int*>(value) = _droppedOldest;
+		return true;
+	case PIXISStatus_DeliveryDroppedNewest:
+		*reinterpret_cast<int*>(value) = _droppedNewest;
+		return true;
+	case PIXISStatus_DeliveryDecimated:
+		*reinterpret_cast<int*>(value) = _decimated;
+		return true;
+	case PIXISStatus_DeliveryBlockedTime:
+		*reinterpret_cast<double*>(value) = _blockedTicks * _msPerTick;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,135 @@
+/**
+* @file:       PIXISDeliveryQueue.h
+*
+* Purpose:     Class declaration for PIXISDeliveryQueue.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_DELIVERY_QUEUE_HEADER__
+#define __PIXIS_DELIVERY_QUEUE_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include <vector>
+
+/**
+* What happens to a frame for the engine when the delivery queue is full.
+*/
+enum PIXISDeliveryPolicy{
+	PIXISDelivery_Direct,           // No queue: frames go to receiveFrame from the send stage, as they always have
+	PIXISDelivery_Block,            // The send stage waits for room, holding up the pipeline and acquisition
+	PIXISDelivery_DropOldest,       // The oldest queued frame is discarded for the new one
+	PIXISDelivery_DropNewest,       // The new frame is discarded
+	PIXISDelivery_Decimate          // Only every Nth frame is queued, N growing while the queue fills
+};
+
+/**
+* One frame waiting for the engine.
+*/
+struct PIXISDeliveryFrame{
+	std::vector<pibyte> image;
+	double time;
+	int sequenceStep;
+};
+
+/**
+* Class PIXISDeliveryQueue
+*
+* @brief:  Bounded queue between the send stage and the engine. A thread of its own
+*          takes frames off the queue and hands them to receiveFrame, so a slow
+*          engine only fills the queue, and what happens once it is full is chosen
+*          with Delivery_Policy instead of depending on the engine.
+*
+*          The queue holds at most Delivery_Max_Frames frames and at most
+*          Delivery_Max_Bytes of image data. Frames discarded by the policy are not
+*          sent and do not count towards FramesPerTrigger. The depth, high-water mark
+*          and frames discarded by each policy are reported in the Delivery_* status
+*          properties.
+*/
+class PIXISDeliveryQueue{
+
+public:
+	// Called on the delivery thread for every frame taken off the queue
+	typedef void (*DeliverFunction)(void* context, const PIXISDeliveryFrame& frame);
+
+	PIXISDeliveryQueue();
+	virtual ~PIXISDeliveryQueue();
+
+	// addProperties adds the Delivery_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* configure reads the Delivery_* properties for frames of frameBytes bytes and resets
+	* the status counters. Called from startCapture().
+	*
+	* @return: false, after warning, if not even one frame fits in Delivery_Max_Bytes.
+	*/
+	bool configure(imaqkit::IPropContainer* propContainer, size_t frameBytes);
+
+	bool isEnabled() const { return _policy != PIXISDelivery_Direct; }
+
+	// start starts the delivery thread. If it cannot be created the queue falls back to Delivery_Policy direct.
+	void start(DeliverFunction fn, void* context);
+
+	// setScheduling sets the affinity (0 for any processor) and priority of the thread started next
+	void setScheduling(DWORD_PTR affinity, int priority);
+
+	// drain waits until every queued frame has been taken off the queue and delivered
+	void drain();
+
+	// stop drains and ends the delivery thread
+	void stop();
+
+	/**
+	* offer queues a copy of image, or discards frames as the policy says. With
+	* Delivery_Policy block it waits for room.
+	*
+	* @return: The number of frames discarded, counting image itself if it was not queued.
+	*/
+	int offer(const pibyte* image, double time, int sequenceStep);
+
+	// getStatus writes the value of a Delivery_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	static DWORD WINAPI deliveryThread(void* param);
+
+	/// Configured values
+	int _policy;
+	int _capacity;
+	size_t _frameBytes;
+
+	DeliverFunction _fn;
+	void* _context;
+	DWORD_PTR _affinity;
+	int _priority;
+	HANDLE _thread;
+	volatile LONG _quit;
+
+	/// Ring of _capacity frames, guarded by _guard. Buffers are kept for reuse.
+	std::vector<PIXISDeliveryFrame> _frames;
+	int _head;
+	volatile LONG _count;       // Also read unguarded for the status
+	bool _delivering;           // The delivery thread holds a frame taken off the queue
+	CRITICAL_SECTION _guard;
+	HANDLE _queued;             // Set when a frame is queued
+	HANDLE _taken;              // Set when a frame has been delivered
+
+	/// Decimation: one in every _decimation offers is queued
+	int _decimation;
+	pi64s _offered;
+
+	/// Status values
+	volatile LONG _highWater;
+	volatile LONG _droppedOldest;
+	volatile LONG _droppedNewest;
+	volatile LONG _decimated;
+	volatile LONG64 _blockedTicks;
+	double _msPerTick;
+};
+#endif
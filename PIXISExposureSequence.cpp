@@ -0,0 +1,298 @@
+/**
+* @file:       PIXISExposureSequence.cpp
+*
+* Purpose:     Implements hardware-timed sequences of per-readout parameter sets.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISExposureSequence.h"
+#include "PIXISAdaptorProps.h"
+#include "picam_advanced.h"
+#include <stdlib.h>
+#include <string.h>
+
+PIXISExposureSequence::PIXISExposureSequence() :
+	_next(0),
+	_prepared(-1),
+	_originalExposure(0.0),
+	_originalGain(0),
+	_originalX(0),
+	_originalY(0),
+	_log(NULL){
+}
+
+PIXISExposureSequence::~PIXISExposureSequence(){
+	if (_log){
+		fclose(_log);
+	}
+}
+
+void PIXISExposureSequence::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createStringProperty("Sequence_Steps", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createStringProperty("Sequence_Log_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Sequence_Frame", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_SequenceFrame);
+
+	hProp = devicePropFact->createIntProperty("Sequence_Step", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_SequenceStep);
+}
+
+bool PIXISExposureSequence::parseSteps(const char* text){
+	_steps.clear();
+
+	const char* cursor = text;
+	while (*cursor){
+		PIXISSequenceStep step;
+		memset(&step, 0, sizeof(step));
+
+		//Up to four comma separated numbers make a step
+		piflt fields[4];
+		int count = 0;
+		while (count < 4){
+			char* end;
+			fields[count] = strtod(cursor, &end);
+			if (end == cursor){
+				break;
+			}
+			count++;
+			cursor = end;
+			while (*cursor == ' ') cursor++;
+			if (*cursor != ','){
+				break;
+			}
+			cursor++;
+		}
+
+		while (*cursor == ' ') cursor++;
+		if (count == 0 || count == 3 || (*cursor != ';' && *cursor != 0)){
+			return false;
+		}
+		if (*cursor == ';'){
+			cursor++;
+		}
+
+		step.exposure = fields[0];
+		if (count >= 2){
+			step.gain = (piint)fields[1];
+		}
+		if (count == 4){
+			step.hasPosition = true;
+			step.x = (piint)fields[2];
+			step.y = (piint)fields[3];
+		}
+		_steps.push_back(step);
+	}
+	return true;
+}
+
+/**
+* configure opens Sequence_Log_File once the steps are known to be valid. While a file is
+* replayed there is no camera to check them against.
+*/
+bool PIXISExposureSequence::configure(imaqkit::IPropContainer* propContainer, PicamHandle camera){
+	if (_log){
+		fclose(_log);
+		_log = NULL;
+	}
+	_next = 0;
+	_prepared = -1;
+
+	const char* text = static_cast<const char*>(propContainer->getPropValue("Sequence_Steps"));
+	if (!parseSteps(text)){
+		_steps.clear();
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:sequence", "Sequence_Steps could not be parsed. Steps are \"exposure[,gain[,x,y]]\" separated by ';'.");
+		return false;
+	}
+	if (_steps.empty()){
+		return true;
+	}
+	if (camera != NULL && !checkSteps(camera)){
+		_steps.clear();
+		return false;
+	}
+
+	const char* logFile = static_cast<const char*>(propContainer->getPropValue("Sequence_Log_File"));
+	if (logFile && *logFile){
+		if (fopen_s(&_log, logFile, "w") == 0){
+			fprintf(_log, "frame,step,exposure,time\n");
+		}
+		else{
+			_log = NULL;
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:sequence", "Could not open Sequence_Log_File.");
+		}
+	}
+	return true;
+}
+
+/**
+* checkSteps uses the Picam_CanSet* functions, which test a value against the capable
+* constraints without changing anything. Warns about the first step that fails.
+*/
+bool PIXISExposureSequence::checkSteps(PicamHandle camera){
+	PicamHandle model;
+	PicamAdvanced_GetCameraModel(camera, &model);
+
+	Picam_GetParameterFloatingPointValue(model, PicamParameter_ExposureTime, &_originalExposure);
+	Picam_GetParameterIntegerValue(model, PicamParameter_AdcAnalogGain, &_originalGain);
+
+	const PicamRois* region;
+	Picam_GetParameterRoisValue(model, PicamParameter_Rois, &region);
+	PicamRoi roi = region->roi_array[0];
+	Picam_DestroyRois(region);
+	_originalX = roi.x;
+	_originalY = roi.y;
+
+	for (size_t i = 0; i < _steps.size(); ++i){
+		const PIXISSequenceStep& step = _steps[i];
+		pibln settable = true;
+
+		Picam_CanSetParameterFloatingPointValue(model, PicamParameter_ExposureTime, step.exposure, &settable);
+		if (settable && step.gain){
+			Picam_CanSetParameterIntegerValue(model, PicamParameter_AdcAnalogGain, step.gain, &settable);
+		}
+		if (settable && step.hasPosition){
+			PicamRoi moved = roi;
+			moved.x = step.x;
+			moved.y = step.y;
+			PicamRois rois;
+			rois.roi_array = &moved;
+			rois.roi_count = 1;
+			Picam_CanSetParameterRoisValue(model, PicamParameter_Rois, &rois, &settable);
+		}
+
+		if (!settable){
+			char message[128];
+			sprintf_s(message, sizeof(message), "Sequence step %d is not a valid camera setting.", (int)i + 1);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:sequence", message);
+			return false;
+		}
+	}
+	return true;
+}
+
+void PIXISExposureSequence::prepare(PicamHandle camera){
+	if (_prepared == _next){
+		return;
+	}
+
+	//A replayed readout was taken with the step already, so it only has to be counted
+	if (camera == NULL){
+		_prepared = _next;
+		return;
+	}
+
+	const PIXISSequenceStep& step = _steps[_next];
+	Picam_SetParameterFloatingPointValue(camera, PicamParameter_ExposureTime, step.exposure);
+	if (step.gain){
+		Picam_SetParameterIntegerValue(camera, PicamParameter_AdcAnalogGain, step.gain);
+	}
+	if (step.hasPosition){
+		const PicamRois* region;
+		Picam_GetParameterRoisValue(camera, PicamParameter_Rois, &region);
+		PicamRoi moved = region->roi_array[0];
+		Picam_DestroyRois(region);
+		moved.x = step.x;
+		moved.y = step.y;
+		PicamRois rois;
+		rois.roi_array = &moved;
+		rois.roi_count = 1;
+		Picam_SetParameterRoisValue(camera, PicamParameter_Rois, &rois);
+	}
+
+	//Steps that repeat the previous values leave nothing to commit
+	pibln committed;
+	Picam_AreParametersCommitted(camera, &committed);
+	if (!committed){
+		const PicamParameter* failedParameterArray;
+		piint failedParameterCount;
+		Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+		if (failedParameterCount){
+			char message[128];
+			sprintf_s(message, sizeof(message), "Failed to commit sequence step %d.", _next + 1);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:sequence", message);
+		}
+		Picam_DestroyParameters(failedParameterArray);
+	}
+	_prepared = _next;
+}
+
+int PIXISExposureSequence::readoutDone(){
+	int step = _prepared;
+	_next = (_prepared + 1) % (int)_steps.size();
+	return step;
+}
+
+void PIXISExposureSequence::frameDelivered(int frame, int step, double time){
+	PIXISSequenceTag tag;
+	tag.frame = frame;
+	tag.step = step + 1;
+	tag.exposure = _steps[step].exposure;
+	_latest.publish(tag);
+
+	if (_log){
+		fprintf(_log, "%d,%d,%g,%.6f\n", tag.frame, tag.step, tag.exposure, time);
+	}
+}
+
+void PIXISExposureSequence::finish(PicamHandle camera){
+	if (_log){
+		fclose(_log);
+		_log = NULL;
+	}
+	_next = 0;
+	_prepared = -1;
+
+	//A replayed file changed nothing on a camera
+	if (camera == NULL){
+		return;
+	}
+
+	Picam_SetParameterFloatingPointValue(camera, PicamParameter_ExposureTime, _originalExposure);
+	if (_originalGain){
+		Picam_SetParameterIntegerValue(camera, PicamParameter_AdcAnalogGain, _originalGain);
+	}
+
+	const PicamRois* region;
+	Picam_GetParameterRoisValue(camera, PicamParameter_Rois, &region);
+	PicamRoi restored = region->roi_array[0];
+	Picam_DestroyRois(region);
+	restored.x = _originalX;
+	restored.y = _originalY;
+	PicamRois rois;
+	rois.roi_array = &restored;
+	rois.roi_count = 1;
+	Picam_SetParameterRoisValue(camera, PicamParameter_Rois, &rois);
+
+	const PicamParameter* failedParameterArray;
+	piint failedParameterCount;
+	Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+	Picam_DestroyParameters(failedParameterArray);
+}
+
+bool PIXISExposureSequence::getStatus(int id, void* value) const{
+	PIXISSequenceTag tag;
+	switch (id){
+	case PIXISStatus_SequenceFrame:
+		_latest.read(tag);
+		*reinterpret_cast<int*>(value) = tag.frame;
+		return true;
+	case PIXISStatus_SequenceStep:
+		_latest.read(tag);
+		*reinterpret_cast<int*>(value) = tag.step;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,115 @@
+/**
+* @file:       PIXISExposureSequence.h
+*
+* Purpose:     Class declaration for PIXISExposureSequence.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_EXPOSURE_SEQUENCE_HEADER__
+#define __PIXIS_EXPOSURE_SEQUENCE_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISLatestValue.h"
+#include <stdio.h>
+#include <vector>
+
+/**
+* One step of a sequence. Gain and ROI position are optional.
+*/
+struct PIXISSequenceStep{
+	piflt exposure;     // ms
+	piint gain;         // PicamAdcAnalogGain, 0 keeps the current gain
+	bool hasPosition;
+	piint x;
+	piint y;
+};
+
+/**
+* The step the most recently delivered frame was acquired with.
+*/
+struct PIXISSequenceTag{
+	piint frame;        // Frame number in the engine, starting at 1
+	piint step;         // Step index, starting at 1
+	piflt exposure;
+};
+
+/**
+* Class PIXISExposureSequence
+*
+* @brief:  Runs a list of per-readout parameter sets uploaded up front through
+*          Sequence_Steps. Each step is checked against the camera model in
+*          startCapture(), and the acquisition thread commits the next step between
+*          readouts, so no property round trip or engine stop/restart is involved.
+*
+*          Sequence_Steps holds steps separated by ';'. A step is
+*          "exposure[,gain[,x,y]]" with the exposure in ms and the gain as the
+*          PicamAdcAnalogGain value. x and y move the ROI; its size stays fixed so
+*          every frame has the geometry the engine expects. Steps repeat until the
+*          acquisition ends.
+*
+*          While a file is replayed nothing is committed, but the steps still advance
+*          with each readout, so a file recorded with the same sequence gets the step
+*          tags, log lines and HDR brackets it was recorded with.
+*/
+class PIXISExposureSequence{
+
+public:
+	PIXISExposureSequence();
+	virtual ~PIXISExposureSequence();
+
+	// addProperties adds the Sequence_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure parses and validates Sequence_Steps. Returns false, after warning, if a step is invalid.
+	bool configure(imaqkit::IPropContainer* propContainer, PicamHandle camera);
+
+	bool isEnabled() const { return !_steps.empty(); }
+
+	int getStepCount() const { return (int)_steps.size(); }
+
+	// getExposure returns the exposure of step, counting from 0, in ms
+	piflt getExposure(int step) const { return _steps[step].exposure; }
+
+	// prepare commits the next step unless it is already in place. Called before each readout, with a NULL camera while replaying.
+	void prepare(PicamHandle camera);
+
+	// readoutDone moves on to the next step once the prepared one has produced a readout
+	int readoutDone();
+
+	// frameDelivered records that the engine received frame with the given step
+	void frameDelivered(int frame, int step, double time);
+
+	// finish puts back the values the camera had before the sequence started
+	void finish(PicamHandle camera);
+
+	// getStatus writes the value of a Sequence_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// parseSteps fills _steps from text. Returns false on a syntax error.
+	bool parseSteps(const char* text);
+
+	// checkSteps saves the camera values the steps change and checks each step against the camera model
+	bool checkSteps(PicamHandle camera);
+
+	std::vector<PIXISSequenceStep> _steps;
+	int _next;
+	int _prepared;
+
+	/// Camera values saved by configure() and restored by finish()
+	piflt _originalExposure;
+	piint _originalGain;
+	piint _originalX;
+	piint _originalY;
+
+	/// Optional per-frame log, one "frame,step,exposure,time" line per delivered frame
+	FILE* _log;
+
+	PIXISLatestValue<PIXISSequenceTag> _latest;
+};
+#endif
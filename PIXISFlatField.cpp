@@ -0,0 +1,259 @@
+/**
+* @file:       PIXISFlatField.cpp
+*
+* Purpose:     Implements the fused offset and flat-field gain correction.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISFlatField.h"
+#include "PIXISAdaptorProps.h"
+#include <emmintrin.h>
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+
+// Pixels corrected by one worker pool tile
+#define PIXIS_FLAT_FIELD_TILE_PIXELS 16384
+
+PIXISFlatField::PIXISFlatField() :
+	_enabled(false),
+	_floatOutput(false),
+	_scale(1.0f),
+	_input(NULL),
+	_pixelCount(0){
+}
+
+void PIXISFlatField::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Flat_Field", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw float32 gain per pixel, of the readout or of the whole active sensor
+	hProp = devicePropFact->createStringProperty("Flat_Field_Gain_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw float32 offset per pixel of the readout, e.g. an averaged dark readout. Empty uses Flat_Field_Offset.
+	hProp = devicePropFact->createStringProperty("Flat_Field_Offset_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createDoubleProperty("Flat_Field_Offset", 0.0, 65535.0, 0.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createEnumProperty("Flat_Field_Output", "uint16", 0);
+	devicePropFact->addEnumValue(hProp, "float32", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Multiplies the corrected values before they are rounded into 16 bits
+	hProp = devicePropFact->createDoubleProperty("Flat_Field_Scale", 0.0, 65535.0, 1.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+}
+
+bool PIXISFlatField::isFloatOutput(imaqkit::IPropContainer* propContainer){
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Flat_Field"));
+	int* output = static_cast<int*>(propContainer->getPropValue("Flat_Field_Output"));
+	return *enabled == 1 && *output == 1;
+}
+
+bool PIXISFlatField::loadMap(const char* path, PIXISMapFile& loaded, std::vector<float>& map){
+	if (!map.empty() && loaded.isLoaded(path)){
+		return true;
+	}
+	map.clear();
+
+	FILE* file;
+	if (!loaded.loading(path) || fopen_s(&file, path, "rb") != 0){
+		loaded.clear();
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long bytes = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (bytes > 0){
+		map.resize(bytes / sizeof(float));
+		if (fread(&map[0], sizeof(float), map.size(), file) != map.size()){
+			map.clear();
+		}
+	}
+	fclose(file);
+
+	//A NaN or infinite value would spread through every readout it corrects
+	for (size_t i = 0; i < map.size(); ++i){
+		if (!_finite(map[i])){
+			map.clear();
+			break;
+		}
+	}
+	if (map.empty()){
+		loaded.clear();
+		return false;
+	}
+	return true;
+}
+
+/**
+* resampleGain cuts the ROI out of a sensor-sized gain map. A binned pixel collects the
+* charge of its bin, so its gain is the reciprocal of the mean response 1/gain over the
+* bin. Readouts of several kinetics frames repeat the ROI once per frame.
+*/
+bool PIXISFlatField::resampleGain(imaqkit::IPropContainer* propContainer, int sensorWidth, int sensorHeight, int readoutWidth, int readoutHeight){
+	int x0 = *static_cast<int*>(propContainer->getPropValue("ROIXOffset"));
+	int y0 = *static_cast<int*>(propContainer->getPropValue("ROIYOffset"));
+	int width = *static_cast<int*>(propContainer->getPropValue("ROIWidth"));
+	int height = *static_cast<int*>(propContainer->getPropValue("ROIHeight"));
+	int xBinning = *static_cast<int*>(propContainer->getPropValue("ROIXBinning"));
+	int yBinning = *static_cast<int*>(propContainer->getPropValue("ROIYBinning"));
+
+	int binnedHeight = height / yBinning;
+	if (x0 < 0 || y0 < 0 || x0 + width > sensorWidth || y0 + height > sensorHeight ||
+		width / xBinning != readoutWidth || binnedHeight == 0 || readoutHeight % binnedHeight != 0){
+		return false;
+	}
+
+	_gain.resize((size_t)readoutWidth * readoutHeight);
+	for (int by = 0; by < binnedHeight; ++by){
+		for (int bx = 0; bx < readoutWidth; ++bx){
+			double response = 0.0;
+			for (int y = 0; y < yBinning; ++y){
+				const float* row = &_gainFile[(size_t)(y0 + by * yBinning + y) * sensorWidth + x0 + bx * xBinning];
+				for (int x = 0; x < xBinning; ++x){
+					response += row[x] != 0.0f ? 1.0 / row[x] : 0.0;
+				}
+			}
+			_gain[(size_t)by * readoutWidth + bx] = response > 0.0 ? (float)(xBinning * yBinning / response) : 0.0f;
+		}
+	}
+	for (int frame = 1; frame < readoutHeight / binnedHeight; ++frame){
+		memcpy(&_gain[(size_t)frame * binnedHeight * readoutWidth], &_gain[0], (size_t)binnedHeight * readoutWidth * sizeof(float));
+	}
+	return true;
+}
+
+bool PIXISFlatField::configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, int readoutWidth, int readoutHeight, bool roiGeometry){
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Flat_Field"));
+	int* output = static_cast<int*>(propContainer->getPropValue("Flat_Field_Output"));
+	double* scale = static_cast<double*>(propContainer->getPropValue("Flat_Field_Scale"));
+	double* offset = static_cast<double*>(propContainer->getPropValue("Flat_Field_Offset"));
+	const char* gainPath = static_cast<const char*>(propContainer->getPropValue("Flat_Field_Gain_File"));
+	const char* offsetPath = static_cast<const char*>(propContainer->getPropValue("Flat_Field_Offset_File"));
+	_enabled = (*enabled == 1);
+	_floatOutput = (*output == 1);
+	_scale = (float)*scale;
+	if (!_enabled){
+		return true;
+	}
+
+	size_t pixelCount = (size_t)readoutWidth * readoutHeight;
+	char message[MAX_PATH + 128];
+
+	if (!loadMap(gainPath, _gainSource, _gainFile)){
+		sprintf_s(message, sizeof(message), "The flat-field gain map '%s' could not be read or holds values that are not finite.", gainPath);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:flatField", message);
+		return false;
+	}
+	piint sensorWidth = 0, sensorHeight = 0;
+	Picam_GetParameterIntegerValue(camera, PicamParameter_SensorActiveWidth, &sensorWidth);
+	Picam_GetParameterIntegerValue(camera, PicamParameter_SensorActiveHeight, &sensorHeight);
+	if (_gainFile.size() == pixelCount){
+		_gain = _gainFile;
+	}
+	else if (!roiGeometry || _gainFile.size() != (size_t)sensorWidth * sensorHeight ||
+		!resampleGain(propContainer, sensorWidth, sensorHeight, readoutWidth, readoutHeight)){
+		sprintf_s(message, sizeof(message), "The flat-field gain map holds %u values, which fits neither the %d x %d readout nor the sensor.",
+			(unsigned)_gainFile.size(), readoutWidth, readoutHeight);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:flatField", message);
+		return false;
+	}
+
+	if (offsetPath[0] == '\0'){
+		_offset.assign(pixelCount, (float)*offset);
+	}
+	else if (!loadMap(offsetPath, _offsetSource, _offsetFile) || _offsetFile.size() != pixelCount){
+		sprintf_s(message, sizeof(message), "The flat-field offset map '%s' could not be read, holds values that are not finite or is not the size of the %d x %d readout.",
+			offsetPath, readoutWidth, readoutHeight);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:flatField", message);
+		return false;
+	}
+	else{
+		_offset = _offsetFile;
+	}
+
+	_corrected.resize(pixelCount);
+	_float.resize(_floatOutput ? pixelCount : 1);
+	return true;
+}
+
+const pi16u* PIXISFlatField::process(const pi16u* pixels, int width, int height, PIXISWorkerPool* workers){
+	_input = pixels;
+	_pixelCount = width * height;
+	int tileCount = (_pixelCount + PIXIS_FLAT_FIELD_TILE_PIXELS - 1) / PIXIS_FLAT_FIELD_TILE_PIXELS;
+	workers->run(correctTile, this, tileCount);
+	return &_corrected[0];
+}
+
+/**
+* correctTile converts eight pixels at a time to float, applies the maps and, for the
+* 16 bit result, scales, clamps to [0, 65535] and packs them back. Rounding adds 0.5 and
+* truncates, as the scalar tail does, rather than rounding halves to even. SSE2 only
+* packs with signed saturation, so the values are shifted by 32768 around the pack.
+*/
+void PIXISFlatField::correctTile(void* context, int tile){
+	PIXISFlatField* flatField = reinterpret_cast<PIXISFlatField*>(context);
+	int begin = tile * PIXIS_FLAT_FIELD_TILE_PIXELS;
+	int end = begin + PIXIS_FLAT_FIELD_TILE_PIXELS < flatField->_pixelCount ? begin + PIXIS_FLAT_FIELD_TILE_PIXELS : flatField->_pixelCount;
+
+	const pi16u* in = flatField->_input;
+	const float* offset = &flatField->_offset[0];
+	const float* gain = &flatField->_gain[0];
+	pi16u* out = &flatField->_corrected[0];
+	float* outFloat = flatField->_floatOutput ? &flatField->_float[0] : NULL;
+	float scale = flatField->_scale;
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16((short)0x8000);
+	const __m128 vscale = _mm_set1_ps(scale);
+	const __m128 vzero = _mm_setzero_ps();
+	const __m128 vmax = _mm_set1_ps(65535.0f);
+	const __m128 vhalf = _mm_set1_ps(0.5f);
+	const __m128i vshift = _mm_set1_epi32(32768);
+
+	int i = begin;
+	for (; i + 8 <= end; i += 8){
+		__m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero));
+		__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero));
+		lo = _mm_mul_ps(_mm_sub_ps(lo, _mm_loadu_ps(offset + i)), _mm_loadu_ps(gain + i));
+		hi = _mm_mul_ps(_mm_sub_ps(hi, _mm_loadu_ps(offset + i + 4)), _mm_loadu_ps(gain + i + 4));
+		if (outFloat){
+			_mm_storeu_ps(outFloat + i, lo);
+			_mm_storeu_ps(outFloat + i + 4, hi);
+		}
+		lo = _mm_min_ps(_mm_max_ps(_mm_mul_ps(lo, vscale), vzero), vmax);
+		hi = _mm_min_ps(_mm_max_ps(_mm_mul_ps(hi, vscale), vzero), vmax);
+		__m128i roundedLo = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(lo, vhalf)), vshift);
+		__m128i roundedHi = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(hi, vhalf)), vshift);
+		__m128i packed = _mm_packs_epi32(roundedLo, roundedHi);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(packed, bias));
+	}
+	for (; i < end; ++i){
+		float value = (in[i] - offset[i]) * gain[i];
+		if (outFloat){
+			outFloat[i] = value;
+		}
+		value *= scale;
+		value = value < 0.0f ? 0.0f : (value > 65535.0f ? 65535.0f : value);
+		out[i] = (pi16u)(value + 0.5f);
+	}
+}
@@ -0,0 +1,105 @@
+/**
+* @file:       PIXISFlatField.h
+*
+* Purpose:     Class declaration for PIXISFlatField.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_FLAT_FIELD_HEADER__
+#define __PIXIS_FLAT_FIELD_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include "PIXISWorkerPool.h"
+#include "PIXISMapFile.h"
+#include <string>
+#include <vector>
+
+/**
+* Class PIXISFlatField
+*
+* @brief:  Corrects each readout as (raw - offset) * gain in one pass, eight pixels per
+*          SSE2 step, split into tiles on the worker pool.
+*
+*          Maps are raw little endian float32 files. The gain map
+*          (Flat_Field_Gain_File) is either the size of the readout or of the whole
+*          active sensor; a sensor map is cut to the ROI and combined over each bin,
+*          as the reciprocal of the mean response, whenever the ROI or binning
+*          changes. The offset map (Flat_Field_Offset_File) must be the size of the
+*          readout; without one Flat_Field_Offset is subtracted from every pixel.
+*          startCapture() fails if a map does not fit, so an uncorrected readout is
+*          never sent on.
+*
+*          With Flat_Field_Output uint16 the result is multiplied by Flat_Field_Scale
+*          and rounded into 16 bits. With float32 the engine is sent the corrected
+*          values as single precision frames, while the stages after the correction
+*          see the 16 bit result.
+*/
+class PIXISFlatField{
+
+public:
+	PIXISFlatField();
+
+	// addProperties adds the Flat_Field_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* configure reads the Flat_Field_* properties and fits the maps to a readoutWidth x
+	* readoutHeight readout. Sensor-sized gain maps are only cut to the ROI when
+	* roiGeometry is true, i.e. the readout comes from the camera.
+	*
+	* @return: false, after warning, if a map cannot be used for the readout.
+	*/
+	bool configure(imaqkit::IPropContainer* propContainer, PicamHandle camera, int readoutWidth, int readoutHeight, bool roiGeometry);
+
+	bool isEnabled() const { return _enabled; }
+	bool isFloatOutput() const { return _enabled && _floatOutput; }
+
+	// isFloatOutput returns true if the Flat_Field_* properties ask for float32 frames, for getFrameType() before configure()
+	static bool isFloatOutput(imaqkit::IPropContainer* propContainer);
+
+	/**
+	* process corrects a width x height readout.
+	*
+	* @return: The 16 bit result, valid until the next call. With float32 output the float result is in getFloatImage().
+	*/
+	const pi16u* process(const pi16u* pixels, int width, int height, PIXISWorkerPool* workers);
+
+	const float* getFloatImage() const { return &_float[0]; }
+
+	// loadMap reads a raw float32 map file into map, unless it is the file already loaded and unchanged. Fails on NaN or infinite values.
+	static bool loadMap(const char* path, PIXISMapFile& loaded, std::vector<float>& map);
+
+private:
+	// correctTile is the PIXISWorkerPool::TileFunction correcting one run of pixels
+	static void correctTile(void* context, int tile);
+
+	// resampleGain cuts a sensor-sized gain map to the ROI and bins it into _gain
+	bool resampleGain(imaqkit::IPropContainer* propContainer, int sensorWidth, int sensorHeight, int readoutWidth, int readoutHeight);
+
+	bool _enabled;
+	bool _floatOutput;
+	float _scale;
+
+	/// Maps fitted to the readout
+	std::vector<float> _gain;
+	std::vector<float> _offset;
+
+	/// Files as loaded, kept so that a change of ROI does not read them again
+	PIXISMapFile _gainSource;
+	std::vector<float> _gainFile;
+	PIXISMapFile _offsetSource;
+	std::vector<float> _offsetFile;
+
+	/// Readout being corrected
+	const pi16u* _input;
+	int _pixelCount;
+	std::vector<pi16u> _corrected;
+	std::vector<float> _float;
+};
+#endif
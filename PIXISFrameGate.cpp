@@ -0,0 +1,181 @@
+/**
+* @file:       PIXISFrameGate.cpp
+*
+* Purpose:     Implements content-based gating of readouts before they reach the engine.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISFrameGate.h"
+#include "PIXISAdaptorProps.h"
+#include <emmintrin.h>
+#include <limits.h>
+
+PIXISFrameGate::PIXISFrameGate() :
+	_mode(PIXISFrameGate_Off),
+	_x(0), _y(0), _width(0), _height(0),
+	_threshold(0.0),
+	_level(0),
+	_minPixels(1),
+	_accepted(0),
+	_rejected(0){
+}
+
+void PIXISFrameGate::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Frame_Gate", "off", PIXISFrameGate_Off);
+	devicePropFact->addEnumValue(hProp, "sum", PIXISFrameGate_Sum);
+	devicePropFact->addEnumValue(hProp, "max", PIXISFrameGate_Max);
+	devicePropFact->addEnumValue(hProp, "pixel_count", PIXISFrameGate_PixelCount);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Gate region, in pixels of the (binned) readout
+	const char* regionNames[] = { "Frame_Gate_X", "Frame_Gate_Y", "Frame_Gate_Width", "Frame_Gate_Height" };
+	for (int i = 0; i < 4; ++i){
+		hProp = devicePropFact->createIntProperty(regionNames[i], 0, INT_MAX, 0);
+		devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+		devicePropFact->addProperty(hProp);
+	}
+
+	hProp = devicePropFact->createDoubleProperty("Frame_Gate_Threshold", 0.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Frame_Gate_Level", 0, 65535, 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Frame_Gate_Min_Pixels", 1, INT_MAX, 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Frame_Gate_Accepted", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameGateAccepted);
+
+	hProp = devicePropFact->createIntProperty("Frame_Gate_Rejected", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameGateRejected);
+}
+
+void PIXISFrameGate::configure(imaqkit::IPropContainer* propContainer){
+	_mode = static_cast<PIXISFrameGateMode>(*static_cast<int*>(propContainer->getPropValue("Frame_Gate")));
+	_x = *static_cast<int*>(propContainer->getPropValue("Frame_Gate_X"));
+	_y = *static_cast<int*>(propContainer->getPropValue("Frame_Gate_Y"));
+	_width = *static_cast<int*>(propContainer->getPropValue("Frame_Gate_Width"));
+	_height = *static_cast<int*>(propContainer->getPropValue("Frame_Gate_Height"));
+	_threshold = *static_cast<double*>(propContainer->getPropValue("Frame_Gate_Threshold"));
+	_level = *static_cast<int*>(propContainer->getPropValue("Frame_Gate_Level"));
+	_minPixels = *static_cast<int*>(propContainer->getPropValue("Frame_Gate_Min_Pixels"));
+
+	InterlockedExchange(&_accepted, 0);
+	InterlockedExchange(&_rejected, 0);
+}
+
+/**
+* accept scans the gate region row by row with SSE2, eight pixels per step. The scan stops
+* as soon as the rule is met, since none of the rules can become false again with more
+* (non-negative) pixels.
+*/
+bool PIXISFrameGate::accept(const pi16u* pixels, int width, int height){
+	//Clip the gate region to the readout
+	int x0 = _x < width ? _x : width;
+	int y0 = _y < height ? _y : height;
+	int x1 = (_width > 0 && _width < width - x0) ? x0 + _width : width;
+	int y1 = (_height > 0 && _height < height - y0) ? y0 + _height : height;
+
+	const __m128i bias = _mm_set1_epi16((short)0x8000);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i level = _mm_set1_epi16((short)(_level ^ 0x8000));
+	__m128i vmax = _mm_set1_epi16((short)0x8000);
+
+	pi64u sum = 0;
+	pi64s count = 0;
+	int maximum = 0;
+	bool passed = false;
+	__declspec(align(16)) pi32u sumLanes[4];
+	__declspec(align(16)) pi16u countLanes[8];
+	__declspec(align(16)) pi16s maxLanes[8];
+
+	for (int y = y0; y < y1 && !passed; ++y){
+		const pi16u* row = pixels + (size_t)y * width;
+		int x = x0;
+
+		switch (_mode){
+		case PIXISFrameGate_Sum:{
+			__m128i vsum = zero;
+			for (; x + 8 <= x1; x += 8){
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+				vsum = _mm_add_epi32(vsum, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+			}
+			_mm_store_si128(reinterpret_cast<__m128i*>(sumLanes), vsum);
+			sum += (pi64u)sumLanes[0] + sumLanes[1] + sumLanes[2] + sumLanes[3];
+			for (; x < x1; ++x){
+				sum += row[x];
+			}
+			passed = sum > _threshold;
+			break;
+		}
+		case PIXISFrameGate_Max:{
+			for (; x + 8 <= x1; x += 8){
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+				vmax = _mm_max_epi16(vmax, _mm_xor_si128(v, bias));
+			}
+			for (; x < x1; ++x){
+				if (row[x] > maximum) maximum = row[x];
+			}
+			_mm_store_si128(reinterpret_cast<__m128i*>(maxLanes), vmax);
+			for (int lane = 0; lane < 8; ++lane){
+				int laneMax = (pi16u)maxLanes[lane] ^ 0x8000;
+				if (laneMax > maximum) maximum = laneMax;
+			}
+			passed = maximum > _threshold;
+			break;
+		}
+		case PIXISFrameGate_PixelCount:{
+			__m128i vcount = zero;
+			for (; x + 8 <= x1; x += 8){
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+				// The compare mask is -1 for pixels above the level
+				vcount = _mm_sub_epi16(vcount, _mm_cmpgt_epi16(_mm_xor_si128(v, bias), level));
+			}
+			_mm_store_si128(reinterpret_cast<__m128i*>(countLanes), vcount);
+			for (int lane = 0; lane < 8; ++lane){
+				count += countLanes[lane];
+			}
+			for (; x < x1; ++x){
+				if (row[x] > _level) count++;
+			}
+			passed = count >= _minPixels;
+			break;
+		}
+		default:
+			passed = true;
+			break;
+		}
+	}
+
+	if (passed){
+		InterlockedIncrement(&_accepted);
+	}
+	else{
+		InterlockedIncrement(&_rejected);
+	}
+	return passed;
+}
+
+bool PIXISFrameGate::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_FrameGateAccepted:
+		*reinterpret_cast<int*>(value) = _accepted;
+		return true;
+	case PIXISStatus_FrameGateRejected:
+		*reinterpret_cast<int*>(value) = _rejected;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,71 @@
+/**
+* @file:       PIXISFrameGate.h
+*
+* Purpose:     Class declaration for PIXISFrameGate.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_FRAME_GATE_HEADER__
+#define __PIXIS_FRAME_GATE_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+
+/**
+* Gate rules, stored as the ID of the Frame_Gate enum property.
+*/
+enum PIXISFrameGateMode{
+	PIXISFrameGate_Off = 0,
+	PIXISFrameGate_Sum = 1,          // Sum over the gate region above Frame_Gate_Threshold
+	PIXISFrameGate_Max = 2,          // Brightest pixel of the gate region above Frame_Gate_Threshold
+	PIXISFrameGate_PixelCount = 3    // At least Frame_Gate_Min_Pixels pixels above Frame_Gate_Level
+};
+
+/**
+* Class PIXISFrameGate
+*
+* @brief:  Decides from the raw readout whether a frame is worth sending to the engine.
+*          Rejected frames are dropped before makeFrame, so readouts without signal
+*          cost one pass over the gate region and nothing else.
+*/
+class PIXISFrameGate{
+
+public:
+	PIXISFrameGate();
+
+	// addProperties adds the Frame_Gate* configuration and counter properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure reads the Frame_Gate* properties and resets the counters. Called from startCapture().
+	void configure(imaqkit::IPropContainer* propContainer);
+
+	bool isEnabled() const { return _mode != PIXISFrameGate_Off; }
+
+	// accept evaluates the gate rule on a width x height readout and updates the counters
+	bool accept(const pi16u* pixels, int width, int height);
+
+	// getStatus writes the value of a Frame_Gate counter. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	PIXISFrameGateMode _mode;
+
+	/// Gate region in readout pixels. A width or height of 0 extends to the edge of the readout.
+	int _x;
+	int _y;
+	int _width;
+	int _height;
+
+	piflt _threshold;
+	int _level;
+	int _minPixels;
+
+	volatile LONG _accepted;
+	volatile LONG _rejected;
+};
+#endif
@@ -0,0 +1,208 @@
+/**
+* @file:       PIXISFrameStats.cpp
+*
+* Purpose:     Implements per-readout statistics computed on the acquisition thread.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISFrameStats.h"
+#include "PIXISAdaptorProps.h"
+#include <emmintrin.h>
+#include <limits.h>
+
+// Number of 8 pixel SSE2 steps before the 32 bit sum lanes and 16 bit saturation lanes
+// are folded into the 64 bit totals. Each sum lane grows by at most 2 * 65535 per step.
+#define PIXIS_STATS_FLUSH_STEPS 16384
+
+PIXISFrameStats::PIXISFrameStats() :
+	_enabled(false),
+	_fullScale(65535),
+	_histogramShift(16 - 4){
+}
+
+void PIXISFrameStats::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Frame_Statistics", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Frame_Stats_Readout", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameStatsReadout);
+
+	hProp = devicePropFact->createIntProperty("Frame_Stats_Min", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameStatsMin);
+
+	hProp = devicePropFact->createIntProperty("Frame_Stats_Max", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameStatsMax);
+
+	hProp = devicePropFact->createDoubleProperty("Frame_Stats_Mean", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameStatsMean);
+
+	// The sum of a full 16 bit frame overflows an int, so it is stored as a double
+	hProp = devicePropFact->createDoubleProperty("Frame_Stats_Sum", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameStatsSum);
+
+	hProp = devicePropFact->createIntProperty("Frame_Stats_Saturated", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameStatsSaturated);
+
+	int histogram[PIXIS_STATS_HISTOGRAM_BINS] = { 0 };
+	hProp = devicePropFact->createIntArrayProperty("Frame_Stats_Histogram", 0, INT_MAX, PIXIS_STATS_HISTOGRAM_BINS, histogram);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_FrameStatsHistogram);
+}
+
+void PIXISFrameStats::configure(imaqkit::IPropContainer* propContainer, PicamHandle camera){
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Frame_Statistics"));
+	_enabled = (*enabled == 1);
+
+	//If the camera does not report a bit depth, assume the PIXIS 16 bit ADC
+	piint bitDepth = 16;
+	Picam_GetParameterIntegerValue(camera, PicamParameter_AdcBitDepth, &bitDepth);
+	if (bitDepth < 1 || bitDepth > 16){
+		bitDepth = 16;
+	}
+	_fullScale = (1 << bitDepth) - 1;
+	_histogramShift = bitDepth > 4 ? bitDepth - 4 : 0;
+}
+
+/**
+* process makes a single pass over the readout. Eight pixels are handled per SSE2 step:
+* min/max use the signed 16 bit instructions on values biased by 0x8000, the sum is
+* widened to 32 bit lanes, and saturated pixels are counted with a compare mask.
+*/
+void PIXISFrameStats::process(const pi16u* pixels, piint pixelCount, pi64s readout){
+	if (pixelCount <= 0){
+		return;
+	}
+
+	PIXISFrameStatistics stats;
+	memset(&stats, 0, sizeof(stats));
+	stats.readout = readout;
+
+	const __m128i bias = _mm_set1_epi16((short)0x8000);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i belowSaturation = _mm_set1_epi16((short)((_fullScale - 1) ^ 0x8000));
+	const __m128i histogramShift = _mm_cvtsi32_si128(_histogramShift);
+	__m128i vmin = _mm_set1_epi16(0x7FFF);
+	__m128i vmax = _mm_set1_epi16((short)0x8000);
+
+	pi64u sum = 0;
+	pi64s saturated = 0;
+	__declspec(align(16)) pi16u bins[8];
+	__declspec(align(16)) pi32u sumLanes[4];
+	__declspec(align(16)) pi16u saturatedLanes[8];
+
+	piint i = 0;
+	while (i + 8 <= pixelCount){
+		piint blockEnd = i + 8 * PIXIS_STATS_FLUSH_STEPS;
+		if (blockEnd > pixelCount){
+			blockEnd = pixelCount;
+		}
+		__m128i vsum = zero;
+		__m128i vsaturated = zero;
+
+		for (; i + 8 <= blockEnd; i += 8){
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+			__m128i biased = _mm_xor_si128(v, bias);
+			vmin = _mm_min_epi16(vmin, biased);
+			vmax = _mm_max_epi16(vmax, biased);
+			vsum = _mm_add_epi32(vsum, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+			// The compare mask is -1 for saturated lanes
+			vsaturated = _mm_sub_epi16(vsaturated, _mm_cmpgt_epi16(biased, belowSaturation));
+
+			_mm_store_si128(reinterpret_cast<__m128i*>(bins), _mm_srl_epi16(v, histogramShift));
+			for (int lane = 0; lane < 8; ++lane){
+				pi16u bin = bins[lane];
+				stats.histogram[bin < PIXIS_STATS_HISTOGRAM_BINS ? bin : PIXIS_STATS_HISTOGRAM_BINS - 1]++;
+			}
+		}
+
+		_mm_store_si128(reinterpret_cast<__m128i*>(sumLanes), vsum);
+		_mm_store_si128(reinterpret_cast<__m128i*>(saturatedLanes), vsaturated);
+		for (int lane = 0; lane < 4; ++lane){
+			sum += sumLanes[lane];
+		}
+		for (int lane = 0; lane < 8; ++lane){
+			saturated += saturatedLanes[lane];
+		}
+	}
+
+	__declspec(align(16)) pi16s minLanes[8];
+	__declspec(align(16)) pi16s maxLanes[8];
+	_mm_store_si128(reinterpret_cast<__m128i*>(minLanes), vmin);
+	_mm_store_si128(reinterpret_cast<__m128i*>(maxLanes), vmax);
+	piint minimum = 65535;
+	piint maximum = 0;
+	if (i > 0){
+		for (int lane = 0; lane < 8; ++lane){
+			piint laneMin = (pi16u)minLanes[lane] ^ 0x8000;
+			piint laneMax = (pi16u)maxLanes[lane] ^ 0x8000;
+			if (laneMin < minimum) minimum = laneMin;
+			if (laneMax > maximum) maximum = laneMax;
+		}
+	}
+
+	//Pixels left over after the last full SSE2 step
+	for (; i < pixelCount; ++i){
+		piint value = pixels[i];
+		if (value < minimum) minimum = value;
+		if (value > maximum) maximum = value;
+		sum += value;
+		if (value >= _fullScale){
+			saturated++;
+		}
+		piint bin = value >> _histogramShift;
+		stats.histogram[bin < PIXIS_STATS_HISTOGRAM_BINS ? bin : PIXIS_STATS_HISTOGRAM_BINS - 1]++;
+	}
+
+	stats.minimum = minimum;
+	stats.maximum = maximum;
+	stats.sum = (piflt)sum;
+	stats.mean = (piflt)sum / pixelCount;
+	stats.saturated = (piint)saturated;
+
+	_latest.publish(stats);
+}
+
+bool PIXISFrameStats::getStatus(int id, void* value) const{
+	if (id < PIXISStatus_FrameStatsReadout || id > PIXISStatus_FrameStatsHistogram){
+		return false;
+	}
+
+	//Reads as all zeros until the first readout has been processed
+	PIXISFrameStatistics stats;
+	_latest.read(stats);
+
+	switch (id){
+	case PIXISStatus_FrameStatsReadout:
+		*reinterpret_cast<int*>(value) = (int)stats.readout;
+		break;
+	case PIXISStatus_FrameStatsMin:
+		*reinterpret_cast<int*>(value) = stats.minimum;
+		break;
+	case PIXISStatus_FrameStatsMax:
+		*reinterpret_cast<int*>(value) = stats.maximum;
+		break;
+	case PIXISStatus_FrameStatsMean:
+		*reinterpret_cast<double*>(value) = stats.mean;
+		break;
+	case PIXISStatus_FrameStatsSum:
+		*reinterpret_cast<double*>(value) = stats.sum;
+		break;
+	case PIXISStatus_FrameStatsSaturated:
+		*reinterpret_cast<int*>(value) = stats.saturated;
+		break;
+	case PIXISStatus_FrameStatsHistogram:
+		for (int bin = 0; bin < PIXIS_STATS_HISTOGRAM_BINS; ++bin){
+			reinterpret_cast<int*>(value)[bin] = stats.histogram[bin];
+		}
+		break;
+	}
+	return true;
+}
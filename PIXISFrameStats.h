@@ -0,0 +1,72 @@
+/**
+* @file:       PIXISFrameStats.h
+*
+* Purpose:     Class declaration for PIXISFrameStats.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_FRAME_STATS_HEADER__
+#define __PIXIS_FRAME_STATS_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISLatestValue.h"
+
+// Number of bins in the coarse histogram. The bins evenly split the ADC range.
+#define PIXIS_STATS_HISTOGRAM_BINS 16
+
+/**
+* Statistics of one readout. The histogram covers 0 to the ADC full scale.
+*/
+struct PIXISFrameStatistics{
+	pi64s readout;              // Readout number since startCapture(), starting at 1
+	piint minimum;
+	piint maximum;
+	piflt mean;
+	piflt sum;
+	piint saturated;            // Number of pixels at or above the ADC full scale
+	piint histogram[PIXIS_STATS_HISTOGRAM_BINS];
+};
+
+/**
+* Class PIXISFrameStats
+*
+* @brief:  Computes statistics of each readout on the acquisition thread and exposes
+*          the latest result as read only adaptor properties, so the signal level can
+*          be monitored without sending frames to MATLAB.
+*/
+class PIXISFrameStats{
+
+public:
+	PIXISFrameStats();
+
+	// addProperties adds the Frame_Statistics switch and the Frame_Stats_* status properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure reads the Frame_Statistics switch and the ADC bit depth. Called from startCapture().
+	void configure(imaqkit::IPropContainer* propContainer, PicamHandle camera);
+
+	bool isEnabled() const { return _enabled; }
+
+	// process computes the statistics of pixelCount pixels and publishes them
+	void process(const pi16u* pixels, piint pixelCount, pi64s readout);
+
+	// getStatus writes the value of a Frame_Stats_* property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	bool _enabled;
+
+	/// ADC full scale in counts, (1 << bit depth) - 1
+	piint _fullScale;
+
+	/// Right shift mapping a pixel value onto a histogram bin
+	piint _histogramShift;
+
+	PIXISLatestValue<PIXISFrameStatistics> _latest;
+};
+#endif
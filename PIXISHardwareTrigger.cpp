@@ -0,0 +1,131 @@
+/**
+* @file:       PIXISHardwareTrigger.cpp
+*
+* Purpose:     Implements the hardware trigger configurations.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISHardwareTrigger.h"
+#include <stdio.h>
+#include <vector>
+#include <string>
+
+/**
+* getTriggerNames reads the capable values of an enumerated trigger parameter and their
+* names, with spaces replaced by '_' as in the property names. Returns false if the
+* camera does not have the parameter.
+*/
+static bool getTriggerNames(PicamHandle camera, PicamParameter parameter, PicamEnumeratedType enumType,
+	std::vector<piint>& values, std::vector<std::string>& names){
+	const PicamCollectionConstraint* capable;
+	if (Picam_GetParameterCollectionConstraint(camera, parameter, PicamConstraintCategory_Capable, &capable) != PicamError_None){
+		return false;
+	}
+	for (piint i = 0; i < capable->values_count; ++i){
+		piint value = (piint)capable->values_array[i];
+		const pichar* name;
+		if (Picam_GetEnumerationString(enumType, value, &name) != PicamError_None){
+			continue;
+		}
+		std::string text(name);
+		Picam_DestroyString(name);
+		for (size_t c = 0; c < text.size(); ++c){
+			if (text[c] == ' '){
+				text[c] = '_';
+			}
+		}
+		values.push_back(value);
+		names.push_back(text);
+	}
+	Picam_DestroyCollectionConstraints(capable);
+	return true;
+}
+
+PIXISHardwareTrigger::PIXISHardwareTrigger() :
+	_requested(false),
+	_applied(false),
+	_response(PicamTriggerResponse_NoResponse),
+	_determination(PicamTriggerDetermination_RisingEdge),
+	_originalResponse(PicamTriggerResponse_NoResponse),
+	_originalDetermination(PicamTriggerDetermination_RisingEdge){
+}
+
+void PIXISHardwareTrigger::addConfigurations(imaqkit::ITriggerInfo* hwTriggerInfo, PicamHandle camera){
+	std::vector<piint> responses, determinations;
+	std::vector<std::string> responseNames, determinationNames;
+	if (!getTriggerNames(camera, PicamParameter_TriggerResponse, PicamEnumeratedType_TriggerResponse, responses, responseNames) ||
+		!getTriggerNames(camera, PicamParameter_TriggerDetermination, PicamEnumeratedType_TriggerDetermination, determinations, determinationNames)){
+		return;
+	}
+
+	//No response is what immediate and manual triggers already use
+	for (size_t r = 0; r < responses.size(); ++r){
+		if (responses[r] == PicamTriggerResponse_NoResponse){
+			continue;
+		}
+		for (size_t d = 0; d < determinations.size(); ++d){
+			hwTriggerInfo->addConfiguration(responseNames[r].c_str(), responses[r], determinationNames[d].c_str(), determinations[d]);
+		}
+	}
+}
+
+void PIXISHardwareTrigger::request(imaqkit::IPropContainer* enginePropContainer){
+	int* source = static_cast<int*>(enginePropContainer->getPropValue("TriggerSource"));
+	int* condition = static_cast<int*>(enginePropContainer->getPropValue("TriggerCondition"));
+	_response = *source;
+	_determination = *condition;
+	_requested = true;
+}
+
+bool PIXISHardwareTrigger::takeRequest(){
+	bool requested = _requested;
+	_requested = false;
+	return requested;
+}
+
+bool PIXISHardwareTrigger::apply(PicamHandle camera){
+	//Without the camera's own values there would be nothing to put back, so nothing is changed
+	if (Picam_GetParameterIntegerValue(camera, PicamParameter_TriggerResponse, &_originalResponse) != PicamError_None ||
+		Picam_GetParameterIntegerValue(camera, PicamParameter_TriggerDetermination, &_originalDetermination) != PicamError_None){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:trigger", "The camera's trigger settings could not be read, so the hardware trigger was not applied.");
+		_requested = false;
+		return false;
+	}
+	_applied = true;
+
+	const PicamParameter* failedParameterArray = NULL;
+	piint failedParameterCount = 0;
+	if (Picam_SetParameterIntegerValue(camera, PicamParameter_TriggerResponse, _response) != PicamError_None ||
+		Picam_SetParameterIntegerValue(camera, PicamParameter_TriggerDetermination, _determination) != PicamError_None ||
+		Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount) != PicamError_None ||
+		failedParameterCount){
+		Picam_DestroyParameters(failedParameterArray);
+		char message[160];
+		sprintf_s(message, sizeof(message), "The camera rejected hardware trigger source %d with condition %d.", _response, _determination);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:trigger", message);
+		finish(camera);
+		return false;
+	}
+	Picam_DestroyParameters(failedParameterArray);
+	return true;
+}
+
+void PIXISHardwareTrigger::finish(PicamHandle camera){
+	_requested = false;
+	if (!_applied){
+		return;
+	}
+	_applied = false;
+
+	Picam_SetParameterIntegerValue(camera, PicamParameter_TriggerResponse, _originalResponse);
+	Picam_SetParameterIntegerValue(camera, PicamParameter_TriggerDetermination, _originalDetermination);
+	const PicamParameter* failedParameterArray;
+	piint failedParameterCount;
+	Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+	Picam_DestroyParameters(failedParameterArray);
+}
@@ -0,0 +1,67 @@
+/**
+* @file:       PIXISHardwareTrigger.h
+*
+* Purpose:     Class declaration for PIXISHardwareTrigger.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_HARDWARE_TRIGGER_HEADER__
+#define __PIXIS_HARDWARE_TRIGGER_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+
+/**
+* Class PIXISHardwareTrigger
+*
+* @brief:  Offers the camera's external trigger input as hardware triggers, so an
+*          acquisition starts on the trigger edge instead of a software round trip
+*          from MATLAB into startCapture().
+*
+*          Each capable TriggerResponse other than no response becomes a trigger
+*          source and each capable TriggerDetermination a trigger condition, with the
+*          PICam enumeration values as their IDs, so triggerinfo lists e.g. source
+*          "Start_On_Single_Trigger" with condition "Rising_Edge". When the engine
+*          configures a hardware trigger the pair is committed to the camera for that
+*          acquisition, and the camera's own values are put back when it ends, so
+*          immediate and manual triggers keep starting without an external signal.
+*          The acquisition runs continuously while a trigger is applied, so
+*          Start_On_Single_Trigger takes one edge for the whole acquisition.
+*/
+class PIXISHardwareTrigger{
+
+public:
+	PIXISHardwareTrigger();
+
+	// addConfigurations registers every capable source and condition pair of camera with hwTriggerInfo
+	static void addConfigurations(imaqkit::ITriggerInfo* hwTriggerInfo, PicamHandle camera);
+
+	// request takes the TriggerSource and TriggerCondition the engine is configured with. Called from useHardwareTrigger().
+	void request(imaqkit::IPropContainer* enginePropContainer);
+
+	// takeRequest returns whether a trigger was requested for this start and clears the request
+	bool takeRequest();
+
+	// apply commits the requested trigger to the camera. Returns false, after warning, if the camera rejects it.
+	bool apply(PicamHandle camera);
+
+	// finish puts back the camera's trigger values and forgets the request
+	void finish(PicamHandle camera);
+
+private:
+	bool _requested;
+	bool _applied;
+
+	/// TriggerSource and TriggerCondition IDs, which are PICam TriggerResponse and TriggerDetermination values
+	piint _response;
+	piint _determination;
+
+	/// Camera values saved by apply() and restored by finish()
+	piint _originalResponse;
+	piint _originalDetermination;
+};
+#endif
@@ -0,0 +1,256 @@
+/**
+* @file:       PIXISHdrMerge.cpp
+*
+* Purpose:     Implements the merge of bracketed exposures into float32 frames.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISHdrMerge.h"
+#include "PIXISAdaptorProps.h"
+#include <emmintrin.h>
+#include <stdio.h>
+
+// Pixels folded in per worker pool tile
+#define PIXIS_HDR_TILE_PIXELS 16384
+
+PIXISHdrMerge::PIXISHdrMerge() :
+	_enabled(false),
+	_offset(0.0f),
+	_saturation(65535.0f),
+	_shortest(0),
+	_longest(1.0f),
+	_input(NULL),
+	_pixelCount(0),
+	_step(0),
+	_received(0),
+	_saturated(0),
+	_frames(0),
+	_incomplete(0),
+	_lastSaturated(0){
+}
+
+void PIXISHdrMerge::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	// Merges each pass through Sequence_Steps into one float32 frame
+	hProp = devicePropFact->createEnumProperty("HDR_Merge", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Dark level subtracted before the readouts are scaled by their exposure
+	hProp = devicePropFact->createDoubleProperty("HDR_Offset", 0.0, 65535.0, 0.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Pixel values at or above this are saturated and left out of the merge
+	hProp = devicePropFact->createIntProperty("HDR_Saturation", 1, 65535, 65535);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("HDR_Frames", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_HdrFrames);
+
+	// Brackets abandoned because a readout of them did not reach the merge
+	hProp = devicePropFact->createIntProperty("HDR_Incomplete", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_HdrIncomplete);
+
+	// Pixels of the latest merged frame saturated in every readout
+	hProp = devicePropFact->createIntProperty("HDR_Saturated_Pixels", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_HdrSaturatedPixels);
+}
+
+bool PIXISHdrMerge::isEnabled(imaqkit::IPropContainer* propContainer){
+	int* enabled = static_cast<int*>(propContainer->getPropValue("HDR_Merge"));
+	return *enabled == 1;
+}
+
+bool PIXISHdrMerge::configure(imaqkit::IPropContainer* propContainer, const PIXISExposureSequence& sequence, int readoutWidth, int readoutHeight){
+	double* offset = static_cast<double*>(propContainer->getPropValue("HDR_Offset"));
+	int* saturation = static_cast<int*>(propContainer->getPropValue("HDR_Saturation"));
+	_enabled = isEnabled(propContainer);
+	_offset = (float)*offset;
+	_saturation = (float)*saturation;
+	_frames = 0;
+	_incomplete = 0;
+	_lastSaturated = 0;
+	if (!_enabled){
+		return true;
+	}
+
+	if (sequence.getStepCount() < 2){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:hdr", "HDR_Merge needs Sequence_Steps with at least two exposures to bracket.");
+		return false;
+	}
+	_exposures.resize(sequence.getStepCount());
+	_shortest = 0;
+	_longest = 0.0f;
+	for (int step = 0; step < sequence.getStepCount(); ++step){
+		_exposures[step] = (float)sequence.getExposure(step);
+		if (_exposures[step] < _exposures[_shortest]){
+			_shortest = step;
+		}
+		if (_exposures[step] > _longest){
+			_longest = _exposures[step];
+		}
+	}
+	if (_exposures[_shortest] <= 0.0f){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:hdr", "HDR_Merge cannot scale a bracket with an exposure of 0.");
+		return false;
+	}
+
+	_pixelCount = readoutWidth * readoutHeight;
+	_counts.resize(_pixelCount);
+	_times.resize(_pixelCount);
+	_fallback.resize(_pixelCount);
+	_merged.resize(_pixelCount);
+	_received = 0;
+	return true;
+}
+
+const float* PIXISHdrMerge::process(const pi16u* pixels, int width, int height, int step, PIXISWorkerPool* workers){
+	if (width * height != _pixelCount){
+		return NULL;
+	}
+
+	//A readout that belongs to no step cannot be placed in a bracket
+	if (step < 0){
+		InterlockedIncrement(&_incomplete);
+		_received = -1;
+		return NULL;
+	}
+
+	//A readout missing from a bracket, e.g. dropped by an earlier stage, abandons it until the next one starts
+	if (step == 0){
+		if (_received > 0){
+			InterlockedIncrement(&_incomplete);
+		}
+		_received = 0;
+	}
+	if (step != _received){
+		if (_received > 0){
+			InterlockedIncrement(&_incomplete);
+		}
+		_received = -1;
+		return NULL;
+	}
+
+	_input = pixels;
+	_step = step;
+	_saturated = 0;
+	int tileCount = (_pixelCount + PIXIS_HDR_TILE_PIXELS - 1) / PIXIS_HDR_TILE_PIXELS;
+	workers->run(mergeTile, this, tileCount);
+	_received++;
+
+	if (_received < (int)_exposures.size()){
+		return NULL;
+	}
+	_received = 0;
+	_lastSaturated = _saturated;
+	InterlockedIncrement(&_frames);
+	return &_merged[0];
+}
+
+/**
+* mergeTile converts eight pixels at a time to float. The saturation compare gives a
+* mask that zeroes what a saturated pixel would add, so every pixel takes the same
+* path. The first readout of a bracket sets the sums and the last divides them.
+*/
+void PIXISHdrMerge::mergeTile(void* context, int tile){
+	PIXISHdrMerge* merge = reinterpret_cast<PIXISHdrMerge*>(context);
+	int begin = tile * PIXIS_HDR_TILE_PIXELS;
+	int end = begin + PIXIS_HDR_TILE_PIXELS < merge->_pixelCount ? begin + PIXIS_HDR_TILE_PIXELS : merge->_pixelCount;
+
+	const pi16u* in = merge->_input;
+	float* counts = &merge->_counts[0];
+	float* times = &merge->_times[0];
+	float* fallback = &merge->_fallback[0];
+	float* merged = &merge->_merged[0];
+	bool first = merge->_step == 0;
+	bool shortest = merge->_step == merge->_shortest;
+	bool last = merge->_step == (int)merge->_exposures.size() - 1;
+	float exposure = merge->_exposures[merge->_step];
+	float scale = merge->_longest / exposure;
+	LONG saturated = 0;
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 voffset = _mm_set1_ps(merge->_offset);
+	const __m128 vsaturation = _mm_set1_ps(merge->_saturation);
+	const __m128 vexposure = _mm_set1_ps(exposure);
+	const __m128 vscale = _mm_set1_ps(scale);
+	const __m128 vlongest = _mm_set1_ps(merge->_longest);
+	const __m128 vzero = _mm_setzero_ps();
+
+	int i = begin;
+	for (; i + 8 <= end; i += 8){
+		__m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		for (int half = 0; half < 2; ++half){
+			int j = i + 4 * half;
+			__m128 value = _mm_cvtepi32_ps(half ? _mm_unpackhi_epi16(raw, zero) : _mm_unpacklo_epi16(raw, zero));
+			__m128 valid = _mm_cmplt_ps(value, vsaturation);
+			__m128 signal = _mm_sub_ps(value, voffset);
+			__m128 count = _mm_and_ps(valid, signal);
+			__m128 time = _mm_and_ps(valid, vexposure);
+			if (!first){
+				count = _mm_add_ps(count, _mm_loadu_ps(counts + j));
+				time = _mm_add_ps(time, _mm_loadu_ps(times + j));
+			}
+			if (shortest){
+				_mm_storeu_ps(fallback + j, _mm_mul_ps(signal, vscale));
+			}
+			if (last){
+				//Lanes with no time divide by 0, but are replaced by the fallback
+				__m128 lit = _mm_cmpgt_ps(time, vzero);
+				__m128 ratio = _mm_div_ps(_mm_mul_ps(count, vlongest), time);
+				_mm_storeu_ps(merged + j, _mm_or_ps(_mm_and_ps(lit, ratio), _mm_andnot_ps(lit, _mm_loadu_ps(fallback + j))));
+				int none = _mm_movemask_ps(lit) ^ 0xF;
+				saturated += (none & 1) + ((none >> 1) & 1) + ((none >> 2) & 1) + ((none >> 3) & 1);
+			}
+			else{
+				_mm_storeu_ps(counts + j, count);
+				_mm_storeu_ps(times + j, time);
+			}
+		}
+	}
+	for (; i < end; ++i){
+		float value = in[i];
+		bool valid = value < merge->_saturation;
+		float signal = value - merge->_offset;
+		float count = (valid ? signal : 0.0f) + (first ? 0.0f : counts[i]);
+		float time = (valid ? exposure : 0.0f) + (first ? 0.0f : times[i]);
+		if (shortest){
+			fallback[i] = signal * scale;
+		}
+		if (last){
+			merged[i] = time > 0.0f ? count * merge->_longest / time : fallback[i];
+			saturated += time > 0.0f ? 0 : 1;
+		}
+		else{
+			counts[i] = count;
+			times[i] = time;
+		}
+	}
+	if (saturated){
+		InterlockedExchangeAdd(&merge->_saturated, saturated);
+	}
+}
+
+bool PIXISHdrMerge::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_HdrFrames:
+		*reinterpret_cast<int*>(value) = _frames;
+		return true;
+	case PIXISStatus_HdrIncomplete:
+		*reinterpret_cast<int*>(value) = _incomplete;
+		return true;
+	case PIXISStatus_HdrSaturatedPixels:
+		*reinterpret_cast<int*>(value) = _lastSaturated;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,111 @@
+/**
+* @file:       PIXISHdrMerge.h
+*
+* Purpose:     Class declaration for PIXISHdrMerge.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_HDR_MERGE_HEADER__
+#define __PIXIS_HDR_MERGE_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include "PIXISExposureSequence.h"
+#include "PIXISWorkerPool.h"
+#include <vector>
+
+/**
+* Class PIXISHdrMerge
+*
+* @brief:  Merges the readouts of each pass through Sequence_Steps, bracketed
+*          exposures, into one float32 frame with more dynamic range than a single
+*          16 bit readout.
+*
+*          The exposure sequence already switches the exposure between readouts
+*          without stopping the acquisition, so each pass of N steps is a bracket
+*          of N readouts. Every readout is folded into running per-pixel sums as
+*          it arrives, eight pixels per SSE2 step on the worker pool: a pixel below
+*          HDR_Saturation adds its counts above HDR_Offset and its exposure time,
+*          a saturated one adds nothing. The merged pixel is their ratio, in counts
+*          of the longest exposure, which weights each readout by its exposure as
+*          its shot noise calls for. A pixel saturated in every readout takes the
+*          shortest exposure's value, scaled the same way.
+*
+*          Only the merged frame goes on to the engine, one per bracket. The
+*          stages after the merge see the last readout of the bracket, so a start
+*          with the flat field, cosmic ray filter, apertures, peak finding or
+*          preview on, which would work on that raw readout, fails.
+*
+*          A replayed file is merged the same way, with the steps counted off its
+*          readouts in order, so it has to be recorded with the same Sequence_Steps
+*          starting at the first step.
+*/
+class PIXISHdrMerge{
+
+public:
+	PIXISHdrMerge();
+
+	// addProperties adds the HDR_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* configure reads the HDR_* properties and takes the brackets from sequence, for
+	* readoutWidth x readoutHeight readouts. Called from startCapture() after the
+	* sequence is configured.
+	*
+	* @return: false, after warning, if HDR_Merge is on without at least two sequence steps.
+	*/
+	bool configure(imaqkit::IPropContainer* propContainer, const PIXISExposureSequence& sequence, int readoutWidth, int readoutHeight);
+
+	bool isEnabled() const { return _enabled; }
+
+	// isEnabled returns true if the HDR_* properties ask for merged frames, for getFrameType() before configure()
+	static bool isEnabled(imaqkit::IPropContainer* propContainer);
+
+	/**
+	* process folds a width x height readout taken at sequence step into the bracket.
+	*
+	* @return: The merged frame, valid until the next call, once the bracket is complete. NULL before then.
+	*/
+	const float* process(const pi16u* pixels, int width, int height, int step, PIXISWorkerPool* workers);
+
+	// getStatus writes the value of an HDR_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// mergeTile is the PIXISWorkerPool::TileFunction folding one run of pixels into the sums
+	static void mergeTile(void* context, int tile);
+
+	bool _enabled;
+	float _offset;
+	float _saturation;
+
+	/// Brackets, indexed by sequence step
+	std::vector<float> _exposures;
+	int _shortest;
+	float _longest;
+
+	/// Per pixel sums of the bracket in progress, and the result
+	std::vector<float> _counts;
+	std::vector<float> _times;
+	std::vector<float> _fallback;
+	std::vector<float> _merged;
+
+	/// Readout being folded in
+	const pi16u* _input;
+	int _pixelCount;
+	int _step;
+	int _received;          // Readouts of the bracket in progress so far
+	volatile LONG _saturated;
+
+	/// Status values
+	volatile LONG _frames;
+	volatile LONG _incomplete;
+	volatile LONG _lastSaturated;
+};
+#endif
@@ -0,0 +1,249 @@
+/**
+* @file:       PIXISKineticsSetup.cpp
+*
+* Purpose:     Implements the constraint-driven kinetics configuration.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISKineticsSetup.h"
+#include "PIXISAdaptorProps.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+PIXISKineticsSetup::PIXISKineticsSetup(){
+	memset(&_timing, 0, sizeof(_timing));
+}
+
+void PIXISKineticsSetup::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	// 0 picks the height that fits Kinetics_Frames_Per_Readout sub-frames on the sensor
+	hProp = devicePropFact->createIntProperty("Kinetics_Window_Height", 0, INT_MAX, 128);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->setIdentifier(hProp, PIXISCommand_KineticsWindowHeight);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Kinetics_Frames_Per_Readout", 0, INT_MAX, 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->setIdentifier(hProp, PIXISCommand_KineticsFramesPerReadout);
+	devicePropFact->addProperty(hProp);
+
+	// us per row. 0 picks the fastest capable rate.
+	hProp = devicePropFact->createDoubleProperty("Kinetics_Shift_Rate", 0.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->setIdentifier(hProp, PIXISCommand_KineticsShiftRate);
+	devicePropFact->addProperty(hProp);
+
+	// ms
+	hProp = devicePropFact->createDoubleProperty("Kinetics_Exposure_Time", 10.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->setIdentifier(hProp, PIXISCommand_KineticsExposureTime);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createEnumProperty("Kinetics_Trigger_Response", "start_on_single_trigger", PicamTriggerResponse_StartOnSingleTrigger);
+	devicePropFact->addEnumValue(hProp, "no_response", PicamTriggerResponse_NoResponse);
+	devicePropFact->addEnumValue(hProp, "readout_per_trigger", PicamTriggerResponse_ReadoutPerTrigger);
+	devicePropFact->addEnumValue(hProp, "shift_per_trigger", PicamTriggerResponse_ShiftPerTrigger);
+	devicePropFact->addEnumValue(hProp, "expose_during_trigger_pulse", PicamTriggerResponse_ExposeDuringTriggerPulse);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->setIdentifier(hProp, PIXISCommand_KineticsTriggerResponse);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Kinetics_Window_Height_Applied", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_KineticsWindowHeight);
+
+	hProp = devicePropFact->createIntProperty("Kinetics_Frames_Per_Readout_Applied", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_KineticsFramesPerReadout);
+
+	hProp = devicePropFact->createDoubleProperty("Kinetics_Subframe_Interval", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_KineticsSubframeInterval);
+
+	hProp = devicePropFact->createDoubleProperty("Kinetics_Readout_Time", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_KineticsReadoutTime);
+}
+
+piflt PIXISKineticsSetup::closestInRange(PicamHandle camera, PicamParameter parameter, piflt value, const char* propertyName){
+	const PicamRangeConstraint* capable;
+	if (Picam_GetParameterRangeConstraint(camera, parameter, PicamConstraintCategory_Capable, &capable) != PicamError_None){
+		return value;
+	}
+
+	piflt closest = value;
+	if (closest < capable->minimum){
+		closest = capable->minimum;
+	}
+	if (closest > capable->maximum){
+		closest = capable->maximum;
+	}
+	if (capable->increment > 0.0){
+		closest = capable->minimum + floor((closest - capable->minimum) / capable->increment + 0.5) * capable->increment;
+	}
+	Picam_DestroyRangeConstraints(capable);
+
+	if (propertyName && fabs(closest - value) > 1e-9 * fabs(value)){
+		char message[160];
+		sprintf_s(message, sizeof(message), "%s is outside the camera's range. Using %g instead.", propertyName, closest);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:kinetics", message);
+	}
+	return closest;
+}
+
+bool PIXISKineticsSetup::apply(PicamHandle camera, imaqkit::IPropContainer* propContainer){
+	int* windowHeight = static_cast<int*>(propContainer->getPropValue("Kinetics_Window_Height"));
+	int* framesPerReadout = static_cast<int*>(propContainer->getPropValue("Kinetics_Frames_Per_Readout"));
+	double* shiftRate = static_cast<double*>(propContainer->getPropValue("Kinetics_Shift_Rate"));
+	double* exposureTime = static_cast<double*>(propContainer->getPropValue("Kinetics_Exposure_Time"));
+	int* triggerResponse = static_cast<int*>(propContainer->getPropValue("Kinetics_Trigger_Response"));
+
+	//Trigger response, if the camera supports the one asked for
+	const PicamCollectionConstraint* responses;
+	if (Picam_GetParameterCollectionConstraint(camera, PicamParameter_TriggerResponse, PicamConstraintCategory_Capable, &responses) == PicamError_None){
+		bool capable = false;
+		char names[256] = "";
+		for (piint i = 0; i < responses->values_count; ++i){
+			if ((int)responses->values_array[i] == *triggerResponse){
+				capable = true;
+			}
+			const pichar* name;
+			Picam_GetEnumerationString(PicamEnumeratedType_TriggerResponse, (piint)responses->values_array[i], &name);
+			strncat_s(names, sizeof(names), i ? ", " : "", _TRUNCATE);
+			strncat_s(names, sizeof(names), name, _TRUNCATE);
+			Picam_DestroyString(name);
+		}
+		Picam_DestroyCollectionConstraints(responses);
+
+		if (capable){
+			Picam_SetParameterIntegerValue(camera, PicamParameter_TriggerResponse, *triggerResponse);
+		}
+		else{
+			char message[320];
+			sprintf_s(message, sizeof(message), "Kinetics_Trigger_Response is not supported by this camera, which supports: %s.", names);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:kinetics", message);
+		}
+	}
+
+	//Vertical shift rate, the fastest being the smallest time per row
+	pibln hasShiftRate = false;
+	Picam_DoesParameterExist(camera, PicamParameter_VerticalShiftRate, &hasShiftRate);
+	const PicamCollectionConstraint* rates;
+	if (hasShiftRate &&
+		Picam_GetParameterCollectionConstraint(camera, PicamParameter_VerticalShiftRate, PicamConstraintCategory_Capable, &rates) == PicamError_None){
+		if (rates->values_count > 0){
+			piflt chosen = rates->values_array[0];
+			for (piint i = 1; i < rates->values_count; ++i){
+				piflt rate = rates->values_array[i];
+				if (*shiftRate == 0.0 ? rate < chosen : fabs(rate - *shiftRate) < fabs(chosen - *shiftRate)){
+					chosen = rate;
+				}
+			}
+			if (*shiftRate != 0.0 && chosen != *shiftRate){
+				char message[160];
+				sprintf_s(message, sizeof(message), "Kinetics_Shift_Rate is not a rate of this camera. Using %g us instead.", chosen);
+				imaqkit::adaptorWarn("PIXISCameraAdaptor:kinetics", message);
+			}
+			Picam_SetParameterFloatingPointValue(camera, PicamParameter_VerticalShiftRate, chosen);
+		}
+		Picam_DestroyCollectionConstraints(rates);
+	}
+
+	//Window height, derived from the number of sub-frames if not given
+	piflt window = *windowHeight;
+	if (window == 0.0){
+		piint sensorHeight = 0;
+		Picam_GetParameterIntegerValue(camera, PicamParameter_SensorActiveHeight, &sensorHeight);
+		window = *framesPerReadout > 0 ? sensorHeight / *framesPerReadout : sensorHeight;
+	}
+	window = closestInRange(camera, PicamParameter_KineticsWindowHeight, window, *windowHeight ? "Kinetics_Window_Height" : NULL);
+	Picam_SetParameterIntegerValue(camera, PicamParameter_KineticsWindowHeight, (piint)window);
+
+	piflt exposure = closestInRange(camera, PicamParameter_ExposureTime, *exposureTime, "Kinetics_Exposure_Time");
+	Picam_SetParameterFloatingPointValue(camera, PicamParameter_ExposureTime, exposure);
+
+	//The required ROI constraint now describes a single kinetics window
+	const PicamRoisConstraint* roiConstraint;
+	if (Picam_GetParameterRoisConstraint(camera, PicamParameter_Rois, PicamConstraintCategory_Required, &roiConstraint) == PicamError_None){
+		PicamRoi roi;
+		roi.x = (piint)roiConstraint->x_constraint.minimum;
+		roi.width = (piint)roiConstraint->width_constraint.maximum;
+		roi.y = (piint)roiConstraint->y_constraint.minimum;
+		roi.height = (piint)roiConstraint->height_constraint.maximum;
+		if (roi.height > (piint)window){
+			roi.height = (piint)window;
+		}
+		roi.x_binning = 1;
+		roi.y_binning = 1;
+		Picam_DestroyRoisConstraints(roiConstraint);
+
+		PicamRois rois;
+		rois.roi_count = 1;
+		rois.roi_array = &roi;
+		Picam_SetParameterRoisValue(camera, PicamParameter_Rois, &rois);
+	}
+
+	const PicamParameter* failedParameterArray;
+	piint failedParameterCount;
+	Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+	for (piint i = 0; i < failedParameterCount; ++i){
+		const pichar* name;
+		Picam_GetEnumerationString(PicamEnumeratedType_Parameter, failedParameterArray[i], &name);
+		char message[160];
+		sprintf_s(message, sizeof(message), "The kinetics setup could not commit %s.", name);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:kinetics", message);
+		Picam_DestroyString(name);
+	}
+	Picam_DestroyParameters(failedParameterArray);
+
+	//Report what the camera ended up with
+	Picam_GetParameterIntegerValue(camera, PicamParameter_KineticsWindowHeight, &_timing.windowHeight);
+	Picam_GetParameterIntegerValue(camera, PicamParameter_FramesPerReadout, &_timing.framesPerReadout);
+	Picam_GetParameterFloatingPointValue(camera, PicamParameter_ExposureTime, &_timing.exposureTime);
+	Picam_GetParameterFloatingPointValue(camera, PicamParameter_ReadoutTimeCalculation, &_timing.readoutTime);
+	_timing.shiftRate = 0.0;
+	if (hasShiftRate){
+		Picam_GetParameterFloatingPointValue(camera, PicamParameter_VerticalShiftRate, &_timing.shiftRate);
+	}
+	_timing.subframeInterval = _timing.exposureTime + _timing.windowHeight * _timing.shiftRate / 1000.0;
+
+	if (*framesPerReadout > 0 && _timing.framesPerReadout != *framesPerReadout){
+		char message[160];
+		sprintf_s(message, sizeof(message), "The kinetics window gives %d frames per readout instead of Kinetics_Frames_Per_Readout.", _timing.framesPerReadout);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:kinetics", message);
+	}
+	return failedParameterCount == 0;
+}
+
+bool PIXISKineticsSetup::applyCommand(int id, PicamHandle camera, imaqkit::IPropContainer* propContainer, bool kineticsMode){
+	if (id < PIXISCommand_KineticsWindowHeight || id > PIXISCommand_KineticsTriggerResponse){
+		return false;
+	}
+	//Outside kinetics mode the values are kept for when it is selected
+	if (kineticsMode){
+		apply(camera, propContainer);
+	}
+	return true;
+}
+
+bool PIXISKineticsSetup::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_KineticsWindowHeight:
+		*reinterpret_cast<int*>(value) = _timing.windowHeight;
+		return true;
+	case PIXISStatus_KineticsFramesPerReadout:
+		*reinterpret_cast<int*>(value) = _timing.framesPerReadout;
+		return true;
+	case PIXISStatus_KineticsSubframeInterval:
+		*reinterpret_cast<double*>(value) = _timing.subframeInterval;
+		return true;
+	case PIXISStatus_KineticsReadoutTime:
+		*reinterpret_cast<double*>(value) = _timing.readoutTime;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,71 @@
+/**
+* @file:       PIXISKineticsSetup.h
+*
+* Purpose:     Class declaration for PIXISKineticsSetup.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_KINETICS_SETUP_HEADER__
+#define __PIXIS_KINETICS_SETUP_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+
+/**
+* Kinetics timing that took effect, as reported by the Kinetics_*_Applied and
+* Kinetics_Subframe_Interval status properties.
+*/
+struct PIXISKineticsTiming{
+	piint windowHeight;         // Rows per sub-frame
+	piint framesPerReadout;     // Sub-frames per readout
+	piflt shiftRate;            // us per row shifted
+	piflt exposureTime;         // ms
+	piflt subframeInterval;     // ms from one sub-frame to the next: exposure plus the window shift
+	piflt readoutTime;          // ms, PicamParameter_ReadoutTimeCalculation
+};
+
+/**
+* Class PIXISKineticsSetup
+*
+* @brief:  Configures kinetics readout from the Kinetics_* properties when
+*          Readout_Control_Mode is set to Kinetics, and again whenever one of them is
+*          set while the camera is in kinetics mode.
+*
+*          Each value is checked against the camera's capable constraint and the
+*          nearest valid value is used, with a warning, if it is out of range. A value
+*          of 0 asks for the fastest choice: the fastest vertical shift rate, or the
+*          window height that fits Kinetics_Frames_Per_Readout sub-frames on the
+*          sensor. The ROI is then derived from the required constraint, which PICam
+*          narrows to the kinetics window once the window height is set.
+*/
+class PIXISKineticsSetup{
+
+public:
+	PIXISKineticsSetup();
+
+	// addProperties adds the Kinetics_* command and status properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// apply sets and commits the kinetics parameters. The camera must already be in kinetics mode.
+	bool apply(PicamHandle camera, imaqkit::IPropContainer* propContainer);
+
+	/**
+	* applyCommand re-applies the setup after a Kinetics_* property was set, if the
+	* camera is in kinetics mode. Returns false if id is not a Kinetics_* command.
+	*/
+	bool applyCommand(int id, PicamHandle camera, imaqkit::IPropContainer* propContainer, bool kineticsMode);
+
+	// getStatus writes the value of a Kinetics_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// closestInRange returns value moved onto the capable range of parameter, warning if it had to move and propertyName is given
+	static piflt closestInRange(PicamHandle camera, PicamParameter parameter, piflt value, const char* propertyName);
+
+	PIXISKineticsTiming _timing;
+};
+#endif
@@ -0,0 +1,64 @@
+/**
+* @file:       PIXISLatestValue.h
+*
+* Purpose:     Lock-free single writer slot holding the most recent value of a
+*              small struct.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_LATEST_VALUE_HEADER__
+#define __PIXIS_LATEST_VALUE_HEADER__
+
+#include <Windows.h>
+#include <string.h>
+
+/**
+* Class PIXISLatestValue
+*
+* @brief:  Sequence-locked slot. The acquisition thread publishes without ever
+*          waiting and property getters on the MATLAB thread retry until they
+*          copy a value that was not overwritten mid-read.
+*
+* T must be a plain struct (copied with assignment, no pointers into itself).
+*/
+template <typename T>
+class PIXISLatestValue{
+
+public:
+	PIXISLatestValue() : _sequence(0) {
+		memset(&_value, 0, sizeof(T));
+	}
+
+	// publish stores value. Only one thread may publish at a time.
+	void publish(const T& value){
+		InterlockedIncrement(&_sequence);   // Odd: write in progress
+		_value = value;
+		InterlockedIncrement(&_sequence);   // Even: value is stable
+	}
+
+	// read copies the latest value into value. Returns false if nothing has been published yet.
+	bool read(T& value) const{
+		for (;;){
+			LONG before = _sequence;
+			if (before & 1){
+				YieldProcessor();
+				continue;
+			}
+			MemoryBarrier();
+			value = _value;
+			MemoryBarrier();
+			if (_sequence == before){
+				return before != 0;
+			}
+		}
+	}
+
+private:
+	volatile LONG _sequence;
+	T _value;
+};
+#endif
@@ -0,0 +1,69 @@
+/**
+* @file:       PIXISMapFile.h
+*
+* Purpose:     Identity of a loaded map file, so that a map is only read again
+*              once its file changes.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_MAP_FILE_HEADER__
+#define __PIXIS_MAP_FILE_HEADER__
+
+#include <Windows.h>
+#include <string>
+
+/**
+* Class PIXISMapFile
+*
+* @brief:  Remembers the path, size and last write time of the map file a cached
+*          map was read from. A file rewritten under the same name, e.g. a new flat
+*          field saved over the old one, no longer matches and is read again.
+*/
+class PIXISMapFile{
+
+public:
+	PIXISMapFile() : _size(0), _writeTime(0) {}
+
+	// isLoaded returns true if path is the file recorded by loaded(), unchanged since
+	bool isLoaded(const char* path) const{
+		LONG64 size, writeTime;
+		return !_path.empty() && _path == path && examine(path, &size, &writeTime) && size == _size && writeTime == _writeTime;
+	}
+
+	// loading records path as the file about to be read. Returns false if it cannot be examined.
+	bool loading(const char* path){
+		clear();
+		if (!examine(path, &_size, &_writeTime)){
+			return false;
+		}
+		_path = path;
+		return true;
+	}
+
+	// clear forgets the file, for a read that failed
+	void clear(){
+		_path.clear();
+		_size = 0;
+		_writeTime = 0;
+	}
+
+private:
+	static bool examine(const char* path, LONG64* size, LONG64* writeTime){
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes)){
+			return false;
+		}
+		*size = ((LONG64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+		*writeTime = ((LONG64)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+		return true;
+	}
+
+	std::string _path;
+	LONG64 _size;
+	LONG64 _writeTime;
+};
+#endif
@@ -0,0 +1,87 @@
+/**
+* @file:       PIXISOnlineUpdates.cpp
+*
+* Purpose:     Implements the record of parameters changed during acquisition.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISOnlineUpdates.h"
+#include "PIXISAdaptorProps.h"
+#include <string.h>
+
+void PIXISOnlineUpdates::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createIntProperty("Online_Update_Count", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_OnlineUpdateCount);
+
+	hProp = devicePropFact->createIntProperty("Online_Update_Readout", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_OnlineUpdateReadout);
+
+	hProp = devicePropFact->createIntProperty("Online_Update_Frame", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_OnlineUpdateFrame);
+}
+
+PIXISOnlineUpdates::PIXISOnlineUpdates() :
+	_count(0),
+	_pendingReadout(0){
+	memset(&_pending, 0, sizeof(_pending));
+	InitializeCriticalSection(&_guard);
+}
+
+PIXISOnlineUpdates::~PIXISOnlineUpdates(){
+	DeleteCriticalSection(&_guard);
+}
+
+void PIXISOnlineUpdates::record(pi64s inFlight){
+	EnterCriticalSection(&_guard);
+	_pending.count = ++_count;
+	_pending.readout = inFlight + 1;
+	_pending.frame = 0;
+	_latest.publish(_pending);
+	InterlockedExchange64(&_pendingReadout, _pending.readout);
+	LeaveCriticalSection(&_guard);
+}
+
+void PIXISOnlineUpdates::reached(pi64s readout, pi64s frame){
+	//Most readouts arrive with no change waiting, so the guard is only taken when one is due
+	LONG64 pending = _pendingReadout;
+	if (pending == 0 || readout < pending){
+		return;
+	}
+	EnterCriticalSection(&_guard);
+	if (_pendingReadout != 0 && readout >= _pendingReadout){
+		_pending.frame = (piint)frame;
+		_latest.publish(_pending);
+		InterlockedExchange64(&_pendingReadout, 0);
+	}
+	LeaveCriticalSection(&_guard);
+}
+
+void PIXISOnlineUpdates::restart(){
+	InterlockedExchange64(&_pendingReadout, 0);
+}
+
+bool PIXISOnlineUpdates::getStatus(int id, void* value) const{
+	PIXISOnlineUpdate update;
+	switch (id){
+	case PIXISStatus_OnlineUpdateCount:
+		_latest.read(update);
+		*reinterpret_cast<int*>(value) = update.count;
+		return true;
+	case PIXISStatus_OnlineUpdateReadout:
+		_latest.read(update);
+		*reinterpret_cast<int*>(value) = (int)update.readout;
+		return true;
+	case PIXISStatus_OnlineUpdateFrame:
+		_latest.read(update);
+		*reinterpret_cast<int*>(value) = update.frame;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,72 @@
+/**
+* @file:       PIXISOnlineUpdates.h
+*
+* Purpose:     Class declaration for PIXISOnlineUpdates.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_ONLINE_UPDATES_HEADER__
+#define __PIXIS_ONLINE_UPDATES_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISLatestValue.h"
+
+/**
+* Where the most recent online parameter change took effect.
+*/
+struct PIXISOnlineUpdate{
+	piint count;            // Online changes since the device was created
+	pi64s readout;          // First readout guaranteed to use the new value
+	piint frame;            // Engine frame number of the first readout from there that reaches the engine, 0 until it does
+};
+
+/**
+* Class PIXISOnlineUpdates
+*
+* @brief:  Records parameter changes that PIXISPropSetListener applied with the
+*          Picam_Set*ValueOnline functions, without stopping the acquisition, so
+*          the first frame acquired with the new value can be identified.
+*/
+class PIXISOnlineUpdates{
+
+public:
+	PIXISOnlineUpdates();
+	~PIXISOnlineUpdates();
+
+	// addProperties adds the Online_Update_* status properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* record notes an online change made while readout inFlight was being acquired.
+	* That readout may or may not see the new value, so the change is reported as
+	* taking effect with the one after it.
+	*/
+	void record(pi64s inFlight);
+
+	/**
+	* reached is called with each readout as it is handed to the engine, and frame
+	* the engine frame number it will have. The first one at or after the readout
+	* of the latest change fills in its Online_Update_Frame. Readouts still in the
+	* pipeline or the delivery queue are counted, as they are numbered here.
+	*/
+	void reached(pi64s readout, pi64s frame);
+
+	// restart forgets a change still waiting for its frame, as readouts are numbered from 1 again
+	void restart();
+
+	// getStatus writes the value of an Online_Update_* property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	piint _count;
+	PIXISLatestValue<PIXISOnlineUpdate> _latest;
+	PIXISOnlineUpdate _pending;             // Latest change, guarded by _guard
+	volatile LONG64 _pendingReadout;        // Its readout until the frame is known, 0 otherwise. Also read unguarded.
+	CRITICAL_SECTION _guard;                // Serialises publishing from the MATLAB and send stage threads
+};
+#endif
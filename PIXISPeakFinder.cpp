@@ -0,0 +1,374 @@
+/**
+* @file:       PIXISPeakFinder.cpp
+*
+* Purpose:     Implements per-row peak finding for spectra.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISPeakFinder.h"
+#include "PIXISAdaptorProps.h"
+#include <emmintrin.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+// Full width at half maximum of a Gaussian of unit sigma, 2 * sqrt(2 * ln 2)
+#define PIXIS_PEAK_FWHM_PER_SIGMA 2.3548200450309493
+
+// Orders candidate pixels by their height above the background, highest first
+struct PIXISPeakHigher{
+	const piflt* residual;
+	bool operator()(int a, int b) const { return residual[a] > residual[b]; }
+};
+
+// Orders peaks along their row
+static bool peakBefore(const PIXISPeak& a, const PIXISPeak& b){
+	return a.position < b.position;
+}
+
+/**
+* runningExtreme replaces values[i] by the minimum (or maximum) of values[i, i + window)
+* for i in [0, length - window]. The window is built by doubling: after pass k each
+* value covers 2^k pixels, and two overlapping power of two spans make up the window.
+* Each pass reads ahead of what it writes, so it runs in place, eight signed 16 bit
+* values per SSE2 step.
+*/
+static void runningExtreme(short* values, int length, int window, bool maximum){
+	int span = 1;
+	while (span * 2 <= window){
+		int count = length - span;
+		int i = 0;
+		for (; i + 8 <= count; i += 8){
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i + span));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), maximum ? _mm_max_epi16(a, b) : _mm_min_epi16(a, b));
+		}
+		for (; i < count; ++i){
+			short b = values[i + span];
+			values[i] = maximum ? (b > values[i] ? b : values[i]) : (b < values[i] ? b : values[i]);
+		}
+		length = count;
+		span *= 2;
+	}
+
+	int offset = window - span;
+	if (offset == 0){
+		return;
+	}
+	int count = length - offset;
+	int i = 0;
+	for (; i + 8 <= count; i += 8){
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i + offset));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), maximum ? _mm_max_epi16(a, b) : _mm_min_epi16(a, b));
+	}
+	for (; i < count; ++i){
+		short b = values[i + offset];
+		values[i] = maximum ? (b > values[i] ? b : values[i]) : (b < values[i] ? b : values[i]);
+	}
+}
+
+//padEdges repeats the first and last of the width values starting at values + half over half values on each side
+static void padEdges(short* values, int width, int half){
+	for (int i = 0; i < half; ++i){
+		values[i] = values[half];
+		values[half + width + i] = values[half + width - 1];
+	}
+}
+
+PIXISPeakFinder::PIXISPeakFinder() :
+	_enabled(false),
+	_sendImages(true),
+	_gaussian(true),
+	_threshold(0.0),
+	_backgroundWidth(0),
+	_separation(1),
+	_maxCount(1),
+	_log(NULL){
+}
+
+PIXISPeakFinder::~PIXISPeakFinder(){
+	finish();
+}
+
+void PIXISPeakFinder::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Peak_Finding", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createEnumProperty("Peak_Refinement", "gaussian", 1);
+	devicePropFact->addEnumValue(hProp, "centroid", 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Counts above the background a peak must reach
+	hProp = devicePropFact->createDoubleProperty("Peak_Threshold", 0.0, 65535.0, 100.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Pixels the background is estimated over, wider than any line. 0 leaves the background at 0.
+	hProp = devicePropFact->createIntProperty("Peak_Background_Width", 0, 65535, 31);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// A peak is the highest pixel within this many pixels on either side
+	hProp = devicePropFact->createIntProperty("Peak_Min_Separation", 1, 65535, 3);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Highest peaks kept per row
+	hProp = devicePropFact->createIntProperty("Peak_Max_Count", 1, 65535, 8);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// With off the readouts are reduced to peaks and not sent to the engine
+	hProp = devicePropFact->createEnumProperty("Peak_Images", "on", 1);
+	devicePropFact->addEnumValue(hProp, "off", 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// One "readout,time,row,position,width,amplitude" line per peak
+	hProp = devicePropFact->createStringProperty("Peak_Log_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Peak_Readout", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PeakReadout);
+
+	hProp = devicePropFact->createIntProperty("Peak_Count", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PeakCount);
+
+	// Row, position, width and amplitude of each peak in turn, zero past Peak_Count
+	double table[PIXIS_PEAK_TABLE_SIZE * PIXIS_PEAK_TABLE_COLUMNS] = { 0.0 };
+	hProp = devicePropFact->createDoubleArrayProperty("Peak_Table", 0.0, 1.0e9, PIXIS_PEAK_TABLE_SIZE * PIXIS_PEAK_TABLE_COLUMNS, table);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PeakTable);
+}
+
+void PIXISPeakFinder::configure(imaqkit::IPropContainer* propContainer){
+	finish();
+
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Peak_Finding"));
+	_enabled = (*enabled == 1);
+	int* refinement = static_cast<int*>(propContainer->getPropValue("Peak_Refinement"));
+	_gaussian = (*refinement == 1);
+	int* images = static_cast<int*>(propContainer->getPropValue("Peak_Images"));
+	_sendImages = (*images == 1);
+	_threshold = *static_cast<double*>(propContainer->getPropValue("Peak_Threshold"));
+	_backgroundWidth = *static_cast<int*>(propContainer->getPropValue("Peak_Background_Width"));
+	_separation = *static_cast<int*>(propContainer->getPropValue("Peak_Min_Separation"));
+	_maxCount = *static_cast<int*>(propContainer->getPropValue("Peak_Max_Count"));
+	if (!_enabled){
+		return;
+	}
+
+	PIXISPeakTable table;
+	memset(&table, 0, sizeof(table));
+	_latest.publish(table);
+
+	const char* logFile = static_cast<const char*>(propContainer->getPropValue("Peak_Log_File"));
+	if (logFile && *logFile){
+		if (fopen_s(&_log, logFile, "w") == 0){
+			fprintf(_log, "readout,time,row,position,width,amplitude\n");
+		}
+		else{
+			_log = NULL;
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:peaks", "Could not open Peak_Log_File.");
+		}
+	}
+}
+
+void PIXISPeakFinder::background(const pi16u* row, int width){
+	_background.resize(width);
+	if (_backgroundWidth == 0){
+		memset(&_background[0], 0, width * sizeof(piflt));
+		return;
+	}
+
+	//An odd window centres the opening on each pixel
+	int half = _backgroundWidth / 2;
+	int window = 2 * half + 1;
+	_padded.resize(width + 2 * half);
+	short* padded = &_padded[0];
+
+	//Biasing by 0x8000 lets the signed 16 bit min/max order the unsigned pixels
+	for (int i = 0; i < width; ++i){
+		padded[half + i] = (short)(row[i] ^ 0x8000);
+	}
+	padEdges(padded, width, half);
+	runningExtreme(padded, width + 2 * half, window, false);
+
+	memmove(padded + half, padded, width * sizeof(short));
+	padEdges(padded, width, half);
+	runningExtreme(padded, width + 2 * half, window, true);
+
+	for (int i = 0; i < width; ++i){
+		_background[i] = (pi16u)(padded[i] ^ 0x8000);
+	}
+}
+
+void PIXISPeakFinder::findPeaks(const pi16u* row, int width, int rowIndex){
+	_residual.resize(width);
+	for (int i = 0; i < width; ++i){
+		_residual[i] = row[i] - _background[i];
+	}
+	const piflt* residual = &_residual[0];
+
+	//A plateau counts once, at its first pixel
+	_candidates.clear();
+	for (int i = 0; i < width; ++i){
+		//A peak must stand above the background, or refine() would divide by a zero sum
+		piflt value = residual[i];
+		if (value < _threshold || value <= 0.0){
+			continue;
+		}
+		int first = i - _separation > 0 ? i - _separation : 0;
+		int last = i + _separation < width - 1 ? i + _separation : width - 1;
+		bool highest = true;
+		for (int j = first; j <= last && highest; ++j){
+			highest = residual[j] < value || (residual[j] == value && j >= i);
+		}
+		if (highest){
+			_candidates.push_back(i);
+		}
+	}
+
+	size_t kept = _candidates.size();
+	if (kept > (size_t)_maxCount){
+		PIXISPeakHigher higher;
+		higher.residual = residual;
+		std::partial_sort(_candidates.begin(), _candidates.begin() + _maxCount, _candidates.end(), higher);
+		kept = _maxCount;
+	}
+
+	size_t rowStart = _peaks.size();
+	for (size_t c = 0; c < kept; ++c){
+		PIXISPeak peak;
+		peak.row = rowIndex;
+		if (refine(peak, _candidates[c], width)){
+			_peaks.push_back(peak);
+		}
+	}
+	std::sort(_peaks.begin() + rowStart, _peaks.end(), peakBefore);
+}
+
+/**
+* refine fits a parabola to the logarithm of the three pixels at the top, which is exact
+* for a Gaussian line. Lines whose neighbours are not above the background, or whose
+* top is flat, are refined by the centroid instead. Returns false for a top that is not
+* above the background, which has no centroid.
+*/
+bool PIXISPeakFinder::refine(PIXISPeak& peak, int index, int width) const{
+	const piflt* residual = &_residual[0];
+	piflt top = residual[index];
+
+	if (_gaussian && index > 0 && index < width - 1 && residual[index - 1] > 0.0 && residual[index + 1] > 0.0){
+		piflt left = log(residual[index - 1]);
+		piflt centre = log(top);
+		piflt right = log(residual[index + 1]);
+		piflt curvature = left - 2.0 * centre + right;
+		if (curvature < 0.0){
+			piflt offset = 0.5 * (left - right) / curvature;
+			peak.position = index + offset;
+			peak.width = PIXIS_PEAK_FWHM_PER_SIGMA * sqrt(-1.0 / curvature);
+			peak.amplitude = exp(centre - 0.125 * (left - right) * (left - right) / curvature);
+			return true;
+		}
+	}
+
+	piflt half = top / 2.0;
+	int first = index;
+	while (first > 0 && residual[first - 1] > half){
+		first--;
+	}
+	int last = index;
+	while (last < width - 1 && residual[last + 1] > half){
+		last++;
+	}
+
+	piflt sum = 0.0;
+	piflt moment = 0.0;
+	for (int i = first; i <= last; ++i){
+		sum += residual[i];
+		moment += residual[i] * i;
+	}
+	if (!(top > 0.0) || !(sum > 0.0)){
+		return false;
+	}
+
+	//The half maximum crossings are interpolated between the pixels either side
+	piflt leftEdge = first;
+	if (first > 0){
+		leftEdge = first - 1 + (half - residual[first - 1]) / (residual[first] - residual[first - 1]);
+	}
+	piflt rightEdge = last;
+	if (last < width - 1){
+		rightEdge = last + (residual[last] - half) / (residual[last] - residual[last + 1]);
+	}
+
+	peak.position = moment / sum;
+	peak.width = rightEdge - leftEdge;
+	peak.amplitude = top;
+	return true;
+}
+
+void PIXISPeakFinder::process(const pi16u* pixels, int width, int height, pi64s readout, double time){
+	_peaks.clear();
+	for (int row = 0; row < height; ++row){
+		const pi16u* line = pixels + (size_t)row * width;
+		background(line, width);
+		findPeaks(line, width, row);
+	}
+
+	//Rows and positions count from 1, as MATLAB indexes the frame
+	PIXISPeakTable table;
+	memset(&table, 0, sizeof(table));
+	table.readout = readout;
+	table.count = (piint)_peaks.size();
+	for (size_t i = 0; i < _peaks.size(); ++i){
+		const PIXISPeak& peak = _peaks[i];
+		if (i < PIXIS_PEAK_TABLE_SIZE){
+			table.peaks[i][0] = peak.row + 1;
+			table.peaks[i][1] = peak.position + 1.0;
+			table.peaks[i][2] = peak.width;
+			table.peaks[i][3] = peak.amplitude;
+		}
+		if (_log){
+			fprintf(_log, "%lld,%.6f,%d,%.3f,%.3f,%.1f\n", readout, time, peak.row + 1, peak.position + 1.0, peak.width, peak.amplitude);
+		}
+	}
+	_latest.publish(table);
+}
+
+void PIXISPeakFinder::finish(){
+	if (_log){
+		fclose(_log);
+		_log = NULL;
+	}
+}
+
+bool PIXISPeakFinder::getStatus(int id, void* value) const{
+	PIXISPeakTable table;
+	switch (id){
+	case PIXISStatus_PeakReadout:
+		_latest.read(table);
+		*reinterpret_cast<int*>(value) = (int)table.readout;
+		return true;
+	case PIXISStatus_PeakCount:
+		_latest.read(table);
+		*reinterpret_cast<int*>(value) = table.count;
+		return true;
+	case PIXISStatus_PeakTable:
+		_latest.read(table);
+		memcpy(value, table.peaks, sizeof(table.peaks));
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,121 @@
+/**
+* @file:       PIXISPeakFinder.h
+*
+* Purpose:     Class declaration for PIXISPeakFinder.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_PEAK_FINDER_HEADER__
+#define __PIXIS_PEAK_FINDER_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISLatestValue.h"
+#include <stdio.h>
+#include <vector>
+
+// Peaks of the latest readout reported in Peak_Table
+#define PIXIS_PEAK_TABLE_SIZE 64
+
+// Columns of Peak_Table: row, position, width, amplitude
+#define PIXIS_PEAK_TABLE_COLUMNS 4
+
+/**
+* One peak found in a row of a readout.
+*/
+struct PIXISPeak{
+	piint row;
+	piflt position;             // Sub-pixel position along the row
+	piflt width;                // Full width at half maximum, in pixels
+	piflt amplitude;            // Height above the background, in counts
+};
+
+/**
+* The peaks of the most recently processed readout.
+*/
+struct PIXISPeakTable{
+	pi64s readout;
+	piint count;                // Peaks found, which may be more than the table holds
+	piflt peaks[PIXIS_PEAK_TABLE_SIZE][PIXIS_PEAK_TABLE_COLUMNS];
+};
+
+/**
+* Class PIXISPeakFinder
+*
+* @brief:  Finds emission lines in each row of a readout, so spectra can be tracked
+*          without sending every binned readout to MATLAB to be fitted.
+*
+*          The background of a row is its morphological opening (a running minimum
+*          followed by a running maximum) over Peak_Background_Width pixels, which
+*          follows the continuum but cuts off lines narrower than the window. Both
+*          passes are computed eight pixels per SSE2 step. A peak is a pixel at least
+*          Peak_Threshold above the background that is the highest within
+*          Peak_Min_Separation pixels; the Peak_Max_Count highest of a row are kept
+*          and refined to sub-pixel position, width and amplitude, either by a
+*          Gaussian through the three pixels at the top or by the centroid of the
+*          pixels above half maximum.
+*
+*          The peaks of the latest readout are reported in Peak_Table, and every
+*          peak is written to Peak_Log_File when one is given. With Peak_Images off
+*          the readouts are not sent to the engine at all.
+*/
+class PIXISPeakFinder{
+
+public:
+	PIXISPeakFinder();
+	virtual ~PIXISPeakFinder();
+
+	// addProperties adds the Peak_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure reads the Peak_* properties and opens the log file. Called from startCapture().
+	void configure(imaqkit::IPropContainer* propContainer);
+
+	bool isEnabled() const { return _enabled; }
+
+	// sendsImages returns false if readouts are only to be reduced to peaks
+	bool sendsImages() const { return _sendImages; }
+
+	// process finds the peaks of each row of a width x height readout and publishes them
+	void process(const pi16u* pixels, int width, int height, pi64s readout, double time);
+
+	// finish closes the log file
+	void finish();
+
+	// getStatus writes the value of a Peak_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// background fills _background with the opening of one row
+	void background(const pi16u* row, int width);
+
+	// findPeaks adds the peaks of one row to _peaks
+	void findPeaks(const pi16u* row, int width, int rowIndex);
+
+	// refine sets the sub-pixel position, width and amplitude of the peak at pixel index. Returns false if it has none.
+	bool refine(PIXISPeak& peak, int index, int width) const;
+
+	bool _enabled;
+	bool _sendImages;
+	bool _gaussian;
+	piflt _threshold;
+	int _backgroundWidth;
+	int _separation;
+	int _maxCount;
+
+	/// Working rows, reused between readouts
+	std::vector<short> _padded;
+	std::vector<piflt> _background;
+	std::vector<piflt> _residual;
+	std::vector<int> _candidates;
+	std::vector<PIXISPeak> _peaks;
+
+	FILE* _log;
+
+	PIXISLatestValue<PIXISPeakTable> _latest;
+};
+#endif
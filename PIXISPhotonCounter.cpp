@@ -0,0 +1,344 @@
+/**
+* @file:       PIXISPhotonCounter.cpp
+*
+* Purpose:     Implements photon counting, reducing readouts to event lists.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISPhotonCounter.h"
+#include "PIXISAdaptorProps.h"
+#include "PIXISFlatField.h"
+#include <emmintrin.h>
+#include <math.h>
+#include <string.h>
+
+PIXISPhotonCounter::PIXISPhotonCounter() :
+	_enabled(false),
+	_sendImages(true),
+	_maxPixels(1),
+	_width(0),
+	_pixelCount(0),
+	_eventFile(NULL),
+	_totalEvents(0),
+	_rejected(0){
+}
+
+PIXISPhotonCounter::~PIXISPhotonCounter(){
+	finish();
+}
+
+void PIXISPhotonCounter::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Photon_Counting", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw float32 dark level per pixel of the readout, e.g. an averaged dark readout. Empty uses Photon_Dark_Level.
+	hProp = devicePropFact->createStringProperty("Photon_Dark_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createDoubleProperty("Photon_Dark_Level", 0.0, 65535.0, 0.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw float32 read noise per pixel of the readout, in counts rms. Empty uses Photon_Read_Noise.
+	hProp = devicePropFact->createStringProperty("Photon_Noise_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createDoubleProperty("Photon_Read_Noise", 0.0, 65535.0, 10.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// A pixel is lit above the dark level plus this many times the read noise
+	hProp = devicePropFact->createDoubleProperty("Photon_Threshold_Sigmas", 0.0, 1000.0, 5.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Larger groups of lit pixels are rejected, not counted
+	hProp = devicePropFact->createIntProperty("Photon_Max_Event_Pixels", 1, 65535, 9);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// With off the readouts are reduced to events and not sent to the engine
+	hProp = devicePropFact->createEnumProperty("Photon_Images", "on", 1);
+	devicePropFact->addEnumValue(hProp, "off", 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Binary file of PIXISPhotonEvent records, one per event
+	hProp = devicePropFact->createStringProperty("Photon_Event_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw uint32 events per pixel of the readout, written when the acquisition ends
+	hProp = devicePropFact->createStringProperty("Photon_Count_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Photon_Readout", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PhotonReadout);
+
+	hProp = devicePropFact->createIntProperty("Photon_Event_Count", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PhotonEventCount);
+
+	hProp = devicePropFact->createDoubleProperty("Photon_Total_Events", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PhotonTotalEvents);
+
+	hProp = devicePropFact->createDoubleProperty("Photon_Rejected", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PhotonRejected);
+
+	// x, y and amplitude of each event in turn, zero past Photon_Event_Count
+	double table[PIXIS_PHOTON_TABLE_SIZE * PIXIS_PHOTON_TABLE_COLUMNS] = { 0.0 };
+	hProp = devicePropFact->createDoubleArrayProperty("Photon_Events", 0.0, 1.0e9, PIXIS_PHOTON_TABLE_SIZE * PIXIS_PHOTON_TABLE_COLUMNS, table);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PhotonEvents);
+}
+
+bool PIXISPhotonCounter::configure(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight){
+	finish();
+
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Photon_Counting"));
+	int* images = static_cast<int*>(propContainer->getPropValue("Photon_Images"));
+	double* darkLevel = static_cast<double*>(propContainer->getPropValue("Photon_Dark_Level"));
+	double* readNoise = static_cast<double*>(propContainer->getPropValue("Photon_Read_Noise"));
+	double* sigmas = static_cast<double*>(propContainer->getPropValue("Photon_Threshold_Sigmas"));
+	const char* darkPath = static_cast<const char*>(propContainer->getPropValue("Photon_Dark_File"));
+	const char* noisePath = static_cast<const char*>(propContainer->getPropValue("Photon_Noise_File"));
+	_enabled = (*enabled == 1);
+	_sendImages = (*images == 1);
+	_maxPixels = *static_cast<int*>(propContainer->getPropValue("Photon_Max_Event_Pixels"));
+	_totalEvents = 0;
+	_rejected = 0;
+	if (!_enabled){
+		return true;
+	}
+
+	_width = readoutWidth;
+	_pixelCount = readoutWidth * readoutHeight;
+	char message[MAX_PATH + 128];
+
+	if (darkPath[0] == '\0'){
+		_dark.assign(_pixelCount, (float)*darkLevel);
+	}
+	else if (!PIXISFlatField::loadMap(darkPath, _darkSource, _darkFile) || _darkFile.size() != (size_t)_pixelCount){
+		sprintf_s(message, sizeof(message), "The photon counting dark map '%s' could not be read, holds values that are not finite or is not the size of the %d x %d readout.",
+			darkPath, readoutWidth, readoutHeight);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:photons", message);
+		return false;
+	}
+	else{
+		_dark = _darkFile;
+	}
+
+	if (noisePath[0] != '\0' &&
+		(!PIXISFlatField::loadMap(noisePath, _noiseSource, _noiseFile) || _noiseFile.size() != (size_t)_pixelCount)){
+		sprintf_s(message, sizeof(message), "The photon counting noise map '%s' could not be read, holds values that are not finite or is not the size of the %d x %d readout.",
+			noisePath, readoutWidth, readoutHeight);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:photons", message);
+		return false;
+	}
+
+	//A pixel is lit when it is above the threshold, so the threshold rounds down to the counts below it
+	_threshold.resize(_pixelCount);
+	for (int i = 0; i < _pixelCount; ++i){
+		double noise = noisePath[0] == '\0' ? *readNoise : _noiseFile[i];
+		double threshold = floor(_dark[i] + *sigmas * noise);
+		threshold = threshold < 0.0 ? 0.0 : (threshold > 65535.0 ? 65535.0 : threshold);
+		_threshold[i] = (short)((pi16u)threshold ^ 0x8000);
+	}
+	_state.assign(_pixelCount, 0);
+
+	PIXISPhotonTable table;
+	memset(&table, 0, sizeof(table));
+	_latest.publish(table);
+
+	const char* eventPath = static_cast<const char*>(propContainer->getPropValue("Photon_Event_File"));
+	if (eventPath && *eventPath && fopen_s(&_eventFile, eventPath, "wb") != 0){
+		_eventFile = NULL;
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:photons", "Could not open Photon_Event_File.");
+	}
+	const char* countPath = static_cast<const char*>(propContainer->getPropValue("Photon_Count_File"));
+	_countPath = countPath ? countPath : "";
+	_counts.assign(_countPath.empty() ? 0 : _pixelCount, 0);
+	return true;
+}
+
+/**
+* findLit compares eight pixels at a time with their thresholds. SSE2 only compares
+* signed 16 bit values, so the pixels are biased by 0x8000 as the thresholds are. Most
+* of a sparse readout is dark, and a step without a lit pixel costs only the compare.
+*/
+void PIXISPhotonCounter::findLit(const pi16u* pixels, int pixelCount){
+	const short* threshold = &_threshold[0];
+	unsigned char* state = &_state[0];
+	const __m128i bias = _mm_set1_epi16((short)0x8000);
+	_lit.clear();
+
+	int i = 0;
+	for (; i + 8 <= pixelCount; i += 8){
+		__m128i value = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i)), bias);
+		__m128i limit = _mm_loadu_si128(reinterpret_cast<const __m128i*>(threshold + i));
+		int mask = _mm_movemask_epi8(_mm_cmpgt_epi16(value, limit));
+		if (mask == 0){
+			continue;
+		}
+		for (int lane = 0; lane < 8; ++lane){
+			if (mask & (1 << (2 * lane))){
+				_lit.push_back(i + lane);
+				state[i + lane] = 1;
+			}
+		}
+	}
+	for (; i < pixelCount; ++i){
+		if ((short)(pixels[i] ^ 0x8000) > threshold[i]){
+			_lit.push_back(i);
+			state[i] = 1;
+		}
+	}
+}
+
+void PIXISPhotonCounter::group(const pi16u* pixels, int width, int height, int index, PIXISPhotonEvent& event){
+	unsigned char* state = &_state[0];
+	const float* dark = &_dark[0];
+	double sum = 0.0;
+	double sumX = 0.0;
+	double sumY = 0.0;
+	int count = 0;
+
+	_stack.clear();
+	_stack.push_back(index);
+	state[index] = 2;
+	while (!_stack.empty()){
+		int pixel = _stack.back();
+		_stack.pop_back();
+		int x = pixel % width;
+		int y = pixel / width;
+		double amplitude = pixels[pixel] - dark[pixel];
+		if (amplitude < 0.0){
+			amplitude = 0.0;
+		}
+		sum += amplitude;
+		sumX += amplitude * x;
+		sumY += amplitude * y;
+		count++;
+
+		for (int ny = (y > 0 ? y - 1 : 0); ny <= (y < height - 1 ? y + 1 : y); ++ny){
+			for (int nx = (x > 0 ? x - 1 : 0); nx <= (x < width - 1 ? x + 1 : x); ++nx){
+				int neighbour = ny * width + nx;
+				if (state[neighbour] == 1){
+					state[neighbour] = 2;
+					_stack.push_back(neighbour);
+				}
+			}
+		}
+	}
+
+	//An event lit only through a threshold below the dark level has no weight and sits where it was found
+	event.x = (float)(sum > 0.0 ? sumX / sum : index % width) + 1.0f;
+	event.y = (float)(sum > 0.0 ? sumY / sum : index / width) + 1.0f;
+	event.amplitude = (float)sum;
+	event.pixels = count;
+}
+
+void PIXISPhotonCounter::process(const pi16u* pixels, int width, int height, pi64s readout, double time){
+	_events.clear();
+	int pixelCount = width * height;
+	if (pixelCount != _pixelCount){
+		return;
+	}
+
+	findLit(pixels, pixelCount);
+	LONG64 rejected = 0;
+	for (size_t i = 0; i < _lit.size(); ++i){
+		int index = _lit[i];
+		if (_state[index] != 1){
+			continue;
+		}
+		PIXISPhotonEvent event;
+		event.time = time;
+		event.readout = readout;
+		group(pixels, width, height, index, event);
+		if (event.pixels > _maxPixels){
+			rejected++;
+			continue;
+		}
+		_events.push_back(event);
+		if (!_counts.empty()){
+			int x = (int)(event.x - 0.5f);
+			int y = (int)(event.y - 0.5f);
+			_counts[(size_t)y * width + x]++;
+		}
+	}
+	//Only the lit pixels were marked, so only they need clearing
+	for (size_t i = 0; i < _lit.size(); ++i){
+		_state[_lit[i]] = 0;
+	}
+
+	_totalEvents = _totalEvents + (LONG64)_events.size();
+	_rejected = _rejected + rejected;
+	if (_eventFile && !_events.empty()){
+		fwrite(&_events[0], sizeof(PIXISPhotonEvent), _events.size(), _eventFile);
+	}
+
+	PIXISPhotonTable table;
+	memset(&table, 0, sizeof(table));
+	table.readout = readout;
+	table.count = (piint)_events.size();
+	for (size_t i = 0; i < _events.size() && i < PIXIS_PHOTON_TABLE_SIZE; ++i){
+		table.events[i][0] = _events[i].x;
+		table.events[i][1] = _events[i].y;
+		table.events[i][2] = _events[i].amplitude;
+	}
+	_latest.publish(table);
+}
+
+void PIXISPhotonCounter::finish(){
+	if (_eventFile){
+		fclose(_eventFile);
+		_eventFile = NULL;
+	}
+	if (!_counts.empty()){
+		FILE* file;
+		if (fopen_s(&file, _countPath.c_str(), "wb") == 0){
+			fwrite(&_counts[0], sizeof(unsigned int), _counts.size(), file);
+			fclose(file);
+		}
+		else{
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:photons", "Could not write Photon_Count_File.");
+		}
+		_counts.clear();
+	}
+}
+
+bool PIXISPhotonCounter::getStatus(int id, void* value) const{
+	PIXISPhotonTable table;
+	switch (id){
+	case PIXISStatus_PhotonReadout:
+		_latest.read(table);
+		*reinterpret_cast<int*>(value) = (int)table.readout;
+		return true;
+	case PIXISStatus_PhotonEventCount:
+		_latest.read(table);
+		*reinterpret_cast<int*>(value) = table.count;
+		return true;
+	case PIXISStatus_PhotonTotalEvents:
+		*reinterpret_cast<double*>(value) = (double)_totalEvents;
+		return true;
+	case PIXISStatus_PhotonRejected:
+		*reinterpret_cast<double*>(value) = (double)_rejected;
+		return true;
+	case PIXISStatus_PhotonEvents:
+		_latest.read(table);
+		memcpy(value, table.events, sizeof(table.events));
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,137 @@
+/**
+* @file:       PIXISPhotonCounter.h
+*
+* Purpose:     Class declaration for PIXISPhotonCounter.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_PHOTON_COUNTER_HEADER__
+#define __PIXIS_PHOTON_COUNTER_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISLatestValue.h"
+#include "PIXISMapFile.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Events of the latest readout reported in Photon_Events
+#define PIXIS_PHOTON_TABLE_SIZE 64
+
+// Columns of Photon_Events: x, y, amplitude
+#define PIXIS_PHOTON_TABLE_COLUMNS 3
+
+/**
+* One photon event as written to Photon_Event_File, 32 bytes little endian.
+*/
+struct PIXISPhotonEvent{
+	piflt time;                 // imaqkit::getCurrentTime() of the readout
+	pi64s readout;              // Readout number since startCapture()
+	float x;                    // Amplitude weighted centroid, counting from 1 as MATLAB does
+	float y;
+	float amplitude;            // Counts above the dark level, summed over the event's pixels
+	piint pixels;               // Pixels above threshold in the event
+};
+
+/**
+* The events of the most recently processed readout.
+*/
+struct PIXISPhotonTable{
+	pi64s readout;
+	piint count;                // Events found, which may be more than the table holds
+	piflt events[PIXIS_PHOTON_TABLE_SIZE][PIXIS_PHOTON_TABLE_COLUMNS];
+};
+
+/**
+* Class PIXISPhotonCounter
+*
+* @brief:  Reduces sparse, low light readouts to lists of photon events.
+*
+*          A pixel is lit when it is above its own threshold, the dark level plus
+*          Photon_Threshold_Sigmas times the read noise. Dark level and noise are
+*          either one value for every pixel or raw float32 maps the size of the
+*          readout, so the thresholds are worked out once in configure() and the
+*          raw readout is compared against them eight pixels per SSE2 step. Lit
+*          pixels that touch, diagonally included, make up one event, with the
+*          amplitude weighted centroid as its position. Events of more than
+*          Photon_Max_Event_Pixels pixels, such as cosmic rays, are rejected.
+*
+*          Events are appended to Photon_Event_File as PIXISPhotonEvent records and
+*          those of the latest readout are reported in Photon_Events. Photon_Count_File
+*          receives the counting image, one uint32 per pixel of the readout, at the end
+*          of the acquisition. With Photon_Images off the readouts are not sent to the
+*          engine at all.
+*/
+class PIXISPhotonCounter{
+
+public:
+	PIXISPhotonCounter();
+	virtual ~PIXISPhotonCounter();
+
+	// addProperties adds the Photon_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	/**
+	* configure reads the Photon_* properties, works out the thresholds for a
+	* readoutWidth x readoutHeight readout and opens the event file. Called from
+	* startCapture().
+	*
+	* @return: false, after warning, if a map cannot be used for the readout.
+	*/
+	bool configure(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight);
+
+	bool isEnabled() const { return _enabled; }
+
+	// sendsImages returns false if readouts are only to be reduced to events
+	bool sendsImages() const { return _sendImages; }
+
+	// process finds the events of a width x height readout and publishes them
+	void process(const pi16u* pixels, int width, int height, pi64s readout, double time);
+
+	// finish closes the event file and writes the counting image
+	void finish();
+
+	// getStatus writes the value of a Photon_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// findLit collects the pixels above their threshold into _lit
+	void findLit(const pi16u* pixels, int pixelCount);
+
+	// group gathers the event containing lit pixel index, marking its pixels as taken
+	void group(const pi16u* pixels, int width, int height, int index, PIXISPhotonEvent& event);
+
+	bool _enabled;
+	bool _sendImages;
+	int _maxPixels;
+	int _width;
+	int _pixelCount;
+
+	/// Per pixel of the readout
+	std::vector<short> _threshold;      // Biased by 0x8000 for the signed SSE2 compare
+	std::vector<float> _dark;
+	std::vector<unsigned char> _state;  // 0 unlit, 1 lit, 2 taken by an event
+	std::vector<int> _lit;
+	std::vector<int> _stack;
+	std::vector<PIXISPhotonEvent> _events;
+
+	/// Maps as loaded, kept so that a new acquisition does not read them again
+	PIXISMapFile _darkSource;
+	std::vector<float> _darkFile;
+	PIXISMapFile _noiseSource;
+	std::vector<float> _noiseFile;
+
+	FILE* _eventFile;
+	std::string _countPath;
+	std::vector<unsigned int> _counts;
+
+	volatile LONG64 _totalEvents;
+	volatile LONG64 _rejected;
+	PIXISLatestValue<PIXISPhotonTable> _latest;
+};
+#endif
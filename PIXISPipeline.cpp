@@ -0,0 +1,417 @@
+/**
+* @file:       PIXISPipeline.cpp
+*
+* Purpose:     Implements the staged processing of readouts, inline or on stage threads.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISPipeline.h"
+#include "PIXISAdaptorProps.h"
+#include "PIXISTraceRecorder.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+
+// Pipeline_Stages names, indexed by PIXISPipelineStage. Sending is not listed; it always runs last.
+static const char* stageNames[PIXISStage_Count] = { "stats", "accumulate", "defects", "hdr", "photons", "flat_field", "cosmic_ray", "apertures", "peaks", "gate", "shared_memory", "preview", "send" };
+
+// Thread names in the trace, indexed by PIXISPipelineStage
+static const char* stageThreadNames[PIXISStage_Count] = { "Stats stage", "Accumulator stage", "Defect stage", "HDR stage", "Photon counting stage", "Flat field stage", "Cosmic ray stage", "Aperture stage", "Peak finding stage",
+	"Gate stage", "Shared memory stage", "Preview stage", "Send stage" };
+
+PIXISPipelineItem::PIXISPipelineItem() :
+	readout(0),
+	width(0),
+	height(0),
+	time(0.0),
+	wakeTicks(0),
+	sequenceStep(-1),
+	dropped(false),
+	engineDecided(false),
+	toEngine(false),
+	pixels(NULL),
+	image(NULL),
+	owned(false){
+}
+
+void PIXISPipelineItem::reset(pi64s readoutNumber, int readoutWidth, int readoutHeight, double readoutTime, int step){
+	readout = readoutNumber;
+	width = readoutWidth;
+	height = readoutHeight;
+	time = readoutTime;
+	wakeTicks = 0;
+	sequenceStep = step;
+	dropped = false;
+	engineDecided = false;
+	toEngine = false;
+	pixels = NULL;
+	image = NULL;
+}
+
+void PIXISPipelineItem::setPixels(const pi16u* source){
+	if (!owned){
+		pixels = source;
+		return;
+	}
+	size_t count = (size_t)width * height;
+	if (pixelBuffer.size() < count){
+		pixelBuffer.resize(count);
+	}
+	//A stage may hand back the item's own buffer
+	if (source != &pixelBuffer[0]){
+		memcpy(&pixelBuffer[0], source, count * sizeof(pi16u));
+	}
+	pixels = &pixelBuffer[0];
+}
+
+pi16u* PIXISPipelineItem::writablePixels(){
+	size_t count = (size_t)width * height;
+	if (pixelBuffer.size() < count){
+		pixelBuffer.resize(count);
+	}
+	//The readout may be the camera's buffer or a read-only replay file, which are not to be written
+	if (pixels != &pixelBuffer[0]){
+		memcpy(&pixelBuffer[0], pixels, count * sizeof(pi16u));
+		pixels = &pixelBuffer[0];
+	}
+	return &pixelBuffer[0];
+}
+
+void PIXISPipelineItem::setImage(const pibyte* source, size_t bytes){
+	if (!owned){
+		image = source;
+		return;
+	}
+	if (imageBuffer.size() < bytes){
+		imageBuffer.resize(bytes);
+	}
+	memcpy(&imageBuffer[0], source, bytes);
+	image = &imageBuffer[0];
+}
+
+PIXISPipelineQueue::PIXISPipelineQueue() :
+	_head(0),
+	_tail(0){
+	_ready = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+PIXISPipelineQueue::~PIXISPipelineQueue(){
+	CloseHandle(_ready);
+}
+
+void PIXISPipelineQueue::init(int capacity){
+	_slots.assign(capacity, NULL);
+	_head = 0;
+	_tail = 0;
+	ResetEvent(_ready);
+}
+
+void PIXISPipelineQueue::push(PIXISPipelineItem* item){
+	LONG64 tail = _tail;
+	_slots[(size_t)(tail % _slots.size())] = item;
+	//The slot must be written before the consumer can see it
+	MemoryBarrier();
+	_tail = tail + 1;
+	SetEvent(_ready);
+}
+
+PIXISPipelineItem* PIXISPipelineQueue::pop(DWORD timeout){
+	LONG64 head = _head;
+	if (head == _tail){
+		WaitForSingleObject(_ready, timeout);
+		if (head == _tail){
+			return NULL;
+		}
+	}
+	MemoryBarrier();
+	PIXISPipelineItem* item = _slots[(size_t)(head % _slots.size())];
+	MemoryBarrier();
+	_head = head + 1;
+	return item;
+}
+
+PIXISPipeline::PIXISPipeline() :
+	_enabled(false),
+	_itemCount(8),
+	_fn(NULL),
+	_context(NULL),
+	_quit(0),
+	_affinity(0),
+	_priority(THREAD_PRIORITY_NORMAL){
+	for (int stage = 0; stage < PIXISStage_Count; ++stage){
+		_chain.push_back(stage);
+		_stageTicks[stage] = 0;
+		_stageMaxTicks[stage] = 0;
+		_stageReadouts[stage] = 0;
+		_stagePosition[stage] = -1;
+	}
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	_msPerTick = 1000.0 / frequency.QuadPart;
+}
+
+PIXISPipeline::~PIXISPipeline(){
+	stop();
+}
+
+void PIXISPipeline::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Pipeline", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Comma separated stages in the order they run. Sending to the engine always comes last.
+	hProp = devicePropFact->createStringProperty("Pipeline_Stages", "stats,accumulate,defects,hdr,photons,flat_field,cosmic_ray,apertures,peaks,gate,shared_memory,preview");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Readouts that can be in the pipeline at once
+	hProp = devicePropFact->createIntProperty("Pipeline_Readouts", 2, 1024, 8);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	int depths[PIXISStage_Count] = { 0 };
+	hProp = devicePropFact->createIntArrayProperty("Pipeline_Queue_Depth", 0, INT_MAX, PIXISStage_Count, depths);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PipelineQueueDepth);
+
+	double times[PIXISStage_Count] = { 0.0 };
+	hProp = devicePropFact->createDoubleArrayProperty("Pipeline_Stage_Time", 0.0, 1.0e9, PIXISStage_Count, times);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PipelineStageTime);
+
+	hProp = devicePropFact->createDoubleArrayProperty("Pipeline_Stage_Max_Time", 0.0, 1.0e9, PIXISStage_Count, times);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PipelineStageMaxTime);
+}
+
+bool PIXISPipeline::configure(imaqkit::IPropContainer* propContainer){
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Pipeline"));
+	int* readouts = static_cast<int*>(propContainer->getPropValue("Pipeline_Readouts"));
+	const char* stages = static_cast<const char*>(propContainer->getPropValue("Pipeline_Stages"));
+	_enabled = (*enabled == 1);
+	_itemCount = *readouts;
+
+	std::vector<int> chain;
+	std::string list(stages);
+	size_t begin = 0;
+	while (begin <= list.size()){
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos){
+			end = list.size();
+		}
+		std::string name = list.substr(begin, end - begin);
+		name.erase(0, name.find_first_not_of(" \t"));
+		name.erase(name.find_last_not_of(" \t") + 1);
+		begin = end + 1;
+		if (name.empty()){
+			continue;
+		}
+
+		int stage = 0;
+		while (stage < PIXISStage_Send && name != stageNames[stage]){
+			stage++;
+		}
+		bool listed = false;
+		for (size_t i = 0; i < chain.size(); ++i){
+			listed = listed || chain[i] == stage;
+		}
+		if (stage == PIXISStage_Send || listed){
+			char message[256];
+			sprintf_s(message, sizeof(message),
+				"Pipeline_Stages has %s stage '%s'. Use each of stats, accumulate, defects, hdr, photons, flat_field, cosmic_ray, apertures, peaks, gate, shared_memory and preview at most once.",
+				listed ? "a repeated" : "an unknown", name.c_str());
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:pipeline", message);
+			return false;
+		}
+		chain.push_back(stage);
+	}
+	chain.push_back(PIXISStage_Send);
+	_chain = chain;
+	return true;
+}
+
+bool PIXISPipeline::hasStage(int stage) const{
+	for (size_t i = 0; i < _chain.size(); ++i){
+		if (_chain[i] == stage){
+			return true;
+		}
+	}
+	return false;
+}
+
+void PIXISPipeline::start(StageFunction fn, void* context, int pixelCount){
+	_activeChain = _chain;
+	_fn = fn;
+	_context = context;
+	for (int stage = 0; stage < PIXISStage_Count; ++stage){
+		_stageTicks[stage] = 0;
+		_stageMaxTicks[stage] = 0;
+		_stageReadouts[stage] = 0;
+	}
+	if (!_enabled){
+		return;
+	}
+
+	//Items keep their buffers from one start to the next
+	_items.resize(_itemCount);
+	_free.init(_itemCount);
+	for (int i = 0; i < _itemCount; ++i){
+		_items[i].owned = true;
+		if ((int)_items[i].pixelBuffer.size() < pixelCount){
+			_items[i].pixelBuffer.resize(pixelCount);
+		}
+		_free.push(&_items[i]);
+	}
+
+	int stageCount = (int)_activeChain.size();
+	_quit = 0;
+	_stageThreads.resize(stageCount);
+	for (int position = 0; position < stageCount; ++position){
+		_queues[position].init(_itemCount);
+		_stageThreads[position].pipeline = this;
+		_stageThreads[position].position = position;
+	}
+	for (int position = 0; position < stageCount; ++position){
+		HANDLE thread = CreateThread(NULL, 0, stageThread, &_stageThreads[position], 0, NULL);
+		if (thread == NULL){
+			//A stage without its thread would never pass items on, so the whole chain runs inline instead
+			_quit = 1;
+			for (size_t i = 0; i < _threads.size(); ++i){
+				WaitForSingleObject(_threads[i], INFINITE);
+				CloseHandle(_threads[i]);
+			}
+			_threads.clear();
+			for (int stage = 0; stage < PIXISStage_Count; ++stage){
+				_stagePosition[stage] = -1;
+			}
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:pipeline", "A pipeline stage thread could not be created. The stages run on the acquisition thread instead.");
+			return;
+		}
+		if (_affinity){
+			SetThreadAffinityMask(thread, _affinity);
+		}
+		SetThreadPriority(thread, _priority);
+		_threads.push_back(thread);
+		_stagePosition[_activeChain[position]] = position;
+	}
+}
+
+void PIXISPipeline::setScheduling(DWORD_PTR affinity, int priority){
+	_affinity = affinity;
+	_priority = priority;
+}
+
+void PIXISPipeline::drain(){
+	if (!isRunning()){
+		return;
+	}
+	while (_free.getDepth() < _itemCount){
+		Sleep(1);
+	}
+}
+
+void PIXISPipeline::stop(){
+	if (!isRunning()){
+		return;
+	}
+	drain();
+	_quit = 1;
+	for (size_t i = 0; i < _threads.size(); ++i){
+		WaitForSingleObject(_threads[i], INFINITE);
+		CloseHandle(_threads[i]);
+	}
+	_threads.clear();
+	for (int stage = 0; stage < PIXISStage_Count; ++stage){
+		_stagePosition[stage] = -1;
+	}
+}
+
+PIXISPipelineItem* PIXISPipeline::nextItem(DWORD timeout){
+	return _free.pop(timeout);
+}
+
+void PIXISPipeline::submit(PIXISPipelineItem* item){
+	_queues[0].push(item);
+}
+
+void PIXISPipeline::process(PIXISPipelineItem* item){
+	int last = (int)_activeChain.size() - 1;
+	for (int position = 0; position <= last; ++position){
+		if (!item->dropped || position == last){
+			runStage(position, item);
+		}
+	}
+}
+
+void PIXISPipeline::runStage(int position, PIXISPipelineItem* item){
+	int stage = _activeChain[position];
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	_fn(_context, stage, item);
+	QueryPerformanceCounter(&end);
+
+	LONG64 ticks = end.QuadPart - start.QuadPart;
+	_stageTicks[stage] = _stageTicks[stage] + ticks;
+	_stageReadouts[stage] = _stageReadouts[stage] + 1;
+	if (ticks > _stageMaxTicks[stage]){
+		_stageMaxTicks[stage] = ticks;
+	}
+}
+
+DWORD WINAPI PIXISPipeline::stageThread(void* param){
+	StageThread* stageThread = reinterpret_cast<StageThread*>(param);
+	PIXISPipeline* pipeline = stageThread->pipeline;
+	int position = stageThread->position;
+	bool last = (position + 1 == (int)pipeline->_activeChain.size());
+	PIXISTraceRecorder::nameThread(stageThreadNames[pipeline->_activeChain[position]]);
+
+	for (;;){
+		PIXISPipelineItem* item = pipeline->_queues[position].pop(100);
+		if (item == NULL){
+			//Only asked to quit once drained, so nothing is left behind
+			if (pipeline->_quit){
+				break;
+			}
+			continue;
+		}
+		if (!item->dropped || last){
+			pipeline->runStage(position, item);
+		}
+		if (last){
+			pipeline->_free.push(item);
+		}
+		else{
+			pipeline->_queues[position + 1].push(item);
+		}
+	}
+	return 0;
+}
+
+bool PIXISPipeline::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_PipelineQueueDepth:
+		for (int stage = 0; stage < PIXISStage_Count; ++stage){
+			LONG position = _stagePosition[stage];
+			reinterpret_cast<int*>(value)[stage] = position >= 0 ? _queues[position].getDepth() : 0;
+		}
+		return true;
+	case PIXISStatus_PipelineStageTime:
+		for (int stage = 0; stage < PIXISStage_Count; ++stage){
+			LONG64 readouts = _stageReadouts[stage];
+			reinterpret_cast<double*>(value)[stage] = readouts ? _stageTicks[stage] * _msPerTick / readouts : 0.0;
+		}
+		return true;
+	case PIXISStatus_PipelineStageMaxTime:
+		for (int stage = 0; stage < PIXISStage_Count; ++stage){
+			reinterpret_cast<double*>(value)[stage] = _stageMaxTicks[stage] * _msPerTick;
+		}
+		return true;
+	}
+	return false;
+}
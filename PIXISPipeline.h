@@ -0,0 +1,213 @@
+/**
+* @file:       PIXISPipeline.h
+*
+* Purpose:     Class declarations for PIXISPipeline and its queue.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_PIPELINE_HEADER__
+#define __PIXIS_PIPELINE_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include <vector>
+
+/**
+* Processing stages a readout goes through between Picam_Acquire and receiveFrame,
+* in their default order. The values index the Pipeline_* status arrays.
+*/
+enum PIXISPipelineStage{
+	PIXISStage_Stats,           // Frame statistics
+	PIXISStage_Accumulate,      // Per-pixel mean and variance
+	PIXISStage_Defects,         // Hot and defective pixel correction
+	PIXISStage_Hdr,             // Merge of bracketed exposures
+	PIXISStage_Photons,         // Photon counting, on the raw readout
+	PIXISStage_FlatField,       // Offset and flat-field gain correction
+	PIXISStage_CosmicRay,       // Cosmic ray removal
+	PIXISStage_Apertures,       // Aperture sums
+	PIXISStage_Peaks,           // Spectral peak finding
+	PIXISStage_Gate,            // Frame gate
+	PIXISStage_SharedMemory,    // Publishing to the shared-memory ring
+	PIXISStage_Preview,         // Binning to the preview image
+	PIXISStage_Send,            // Sending the frame to the engine, always last
+
+	PIXISStage_Count
+};
+
+/**
+* One readout on its way through the stages.
+*/
+struct PIXISPipelineItem{
+	pi64s readout;              // Readout number since startCapture()
+	int width;
+	int height;
+	double time;                // imaqkit::getCurrentTime() when the readout was acquired
+	LONG64 wakeTicks;           // QueryPerformanceCounter when the acquisition thread picked it up, 0 for a held readout
+	int sequenceStep;           // Exposure sequence step, -1 without a sequence
+	bool dropped;               // Set by a stage to skip the stages after it
+	bool engineDecided;         // Whether toEngine has been decided yet
+	bool toEngine;              // Whether the readout goes to the engine, see PIXISPreview::isDue()
+
+	const pi16u* pixels;        // Readout as left by the last stage
+	const pibyte* image;        // Frame to send, when it is not pixels
+
+	/// Owned copies, used when the item outlives the buffer it was given
+	bool owned;
+	std::vector<pi16u> pixelBuffer;
+	std::vector<pibyte> imageBuffer;
+
+	PIXISPipelineItem();
+
+	// reset prepares the item for a new readout
+	void reset(pi64s readoutNumber, int readoutWidth, int readoutHeight, double readoutTime, int step);
+
+	// setPixels makes pixels the readout. An owned item copies them, so the source may be reused.
+	void setPixels(const pi16u* source);
+
+	// writablePixels returns the readout in the item's own buffer, copying it there first if it is elsewhere
+	pi16u* writablePixels();
+
+	// setImage makes the bytes the frame to send, copied into an owned item
+	void setImage(const pibyte* source, size_t bytes);
+};
+
+/**
+* Class PIXISPipelineQueue
+*
+* @brief:  Bounded queue of items with one producer thread and one consumer thread.
+*          Push and pop take no lock; the consumer sleeps on an event when it is
+*          empty.
+*/
+class PIXISPipelineQueue{
+
+public:
+	PIXISPipelineQueue();
+	virtual ~PIXISPipelineQueue();
+
+	// init empties the queue and sizes it for capacity items
+	void init(int capacity);
+
+	// push adds an item. There is always room, since no more items exist than the capacity.
+	void push(PIXISPipelineItem* item);
+
+	// pop removes the oldest item, waiting up to timeout ms. Returns NULL if the queue stayed empty.
+	PIXISPipelineItem* pop(DWORD timeout);
+
+	int getDepth() const { return (int)(_tail - _head); }
+
+private:
+	std::vector<PIXISPipelineItem*> _slots;
+	volatile LONG64 _head;      // Next to pop, written by the consumer only
+	volatile LONG64 _tail;      // Next to push, written by the producer only
+	HANDLE _ready;
+};
+
+/**
+* Class PIXISPipeline
+*
+* @brief:  Runs each readout through the chain of stages named by Pipeline_Stages.
+*
+*          With Pipeline off the chain runs on the acquisition thread, as it always
+*          has. With Pipeline on the readout is copied into one of Pipeline_Readouts
+*          items and each stage runs on a thread of its own, handed items through
+*          PIXISPipelineQueue. The stage threads take Worker_Affinity and
+*          Acquisition_Priority, as the workers do. Every stage sees the readouts in acquisition order, so
+*          stages that keep state across readouts, like the cosmic ray window, work
+*          unchanged and frames reach the engine in order. Sending is always the last
+*          stage and returns the item to the acquisition thread.
+*
+*          Stages left out of Pipeline_Stages are not run, even if their feature is on.
+*          The time each stage takes and the depth of the queue in front of it are
+*          reported in the Pipeline_* status arrays, indexed by PIXISPipelineStage.
+*/
+class PIXISPipeline{
+
+public:
+	// Called by the stage's thread for every readout that has not been dropped, and for every readout at PIXISStage_Send
+	typedef void (*StageFunction)(void* context, int stage, PIXISPipelineItem* item);
+
+	PIXISPipeline();
+	virtual ~PIXISPipeline();
+
+	// addProperties adds the Pipeline_* configuration and status properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure reads the Pipeline_* properties. Returns false, after warning, if Pipeline_Stages is not valid.
+	bool configure(imaqkit::IPropContainer* propContainer);
+
+	// hasStage returns true if the configured chain runs stage
+	bool hasStage(int stage) const;
+
+	/**
+	* start resets the stage timings and, with Pipeline on, starts the stage threads.
+	* Called by the acquisition thread. If a thread cannot be created the chain runs
+	* inline, after a warning.
+	*/
+	void start(StageFunction fn, void* context, int pixelCount);
+
+	// setScheduling sets the affinity (0 for any processor) and priority of the stage threads started next
+	void setScheduling(DWORD_PTR affinity, int priority);
+
+	// drain waits until every readout handed over has been sent
+	void drain();
+
+	// stop drains and ends the stage threads
+	void stop();
+
+	bool isRunning() const { return !_threads.empty(); }
+
+	// nextItem returns a free item, waiting up to timeout ms while they are all in flight. Returns NULL on timeout.
+	PIXISPipelineItem* nextItem(DWORD timeout);
+
+	// submit hands an item from nextItem() to the first stage
+	void submit(PIXISPipelineItem* item);
+
+	// process runs the chain on item in the calling thread
+	void process(PIXISPipelineItem* item);
+
+	// getStatus writes the value of a Pipeline_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	struct StageThread{
+		PIXISPipeline* pipeline;
+		int position;           // Index into _chain
+	};
+
+	static DWORD WINAPI stageThread(void* param);
+
+	// runStage calls the stage function for the stage at position, timing it
+	void runStage(int position, PIXISPipelineItem* item);
+
+	/// Configured values
+	bool _enabled;
+	int _itemCount;
+	std::vector<int> _chain;
+
+	/// Chain being run, copied from the configured values by start()
+	std::vector<int> _activeChain;
+	StageFunction _fn;
+	void* _context;
+
+	std::vector<PIXISPipelineItem> _items;
+	PIXISPipelineQueue _queues[PIXISStage_Count];   // _queues[i] feeds the stage at position i
+	PIXISPipelineQueue _free;                   // Sent items, back to the acquisition thread
+	std::vector<StageThread> _stageThreads;
+	std::vector<HANDLE> _threads;
+	volatile LONG _quit;
+	DWORD_PTR _affinity;
+	int _priority;
+
+	/// Status values, indexed by PIXISPipelineStage
+	volatile LONG64 _stageTicks[PIXISStage_Count];
+	volatile LONG64 _stageMaxTicks[PIXISStage_Count];
+	volatile LONG64 _stageReadouts[PIXISStage_Count];
+	volatile LONG _stagePosition[PIXISStage_Count];     // Position in the running pipeline, -1 when it is not run by a thread
+	double _msPerTick;
+};
+#endif
@@ -0,0 +1,213 @@
+/**
+* @file:       PIXISPixelAccumulator.cpp
+*
+* Purpose:     Implements the per-pixel mean and variance accumulator.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISPixelAccumulator.h"
+#include "PIXISAdaptorProps.h"
+#include <stdio.h>
+#include <string.h>
+
+// Pixels added per worker pool tile
+#define PIXIS_ACCUMULATOR_TILE_PIXELS 16384
+
+PIXISPixelAccumulator::PIXISPixelAccumulator() :
+	_enabled(false),
+	_sendImages(true),
+	_saturation(65535),
+	_input(NULL),
+	_pixelCount(0),
+	_first(true),
+	_readouts(0),
+	_meanLevel(0.0),
+	_meanVariance(0.0){
+}
+
+void PIXISPixelAccumulator::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Accumulator", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Pixel values at or above this are left out of the sums
+	hProp = devicePropFact->createIntProperty("Accumulator_Saturation", 1, 65535, 65535);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// With off the readouts are only accumulated and not sent to the engine
+	hProp = devicePropFact->createEnumProperty("Accumulator_Images", "on", 1);
+	devicePropFact->addEnumValue(hProp, "off", 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw float32 mean per pixel of the readout, written when the acquisition ends
+	hProp = devicePropFact->createStringProperty("Accumulator_Mean_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw float32 sample variance per pixel of the readout
+	hProp = devicePropFact->createStringProperty("Accumulator_Variance_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Raw uint32 readouts accumulated per pixel of the readout
+	hProp = devicePropFact->createStringProperty("Accumulator_Count_File", "");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Accumulator_Readouts", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AccumulatorReadouts);
+
+	// Average over the pixels of the mean map, once the acquisition has ended
+	hProp = devicePropFact->createDoubleProperty("Accumulator_Mean_Level", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AccumulatorMeanLevel);
+
+	// Average over the pixels of the variance map, once the acquisition has ended
+	hProp = devicePropFact->createDoubleProperty("Accumulator_Mean_Variance", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_AccumulatorMeanVariance);
+}
+
+void PIXISPixelAccumulator::configure(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight){
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Accumulator"));
+	int* images = static_cast<int*>(propContainer->getPropValue("Accumulator_Images"));
+	int* saturation = static_cast<int*>(propContainer->getPropValue("Accumulator_Saturation"));
+	const char* meanPath = static_cast<const char*>(propContainer->getPropValue("Accumulator_Mean_File"));
+	const char* variancePath = static_cast<const char*>(propContainer->getPropValue("Accumulator_Variance_File"));
+	const char* countPath = static_cast<const char*>(propContainer->getPropValue("Accumulator_Count_File"));
+	_enabled = (*enabled == 1);
+	_sendImages = (*images == 1);
+	_saturation = (pi16u)*saturation;
+	_meanPath = meanPath ? meanPath : "";
+	_variancePath = variancePath ? variancePath : "";
+	_countPath = countPath ? countPath : "";
+	_readouts = 0;
+	_meanLevel = 0.0;
+	_meanVariance = 0.0;
+	if (!_enabled){
+		return;
+	}
+
+	_pixelCount = readoutWidth * readoutHeight;
+	PIXISPixelSums zero = { 0, 0 };
+	_sums.assign(_pixelCount, zero);
+	_counts.assign(_pixelCount, 0);
+	_shift.assign(_pixelCount, 0);
+	_first = true;
+}
+
+void PIXISPixelAccumulator::process(const pi16u* pixels, int width, int height, PIXISWorkerPool* workers){
+	if (width * height != _pixelCount){
+		return;
+	}
+	_input = pixels;
+	int tileCount = (_pixelCount + PIXIS_ACCUMULATOR_TILE_PIXELS - 1) / PIXIS_ACCUMULATOR_TILE_PIXELS;
+	workers->run(accumulateTile, this, tileCount);
+	_first = false;
+	InterlockedIncrement(&_readouts);
+}
+
+//accumulateTile takes the first readout as the shift and adds the difference from it for every readout
+void PIXISPixelAccumulator::accumulateTile(void* context, int tile){
+	PIXISPixelAccumulator* accumulator = reinterpret_cast<PIXISPixelAccumulator*>(context);
+	int begin = tile * PIXIS_ACCUMULATOR_TILE_PIXELS;
+	int end = begin + PIXIS_ACCUMULATOR_TILE_PIXELS < accumulator->_pixelCount ? begin + PIXIS_ACCUMULATOR_TILE_PIXELS : accumulator->_pixelCount;
+
+	const pi16u* in = accumulator->_input;
+	PIXISPixelSums* sums = &accumulator->_sums[0];
+	unsigned int* counts = &accumulator->_counts[0];
+	pi16u* shift = &accumulator->_shift[0];
+	pi16u saturation = accumulator->_saturation;
+
+	if (accumulator->_first){
+		memcpy(shift + begin, in + begin, (end - begin) * sizeof(pi16u));
+	}
+	for (int i = begin; i < end; ++i){
+		pi16u value = in[i];
+		if (value >= saturation){
+			continue;
+		}
+		pi64s difference = (int)value - (int)shift[i];
+		sums[i].sum += difference;
+		sums[i].squares += difference * difference;
+		counts[i]++;
+	}
+}
+
+void PIXISPixelAccumulator::writeMap(const std::string& path, const void* values, size_t size, size_t count){
+	if (path.empty()){
+		return;
+	}
+	FILE* file;
+	if (fopen_s(&file, path.c_str(), "wb") == 0){
+		fwrite(values, size, count, file);
+		fclose(file);
+	}
+	else{
+		char message[MAX_PATH + 64];
+		sprintf_s(message, sizeof(message), "Could not write the accumulator map '%s'.", path.c_str());
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:accumulator", message);
+	}
+}
+
+/**
+* finish works out mean = shift + S / n and variance = (Q - S * S / n) / (n - 1) from the
+* sum S and sum of squares Q of the differences. A pixel with fewer than two readouts
+* has a variance of 0, and with none a mean of 0.
+*/
+void PIXISPixelAccumulator::finish(){
+	if (!_enabled || _sums.empty()){
+		return;
+	}
+
+	std::vector<float> mean(_pixelCount);
+	std::vector<float> variance(_pixelCount);
+	double levelSum = 0.0;
+	double varianceSum = 0.0;
+	int counted = 0;
+	for (int i = 0; i < _pixelCount; ++i){
+		double n = _counts[i];
+		double sum = (double)_sums[i].sum;
+		mean[i] = n > 0.0 ? (float)(_shift[i] + sum / n) : 0.0f;
+		variance[i] = n > 1.0 ? (float)(((double)_sums[i].squares - sum * sum / n) / (n - 1.0)) : 0.0f;
+		if (n > 1.0){
+			levelSum += mean[i];
+			varianceSum += variance[i];
+			counted++;
+		}
+	}
+	_meanLevel = counted ? levelSum / counted : 0.0;
+	_meanVariance = counted ? varianceSum / counted : 0.0;
+
+	writeMap(_meanPath, &mean[0], sizeof(float), mean.size());
+	writeMap(_variancePath, &variance[0], sizeof(float), variance.size());
+	writeMap(_countPath, &_counts[0], sizeof(unsigned int), _counts.size());
+
+	//The sums are only needed again by the next acquisition, which sizes them afresh
+	std::vector<PIXISPixelSums>().swap(_sums);
+	std::vector<unsigned int>().swap(_counts);
+	std::vector<pi16u>().swap(_shift);
+}
+
+bool PIXISPixelAccumulator::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_AccumulatorReadouts:
+		*reinterpret_cast<int*>(value) = _readouts;
+		return true;
+	case PIXISStatus_AccumulatorMeanLevel:
+		*reinterpret_cast<double*>(value) = _meanLevel;
+		return true;
+	case PIXISStatus_AccumulatorMeanVariance:
+		*reinterpret_cast<double*>(value) = _meanVariance;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,107 @@
+/**
+* @file:       PIXISPixelAccumulator.h
+*
+* Purpose:     Class declaration for PIXISPixelAccumulator.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_PIXEL_ACCUMULATOR_HEADER__
+#define __PIXIS_PIXEL_ACCUMULATOR_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include "PIXISWorkerPool.h"
+#include <string>
+#include <vector>
+
+/**
+* Running sums of one pixel, relative to its first value.
+*/
+struct PIXISPixelSums{
+	pi64s sum;
+	pi64s squares;
+};
+
+/**
+* Class PIXISPixelAccumulator
+*
+* @brief:  Keeps per-pixel mean and variance over every readout of an acquisition in
+*          constant memory, for photon transfer curves and noise checks that would
+*          otherwise need thousands of frames in MATLAB.
+*
+*          Each pixel keeps the sum and sum of squares of its difference from its
+*          first value as 64 bit integers. The shift keeps the sums small, so the
+*          variance does not suffer the cancellation of plain paired sums, and the
+*          integers are exact, which Welford's update is not, without a division per
+*          pixel and readout. The two sums of a pixel sit together, and readouts are
+*          added in tiles of contiguous pixels on the worker pool. Pixels at or above
+*          Accumulator_Saturation are left out, so pixels may count different numbers
+*          of readouts.
+*
+*          When the acquisition ends the mean, variance and count maps are written to
+*          Accumulator_Mean_File, Accumulator_Variance_File (raw float32) and
+*          Accumulator_Count_File (raw uint32), and their averages over the readout
+*          are reported in the Accumulator_* status properties, one point of a
+*          photon transfer curve. With Accumulator_Images off the readouts are not
+*          sent to the engine at all.
+*/
+class PIXISPixelAccumulator{
+
+public:
+	PIXISPixelAccumulator();
+
+	// addProperties adds the Accumulator_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure reads the Accumulator_* properties and empties the sums for a readoutWidth x readoutHeight readout. Called from startCapture().
+	void configure(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight);
+
+	bool isEnabled() const { return _enabled; }
+
+	// sendsImages returns false if readouts are only to be accumulated
+	bool sendsImages() const { return _sendImages; }
+
+	// process adds a width x height readout to the sums
+	void process(const pi16u* pixels, int width, int height, PIXISWorkerPool* workers);
+
+	// finish works out the maps, writes them and publishes their averages
+	void finish();
+
+	// getStatus writes the value of an Accumulator_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// accumulateTile is the PIXISWorkerPool::TileFunction adding one run of pixels
+	static void accumulateTile(void* context, int tile);
+
+	// writeMap writes count values of size bytes each to path, if one is given
+	static void writeMap(const std::string& path, const void* values, size_t size, size_t count);
+
+	bool _enabled;
+	bool _sendImages;
+	pi16u _saturation;
+	std::string _meanPath;
+	std::string _variancePath;
+	std::string _countPath;
+
+	/// Per pixel of the readout
+	std::vector<PIXISPixelSums> _sums;
+	std::vector<unsigned int> _counts;
+	std::vector<pi16u> _shift;
+
+	/// Readout being added
+	const pi16u* _input;
+	int _pixelCount;
+	bool _first;
+
+	/// Status values
+	volatile LONG _readouts;
+	double _meanLevel;
+	double _meanVariance;
+};
+#endif
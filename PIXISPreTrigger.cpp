@@ -0,0 +1,262 @@
+/**
+* @file:       PIXISPreTrigger.cpp
+*
+* Purpose:     Implements the ring of readouts from before the trigger.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISPreTrigger.h"
+#include "PIXISAdaptorProps.h"
+#include <stdio.h>
+#include <string.h>
+
+// Wait for the camera to stop after Picam_StopAcquisition, in ms per update
+#define PIXIS_PRE_TRIGGER_STOP_TIMEOUT 1000
+
+PIXISPreTrigger::PIXISPreTrigger() :
+	_capacity(0),
+	_width(0),
+	_height(0),
+	_next(0),
+	_held(0),
+	_holds(0),
+	_running(false),
+	_acquiring(false),
+	_camera(NULL),
+	_stride(0),
+	_savedReadoutCount(1),
+	_restorePending(false),
+	_lastSent(0){
+	InitializeCriticalSection(&_guard);
+	_stopped = CreateEvent(NULL, TRUE, TRUE, NULL);
+}
+
+PIXISPreTrigger::~PIXISPreTrigger(){
+	CloseHandle(_stopped);
+	DeleteCriticalSection(&_guard);
+}
+
+void PIXISPreTrigger::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	// Readouts kept from before the trigger, 0 for none
+	hProp = devicePropFact->createIntProperty("Pre_Trigger_Frames", 0, 10000, 0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Bytes the ring may hold, which can make it hold fewer than Pre_Trigger_Frames readouts
+	hProp = devicePropFact->createDoubleProperty("Pre_Trigger_Max_Bytes", 1.0, 1.0e12, 256.0 * 1024 * 1024);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Pre_Trigger_Capacity", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PreTriggerCapacity);
+
+	hProp = devicePropFact->createIntProperty("Pre_Trigger_Held", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PreTriggerHeld);
+
+	// Readouts from before the trigger sent with the last acquisition
+	hProp = devicePropFact->createIntProperty("Pre_Trigger_Sent", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PreTriggerSent);
+}
+
+bool PIXISPreTrigger::isEnabled(imaqkit::IPropContainer* propContainer){
+	int* frames = static_cast<int*>(propContainer->getPropValue("Pre_Trigger_Frames"));
+	return *frames > 0;
+}
+
+int PIXISPreTrigger::capacityFor(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight){
+	int* frames = static_cast<int*>(propContainer->getPropValue("Pre_Trigger_Frames"));
+	double* maxBytes = static_cast<double*>(propContainer->getPropValue("Pre_Trigger_Max_Bytes"));
+	double readoutBytes = (double)readoutWidth * readoutHeight * sizeof(pi16u);
+	double fitting = readoutBytes > 0.0 ? *maxBytes / readoutBytes : 0.0;
+	return fitting < *frames ? (int)fitting : *frames;
+}
+
+bool PIXISPreTrigger::arm(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight){
+	EnterCriticalSection(&_guard);
+	if (_holds > 0 || _running){
+		LeaveCriticalSection(&_guard);
+		return false;
+	}
+
+	//The ring is allocated here, and never grows while it runs. Held readouts are kept if it stays the same.
+	int capacity = capacityFor(propContainer, readoutWidth, readoutHeight);
+	if (capacity != _capacity || readoutWidth != _width || readoutHeight != _height){
+		_capacity = capacity;
+		_width = readoutWidth;
+		_height = readoutHeight;
+		_next = 0;
+		_held = 0;
+		_pixels.resize((size_t)_capacity * readoutWidth * readoutHeight);
+		_times.resize(_capacity);
+	}
+	if (_capacity == 0){
+		LeaveCriticalSection(&_guard);
+		return false;
+	}
+	_running = true;
+	ResetEvent(_stopped);
+	LeaveCriticalSection(&_guard);
+	return true;
+}
+
+void PIXISPreTrigger::hold(){
+	EnterCriticalSection(&_guard);
+	_holds++;
+	//The acquisition thread sees the stop as an update that is no longer running
+	if (_acquiring){
+		Picam_StopAcquisition(_camera);
+	}
+	LeaveCriticalSection(&_guard);
+	WaitForSingleObject(_stopped, INFINITE);
+}
+
+/**
+* begin makes the readout count 0, which PICam takes as acquiring until stopped. The
+* start is made under _guard, so a hold() either comes first and no acquisition is
+* started, or comes after and stops it.
+*/
+bool PIXISPreTrigger::begin(PicamHandle camera){
+	_camera = camera;
+	Picam_GetParameterIntegerValue(camera, PicamParameter_ReadoutStride, &_stride);
+	//A count that end() could not put back is still the one to restore
+	if (!_restorePending){
+		Picam_GetParameterLargeIntegerValue(camera, PicamParameter_ReadoutCount, &_savedReadoutCount);
+	}
+	_restorePending = true;
+	Picam_SetParameterLargeIntegerValue(camera, PicamParameter_ReadoutCount, 0);
+	const PicamParameter* failedParameterArray;
+	piint failedParameterCount;
+	Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
+	Picam_DestroyParameters(failedParameterArray);
+
+	EnterCriticalSection(&_guard);
+	bool started = false;
+	if (_holds == 0 && failedParameterCount == 0){
+		started = Picam_StartAcquisition(camera) == PicamError_None;
+		if (!started){
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:preTrigger", "The acquisition into the pre-trigger ring could not be started.");
+		}
+	}
+	_acquiring = started;
+	LeaveCriticalSection(&_guard);
+	if (!started){
+		end();
+	}
+	return started;
+}
+
+void PIXISPreTrigger::end(){
+	EnterCriticalSection(&_guard);
+	bool acquiring = _acquiring;
+	_acquiring = false;
+	LeaveCriticalSection(&_guard);
+
+	//The camera finishes the readout in progress before it reports that it stopped. The
+	//readouts it returns meanwhile are the last ones before the trigger, so they are kept.
+	if (acquiring){
+		Picam_StopAcquisition(_camera);
+		PicamAcquisitionStatus status;
+		status.running = TRUE;
+		while (status.running){
+			PicamAvailableData available;
+			available.readout_count = 0;
+			if (Picam_WaitForAcquisitionUpdate(_camera, PIXIS_PRE_TRIGGER_STOP_TIMEOUT, &available, &status) != PicamError_None){
+				break;
+			}
+			if (available.readout_count > 0){
+				push(available, imaqkit::getCurrentTime());
+			}
+		}
+		//Parameters cannot be committed while the camera still runs
+		if (status.running){
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:preTrigger", "The camera did not stop acquiring into the pre-trigger ring. Its ReadoutCount is restored the next time the ring stops.");
+			return;
+		}
+	}
+
+	Picam_SetParameterLargeIntegerValue(_camera, PicamParameter_ReadoutCount, _savedReadoutCount);
+	const PicamParameter* failedParameterArray = NULL;
+	piint failedParameterCount = 0;
+	PicamError error = Picam_CommitParameters(_camera, &failedParameterArray, &failedParameterCount);
+	Picam_DestroyParameters(failedParameterArray);
+	if (error != PicamError_None || failedParameterCount){
+		char message[160];
+		sprintf_s(message, sizeof(message), "The camera's ReadoutCount of %lld could not be restored after the pre-trigger ring.", _savedReadoutCount);
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:preTrigger", message);
+		return;
+	}
+	_restorePending = false;
+}
+
+void PIXISPreTrigger::release(bool discard){
+	EnterCriticalSection(&_guard);
+	_holds--;
+	if (discard){
+		_next = 0;
+		_held = 0;
+	}
+	LeaveCriticalSection(&_guard);
+}
+
+bool PIXISPreTrigger::keepArmed() const{
+	EnterCriticalSection(&_guard);
+	bool armed = _holds == 0;
+	LeaveCriticalSection(&_guard);
+	return armed;
+}
+
+void PIXISPreTrigger::disarmed(){
+	EnterCriticalSection(&_guard);
+	_running = false;
+	SetEvent(_stopped);
+	LeaveCriticalSection(&_guard);
+}
+
+void PIXISPreTrigger::push(const PicamAvailableData& data, double time){
+	size_t readoutPixels = (size_t)_width * _height;
+	const pibyte* readout = static_cast<const pibyte*>(data.initial_readout);
+	for (pi64s i = 0; i < data.readout_count; ++i){
+		memcpy(&_pixels[_next * readoutPixels], readout, readoutPixels * sizeof(pi16u));
+		_times[_next] = time;
+		_next = (_next + 1) % _capacity;
+		if (_held < _capacity){
+			InterlockedIncrement(&_held);
+		}
+		readout += _stride;
+	}
+}
+
+const pi16u* PIXISPreTrigger::getHeld(int index, double* time) const{
+	//Once the ring is full the oldest readout is the one to be overwritten next
+	int slot = (_next - _held + index + _capacity) % _capacity;
+	*time = _times[slot];
+	return &_pixels[slot * (size_t)_width * _height];
+}
+
+void PIXISPreTrigger::sent(){
+	InterlockedExchange(&_lastSent, _held);
+	InterlockedExchange(&_held, 0);
+	_next = 0;
+}
+
+bool PIXISPreTrigger::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_PreTriggerCapacity:
+		*reinterpret_cast<int*>(value) = _capacity;
+		return true;
+	case PIXISStatus_PreTriggerHeld:
+		*reinterpret_cast<int*>(value) = _held;
+		return true;
+	case PIXISStatus_PreTriggerSent:
+		*reinterpret_cast<int*>(value) = _lastSent;
+		return true;
+	}
+	return false;
+}
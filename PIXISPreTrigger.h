@@ -0,0 +1,127 @@
+/**
+* @file:       PIXISPreTrigger.h
+*
+* Purpose:     Class declaration for PIXISPreTrigger.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_PRE_TRIGGER_HEADER__
+#define __PIXIS_PRE_TRIGGER_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include <vector>
+
+/**
+* Class PIXISPreTrigger
+*
+* @brief:  Keeps the last Pre_Trigger_Frames readouts from before the trigger, so the
+*          frames leading up to a transient are logged along with the ones after it.
+*
+*          While the device is open and not acquiring, the acquisition thread runs one
+*          continuous acquisition into a ring of Pre_Trigger_Frames readouts,
+*          allocated once when it is armed, so the memory used does not grow however
+*          long it waits. startCapture() is the trigger: the ring stops and its
+*          readouts go through the pipeline first, oldest first and with the times
+*          they were acquired at, followed by the readouts after the trigger. The held
+*          readouts count towards FramesPerTrigger.
+*
+*          Anything that commits camera parameters holds the ring first, which stops
+*          the acquisition with Picam_StopAcquisition and waits for the camera to
+*          finish the readout in progress, and arms it again afterwards without the
+*          readouts it held, so they always match the current settings. A new
+*          Pre_Trigger_Frames takes effect the next time the ring is armed: when the
+*          device is opened, after an acquisition or after a camera parameter is set.
+*/
+class PIXISPreTrigger{
+
+public:
+	PIXISPreTrigger();
+	virtual ~PIXISPreTrigger();
+
+	// addProperties adds the Pre_Trigger_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// isEnabled returns true if Pre_Trigger_Frames is more than 0
+	static bool isEnabled(imaqkit::IPropContainer* propContainer);
+
+	/**
+	* arm sizes the ring from Pre_Trigger_Frames for readoutWidth x readoutHeight
+	* readouts, unless it is held or already running. A ring of a new size starts empty.
+	*
+	* @return: true if the acquisition thread is to start running the camera into the ring.
+	*/
+	bool arm(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight);
+
+	// hold stops the ring, waiting for the readout in progress, and keeps it stopped until the matching release()
+	void hold();
+
+	/**
+	* begin starts the continuous acquisition into the ring, unless it was held in the
+	* meantime. Called by the acquisition thread after arm().
+	*
+	* @return: true if the camera is acquiring; the thread then waits for updates until they stop.
+	*/
+	bool begin(PicamHandle camera);
+
+	// end waits for the acquisition into the ring to stop, keeping the readouts it returns, and puts back the camera's readout count
+	void end();
+
+	// release undoes a hold(). With discard the held readouts are dropped, as the camera settings changed.
+	void release(bool discard);
+
+	// keepArmed is asked by the acquisition thread before each readout into the ring; once false it calls disarmed()
+	bool keepArmed() const;
+	void disarmed();
+
+	// push copies the readouts of an update into the ring, over the oldest once it is full
+	void push(const PicamAvailableData& data, double time);
+
+	// getHeldCount and getHeld give the readouts in the ring, oldest first. Only while it is held.
+	int getHeldCount() const { return _held; }
+	const pi16u* getHeld(int index, double* time) const;
+	int getWidth() const { return _width; }
+	int getHeight() const { return _height; }
+
+	// sent empties the ring once its readouts have gone into the pipeline
+	void sent();
+
+	// getStatus writes the value of a Pre_Trigger_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// capacityFor returns the readouts that fit in the ring, from Pre_Trigger_Frames and Pre_Trigger_Max_Bytes
+	static int capacityFor(imaqkit::IPropContainer* propContainer, int readoutWidth, int readoutHeight);
+
+	int _capacity;
+	int _width;
+	int _height;
+
+	/// Ring of _capacity readouts; _next is the slot the next readout goes in
+	std::vector<pi16u> _pixels;
+	std::vector<double> _times;
+	int _next;
+	volatile LONG _held;
+
+	/// Arming state, guarded by _guard
+	mutable CRITICAL_SECTION _guard;
+	int _holds;
+	bool _running;
+	bool _acquiring;            // Picam_StartAcquisition was called and hold() must stop it
+	HANDLE _stopped;            // Set when the acquisition thread has left the ring
+
+	/// Camera the ring acquires from, and the values begin() changed
+	PicamHandle _camera;
+	piint _stride;
+	pi64s _savedReadoutCount;
+	bool _restorePending;       // ReadoutCount has not been put back yet
+
+	/// Status values
+	volatile LONG _lastSent;
+};
+#endif
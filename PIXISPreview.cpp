@@ -0,0 +1,243 @@
+/**
+* @file:       PIXISPreview.cpp
+*
+* Purpose:     Implements the binned, rate-limited preview sent to the engine.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISPreview.h"
+#include "PIXISAdaptorProps.h"
+#include "PIXISTraceRecorder.h"
+#include <string.h>
+
+// Preview rows binned by one worker pool tile
+#define PIXIS_PREVIEW_TILE_ROWS 8
+
+PIXISPreview::PIXISPreview() :
+	_binning(1),
+	_interval(0.1),
+	_nextTime(0.0),
+	_pixels(NULL),
+	_width(0),
+	_height(0),
+	_previewWidth(0),
+	_previewHeight(0),
+	_slotWidth(0),
+	_slotHeight(0),
+	_slotTime(0.0),
+	_busy(0),
+	_thread(NULL),
+	_quit(0),
+	_send(NULL),
+	_context(NULL),
+	_workers(NULL),
+	_affinity(0),
+	_priority(THREAD_PRIORITY_NORMAL),
+	_skipped(0){
+	_ready = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+PIXISPreview::~PIXISPreview(){
+	stop();
+	CloseHandle(_ready);
+}
+
+void PIXISPreview::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Preview_Mode", "off", 1);
+	devicePropFact->addEnumValue(hProp, "bin4", 4);
+	devicePropFact->addEnumValue(hProp, "bin8", 8);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createDoubleProperty("Preview_Frame_Rate", 0.1, 1000.0, 10.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Readouts picked for the preview while the previous one was still being binned
+	hProp = devicePropFact->createIntProperty("Preview_Skipped", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PreviewSkipped);
+}
+
+int PIXISPreview::getBinning(imaqkit::IPropContainer* propContainer){
+	int* mode = static_cast<int*>(propContainer->getPropValue("Preview_Mode"));
+	return *mode > 1 ? *mode : 1;
+}
+
+int PIXISPreview::binnedSize(int size, int binning){
+	int bins = size / binning;
+	return bins > 0 ? bins : 1;
+}
+
+void PIXISPreview::configure(imaqkit::IPropContainer* propContainer){
+	_binning = getBinning(propContainer);
+	double* rate = static_cast<double*>(propContainer->getPropValue("Preview_Frame_Rate"));
+	_interval = 1.0 / *rate;
+	_nextTime = 0.0;
+	_skipped = 0;
+}
+
+void PIXISPreview::start(SendFunction fn, void* context, PIXISWorkerPool* workers){
+	_send = fn;
+	_context = context;
+	_workers = workers;
+	_busy = 0;
+	_quit = 0;
+	if (isEnabled()){
+		_thread = CreateThread(NULL, 0, previewThread, this, 0, NULL);
+		if (_thread && _affinity){
+			SetThreadAffinityMask(_thread, _affinity);
+		}
+		if (_thread){
+			SetThreadPriority(_thread, _priority);
+		}
+	}
+}
+
+void PIXISPreview::setScheduling(DWORD_PTR affinity, int priority){
+	_affinity = affinity;
+	_priority = priority;
+}
+
+void PIXISPreview::drain(){
+	while (_busy){
+		Sleep(1);
+	}
+}
+
+void PIXISPreview::stop(){
+	if (_thread == NULL){
+		return;
+	}
+	drain();
+	_quit = 1;
+	SetEvent(_ready);
+	WaitForSingleObject(_thread, INFINITE);
+	CloseHandle(_thread);
+	_thread = NULL;
+}
+
+bool PIXISPreview::offer(const pi16u* pixels, int width, int height, double time){
+	if (_thread == NULL){
+		_send(_context, process(pixels, width, height, _workers), time);
+		return true;
+	}
+	if (InterlockedCompareExchange(&_busy, 1, 0) != 0){
+		InterlockedIncrement(&_skipped);
+		return false;
+	}
+	_slot.resize((size_t)width * height);
+	memcpy(&_slot[0], pixels, _slot.size() * sizeof(pi16u));
+	_slotWidth = width;
+	_slotHeight = height;
+	_slotTime = time;
+	SetEvent(_ready);
+	return true;
+}
+
+DWORD WINAPI PIXISPreview::previewThread(void* param){
+	PIXISPreview* preview = reinterpret_cast<PIXISPreview*>(param);
+	PIXISTraceRecorder::nameThread("Preview");
+	while (WaitForSingleObject(preview->_ready, INFINITE) == WAIT_OBJECT_0 && !preview->_quit){
+		{
+			PIXISTraceScope scope("Preview");
+			const pibyte* image = preview->process(&preview->_slot[0], preview->_slotWidth, preview->_slotHeight, preview->_workers);
+			preview->_send(preview->_context, image, preview->_slotTime);
+		}
+		InterlockedExchange(&preview->_busy, 0);
+	}
+	return 0;
+}
+
+bool PIXISPreview::getStatus(int id, void* value) const{
+	if (id != PIXISStatus_PreviewSkipped){
+		return false;
+	}
+	*reinterpret_cast<int*>(value) = _skipped;
+	return true;
+}
+
+bool PIXISPreview::isDue(double time){
+	if (time < _nextTime){
+		return false;
+	}
+	//After a gap in the readouts the schedule restarts from now instead of catching up
+	_nextTime += _interval;
+	if (_nextTime <= time){
+		_nextTime = time + _interval;
+	}
+	return true;
+}
+
+const pibyte* PIXISPreview::process(const pi16u* pixels, int width, int height, PIXISWorkerPool* workers){
+	_pixels = pixels;
+	_width = width;
+	_height = height;
+	_previewWidth = binnedSize(width, _binning);
+	_previewHeight = binnedSize(height, _binning);
+	int previewCount = _previewWidth * _previewHeight;
+	_sums.resize(previewCount);
+	_image.resize(previewCount);
+
+	int tileCount = (_previewHeight + PIXIS_PREVIEW_TILE_ROWS - 1) / PIXIS_PREVIEW_TILE_ROWS;
+	workers->run(binTile, this, tileCount);
+
+	//The binned frame is small, so the display range is found serially
+	pi32u low = _sums[0];
+	pi32u high = _sums[0];
+	for (int i = 1; i < previewCount; ++i){
+		if (_sums[i] < low) low = _sums[i];
+		if (_sums[i] > high) high = _sums[i];
+	}
+	pi32u range = high > low ? high - low : 1;
+	for (int i = 0; i < previewCount; ++i){
+		_image[i] = (pibyte)(((pi64u)(_sums[i] - low) * 255) / range);
+	}
+
+	_pixels = NULL;
+	return &_image[0];
+}
+
+void PIXISPreview::binTile(void* context, int tile){
+	PIXISPreview* preview = reinterpret_cast<PIXISPreview*>(context);
+
+	int binning = preview->_binning;
+	int width = preview->_width;
+	int rowEnd = (tile + 1) * PIXIS_PREVIEW_TILE_ROWS;
+	if (rowEnd > preview->_previewHeight){
+		rowEnd = preview->_previewHeight;
+	}
+
+	for (int py = tile * PIXIS_PREVIEW_TILE_ROWS; py < rowEnd; ++py){
+		pi32u* sums = &preview->_sums[(size_t)py * preview->_previewWidth];
+		for (int px = 0; px < preview->_previewWidth; ++px){
+			sums[px] = 0;
+		}
+
+		//A readout smaller than one bin is binned as far as it goes
+		int yEnd = (py + 1) * binning;
+		if (yEnd > preview->_height){
+			yEnd = preview->_height;
+		}
+		for (int y = py * binning; y < yEnd; ++y){
+			const pi16u* row = preview->_pixels + (size_t)y * width;
+			for (int px = 0; px < preview->_previewWidth; ++px){
+				int xEnd = (px + 1) * binning;
+				if (xEnd > width){
+					xEnd = width;
+				}
+				pi32u sum = 0;
+				for (int x = px * binning; x < xEnd; ++x){
+					sum += row[x];
+				}
+				sums[px] += sum;
+			}
+		}
+	}
+}
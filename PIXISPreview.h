@@ -0,0 +1,130 @@
+/**
+* @file:       PIXISPreview.h
+*
+* Purpose:     Class declaration for PIXISPreview.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_PREVIEW_HEADER__
+#define __PIXIS_PREVIEW_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include "PIXISWorkerPool.h"
+#include <vector>
+
+/**
+* Class PIXISPreview
+*
+* @brief:  Turns the engine stream into a low-rate preview. With Preview_Mode set to
+*          bin4 or bin8 the engine is sent MONO8 frames binned 4x4 or 8x8, at most
+*          Preview_Frame_Rate per second. Every readout still goes to the shared-memory
+*          ring and the per-readout processing at the full rate and resolution; only the
+*          readouts picked for the preview are binned.
+*
+*          Each preview frame is scaled from its own minimum to its maximum, so no
+*          display range needs to be set.
+*
+*          The binning runs on a preview thread of its own, so the stage only copies a
+*          picked readout into a single slot and goes on with the next one. The
+*          preview thread bins the slot and sends the frame. A readout picked while
+*          the previous one is still being binned is skipped, and counted in
+*          Preview_Skipped, so a slow preview never holds up the pipeline.
+*/
+class PIXISPreview{
+
+public:
+	// Called on the preview thread with every binned frame
+	typedef void (*SendFunction)(void* context, const pibyte* image, double time);
+
+	PIXISPreview();
+	virtual ~PIXISPreview();
+
+	// addProperties adds the Preview_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// getBinning returns the current Preview_Mode binning, or 1 if the preview is off
+	static int getBinning(imaqkit::IPropContainer* propContainer);
+
+	// binnedSize returns the number of whole bins along a readout dimension, at least 1
+	static int binnedSize(int size, int binning);
+
+	// configure reads the Preview_* properties. Called from startCapture().
+	void configure(imaqkit::IPropContainer* propContainer);
+
+	bool isEnabled() const { return _binning > 1; }
+
+	// isDue returns true if the readout taken at time (s) should become a preview frame
+	bool isDue(double time);
+
+	// start starts the preview thread, with the preview on. Without the thread offer() bins inline.
+	void start(SendFunction fn, void* context, PIXISWorkerPool* workers);
+
+	// setScheduling sets the affinity (0 for any processor) and priority of the thread started next
+	void setScheduling(DWORD_PTR affinity, int priority);
+
+	// drain waits until the frame being binned has been sent
+	void drain();
+
+	// stop drains and ends the preview thread
+	void stop();
+
+	/**
+	* offer hands a width x height readout taken at time to the preview thread, which
+	* copies it and returns without waiting for the binning.
+	*
+	* @return: false if the previous readout is still being binned, and this one was skipped.
+	*/
+	bool offer(const pi16u* pixels, int width, int height, double time);
+
+	// getStatus writes the value of a Preview_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	static DWORD WINAPI previewThread(void* param);
+
+	// process bins a width x height readout into an 8 bit preview frame, valid until the next call
+	const pibyte* process(const pi16u* pixels, int width, int height, PIXISWorkerPool* workers);
+
+	// binTile sums the bins of PIXIS_PREVIEW_TILE_ROWS preview rows
+	static void binTile(void* context, int tile);
+
+	int _binning;
+	double _interval;           // s between preview frames
+	double _nextTime;
+
+	/// Readout being binned, set for the duration of process()
+	const pi16u* _pixels;
+	int _width;
+	int _height;
+	int _previewWidth;
+	int _previewHeight;
+
+	std::vector<pi32u> _sums;
+	std::vector<pibyte> _image;
+
+	/// Slot the stage fills and the preview thread bins; _busy from offer() until the frame is sent
+	std::vector<pi16u> _slot;
+	int _slotWidth;
+	int _slotHeight;
+	double _slotTime;
+	volatile LONG _busy;
+
+	HANDLE _thread;
+	HANDLE _ready;              // Auto-reset, set when the slot is filled or the thread is to quit
+	volatile LONG _quit;
+	SendFunction _send;
+	void* _context;
+	PIXISWorkerPool* _workers;
+	DWORD_PTR _affinity;
+	int _priority;
+
+	/// Status values
+	volatile LONG _skipped;
+};
+#endif
@@ -16,6 +16,7 @@
 #include "assert.h"
 #include "PIXISPropGetListener.h"
 #include "picam_advanced.h"
+#include "PIXISAdaptorProps.h"
 #include <vector>
 #include <algorithm>
 
@@ -24,12 +25,23 @@ void PIXISPropGetListener::getValue(imaqkit::IPropInfo* propertyInfo, void* valu
 	const char* propname = propertyInfo->getPropertyName();
 	int propertyID = propertyInfo->getPropertyIdentifier();
 
+	//Adaptor status properties are answered by the adaptor without querying the camera
+	if (isAdaptorStatusProperty(propertyID)){
+		_parent->getAdaptorStatus(propertyID, value);
+		return;
+	}
+
 	PicamParameter parameter = static_cast<PicamParameter>(propertyID);
 	PicamValueType type;
 	PicamHandle camera;
 	PicamHandle inputCamera;
 	inputCamera = _parent->getCameraHandle();
 
+	//While replaying a file there is no camera, and the property keeps its value
+	if (inputCamera == NULL){
+		return;
+	}
+
 	PicamAdvanced_GetCameraModel(inputCamera, &camera);
 	PicamAdvanced_RefreshParametersFromCameraDevice(camera);  //This call is necessary to refresh parameters
 															  //without it you won't get current values
@@ -15,11 +15,14 @@
 
 #include "PIXISPropSetListener.h"
 #include "picam_advanced.h"
+#include "PIXISAdaptorProps.h"
+#include "PIXISTraceRecorder.h"
 
 void PIXISPropSetListener::notify(imaqkit::IPropInfo* propertyInfo, void* newValue) {
 	if (newValue) {
 		// Store a handle to the imaqkit::IPropInfo object passed in.
 		_propInfo = propertyInfo;
+		PIXISTraceScope scope("PropertySet", _propInfo->getPropertyIdentifier());
 
 		// Cast newValue to its appropriate type by checking the property type.
 		switch (_propInfo->getPropertyStorageType()) {
@@ -45,12 +48,20 @@ void PIXISPropSetListener::notify(imaqkit::IPropInfo* propertyInfo, void* newVal
 			// value properties, anything else should cause an assertion error.
 		}
 
-		// Do not re-configure the property value unless the device is already
-		// opened.
-		if (_parent->isOpen()) {
-			// Apply the value to the hardware.
-			applyValue();
+		// Adaptor commands do not touch the camera parameters, so they never stop the acquisition
+		if (isAdaptorCommandProperty(_propInfo->getPropertyIdentifier())) {
+			_parent->applyAdaptorCommand(_propInfo->getPropertyIdentifier(), newValue);
+			return;
 		}
+
+		// While replaying a file there is no camera to apply the value to
+		if (_parent->getCameraHandle() == NULL) {
+			return;
+		}
+
+		// Apply the value to the hardware. The camera is opened when the adaptor
+		// is created, so this does not wait for the device to be opened, and it is
+		// only done once so the acquisition is not stopped and restarted twice.
 		applyValue();
 	}
 }
@@ -58,20 +69,6 @@ void PIXISPropSetListener::notify(imaqkit::IPropInfo* propertyInfo, void* newVal
 //Applies the parameter value to the PIXIS camera
 void PIXISPropSetListener::applyValue() {
 
-	// If device cannot be configured while acquiring data, stop the device,
-	// configure the feature, then restart the device.
-
-	bool wasAcquiring = _parent->isAcquiring();
-	if (wasAcquiring) {
-		// Note: calling stop() will change the acquiring flag to false.
-		// When the device tries to restart it invokes
-		// PIXISAdaptorClass::startCapture() which triggers notification for all
-		// property listeners. Since the device is not acquiring data during
-		// this second notification, the device will not stop and restart
-		// again.
-		_parent->stop();
-	}
-
 	// Get the property name and ID
 	char* propName = const_cast<char*>(_propInfo->getPropertyName());
 	int propertyID = _propInfo->getPropertyIdentifier();
@@ -96,10 +93,44 @@ void PIXISPropSetListener::applyValue() {
 		const char* paramName;
 		Picam_GetEnumerationString(PicamEnumeratedType_Parameter, parameter, &paramName);
 	}
+
+	// The engine sets every property again when it starts. Values the camera already
+	// has are not committed again, so they do not hold up the pre-trigger ring.
+	// Kinetics is still set up again each time it is chosen.
+	bool kinetics = parameter == PicamParameter_ReadoutControlMode && _lastIntValue == PicamReadoutControlMode_Kinetics;
+	if (!kinetics && isCameraValue(camera, parameter, type, propertyID)) {
+		return;
+	}
+
+	// Parameters the camera can change while it runs are applied without
+	// interrupting the acquisition.
+	bool wasAcquiring = _parent->isAcquiring();
+	if (wasAcquiring && applyOnline(camera, parameter, type)) {
+		return;
+	}
+
+	// If device cannot be configured while acquiring data, stop the device,
+	// configure the feature, then restart the device.
+	if (wasAcquiring) {
+		// Note: calling stop() will change the acquiring flag to false.
+		// When the device tries to restart it invokes
+		// PIXISAdaptorClass::startCapture() which triggers notification for all
+		// property listeners. Since the device is not acquiring data during
+		// this second notification, the device will not stop and restart
+		// again.
+		PIXISTraceScope scope("Stop");
+		_parent->stop();
+	}
 	
+	// The pre-trigger ring holds the camera between acquisitions. It is armed again
+	// afterwards, so the readouts it keeps are all taken with the new value.
+	_parent->holdPreTrigger();
+
 	const PicamParameter *failedParameterArray;
 	piint failedParameterCount;
 
+	//Traced through the restart, if the device was stopped
+	PIXISTraceScope commitScope("Commit", propertyID);
 	switch (type){
 	case PicamValueType_Integer:
 		Picam_SetParameterIntegerValue(camera, parameter, _lastIntValue);
@@ -120,78 +151,17 @@ void PIXISPropSetListener::applyValue() {
 		break;
 
 	case PicamValueType_Enumeration:
+		Picam_SetParameterIntegerValue(camera, parameter, _lastIntValue);
 		if (_lastIntValue == PicamReadoutControlMode_Kinetics && parameter == PicamParameter_ReadoutControlMode){
-			imaqkit::adaptorWarn("PIXISCameraAdaptor:hoot", "It's a Kinetics Update!");
-			Picam_SetParameterIntegerValue(camera, PicamParameter_TriggerResponse, 5);
-
-			Picam_SetParameterIntegerValue(camera, parameter, _lastIntValue);
-			Picam_SetParameterFloatingPointValue(camera, PicamParameter_ExposureTime, 10);
-			Picam_SetParameterIntegerValue(camera, PicamParameter_KineticsWindowHeight, 128);
-			const PicamRoisConstraint   *ptrConstraint;	 // Constraints			
-
-			PicamRois				    roiSetup;		 // region of interest  setup
-			PicamRoi					theKineticsROI;
-			piint framesPerReadout = 0;
-			// Variables to compute data blob sizes 
-			piint readoutHeight = 0;      // Height of Readout (in pixels)
-			piint readoutWidth = 0;      // Width  of Readout (in pixels)
-			piint singleFrameHeight = 0;      // Height of single Kinetics frame (in pixels)
-
-			Picam_GetParameterRoisConstraint(camera, PicamParameter_Rois, PicamConstraintCategory_Required, &ptrConstraint);
-
-			// Get width and height of accessible region from current constraints 
-			readoutWidth = (piint)ptrConstraint->width_constraint.maximum;
-			singleFrameHeight = (piint)ptrConstraint->height_constraint.maximum;
-
-			// Deallocate constraints after using access 
-			Picam_DestroyRoisConstraints(ptrConstraint);
-			Picam_GetParameterIntegerValue(camera,PicamParameter_FramesPerReadout, &framesPerReadout);
-			readoutHeight = singleFrameHeight * framesPerReadout;
-
-			// setup the roiSetup object count and pointer 
-			roiSetup.roi_count = 1;
-			roiSetup.roi_array = &theKineticsROI;
-
-			// The ROI structure should hold the size of a single kinetics capture ROI 
-			theKineticsROI.height = singleFrameHeight;
-			theKineticsROI.width = readoutWidth;
-
-			// The ROI structure should hold the location of this ROI (upper left corner of window)
-			theKineticsROI.x = 0;
-			theKineticsROI.y = 0;
-
-			// The vertical and horizontal binning 
-			theKineticsROI.x_binning = 1;
-			theKineticsROI.y_binning = 1;
-			Picam_SetParameterRoisValue(camera, PicamParameter_Rois, &roiSetup);
-		}
-		else{
-			Picam_SetParameterIntegerValue(camera, parameter, _lastIntValue);
+			// Window, timing and ROI come from the Kinetics_* properties, checked
+			// against the camera's constraints
+			_parent->setupKinetics();
 		}
 		
 		Picam_CommitParameters(camera, &failedParameterArray, &failedParameterCount);
 		if (failedParameterCount){
 			imaqkit::adaptorWarn("PIXISCameraAdaptor:hoot", "Failed to Commit a Parameter");
 		}
-
-		if (_lastIntValue == PicamReadoutControlMode_Kinetics && parameter == PicamParameter_ReadoutControlMode){
-			const PicamCollectionConstraint* capable;
-			const pichar* stringEnum;
-			Picam_GetParameterCollectionConstraint(camera, PicamParameter_TriggerResponse, PicamConstraintCategory_Capable, &capable);
-			
-			PicamHandle newCamera;
-			PicamAdvanced_GetCameraModel(camera, &newCamera);
-			PicamAdvanced_RefreshParametersFromCameraDevice(newCamera);
-			Picam_GetParameterCollectionConstraint(newCamera, PicamParameter_TriggerResponse, PicamConstraintCategory_Capable, &capable);
-
-			for (piint j = 0; j < capable->values_count; ++j){
-				Picam_GetEnumerationString(PicamEnumeratedType_TriggerResponse, capable->values_array[j], &stringEnum);
-				imaqkit::adaptorWarn("PIXISCameraAdaptor:hoot", stringEnum);
-			}
-			Picam_DestroyString(stringEnum);
-			Picam_DestroyCollectionConstraints(capable);
-
-		}
 		break;
 
 
@@ -256,12 +226,99 @@ void PIXISPropSetListener::applyValue() {
 		break;
 	}
 
+	_parent->releasePreTrigger(true);
+
 	// Restart the device if it was momentarily stopped to update the feature.
 	if (wasAcquiring) {
 		// Restart the device. This invokes DemoAdaptor::startCapture() which
 		// invoke all property listeners.
+		PIXISTraceScope scope("Restart");
 		_parent->restart();
 	}
 	Picam_DestroyParameters(failedParameterArray);
 }
 
+//applyOnline sets the parameter with Picam_Set*ValueOnline if the camera allows it to
+//change during acquisition. Returns false if the parameter needs the full stop/restart.
+bool PIXISPropSetListener::applyOnline(PicamHandle camera, PicamParameter parameter, PicamValueType type) {
+	// ROI, pulse and modulation values cannot be set online
+	if (type != PicamValueType_Integer &&
+		type != PicamValueType_Boolean &&
+		type != PicamValueType_Enumeration &&
+		type != PicamValueType_FloatingPoint) {
+		return false;
+	}
+
+	pibln onlineable = false;
+	if (Picam_CanSetParameterOnline(camera, parameter, &onlineable) != PicamError_None || !onlineable) {
+		return false;
+	}
+
+	PicamError error;
+	if (type == PicamValueType_FloatingPoint) {
+		error = Picam_SetParameterFloatingPointValueOnline(camera, parameter, _lastDoubleValue);
+	}
+	else {
+		error = Picam_SetParameterIntegerValueOnline(camera, parameter, _lastIntValue);
+	}
+
+	// The camera refuses online changes between readouts, in which case the
+	// value goes through the normal commit
+	if (error != PicamError_None) {
+		return false;
+	}
+
+	_parent->onlineParameterChanged();
+	return true;
+}
+
+//isCameraValue returns true if the new value is the one the camera already has committed
+bool PIXISPropSetListener::isCameraValue(PicamHandle camera, PicamParameter parameter, PicamValueType type, int propertyID) {
+	// Values left on the handle by a commit that failed are not what the camera
+	// uses, so setting one of them again has to commit it again
+	pibln committed;
+	if (Picam_AreParametersCommitted(camera, &committed) != PicamError_None || !committed) {
+		return false;
+	}
+
+	piint intValue;
+	pi64s largeValue;
+	piflt doubleValue;
+	switch (type){
+	case PicamValueType_Integer:
+	case PicamValueType_Boolean:
+	case PicamValueType_Enumeration:
+		return Picam_GetParameterIntegerValue(camera, parameter, &intValue) == PicamError_None && intValue == _lastIntValue;
+
+	case PicamValueType_LargeInteger:
+		return Picam_GetParameterLargeIntegerValue(camera, parameter, &largeValue) == PicamError_None && largeValue == _lastIntValue;
+
+	case PicamValueType_FloatingPoint:
+		return Picam_GetParameterFloatingPointValue(camera, parameter, &doubleValue) == PicamError_None && doubleValue == _lastDoubleValue;
+
+	case PicamValueType_Rois:{
+		//Read the ROI as applyValue() does, after refreshing the model from the camera
+		const PicamRois* region;
+		PicamHandle modelCamera;
+		if (PicamAdvanced_GetCameraModel(camera, &modelCamera) != PicamError_None ||
+			PicamAdvanced_RefreshParametersFromCameraDevice(modelCamera) != PicamError_None ||
+			Picam_GetParameterRoisValue(camera, PicamParameter_Rois, &region) != PicamError_None){
+			return false;
+		}
+		if (region->roi_count < 1){
+			Picam_DestroyRois(region);
+			return false;
+		}
+		const PicamRoi& roi = region->roi_array[0];
+		piint values[] = { 0, roi.height, roi.width, roi.x, roi.y, roi.x_binning, roi.y_binning };
+		int subID = propertyID - PicamParameter_Rois;
+		bool same = subID >= 1 && subID <= 6 && values[subID] == _lastIntValue;
+		Picam_DestroyRois(region);
+		return same;
+	}
+	case PicamValueType_Pulse:
+	case PicamValueType_Modulations:
+		return true;
+	}
+	return false;
+}
@@ -22,6 +22,20 @@ private:
 	*/
 	virtual void applyValue(void);
 
+	/**
+	* applyOnline: Set the parameter without stopping the acquisition, if the camera allows it.
+	*
+	* @return bool: false if the parameter has to be committed with the acquisition stopped.
+	*/
+	bool applyOnline(PicamHandle camera, PicamParameter parameter, PicamValueType type);
+
+	/**
+	* isCameraValue: Compare the new value with the one the camera has committed.
+	*
+	* @return bool: true if there is nothing to commit.
+	*/
+	bool isCameraValue(PicamHandle camera, PicamParameter parameter, PicamValueType type, int propertyID);
+
 	/// Property Information object.
 	imaqkit::IPropInfo* _propInfo;
 
@@ -0,0 +1,316 @@
+/**
+* @file:       PIXISReadoutPlanner.cpp
+*
+* Purpose:     Implements readout time and frame rate planning from PICam's calculation
+*              parameters.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISReadoutPlanner.h"
+#include "PIXISAdaptorProps.h"
+#include "picam_advanced.h"
+#include <limits.h>
+#include <string.h>
+
+void PIXISReadoutPlanner::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	// The candidate. Zero keeps the camera's current value; a zero ROI width or height keeps the whole current ROI.
+	hProp = devicePropFact->createDoubleProperty("Plan_ADC_Speed", 0.0);
+	devicePropFact->addProperty(hProp);
+
+	const char* intNames[] = { "Plan_ADC_Quality", "Plan_ROI_X", "Plan_ROI_Y", "Plan_ROI_Width", "Plan_ROI_Height",
+		"Plan_X_Binning", "Plan_Y_Binning", "Plan_Kinetics_Window_Height" };
+	for (int i = 0; i < sizeof(intNames) / sizeof(intNames[0]); ++i){
+		hProp = devicePropFact->createIntProperty(intNames[i], 0, INT_MAX, 0);
+		devicePropFact->addProperty(hProp);
+	}
+
+	// Requirements used by find_fastest: the slowest ADC speed gives the lowest read noise,
+	// the binning limits keep the required resolution. A zero speed limit allows any speed.
+	hProp = devicePropFact->createDoubleProperty("Plan_Max_ADC_Speed", 0.0);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Plan_Max_X_Binning", 1, PIXIS_PLAN_MAX_BINNING, 1);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Plan_Max_Y_Binning", 1, PIXIS_PLAN_MAX_BINNING, 1);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createEnumProperty("Plan_Request", "none", PIXISPlanRequest_None);
+	devicePropFact->addEnumValue(hProp, "evaluate", PIXISPlanRequest_Evaluate);
+	devicePropFact->addEnumValue(hProp, "find_fastest", PIXISPlanRequest_FindFastest);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->setIdentifier(hProp, PIXISCommand_PlanRequest);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Plan_Valid", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PlanValid);
+
+	hProp = devicePropFact->createDoubleProperty("Plan_Readout_Time", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PlanReadoutTime);
+
+	hProp = devicePropFact->createDoubleProperty("Plan_Frame_Rate", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PlanFrameRate);
+
+	hProp = devicePropFact->createDoubleProperty("Plan_Data_Rate", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_PlanDataRate);
+}
+
+bool PIXISReadoutPlanner::applyCommand(int id, void* newValue, PicamHandle camera, imaqkit::IPropContainer* propContainer, bool acquiring){
+	if (id != PIXISCommand_PlanRequest){
+		return false;
+	}
+
+	int request = *static_cast<int*>(newValue);
+	if (request == PIXISPlanRequest_None){
+		return true;
+	}
+	if (acquiring){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:plan", "Plan_Request is ignored while acquiring.");
+		return true;
+	}
+
+	PicamHandle model;
+	PicamAdvanced_GetCameraModel(camera, &model);
+
+	PIXISReadoutPlan plan;
+	PIXISReadoutPrediction prediction;
+	if (!readPlan(model, propContainer, plan)){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:plan", "The camera's ROI could not be read, so nothing was planned.");
+		return true;
+	}
+
+	if (request == PIXISPlanRequest_FindFastest){
+		if (findFastest(model, propContainer, plan, prediction)){
+			writePlan(propContainer, plan);
+		}
+		else{
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:plan", "No capable configuration meets the Plan requirements.");
+		}
+	}
+	else{
+		predict(model, plan, prediction);
+		if (!prediction.valid){
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:plan", "PICam rejected the planned configuration.");
+		}
+	}
+
+	_latest.publish(prediction);
+	return true;
+}
+
+bool PIXISReadoutPlanner::readPlan(PicamHandle model, imaqkit::IPropContainer* propContainer, PIXISReadoutPlan& plan) const{
+	plan.adcSpeed = *static_cast<double*>(propContainer->getPropValue("Plan_ADC_Speed"));
+	plan.adcQuality = *static_cast<int*>(propContainer->getPropValue("Plan_ADC_Quality"));
+	plan.roi.x = *static_cast<int*>(propContainer->getPropValue("Plan_ROI_X"));
+	plan.roi.y = *static_cast<int*>(propContainer->getPropValue("Plan_ROI_Y"));
+	plan.roi.width = *static_cast<int*>(propContainer->getPropValue("Plan_ROI_Width"));
+	plan.roi.height = *static_cast<int*>(propContainer->getPropValue("Plan_ROI_Height"));
+	plan.roi.x_binning = *static_cast<int*>(propContainer->getPropValue("Plan_X_Binning"));
+	plan.roi.y_binning = *static_cast<int*>(propContainer->getPropValue("Plan_Y_Binning"));
+	plan.kineticsWindowHeight = *static_cast<int*>(propContainer->getPropValue("Plan_Kinetics_Window_Height"));
+
+	//Fill in everything left at zero from the model
+	if (plan.adcSpeed <= 0.0){
+		Picam_GetParameterFloatingPointValue(model, PicamParameter_AdcSpeed, &plan.adcSpeed);
+	}
+	if (plan.adcQuality == 0){
+		Picam_GetParameterIntegerValue(model, PicamParameter_AdcQuality, &plan.adcQuality);
+	}
+
+	const PicamRois* region;
+	if (Picam_GetParameterRoisValue(model, PicamParameter_Rois, &region) != PicamError_None){
+		return false;
+	}
+	if (region->roi_count < 1){
+		Picam_DestroyRois(region);
+		return false;
+	}
+	if (plan.roi.width == 0 || plan.roi.height == 0){
+		plan.roi.x = region->roi_array[0].x;
+		plan.roi.y = region->roi_array[0].y;
+		plan.roi.width = region->roi_array[0].width;
+		plan.roi.height = region->roi_array[0].height;
+	}
+	if (plan.roi.x_binning == 0){
+		plan.roi.x_binning = region->roi_array[0].x_binning;
+	}
+	if (plan.roi.y_binning == 0){
+		plan.roi.y_binning = region->roi_array[0].y_binning;
+	}
+	Picam_DestroyRois(region);
+	return true;
+}
+
+void PIXISReadoutPlanner::writePlan(imaqkit::IPropContainer* propContainer, const PIXISReadoutPlan& plan) const{
+	double adcSpeed = plan.adcSpeed;
+	int xBinning = plan.roi.x_binning;
+	int yBinning = plan.roi.y_binning;
+	int width = plan.roi.width;
+	int height = plan.roi.height;
+	propContainer->setPropValue("Plan_ADC_Speed", &adcSpeed);
+	propContainer->setPropValue("Plan_X_Binning", &xBinning);
+	propContainer->setPropValue("Plan_Y_Binning", &yBinning);
+	propContainer->setPropValue("Plan_ROI_Width", &width);
+	propContainer->setPropValue("Plan_ROI_Height", &height);
+}
+
+/**
+* predict only ever sets values on the camera model, and puts the original values back
+* before returning, also when a set fails partway through. The calculation parameters
+* are derived by PICam from the current, uncommitted values, so the camera device never
+* sees the candidate. Nothing is set unless every value it overwrites could be saved.
+*/
+void PIXISReadoutPlanner::predict(PicamHandle model, const PIXISReadoutPlan& plan, PIXISReadoutPrediction& prediction) const{
+	memset(&prediction, 0, sizeof(prediction));
+
+	//Save the values the candidate overwrites
+	piflt adcSpeed = 0.0;
+	piint adcQuality = 0;
+	piint kineticsWindowHeight = 0;
+	pibln hasQuality = false;
+	pibln hasKinetics = false;
+	const PicamRois* region;
+
+	Picam_DoesParameterExist(model, PicamParameter_AdcQuality, &hasQuality);
+	Picam_IsParameterRelevant(model, PicamParameter_KineticsWindowHeight, &hasKinetics);
+	if (Picam_GetParameterFloatingPointValue(model, PicamParameter_AdcSpeed, &adcSpeed) != PicamError_None ||
+		(hasQuality && Picam_GetParameterIntegerValue(model, PicamParameter_AdcQuality, &adcQuality) != PicamError_None) ||
+		(hasKinetics && Picam_GetParameterIntegerValue(model, PicamParameter_KineticsWindowHeight, &kineticsWindowHeight) != PicamError_None)){
+		return;
+	}
+	if (Picam_GetParameterRoisValue(model, PicamParameter_Rois, &region) != PicamError_None){
+		return;
+	}
+
+	//The ADC speeds a camera offers depend on the quality, so quality goes first
+	PicamRoi roi = plan.roi;
+	PicamRois candidateRois;
+	candidateRois.roi_array = &roi;
+	candidateRois.roi_count = 1;
+
+	bool valid = true;
+	if (hasQuality){
+		valid = valid && Picam_SetParameterIntegerValue(model, PicamParameter_AdcQuality, plan.adcQuality) == PicamError_None;
+	}
+	valid = valid && Picam_SetParameterFloatingPointValue(model, PicamParameter_AdcSpeed, plan.adcSpeed) == PicamError_None;
+	valid = valid && Picam_SetParameterRoisValue(model, PicamParameter_Rois, &candidateRois) == PicamError_None;
+	if (hasKinetics && plan.kineticsWindowHeight > 0){
+		valid = valid && Picam_SetParameterIntegerValue(model, PicamParameter_KineticsWindowHeight, plan.kineticsWindowHeight) == PicamError_None;
+	}
+
+	//A set only checks a value against its own constraints; the candidate as a whole is checked by PICam
+	if (valid){
+		const PicamParameter* failedParameterArray = NULL;
+		piint failedParameterCount = 0;
+		valid = Picam_ValidateParameters(model, &failedParameterArray, &failedParameterCount) == PicamError_None &&
+			failedParameterCount == 0;
+		Picam_DestroyParameters(failedParameterArray);
+	}
+
+	if (valid){
+		piint readoutStride = 0;
+		Picam_GetParameterFloatingPointValue(model, PicamParameter_ReadoutTimeCalculation, &prediction.readoutTime);
+		Picam_GetParameterFloatingPointValue(model, PicamParameter_FrameRateCalculation, &prediction.frameRate);
+		Picam_GetParameterIntegerValue(model, PicamParameter_ReadoutStride, &readoutStride);
+		prediction.dataRate = readoutStride * prediction.frameRate / 1.0e6;
+		prediction.valid = 1;
+	}
+
+	//Put the model back the way it was. Every value is restored, whichever set failed.
+	bool restored = true;
+	if (hasQuality){
+		restored = Picam_SetParameterIntegerValue(model, PicamParameter_AdcQuality, adcQuality) == PicamError_None && restored;
+	}
+	restored = Picam_SetParameterFloatingPointValue(model, PicamParameter_AdcSpeed, adcSpeed) == PicamError_None && restored;
+	restored = Picam_SetParameterRoisValue(model, PicamParameter_Rois, region) == PicamError_None && restored;
+	Picam_DestroyRois(region);
+	if (hasKinetics){
+		restored = Picam_SetParameterIntegerValue(model, PicamParameter_KineticsWindowHeight, kineticsWindowHeight) == PicamError_None && restored;
+	}
+	if (!restored){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:plan", "The camera settings changed for planning could not all be put back.");
+	}
+}
+
+/**
+* findFastest keeps the candidate's ROI and ADC quality and tries every capable ADC speed
+* up to Plan_Max_ADC_Speed with power of two binnings up to Plan_Max_X/Y_Binning and
+* the ROI size. The ROI width and height are trimmed to a multiple of the binning.
+*/
+bool PIXISReadoutPlanner::findFastest(PicamHandle model, imaqkit::IPropContainer* propContainer, PIXISReadoutPlan& plan, PIXISReadoutPrediction& prediction) const{
+	piflt maxSpeed = *static_cast<double*>(propContainer->getPropValue("Plan_Max_ADC_Speed"));
+	int maxXBinning = *static_cast<int*>(propContainer->getPropValue("Plan_Max_X_Binning"));
+	int maxYBinning = *static_cast<int*>(propContainer->getPropValue("Plan_Max_Y_Binning"));
+
+	memset(&prediction, 0, sizeof(prediction));
+	PIXISReadoutPlan best = plan;
+	bool found = false;
+
+	const PicamCollectionConstraint* speeds;
+	if (Picam_GetParameterCollectionConstraint(model, PicamParameter_AdcSpeed, PicamConstraintCategory_Capable, &speeds) != PicamError_None){
+		return false;
+	}
+
+	for (piint s = 0; s < speeds->values_count; ++s){
+		if (maxSpeed > 0.0 && speeds->values_array[s] > maxSpeed){
+			continue;
+		}
+		for (int xBinning = 1; xBinning <= maxXBinning && xBinning <= plan.roi.width; xBinning *= 2){
+			for (int yBinning = 1; yBinning <= maxYBinning && yBinning <= plan.roi.height; yBinning *= 2){
+				PIXISReadoutPlan candidate = plan;
+				candidate.adcSpeed = speeds->values_array[s];
+				candidate.roi.x_binning = xBinning;
+				candidate.roi.y_binning = yBinning;
+				candidate.roi.width = plan.roi.width - plan.roi.width % xBinning;
+				candidate.roi.height = plan.roi.height - plan.roi.height % yBinning;
+				if (candidate.roi.width == 0 || candidate.roi.height == 0){
+					continue;
+				}
+
+				PIXISReadoutPrediction candidatePrediction;
+				predict(model, candidate, candidatePrediction);
+				if (candidatePrediction.valid && candidatePrediction.frameRate > prediction.frameRate){
+					prediction = candidatePrediction;
+					best = candidate;
+					found = true;
+				}
+			}
+		}
+	}
+	Picam_DestroyCollectionConstraints(speeds);
+
+	plan = best;
+	return found;
+}
+
+bool PIXISReadoutPlanner::getStatus(int id, void* value) const{
+	if (id < PIXISStatus_PlanValid || id > PIXISStatus_PlanDataRate){
+		return false;
+	}
+
+	PIXISReadoutPrediction prediction;
+	_latest.read(prediction);
+
+	switch (id){
+	case PIXISStatus_PlanValid:
+		*reinterpret_cast<int*>(value) = prediction.valid;
+		break;
+	case PIXISStatus_PlanReadoutTime:
+		*reinterpret_cast<double*>(value) = prediction.readoutTime;
+		break;
+	case PIXISStatus_PlanFrameRate:
+		*reinterpret_cast<double*>(value) = prediction.frameRate;
+		break;
+	case PIXISStatus_PlanDataRate:
+		*reinterpret_cast<double*>(value) = prediction.dataRate;
+		break;
+	}
+	return true;
+}
@@ -0,0 +1,86 @@
+/**
+* @file:       PIXISReadoutPlanner.h
+*
+* Purpose:     Class declaration for PIXISReadoutPlanner.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_READOUT_PLANNER_HEADER__
+#define __PIXIS_READOUT_PLANNER_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISLatestValue.h"
+
+// Largest Plan_Max_X/Y_Binning, beyond the size of any PIXIS sensor
+#define PIXIS_PLAN_MAX_BINNING 4096
+
+/**
+* Values of the Plan_Request enum property.
+*/
+enum PIXISPlanRequest{
+	PIXISPlanRequest_None = 0,
+	PIXISPlanRequest_Evaluate = 1,       // Predict timing of the Plan_* candidate
+	PIXISPlanRequest_FindFastest = 2     // Replace the candidate with the fastest one meeting the requirements
+};
+
+/**
+* A candidate readout configuration. Zero means "keep the camera's current value".
+*/
+struct PIXISReadoutPlan{
+	piflt adcSpeed;                 // MHz
+	piint adcQuality;               // PicamAdcQuality
+	PicamRoi roi;
+	piint kineticsWindowHeight;
+};
+
+/**
+* Timing predicted by PICam for a candidate.
+*/
+struct PIXISReadoutPrediction{
+	piint valid;                    // 0 if PICam rejected the candidate
+	piflt readoutTime;              // ms
+	piflt frameRate;                // frames per second
+	piflt dataRate;                 // MB/s
+};
+
+/**
+* Class PIXISReadoutPlanner
+*
+* @brief:  Predicts readout time, frame rate and data rate of a candidate configuration
+*          without acquiring. The candidate is written to the camera model as uncommitted
+*          values, PICam's ReadoutTimeCalculation and FrameRateCalculation are read back,
+*          and the model is restored. Nothing is committed to the camera device.
+*/
+class PIXISReadoutPlanner{
+
+public:
+	// addProperties adds the Plan_* candidate, request and prediction properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// applyCommand runs a Plan_Request. Returns false if id is not Plan_Request.
+	bool applyCommand(int id, void* newValue, PicamHandle camera, imaqkit::IPropContainer* propContainer, bool acquiring);
+
+	// getStatus writes the value of a Plan_* prediction property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// readPlan builds the candidate from the Plan_* properties, filling zeros from the model. Returns false if the model's ROI cannot be read.
+	bool readPlan(PicamHandle model, imaqkit::IPropContainer* propContainer, PIXISReadoutPlan& plan) const;
+
+	// writePlan stores a candidate back into the Plan_* properties
+	void writePlan(imaqkit::IPropContainer* propContainer, const PIXISReadoutPlan& plan) const;
+
+	// predict writes plan to the model, reads the calculation parameters and restores the model
+	void predict(PicamHandle model, const PIXISReadoutPlan& plan, PIXISReadoutPrediction& prediction) const;
+
+	// findFastest searches the capable ADC speeds and binnings for the highest frame rate
+	bool findFastest(PicamHandle model, imaqkit::IPropContainer* propContainer, PIXISReadoutPlan& plan, PIXISReadoutPrediction& prediction) const;
+
+	PIXISLatestValue<PIXISReadoutPrediction> _latest;
+};
+#endif
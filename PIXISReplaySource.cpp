@@ -0,0 +1,372 @@
+/**
+* @file:       PIXISReplaySource.cpp
+*
+* Purpose:     Implements replay of recorded raw and SPE captures in place of the camera.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISReplaySource.h"
+#include "PIXISAdaptorProps.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// SPE header layout, common to SPE 2.x and 3.0
+#define SPE_HEADER_BYTES        4100
+#define SPE_XDIM_OFFSET         42          // WORD
+#define SPE_DATATYPE_OFFSET     108         // short, 3 = unsigned 16 bit
+#define SPE_YDIM_OFFSET         656         // WORD
+#define SPE_FOOTER_OFFSET       678         // unsigned 64 bit offset of the SPE 3 XML footer
+#define SPE_NUMFRAMES_OFFSET    1446        // long
+#define SPE_VERSION_OFFSET      1992        // float
+#define SPE_DATATYPE_UINT16     3
+
+// Time left to a due readout that is spun for rather than slept, since Sleep is only as
+// accurate as the timer tick
+#define PIXIS_REPLAY_SPIN_SECONDS 0.002
+
+//speValue reads a little endian header field of type T at offset
+template <typename T>
+static T speValue(const pibyte* data, size_t offset){
+	T value;
+	memcpy(&value, data + offset, sizeof(T));
+	return value;
+}
+
+//xmlAttribute reads the numeric attribute name of the XML element starting at element
+static bool xmlAttribute(const std::string& xml, size_t element, const char* name, double& value){
+	size_t end = xml.find('>', element);
+	std::string key = std::string(" ") + name + "=\"";
+	size_t at = xml.find(key, element);
+	if (at == std::string::npos || at > end){
+		return false;
+	}
+	value = strtod(xml.c_str() + at + key.size(), NULL);
+	return true;
+}
+
+PIXISReplaySource::PIXISReplaySource() :
+	_file(INVALID_HANDLE_VALUE),
+	_mapping(NULL),
+	_data(NULL),
+	_fileBytes(0),
+	_spe(false),
+	_dataOffset(0),
+	_stride(0),
+	_speWidth(0),
+	_speHeight(0),
+	_speFrames(0),
+	_width(0),
+	_height(0),
+	_frames(0),
+	_original(true),
+	_loop(false),
+	_frameInterval(0.1),
+	_next(0),
+	_finished(false),
+	_delivered(0),
+	_lag(0.0){
+	_start.QuadPart = 0;
+	_frequency.QuadPart = 1;
+}
+
+PIXISReplaySource::~PIXISReplaySource(){
+	close();
+}
+
+void PIXISReplaySource::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Replay_Timing", "original", 0);
+	devicePropFact->addEnumValue(hProp, "fastest", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createEnumProperty("Replay_Loop", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Readouts per second for original timing when the file has no time stamps
+	hProp = devicePropFact->createDoubleProperty("Replay_Frame_Rate", 0.001, 100000.0, 10.0);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	// Geometry of raw files. SPE files carry their own.
+	hProp = devicePropFact->createIntProperty("Replay_Width", 1, INT_MAX, 1340);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Replay_Height", 1, INT_MAX, 100);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Replay_Frame", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_ReplayFrame);
+
+	hProp = devicePropFact->createDoubleProperty("Replay_Lag", 0.0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_ReplayLag);
+}
+
+/**
+* isReplayFormat matches the format by name: the camera's format, in any case, is not a
+* file, and a file is recognised by its path separator or extension.
+*/
+bool PIXISReplaySource::isReplayFormat(const char* formatName){
+	if (formatName == NULL || formatName[0] == '\0' || _stricmp(formatName, PIXIS_CAMERA_FORMAT) == 0){
+		return false;
+	}
+	return strpbrk(formatName, "\\/:.") != NULL;
+}
+
+bool PIXISReplaySource::open(const char* path){
+	close();
+
+	_file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER size;
+	if (_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size) || size.QuadPart == 0){
+		close();
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:replay", "The replay file could not be opened.");
+		return false;
+	}
+	_fileBytes = size.QuadPart;
+
+	_mapping = CreateFileMapping(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (_mapping){
+		_data = static_cast<const pibyte*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (_data == NULL){
+		close();
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:replay", "The replay file could not be mapped into memory.");
+		return false;
+	}
+
+	const char* extension = strrchr(path, '.');
+	_spe = extension && _stricmp(extension, ".spe") == 0;
+	if (_spe && !readSpeHeader()){
+		close();
+		return false;
+	}
+	return true;
+}
+
+void PIXISReplaySource::close(){
+	if (_data){
+		UnmapViewOfFile(_data);
+		_data = NULL;
+	}
+	if (_mapping){
+		CloseHandle(_mapping);
+		_mapping = NULL;
+	}
+	if (_file != INVALID_HANDLE_VALUE){
+		CloseHandle(_file);
+		_file = INVALID_HANDLE_VALUE;
+	}
+	_timeStamps.clear();
+}
+
+bool PIXISReplaySource::readSpeHeader(){
+	if (_fileBytes < SPE_HEADER_BYTES || speValue<short>(_data, SPE_DATATYPE_OFFSET) != SPE_DATATYPE_UINT16){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:replay", "Only SPE files of unsigned 16 bit data can be replayed.");
+		return false;
+	}
+
+	_speWidth = speValue<WORD>(_data, SPE_XDIM_OFFSET);
+	_speHeight = speValue<WORD>(_data, SPE_YDIM_OFFSET);
+	_speFrames = speValue<pi32s>(_data, SPE_NUMFRAMES_OFFSET);
+	_dataOffset = SPE_HEADER_BYTES;
+	_stride = (pi64s)_speWidth * _speHeight * sizeof(pi16u);
+
+	//SPE 3 files describe the frame layout, including per-frame metadata, in an XML footer
+	std::string footer;
+	pi64s dataEnd = _fileBytes;
+	if (speValue<float>(_data, SPE_VERSION_OFFSET) >= 3.0f){
+		pi64u footerOffset = speValue<pi64u>(_data, SPE_FOOTER_OFFSET);
+		if (footerOffset > SPE_HEADER_BYTES && footerOffset < (pi64u)_fileBytes){
+			footer.assign(reinterpret_cast<const char*>(_data) + footerOffset, (size_t)(_fileBytes - footerOffset));
+			dataEnd = (pi64s)footerOffset;
+
+			size_t region = footer.find("type=\"Region\"");
+			if (region != std::string::npos && footer.find("type=\"Region\"", region + 1) != std::string::npos){
+				imaqkit::adaptorWarn("PIXISCameraAdaptor:replay", "Only SPE files with a single region can be replayed.");
+				return false;
+			}
+
+			double stride;
+			size_t frameBlock = footer.find("<DataBlock type=\"Frame\"");
+			if (frameBlock != std::string::npos && xmlAttribute(footer, frameBlock, "stride", stride) && stride >= _stride){
+				_stride = (pi64s)stride;
+			}
+		}
+	}
+
+	//A truncated or aborted capture holds fewer frames than its header says, and the
+	//time stamps are only read from the frames that are actually there
+	pi64s available = (dataEnd - _dataOffset) / (_stride ? _stride : 1);
+	if (_speFrames > available || _speFrames <= 0){
+		_speFrames = available;
+	}
+	if (_speFrames < 1 || _stride == 0){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:replay", "The SPE file holds no complete frame.");
+		return false;
+	}
+	if (!footer.empty()){
+		readSpeTimeStamps(footer);
+	}
+	return true;
+}
+
+/**
+* readSpeTimeStamps walks the MetaBlock elements of the footer in order. Each adds its
+* bitDepth to the offset after the frame's pixel data, up to the exposure-started
+* time stamp.
+*/
+void PIXISReplaySource::readSpeTimeStamps(const std::string& footer){
+	size_t block = footer.find("<MetaBlock");
+	size_t frameBlock = footer.find("<DataBlock type=\"Frame\"");
+	double pixelBytes;
+	if (block == std::string::npos || frameBlock == std::string::npos || !xmlAttribute(footer, frameBlock, "size", pixelBytes)){
+		return;
+	}
+	size_t blockEnd = footer.find("</MetaBlock>", block);
+
+	pi64s offset = (pi64s)pixelBytes;
+	size_t element = footer.find('<', footer.find('>', block));
+	while (element != std::string::npos && element < blockEnd){
+		double bitDepth = 64;
+		xmlAttribute(footer, element, "bitDepth", bitDepth);
+		size_t elementEnd = footer.find('>', element);
+
+		if (footer.compare(element, 10, "<TimeStamp") == 0 && footer.find("ExposureStarted", element) < elementEnd){
+			double resolution = 1000000.0;
+			xmlAttribute(footer, element, "resolution", resolution);
+			if (bitDepth != 64 || offset + 8 > _stride){
+				return;
+			}
+			_timeStamps.resize((size_t)_speFrames);
+			pi64s first = speValue<pi64s>(_data, (size_t)(_dataOffset + offset));
+			for (pi64s i = 0; i < _speFrames; ++i){
+				pi64s ticks = speValue<pi64s>(_data, (size_t)(_dataOffset + i * _stride + offset));
+				_timeStamps[(size_t)i] = (ticks - first) / resolution;
+			}
+			return;
+		}
+
+		offset += (pi64s)bitDepth / 8;
+		element = footer.find('<', elementEnd);
+	}
+}
+
+int PIXISReplaySource::getWidth(imaqkit::IPropContainer* propContainer) const{
+	if (_spe){
+		return _speWidth;
+	}
+	return *static_cast<int*>(propContainer->getPropValue("Replay_Width"));
+}
+
+int PIXISReplaySource::getHeight(imaqkit::IPropContainer* propContainer) const{
+	if (_spe){
+		return _speHeight;
+	}
+	return *static_cast<int*>(propContainer->getPropValue("Replay_Height"));
+}
+
+bool PIXISReplaySource::configure(imaqkit::IPropContainer* propContainer){
+	_width = getWidth(propContainer);
+	_height = getHeight(propContainer);
+
+	int* timing = static_cast<int*>(propContainer->getPropValue("Replay_Timing"));
+	int* loop = static_cast<int*>(propContainer->getPropValue("Replay_Loop"));
+	double* frameRate = static_cast<double*>(propContainer->getPropValue("Replay_Frame_Rate"));
+	_original = (*timing == 0);
+	_loop = (*loop == 1);
+	_frameInterval = 1.0 / *frameRate;
+
+	if (_spe){
+		_frames = _speFrames;
+	}
+	else{
+		_dataOffset = 0;
+		_stride = (pi64s)_width * _height * sizeof(pi16u);
+		_frames = _fileBytes / _stride;
+	}
+	if (_frames < 1){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:replay", "The replay file is smaller than one Replay_Width x Replay_Height readout.");
+		return false;
+	}
+
+	_next = 0;
+	_finished = false;
+	_delivered = 0;
+	_lag = 0.0;
+	QueryPerformanceFrequency(&_frequency);
+	return true;
+}
+
+double PIXISReplaySource::dueTime(pi64s index) const{
+	if (!_timeStamps.empty()){
+		return _timeStamps[(size_t)index];
+	}
+	return index * _frameInterval;
+}
+
+const pi16u* PIXISReplaySource::next(int timeout){
+	if (_finished){
+		return NULL;
+	}
+	if (_next == _frames){
+		if (!_loop){
+			_finished = true;
+			return NULL;
+		}
+		_next = 0;
+	}
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	//Each pass over the file is timed from its first readout
+	if (_next == 0){
+		_start = now;
+	}
+
+	if (_original){
+		double due = dueTime(_next);
+		double elapsed = (double)(now.QuadPart - _start.QuadPart) / _frequency.QuadPart;
+		if (due - elapsed > timeout / 1000.0){
+			Sleep(timeout);
+			return NULL;
+		}
+		if (due - elapsed > PIXIS_REPLAY_SPIN_SECONDS){
+			Sleep((DWORD)((due - elapsed - PIXIS_REPLAY_SPIN_SECONDS) * 1000.0));
+		}
+		while (elapsed < due){
+			YieldProcessor();
+			QueryPerformanceCounter(&now);
+			elapsed = (double)(now.QuadPart - _start.QuadPart) / _frequency.QuadPart;
+		}
+		_lag = (elapsed - due) * 1000.0;
+	}
+
+	const pi16u* readout = reinterpret_cast<const pi16u*>(_data + _dataOffset + _next * _stride);
+	_next++;
+	_delivered = _delivered + 1;
+	return readout;
+}
+
+bool PIXISReplaySource::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_ReplayFrame:
+		*reinterpret_cast<int*>(value) = (int)_delivered;
+		return true;
+	case PIXISStatus_ReplayLag:
+		*reinterpret_cast<double*>(value) = _lag;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,124 @@
+/**
+* @file:       PIXISReplaySource.h
+*
+* Purpose:     Class declaration for PIXISReplaySource.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_REPLAY_SOURCE_HEADER__
+#define __PIXIS_REPLAY_SOURCE_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+#include "picam.h"
+#include <string>
+#include <vector>
+
+// Format of the camera itself; any other format the adaptor is given is a file
+#define PIXIS_CAMERA_FORMAT "PIXIS_Camera"
+
+/**
+* Class PIXISReplaySource
+*
+* @brief:  Replays a recorded capture in place of the camera. The file is given as the
+*          format when the videoinput object is created, e.g.
+*          videoinput('pixis', 1, 'C:\data\run12.spe'), and its readouts go through the
+*          same acquisition thread and processing as camera readouts.
+*
+*          SPE files must hold unsigned 16 bit data with one region; their geometry
+*          comes from the header. Files with any other extension are raw: frames of
+*          Replay_Width x Replay_Height unsigned 16 bit pixels, back to back with no
+*          header.
+*
+*          With Replay_Timing set to original, readouts are delivered on the schedule
+*          they were recorded with: the exposure-started time stamps of an SPE 3 file
+*          when it has them, otherwise Replay_Frame_Rate. With fastest they are
+*          delivered as fast as the pipeline takes them. The file is mapped into memory,
+*          so a readout is never copied before processing.
+*/
+class PIXISReplaySource{
+
+public:
+	PIXISReplaySource();
+	virtual ~PIXISReplaySource();
+
+	// addProperties adds the Replay_* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// isReplayFormat returns true if the format given to the adaptor names a file to replay rather than PIXIS_CAMERA_FORMAT
+	static bool isReplayFormat(const char* formatName);
+
+	// open maps the file. Returns false, after warning, if it cannot be replayed.
+	bool open(const char* path);
+	void close();
+	bool isOpen() const { return _data != NULL; }
+
+	// getFrameCount returns the complete frames of an open SPE file, or of a configured raw file
+	pi64s getFrameCount() const { return _spe ? _speFrames : _frames; }
+
+	// getWidth and getHeight return the readout geometry
+	int getWidth(imaqkit::IPropContainer* propContainer) const;
+	int getHeight(imaqkit::IPropContainer* propContainer) const;
+
+	// configure reads the Replay_* properties and rewinds. Returns false, after warning, if the geometry does not fit the file.
+	bool configure(imaqkit::IPropContainer* propContainer);
+
+	/**
+	* next waits until the next readout is due, for at most timeout ms.
+	*
+	* @return: The readout, valid until the next call, or NULL if it is not due yet or the file has ended.
+	*/
+	const pi16u* next(int timeout);
+
+	// isFinished returns true once the last readout was delivered and Replay_Loop is off
+	bool isFinished() const { return _finished; }
+
+	// getStatus writes the value of a Replay_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// readSpeHeader fills in the geometry and time stamps of an SPE file. Returns false if it is not supported.
+	bool readSpeHeader();
+
+	// readSpeTimeStamps reads the exposure-started time stamps described by the SPE 3 XML footer
+	void readSpeTimeStamps(const std::string& footer);
+
+	// dueTime returns the time (s since the replay started) readout index is due
+	double dueTime(pi64s index) const;
+
+	HANDLE _file;
+	HANDLE _mapping;
+	const pibyte* _data;
+	pi64s _fileBytes;
+
+	bool _spe;
+	pi64s _dataOffset;          // Bytes before the first readout
+	pi64s _stride;              // Bytes from one readout to the next
+	int _speWidth;
+	int _speHeight;
+	pi64s _speFrames;
+
+	/// Seconds from the first readout, from the SPE 3 time stamps, empty if there are none
+	std::vector<double> _timeStamps;
+
+	int _width;
+	int _height;
+	pi64s _frames;
+	bool _original;
+	bool _loop;
+	double _frameInterval;      // s, when there are no time stamps
+
+	pi64s _next;
+	LARGE_INTEGER _start;
+	LARGE_INTEGER _frequency;
+	bool _finished;
+
+	/// Status values
+	volatile LONG64 _delivered;
+	volatile double _lag;       // ms behind the original schedule, for the last readout
+};
+#endif
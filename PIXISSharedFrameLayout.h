@@ -0,0 +1,61 @@
+/**
+* @file:       PIXISSharedFrameLayout.h
+*
+* Purpose:     Layout of the named shared-memory frame ring, shared by the adaptor
+*              and the reader library in reader/.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_SHARED_FRAME_LAYOUT_HEADER__
+#define __PIXIS_SHARED_FRAME_LAYOUT_HEADER__
+
+#include <Windows.h>
+
+#define PIXIS_SHARED_FRAME_MAGIC    0x53584950      // "PIXS"
+#define PIXIS_SHARED_FRAME_VERSION  1
+
+// Slots and pixel data start on cache line boundaries
+#define PIXIS_SHARED_FRAME_ALIGNMENT 64
+
+/**
+* The mapping starts with one PIXISSharedFrameHeader, followed by slotCount slots of
+* slotBytes each. A slot is a PIXISSharedSlotHeader followed by the pixels of one
+* readout, row by row with no padding.
+*
+* The adaptor is the only writer. Readout number n (counting from 1 since the ring was
+* created) goes into slot (n - 1) % slotCount. The slot sequence is 2n - 1 while the
+* pixels are copied and 2n once they are complete, so a reader that sees the same even
+* sequence before and after using a slot knows the slot was not overwritten meanwhile.
+* Readers never write to the mapping, so any number of them can map it read only.
+*/
+struct PIXISSharedFrameHeader{
+	LONG magic;                     // PIXIS_SHARED_FRAME_MAGIC
+	LONG version;                   // PIXIS_SHARED_FRAME_VERSION
+	LONG headerBytes;               // Offset of the first slot
+	LONG slotCount;
+	LONG slotBytes;                 // Bytes per slot, including its PIXISSharedSlotHeader
+	LONG slotHeaderBytes;           // Offset of the pixels within a slot
+	LONG64 mappingBytes;            // Size of the whole mapping
+	volatile LONG64 published;      // Number of readouts completely written
+	volatile LONG64 generation;     // Incremented by every startCapture()
+	volatile LONG acquiring;        // 1 between startCapture() and the end of the acquisition
+	LONG reserved[5];
+};
+
+struct PIXISSharedSlotHeader{
+	volatile LONG64 sequence;       // 2n - 1 while readout n is written, 2n once it is complete
+	LONG64 readout;                 // Readout number since startCapture(), starting at 1
+	LONG64 frame;                   // Engine frame number, or 0 if the readout was not sent to MATLAB
+	double time;                    // Adaptor timestamp in seconds, as given to the engine
+	LONG64 generation;              // PIXISSharedFrameHeader::generation when it was written
+	LONG width;                     // Pixels per row
+	LONG height;                    // Rows
+	LONG bytesPerPixel;
+	LONG reserved[3];
+};
+
+#endif
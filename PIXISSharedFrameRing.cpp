@@ -0,0 +1,197 @@
+/**
+* @file:       PIXISSharedFrameRing.cpp
+*
+* Purpose:     Implements the shared-memory ring readouts are published into.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISSharedFrameRing.h"
+#include "PIXISAdaptorProps.h"
+#include <string.h>
+
+//alignUp rounds bytes up to a multiple of PIXIS_SHARED_FRAME_ALIGNMENT
+static LONG64 alignUp(LONG64 bytes){
+	return (bytes + PIXIS_SHARED_FRAME_ALIGNMENT - 1) & ~(LONG64)(PIXIS_SHARED_FRAME_ALIGNMENT - 1);
+}
+
+PIXISSharedFrameRing::PIXISSharedFrameRing() :
+	_mapping(NULL),
+	_header(NULL),
+	_published(0){
+}
+
+PIXISSharedFrameRing::~PIXISSharedFrameRing(){
+	release();
+}
+
+void PIXISSharedFrameRing::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	hProp = devicePropFact->createEnumProperty("Shared_Memory", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createStringProperty("Shared_Memory_Name", "PIXISFrames");
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Shared_Memory_Slots", 2, 1024, 16);
+	devicePropFact->setPropReadOnly(hProp, imaqkit::propreadonly::WHILE_RUNNING);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Shared_Memory_Published", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_SharedMemoryPublished);
+}
+
+void PIXISSharedFrameRing::configure(imaqkit::IPropContainer* propContainer, int width, int height){
+	_published = 0;
+
+	int* enabled = static_cast<int*>(propContainer->getPropValue("Shared_Memory"));
+	if (*enabled != 1){
+		release();
+		return;
+	}
+
+	const char* name = static_cast<const char*>(propContainer->getPropValue("Shared_Memory_Name"));
+	int* slots = static_cast<int*>(propContainer->getPropValue("Shared_Memory_Slots"));
+	LONG slotBytes = (LONG)(alignUp(sizeof(PIXISSharedSlotHeader)) + alignUp((LONG64)width * height * sizeof(pi16u)));
+
+	//Keep the current ring if it has the same name and slot count and the readouts still fit,
+	//so readers do not have to reattach
+	if (_header && _name == name && _header->slotCount == *slots && _header->slotBytes >= slotBytes){
+		InterlockedIncrement64(&_header->generation);
+		_header->acquiring = 1;
+		return;
+	}
+
+	release();
+	if (create(name, *slots, slotBytes)){
+		_header->acquiring = 1;
+	}
+}
+
+bool PIXISSharedFrameRing::create(const char* name, int slotCount, LONG slotBytes){
+	LONG headerBytes = (LONG)alignUp(sizeof(PIXISSharedFrameHeader));
+	LONG64 mappingBytes = headerBytes + (LONG64)slotCount * slotBytes;
+
+	_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		(DWORD)(mappingBytes >> 32), (DWORD)(mappingBytes & 0xFFFFFFFF), name);
+	if (_mapping == NULL){
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:sharedMemory", "Could not create the Shared_Memory_Name mapping. Shared memory is off.");
+		return false;
+	}
+	//Readers still attached from an earlier ring keep the mapping alive, in which case
+	//its existing size is what gets mapped
+	bool existed = (GetLastError() == ERROR_ALREADY_EXISTS);
+
+	_header = static_cast<PIXISSharedFrameHeader*>(MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if (_header == NULL){
+		release();
+		imaqkit::adaptorWarn("PIXISCameraAdaptor:sharedMemory", "Could not map the shared memory. Shared memory is off.");
+		return false;
+	}
+
+	LONG64 published = 0;
+	LONG64 generation = 0;
+	if (existed){
+		if (_header->magic != PIXIS_SHARED_FRAME_MAGIC || _header->mappingBytes < mappingBytes){
+			release();
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:sharedMemory", "A smaller mapping with the same Shared_Memory_Name is still open in another process. Close it or change Shared_Memory_Name.");
+			return false;
+		}
+		//Readers follow the published count, so it carries on from the earlier ring
+		mappingBytes = _header->mappingBytes;
+		published = _header->published;
+		generation = _header->generation;
+	}
+
+	//Readers ignore the ring while the magic is cleared
+	_header->magic = 0;
+	MemoryBarrier();
+	_header->version = PIXIS_SHARED_FRAME_VERSION;
+	_header->headerBytes = headerBytes;
+	_header->slotCount = slotCount;
+	_header->slotBytes = slotBytes;
+	_header->slotHeaderBytes = (LONG)alignUp(sizeof(PIXISSharedSlotHeader));
+	_header->mappingBytes = mappingBytes;
+	_header->published = published;
+	_header->generation = generation + 1;
+	_header->acquiring = 0;
+	pibyte* slots = reinterpret_cast<pibyte*>(_header) + headerBytes;
+	for (int i = 0; i < slotCount; ++i){
+		reinterpret_cast<PIXISSharedSlotHeader*>(slots + (LONG64)i * slotBytes)->sequence = 0;
+	}
+	MemoryBarrier();
+	_header->magic = PIXIS_SHARED_FRAME_MAGIC;
+
+	_name = name;
+	return true;
+}
+
+void PIXISSharedFrameRing::release(){
+	if (_header){
+		_header->acquiring = 0;
+		UnmapViewOfFile(_header);
+		_header = NULL;
+	}
+	if (_mapping){
+		CloseHandle(_mapping);
+		_mapping = NULL;
+	}
+	_name.clear();
+}
+
+/**
+* publish follows the sequence protocol in PIXISSharedFrameLayout.h. The barriers keep
+* the odd sequence ahead of the copy and the copy ahead of the even sequence; readers
+* are never waited for.
+*/
+void PIXISSharedFrameRing::publish(const pi16u* pixels, int width, int height, pi64s readout, pi64s frame, double time){
+	LONG64 bytes = (LONG64)width * height * sizeof(pi16u);
+	if (bytes > _header->slotBytes - _header->slotHeaderBytes){
+		return;
+	}
+
+	LONG64 n = _header->published + 1;
+	pibyte* slotBase = reinterpret_cast<pibyte*>(_header) + _header->headerBytes +
+		((n - 1) % _header->slotCount) * _header->slotBytes;
+	PIXISSharedSlotHeader* slot = reinterpret_cast<PIXISSharedSlotHeader*>(slotBase);
+
+	slot->sequence = 2 * n - 1;
+	MemoryBarrier();
+
+	slot->readout = readout;
+	slot->frame = frame;
+	slot->time = time;
+	slot->generation = _header->generation;
+	slot->width = width;
+	slot->height = height;
+	slot->bytesPerPixel = sizeof(pi16u);
+	memcpy(slotBase + _header->slotHeaderBytes, pixels, (size_t)bytes);
+
+	MemoryBarrier();
+	slot->sequence = 2 * n;
+	_header->published = n;
+	_published = _published + 1;
+}
+
+void PIXISSharedFrameRing::finish(){
+	if (_header){
+		_header->acquiring = 0;
+	}
+}
+
+bool PIXISSharedFrameRing::getStatus(int id, void* value) const{
+	switch (id){
+	case PIXISStatus_SharedMemoryPublished:
+		*reinterpret_cast<int*>(value) = (int)_published;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,68 @@
+/**
+* @file:       PIXISSharedFrameRing.h
+*
+* Purpose:     Class declaration for PIXISSharedFrameRing.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_SHARED_FRAME_RING_HEADER__
+#define __PIXIS_SHARED_FRAME_RING_HEADER__
+
+#include "mwadaptorimaq.h"
+#include "picam.h"
+#include "PIXISSharedFrameLayout.h"
+#include <string>
+
+/**
+* Class PIXISSharedFrameRing
+*
+* @brief:  Publishes readouts into a named shared-memory ring (see
+*          PIXISSharedFrameLayout.h) so processes outside MATLAB can use them without
+*          going through the engine. Publishing is one copy into the next slot and
+*          never waits for readers; a reader that falls behind by more than the ring
+*          size loses the oldest readouts.
+*
+*          The mapping is created by startCapture() and kept until the name or the
+*          size changes, so readers can stay attached across acquisitions.
+*/
+class PIXISSharedFrameRing{
+
+public:
+	PIXISSharedFrameRing();
+	virtual ~PIXISSharedFrameRing();
+
+	// addProperties adds the Shared_Memory* properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// configure creates or reuses the mapping for readouts of up to width x height pixels. Called from startCapture().
+	void configure(imaqkit::IPropContainer* propContainer, int width, int height);
+
+	bool isEnabled() const { return _header != NULL; }
+
+	// publish copies a readout into the next slot. frame is 0 if the readout is not sent to the engine.
+	void publish(const pi16u* pixels, int width, int height, pi64s readout, pi64s frame, double time);
+
+	// finish marks the acquisition as ended for the readers
+	void finish();
+
+	// getStatus writes the value of a Shared_Memory_* status property. Returns false if id is not one of them.
+	bool getStatus(int id, void* value) const;
+
+private:
+	// create maps a new ring. Returns false, after warning, if it cannot.
+	bool create(const char* name, int slotCount, LONG slotBytes);
+
+	void release();
+
+	HANDLE _mapping;
+	PIXISSharedFrameHeader* _header;
+	std::string _name;
+
+	/// Readouts published since startCapture(), kept apart from the mapping for the status property
+	volatile LONG64 _published;
+};
+#endif
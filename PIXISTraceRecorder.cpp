@@ -0,0 +1,277 @@
+/**
+* @file:       PIXISTraceRecorder.cpp
+*
+* Purpose:     Implements the per-thread trace recorder and its Chrome trace-event export.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISTraceRecorder.h"
+#include "PIXISAdaptorProps.h"
+#include <stdio.h>
+#include <new>
+#include <vector>
+
+// Events each thread can record before its buffer is full
+#define PIXIS_TRACE_EVENTS 65536
+
+// Most buffers allocated, so threads created and ended over and over reuse them
+#define PIXIS_TRACE_BUFFERS 64
+
+struct PIXISTraceEvent{
+	const char* name;
+	LONG64 ticks;               // QueryPerformanceCounter
+	LONG64 arg;                 // Shown as args.id when not 0
+	char phase;                 // 'B' or 'E'
+};
+
+/**
+* Events of one thread. Only that thread writes events; count is published after the
+* event it covers, so a dump can read events [0, count) while the thread records.
+*/
+struct PIXISTraceBuffer{
+	HANDLE thread;              // Signalled once the thread has ended and the buffer can be reused
+	DWORD threadId;
+	const char* threadName;
+	LONG generation;            // Recording the events belong to
+	volatile LONG count;
+	volatile LONG dropped;
+	PIXISTraceEvent events[PIXIS_TRACE_EVENTS];
+};
+
+volatile LONG PIXISTraceRecorder::_enabled = 0;
+
+// Buffers of the threads that recorded. A buffer stays with its thread until the thread ends.
+static std::vector<PIXISTraceBuffer*> traceBuffers;
+
+// Exclusive to add or reset a buffer or start a recording, shared to read them
+static SRWLOCK traceGuard = SRWLOCK_INIT;
+
+// Incremented by every recording, so threads reset their buffers on their next event
+static volatile LONG traceGeneration = 0;
+
+// Time the current recording started
+static LARGE_INTEGER traceOrigin;
+
+static __declspec(thread) PIXISTraceBuffer* threadBuffer = NULL;
+static __declspec(thread) const char* threadName = NULL;
+
+/**
+* takeTraceBuffer finds a buffer for the calling thread. It prefers the buffer of an ended
+* thread from an earlier recording, then a new one while there are fewer than
+* PIXIS_TRACE_BUFFERS, then the buffer of an ended thread from this recording, whose
+* events are lost. Returns NULL if there is none. Called with traceGuard held exclusively.
+*/
+static PIXISTraceBuffer* takeTraceBuffer(){
+	PIXISTraceBuffer* ended = NULL;
+	for (size_t i = 0; i < traceBuffers.size(); ++i){
+		PIXISTraceBuffer* candidate = traceBuffers[i];
+		if (WaitForSingleObject(candidate->thread, 0) != WAIT_OBJECT_0){
+			continue;
+		}
+		if (candidate->generation != traceGeneration){
+			ended = candidate;
+			break;
+		}
+		if (ended == NULL){
+			ended = candidate;
+		}
+	}
+
+	PIXISTraceBuffer* buffer = NULL;
+	if (ended && (ended->generation != traceGeneration || traceBuffers.size() >= PIXIS_TRACE_BUFFERS)){
+		CloseHandle(ended->thread);
+		buffer = ended;
+	}
+	else if (traceBuffers.size() < PIXIS_TRACE_BUFFERS){
+		buffer = new (std::nothrow) PIXISTraceBuffer;
+		if (buffer){
+			traceBuffers.push_back(buffer);
+		}
+	}
+	if (buffer == NULL){
+		return NULL;
+	}
+
+	buffer->thread = OpenThread(SYNCHRONIZE, FALSE, GetCurrentThreadId());
+	buffer->threadId = GetCurrentThreadId();
+	return buffer;
+}
+
+//threadTraceBuffer returns the calling thread's buffer, reset for the current recording, or NULL if there is none
+static PIXISTraceBuffer* threadTraceBuffer(){
+	PIXISTraceBuffer* buffer = threadBuffer;
+	if (buffer && buffer->generation == traceGeneration){
+		return buffer;
+	}
+
+	AcquireSRWLockExclusive(&traceGuard);
+	if (buffer == NULL){
+		buffer = takeTraceBuffer();
+		threadBuffer = buffer;
+	}
+	if (buffer){
+		buffer->threadName = threadName;
+		buffer->count = 0;
+		buffer->dropped = 0;
+		buffer->generation = traceGeneration;
+	}
+	ReleaseSRWLockExclusive(&traceGuard);
+	return buffer;
+}
+
+//recordTraceEvent appends one event to the calling thread's buffer
+static void recordTraceEvent(const char* name, char phase, LONG64 arg){
+	PIXISTraceBuffer* buffer = threadTraceBuffer();
+	if (buffer == NULL){
+		return;
+	}
+	LONG count = buffer->count;
+	if (count >= PIXIS_TRACE_EVENTS){
+		buffer->dropped = buffer->dropped + 1;
+		return;
+	}
+
+	PIXISTraceEvent& event = buffer->events[count];
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	event.name = name;
+	event.ticks = now.QuadPart;
+	event.arg = arg;
+	event.phase = phase;
+
+	//The event must be complete before a dump can see it
+	MemoryBarrier();
+	buffer->count = count + 1;
+}
+
+void PIXISTraceRecorder::addProperties(imaqkit::IPropFactory* devicePropFact){
+	void* hProp;
+
+	// Turning it on starts a new recording
+	hProp = devicePropFact->createEnumProperty("Trace", "off", 0);
+	devicePropFact->addEnumValue(hProp, "on", 1);
+	devicePropFact->setIdentifier(hProp, PIXISCommand_Trace);
+	devicePropFact->addProperty(hProp);
+
+	// Setting a file name writes the recording to it
+	hProp = devicePropFact->createStringProperty("Trace_Dump", "");
+	devicePropFact->setIdentifier(hProp, PIXISCommand_TraceDump);
+	devicePropFact->addProperty(hProp);
+
+	hProp = devicePropFact->createIntProperty("Trace_Events", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_TraceEvents);
+
+	hProp = devicePropFact->createIntProperty("Trace_Dropped", 0);
+	addStatusProperty(devicePropFact, hProp, PIXISStatus_TraceDropped);
+}
+
+bool PIXISTraceRecorder::applyCommand(int id, void* newValue){
+	switch (id){
+	case PIXISCommand_Trace:
+		if (*static_cast<int*>(newValue) == 0){
+			_enabled = 0;
+		}
+		else if (_enabled == 0){
+			AcquireSRWLockExclusive(&traceGuard);
+			InterlockedIncrement(&traceGeneration);
+			QueryPerformanceCounter(&traceOrigin);
+			_enabled = 1;
+			ReleaseSRWLockExclusive(&traceGuard);
+		}
+		return true;
+
+	case PIXISCommand_TraceDump:{
+		const char* path = static_cast<const char*>(newValue);
+		if (path[0] != '\0' && !dump(path)){
+			char message[MAX_PATH + 64];
+			sprintf_s(message, sizeof(message), "The trace could not be written to %s.", path);
+			imaqkit::adaptorWarn("PIXISCameraAdaptor:trace", message);
+		}
+		return true;
+	}
+	}
+	return false;
+}
+
+bool PIXISTraceRecorder::getStatus(int id, void* value){
+	if (id != PIXISStatus_TraceEvents && id != PIXISStatus_TraceDropped){
+		return false;
+	}
+
+	LONG64 total = 0;
+	AcquireSRWLockShared(&traceGuard);
+	for (size_t i = 0; i < traceBuffers.size(); ++i){
+		if (traceBuffers[i]->generation == traceGeneration){
+			total += (id == PIXISStatus_TraceEvents) ? traceBuffers[i]->count : traceBuffers[i]->dropped;
+		}
+	}
+	ReleaseSRWLockShared(&traceGuard);
+
+	*reinterpret_cast<int*>(value) = (int)total;
+	return true;
+}
+
+void PIXISTraceRecorder::begin(const char* name, LONG64 arg){
+	recordTraceEvent(name, 'B', arg);
+}
+
+void PIXISTraceRecorder::end(const char* name){
+	recordTraceEvent(name, 'E', 0);
+}
+
+void PIXISTraceRecorder::nameThread(const char* name){
+	threadName = name;
+	if (threadBuffer){
+		threadBuffer->threadName = name;
+	}
+}
+
+bool PIXISTraceRecorder::dump(const char* path){
+	FILE* file;
+	if (fopen_s(&file, path, "w") != 0){
+		return false;
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	double usPerTick = 1000000.0 / frequency.QuadPart;
+	DWORD processId = GetCurrentProcessId();
+
+	AcquireSRWLockShared(&traceGuard);
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":0,\"args\":{\"name\":\"PIXIS adaptor\"}}",
+		processId);
+
+	for (size_t i = 0; i < traceBuffers.size(); ++i){
+		const PIXISTraceBuffer* buffer = traceBuffers[i];
+		if (buffer->generation != traceGeneration){
+			continue;
+		}
+		LONG count = buffer->count;
+		MemoryBarrier();
+
+		if (buffer->threadName){
+			fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+				processId, buffer->threadId, buffer->threadName);
+		}
+		for (LONG e = 0; e < count; ++e){
+			const PIXISTraceEvent& event = buffer->events[e];
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu",
+				event.name, event.phase, (event.ticks - traceOrigin.QuadPart) * usPerTick, processId, buffer->threadId);
+			if (event.arg != 0){
+				fprintf(file, ",\"args\":{\"id\":%lld}", event.arg);
+			}
+			fprintf(file, "}");
+		}
+	}
+	ReleaseSRWLockShared(&traceGuard);
+
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	bool written = !ferror(file);
+	return fclose(file) == 0 && written;
+}
@@ -0,0 +1,89 @@
+/**
+* @file:       PIXISTraceRecorder.h
+*
+* Purpose:     Class declaration for PIXISTraceRecorder and PIXISTraceScope.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_TRACE_RECORDER_HEADER__
+#define __PIXIS_TRACE_RECORDER_HEADER__
+
+#include "mwadaptorimaq.h"
+#include <Windows.h>
+
+/**
+* Class PIXISTraceRecorder
+*
+* @brief:  Records begin and end events from the acquisition thread, the processing
+*          stages, the worker pool and property set/commit calls, so that stalls can
+*          be lined up across threads. Setting Trace to on starts a new recording;
+*          setting Trace_Dump to a file name writes it as Chrome trace-event JSON,
+*          which loads in Perfetto or chrome://tracing.
+*
+*          Each thread records into its own buffer of PIXIS_TRACE_EVENTS events, so
+*          recording takes no lock. Once a buffer is full further events of that
+*          thread are counted in Trace_Dropped. While Trace is off an event costs the
+*          test of isEnabled(). The buffer of a thread that has ended is reused by a
+*          new thread, so the number allocated stays bounded however often the
+*          stage threads are recreated.
+*
+*          The recorder is shared by every adaptor instance in the process, as the
+*          threads it records are.
+*/
+class PIXISTraceRecorder{
+
+public:
+	// addProperties adds the Trace, Trace_Dump and Trace_* status properties
+	static void addProperties(imaqkit::IPropFactory* devicePropFact);
+
+	// applyCommand handles the Trace and Trace_Dump commands. Returns false if id is not one of them.
+	static bool applyCommand(int id, void* newValue);
+
+	// getStatus writes the value of a Trace_* status property. Returns false if id is not one of them.
+	static bool getStatus(int id, void* value);
+
+	static bool isEnabled() { return _enabled != 0; }
+
+	// begin and end record an event of the calling thread. name must be a string literal. Use PIXISTraceScope.
+	static void begin(const char* name, LONG64 arg);
+	static void end(const char* name);
+
+	// nameThread labels the calling thread in the trace. name must be a string literal.
+	static void nameThread(const char* name);
+
+	// dump writes the recording to path. Returns false if the file could not be written.
+	static bool dump(const char* path);
+
+private:
+	static volatile LONG _enabled;
+};
+
+/**
+* Class PIXISTraceScope
+*
+* @brief:  Records a begin event when created and the matching end event when it goes
+*          out of scope, if tracing was on when it was created.
+*/
+class PIXISTraceScope{
+
+public:
+	explicit PIXISTraceScope(const char* name, LONG64 arg = 0) : _name(NULL){
+		if (PIXISTraceRecorder::isEnabled()){
+			_name = name;
+			PIXISTraceRecorder::begin(name, arg);
+		}
+	}
+	~PIXISTraceScope(){
+		if (_name){
+			PIXISTraceRecorder::end(_name);
+		}
+	}
+
+private:
+	const char* _name;
+};
+#endif
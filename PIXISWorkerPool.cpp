@@ -0,0 +1,149 @@
+/**
+* @file:       PIXISWorkerPool.cpp
+*
+* Purpose:     Implements the worker threads used for tiled processing of readouts.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISWorkerPool.h"
+#include "PIXISTraceRecorder.h"
+#include <limits.h>
+
+PIXISWorkerPool::PIXISWorkerPool() :
+	_fn(NULL),
+	_context(NULL),
+	_tileCount(0),
+	_nextTile(0),
+	_helpersOut(0),
+	_quit(0){
+	_wake = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+	_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+	InitializeCriticalSection(&_runGuard);
+}
+
+PIXISWorkerPool::~PIXISWorkerPool(){
+	stop();
+	DeleteCriticalSection(&_runGuard);
+	CloseHandle(_wake);
+	CloseHandle(_done);
+}
+
+void PIXISWorkerPool::start(int threadCount){
+	stop();
+
+	if (threadCount < 0){
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		threadCount = (int)info.dwNumberOfProcessors - 1;
+	}
+
+	InterlockedExchange(&_quit, 0);
+	for (int i = 0; i < threadCount; ++i){
+		HANDLE thread = CreateThread(NULL, 0, workerThread, this, 0, NULL);
+		if (thread == NULL){
+			break;
+		}
+		_threads.push_back(thread);
+	}
+}
+
+void PIXISWorkerPool::stop(){
+	if (_threads.empty()){
+		return;
+	}
+
+	InterlockedExchange(&_quit, 1);
+	ReleaseSemaphore(_wake, (LONG)_threads.size(), NULL);
+	for (size_t i = 0; i < _threads.size(); ++i){
+		WaitForSingleObject(_threads[i], INFINITE);
+		CloseHandle(_threads[i]);
+	}
+	_threads.clear();
+}
+
+bool PIXISWorkerPool::setAffinity(DWORD_PTR mask){
+	bool applied = true;
+	for (size_t i = 0; i < _threads.size(); ++i){
+		if (SetThreadAffinityMask(_threads[i], mask) == 0){
+			applied = false;
+		}
+	}
+	return applied;
+}
+
+bool PIXISWorkerPool::setPriority(int priority){
+	bool applied = true;
+	for (size_t i = 0; i < _threads.size(); ++i){
+		if (!SetThreadPriority(_threads[i], priority)){
+			applied = false;
+		}
+	}
+	return applied;
+}
+
+/**
+* run wakes exactly as many workers as can be given a tile, and does not return until
+* each of them has left the job. A worker can therefore never carry a wake-up over into
+* the next job, which is what makes it safe to reuse the job fields.
+*/
+void PIXISWorkerPool::run(TileFunction fn, void* context, int tileCount){
+	if (tileCount <= 0){
+		return;
+	}
+
+	EnterCriticalSection(&_runGuard);
+
+	LONG helpers = (LONG)_threads.size();
+	if (helpers > tileCount - 1){
+		helpers = tileCount - 1;
+	}
+
+	_fn = fn;
+	_context = context;
+	_tileCount = tileCount;
+	InterlockedExchange(&_helpersOut, helpers);
+	InterlockedExchange(&_nextTile, 0);
+
+	if (helpers > 0){
+		ReleaseSemaphore(_wake, helpers, NULL);
+	}
+	drainTiles();
+	if (helpers > 0){
+		WaitForSingleObject(_done, INFINITE);
+	}
+
+	LeaveCriticalSection(&_runGuard);
+}
+
+void PIXISWorkerPool::drainTiles(){
+	PIXISTraceScope scope("Tiles");
+	for (;;){
+		LONG tile = InterlockedIncrement(&_nextTile) - 1;
+		if (tile >= _tileCount){
+			break;
+		}
+		_fn(_context, tile);
+	}
+}
+
+DWORD WINAPI PIXISWorkerPool::workerThread(void* param){
+	PIXISWorkerPool* pool = reinterpret_cast<PIXISWorkerPool*>(param);
+	PIXISTraceRecorder::nameThread("Worker");
+
+	for (;;){
+		WaitForSingleObject(pool->_wake, INFINITE);
+		if (pool->_quit){
+			break;
+		}
+		pool->drainTiles();
+		if (InterlockedDecrement(&pool->_helpersOut) == 0){
+			SetEvent(pool->_done);
+		}
+	}
+	return 0;
+}
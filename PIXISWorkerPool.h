@@ -0,0 +1,75 @@
+/**
+* @file:       PIXISWorkerPool.h
+*
+* Purpose:     Class declaration for PIXISWorkerPool.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_WORKER_POOL_HEADER__
+#define __PIXIS_WORKER_POOL_HEADER__
+
+#include <Windows.h>
+#include <vector>
+
+/**
+* Class PIXISWorkerPool
+*
+* @brief:  Fixed set of worker threads used to split per-pixel work on a readout into
+*          tiles. The thread that calls run() works on tiles too, so a pool started
+*          with 0 threads simply runs every tile inline.
+*/
+class PIXISWorkerPool{
+
+public:
+	// Called once per tile with the context passed to run()
+	typedef void (*TileFunction)(void* context, int tile);
+
+	PIXISWorkerPool();
+	virtual ~PIXISWorkerPool();
+
+	// start creates threadCount workers. A negative count uses one worker per processor, minus the caller.
+	void start(int threadCount);
+
+	// stop asks the workers to exit and waits for them
+	void stop();
+
+	int getThreadCount() const { return (int)_threads.size(); }
+
+	// setAffinity restricts every worker to the processors in mask. Returns false if any worker could not be moved.
+	bool setAffinity(DWORD_PTR mask);
+
+	// setPriority gives every worker a THREAD_PRIORITY_* level. Returns false if any worker could not be changed.
+	bool setPriority(int priority);
+
+	// run calls fn(context, tile) for every tile in [0, tileCount) and returns when all of them are done.
+	// Calls from different threads are serialized.
+	void run(TileFunction fn, void* context, int tileCount);
+
+private:
+	static DWORD WINAPI workerThread(void* param);
+
+	// drainTiles claims and runs tiles of the current job until none are left
+	void drainTiles();
+
+	std::vector<HANDLE> _threads;
+
+	/// Released once per worker that should join the current job
+	HANDLE _wake;
+
+	/// Set by the last worker to leave the current job
+	HANDLE _done;
+
+	CRITICAL_SECTION _runGuard;
+
+	TileFunction _fn;
+	void* _context;
+	LONG _tileCount;
+	volatile LONG _nextTile;
+	volatile LONG _helpersOut;
+	volatile LONG _quit;
+};
+#endif
@@ -0,0 +1,152 @@
+/**
+* @file:       PIXISFrameReader.cpp
+*
+* Purpose:     Implements the reader side of the shared-memory frame ring.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISFrameReader.h"
+
+PIXISFrameReader::PIXISFrameReader() :
+	_mapping(NULL),
+	_header(NULL),
+	_last(0),
+	_lost(0){
+}
+
+PIXISFrameReader::~PIXISFrameReader(){
+	close();
+}
+
+bool PIXISFrameReader::open(const char* name){
+	close();
+
+	_mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+	if (_mapping == NULL){
+		return false;
+	}
+	//A size of 0 maps the whole ring, whatever size the adaptor gave it
+	_header = static_cast<const PIXISSharedFrameHeader*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (_header == NULL){
+		close();
+		return false;
+	}
+
+	//Start with the next readout published, not the ones already in the ring
+	_last = _header->published;
+	_lost = 0;
+	return true;
+}
+
+void PIXISFrameReader::close(){
+	if (_header){
+		UnmapViewOfFile(_header);
+		_header = NULL;
+	}
+	if (_mapping){
+		CloseHandle(_mapping);
+		_mapping = NULL;
+	}
+}
+
+bool PIXISFrameReader::isReady() const{
+	return _header && _header->magic == PIXIS_SHARED_FRAME_MAGIC && _header->version == PIXIS_SHARED_FRAME_VERSION;
+}
+
+LONG64 PIXISFrameReader::getPublished() const{
+	return isReady() ? _header->published : 0;
+}
+
+bool PIXISFrameReader::isAcquiring() const{
+	return isReady() && _header->acquiring != 0;
+}
+
+bool PIXISFrameReader::latest(PIXISFrameView& view) const{
+	if (!isReady()){
+		return false;
+	}
+	return get(_header->published, view);
+}
+
+/**
+* get follows the sequence protocol in PIXISSharedFrameLayout.h: the slot must hold the
+* even sequence of the requested readout both before and after its header is read.
+*/
+bool PIXISFrameReader::get(LONG64 sequence, PIXISFrameView& view) const{
+	if (!isReady()){
+		return false;
+	}
+	LONG64 published = _header->published;
+	LONG slotCount = _header->slotCount;
+	if (sequence < 1 || sequence > published || sequence <= published - slotCount){
+		return false;
+	}
+
+	const BYTE* slotBase = reinterpret_cast<const BYTE*>(_header) + _header->headerBytes +
+		((sequence - 1) % slotCount) * _header->slotBytes;
+	const PIXISSharedSlotHeader* slot = reinterpret_cast<const PIXISSharedSlotHeader*>(slotBase);
+
+	if (slot->sequence != 2 * sequence){
+		return false;
+	}
+	MemoryBarrier();
+
+	view.pixels = slotBase + _header->slotHeaderBytes;
+	view.sequence = sequence;
+	view.readout = slot->readout;
+	view.frame = slot->frame;
+	view.time = slot->time;
+	view.width = slot->width;
+	view.height = slot->height;
+	view.bytesPerPixel = slot->bytesPerPixel;
+	view.slot = slot;
+
+	return isValid(view);
+}
+
+bool PIXISFrameReader::next(PIXISFrameView& view, DWORD timeout){
+	DWORD start = GetTickCount();
+	for (;;){
+		if (isReady()){
+			LONG64 published = _header->published;
+
+			//The adaptor created a new ring under the same name
+			if (published < _last){
+				_last = published;
+			}
+
+			while (published > _last){
+				LONG64 wanted = _last + 1;
+				//The oldest slot may be the one being overwritten, so skip to the one after it
+				LONG64 oldest = published - _header->slotCount + 2;
+				if (wanted < oldest){
+					_lost += oldest - wanted;
+					wanted = oldest;
+				}
+				if (get(wanted, view)){
+					_last = wanted;
+					return true;
+				}
+				//Overwritten between reading published and the slot
+				_lost++;
+				_last = wanted;
+				published = _header->published;
+			}
+		}
+
+		if (GetTickCount() - start >= timeout){
+			return false;
+		}
+		SwitchToThread();
+	}
+}
+
+bool PIXISFrameReader::isValid(const PIXISFrameView& view) const{
+	MemoryBarrier();
+	return view.slot->sequence == 2 * view.sequence;
+}
@@ -0,0 +1,93 @@
+/**
+* @file:       PIXISFrameReader.h
+*
+* Purpose:     Class declaration for PIXISFrameReader, the reader side of the
+*              adaptor's shared-memory frame ring.
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+#ifndef __PIXIS_FRAME_READER_HEADER__
+#define __PIXIS_FRAME_READER_HEADER__
+
+#include <Windows.h>
+#include "../PIXISSharedFrameLayout.h"
+
+/**
+* One readout in the ring. pixels points straight into the mapping; nothing is copied.
+*/
+struct PIXISFrameView{
+	const void* pixels;
+	LONG64 sequence;                // Position in the ring's publish order, starting at 1
+	LONG64 readout;                 // Readout number since startCapture(), starting at 1
+	LONG64 frame;                   // Engine frame number, or 0 if not sent to MATLAB
+	double time;                    // Adaptor timestamp in seconds
+	int width;
+	int height;
+	int bytesPerPixel;
+	const PIXISSharedSlotHeader* slot;
+};
+
+/**
+* Class PIXISFrameReader
+*
+* @brief:  Maps the ring published by the adaptor's Shared_Memory property read only.
+*          The reader never writes to the mapping or signals the adaptor, so any number
+*          of readers can run without affecting the acquisition.
+*
+*          A view stays usable until the adaptor reuses its slot, which happens
+*          Shared_Memory_Slots readouts later. Call isValid() after using the pixels:
+*          if it returns false the slot was overwritten meanwhile and the result must
+*          be discarded.
+*/
+class PIXISFrameReader{
+
+public:
+	PIXISFrameReader();
+	virtual ~PIXISFrameReader();
+
+	// open maps the ring created with the given Shared_Memory_Name. Returns false if it does not exist.
+	bool open(const char* name);
+	void close();
+	bool isOpen() const { return _header != NULL; }
+
+	// getPublished returns the number of readouts published into the ring so far
+	LONG64 getPublished() const;
+
+	// isAcquiring returns true while the adaptor is acquiring into the ring
+	bool isAcquiring() const;
+
+	// latest gets the newest complete readout. Returns false if there is none.
+	bool latest(PIXISFrameView& view) const;
+
+	// get gets readout sequence if it is complete and still in the ring
+	bool get(LONG64 sequence, PIXISFrameView& view) const;
+
+	/**
+	* next gets the readout after the one it last returned, waiting up to timeout ms for
+	* it to be published. Readouts overwritten before they could be read are skipped and
+	* added to getLost().
+	*/
+	bool next(PIXISFrameView& view, DWORD timeout);
+
+	// isValid returns false if the view's slot has been reused since it was returned
+	bool isValid(const PIXISFrameView& view) const;
+
+	// getLost returns the number of readouts next() skipped because the ring had moved past them
+	LONG64 getLost() const { return _lost; }
+
+private:
+	// isReady returns true if the mapping holds an initialized ring
+	bool isReady() const;
+
+	HANDLE _mapping;
+	const PIXISSharedFrameHeader* _header;
+
+	/// Sequence of the last readout next() returned
+	LONG64 _last;
+	LONG64 _lost;
+};
+#endif
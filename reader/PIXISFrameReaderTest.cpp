@@ -0,0 +1,59 @@
+/**
+* @file:       PIXISFrameReaderTest.cpp
+*
+* Purpose:     Console reader for the adaptor's shared-memory frame ring. Prints one
+*              line per readout and a summary of lost and overwritten readouts.
+*
+*              Usage: PIXISFrameReaderTest [Shared_Memory_Name] [readouts]
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "PIXISFrameReader.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char* argv[]){
+	const char* name = argc > 1 ? argv[1] : "PIXISFrames";
+	long count = argc > 2 ? atol(argv[2]) : 100;
+
+	PIXISFrameReader reader;
+	printf("Waiting for shared memory \"%s\"...\n", name);
+	while (!reader.open(name)){
+		Sleep(100);
+	}
+
+	long received = 0;
+	long overwritten = 0;
+	while (received < count){
+		PIXISFrameView view;
+		if (!reader.next(view, 5000)){
+			printf("No readout for 5 s (acquiring: %s)\n", reader.isAcquiring() ? "yes" : "no");
+			continue;
+		}
+
+		//Work on the pixels in place, then check the slot was not reused meanwhile
+		const unsigned short* pixels = static_cast<const unsigned short*>(view.pixels);
+		long pixelCount = (long)view.width * view.height;
+		double sum = 0.0;
+		for (long i = 0; i < pixelCount; ++i){
+			sum += pixels[i];
+		}
+		if (!reader.isValid(view)){
+			overwritten++;
+			continue;
+		}
+
+		received++;
+		printf("readout %lld frame %lld  %dx%d  t=%.6f  mean=%.2f\n",
+			view.readout, view.frame, view.width, view.height, view.time,
+			pixelCount ? sum / pixelCount : 0.0);
+	}
+
+	printf("%ld readouts, %lld lost, %ld overwritten while reading\n", received, reader.getLost(), overwritten);
+	return 0;
+}
@@ -0,0 +1,104 @@
+/**
+* @file:       PIXISReplaySourceTest.cpp
+*
+* Purpose:     Console test for PIXISReplaySource. Writes SPE 3 files with an
+*              exposure-started time stamp footer whose header frame count does not
+*              match the data, as left by a truncated or aborted capture, and checks
+*              they open with only the complete frames.
+*
+*              Usage: PIXISReplaySourceTest [directory]
+*
+* $Revision: 1.0$
+*
+* $Authors:    Matt Naides $
+*
+* $Date: 2014/31/01 14:26:41 $
+*/
+
+#include "../PIXISReplaySource.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Geometry of the test frames: 4 x 2 pixels followed by one 64 bit time stamp
+#define TEST_WIDTH 4
+#define TEST_HEIGHT 2
+#define TEST_PIXEL_BYTES (TEST_WIDTH * TEST_HEIGHT * 2)
+#define TEST_STRIDE (TEST_PIXEL_BYTES + 8)
+
+//put writes a little endian header field of type T at offset
+template <typename T>
+static void put(std::vector<char>& file, size_t offset, T value){
+	memcpy(&file[offset], &value, sizeof(T));
+}
+
+/**
+* writeSpe writes an SPE 3 file holding frames complete frames, with headerFrames in
+* its header and the frame layout and time stamp in the XML footer.
+*/
+static bool writeSpe(const std::string& path, int headerFrames, int frames){
+	std::vector<char> file(4100 + (size_t)frames * TEST_STRIDE, 0);
+	put<unsigned short>(file, 42, TEST_WIDTH);
+	put<short>(file, 108, 3);
+	put<unsigned short>(file, 656, TEST_HEIGHT);
+	put<pi32s>(file, 1446, headerFrames);
+	put<float>(file, 1992, 3.0f);
+	for (int i = 0; i < frames; ++i){
+		put<pi64s>(file, 4100 + (size_t)i * TEST_STRIDE + TEST_PIXEL_BYTES, 1000000LL * i);
+	}
+	put<pi64u>(file, 678, (pi64u)file.size());
+
+	char footer[512];
+	sprintf_s(footer, sizeof(footer),
+		"<SpeFormat><DataFormat><DataBlock type=\"Frame\" count=\"%d\" size=\"%d\" stride=\"%d\">"
+		"<DataBlock type=\"Region\" size=\"%d\" stride=\"%d\" /></DataBlock></DataFormat>"
+		"<MetaFormat><MetaBlock type=\"Frame\"><TimeStamp event=\"ExposureStarted\" type=\"Int64\" bitDepth=\"64\" resolution=\"1000000\" />"
+		"</MetaBlock></MetaFormat></SpeFormat>",
+		headerFrames, TEST_PIXEL_BYTES, TEST_STRIDE, TEST_PIXEL_BYTES, TEST_PIXEL_BYTES);
+	file.insert(file.end(), footer, footer + strlen(footer));
+
+	FILE* out;
+	if (fopen_s(&out, path.c_str(), "wb") != 0){
+		return false;
+	}
+	bool written = fwrite(&file[0], 1, file.size(), out) == file.size();
+	fclose(out);
+	return written;
+}
+
+//check replays a file written with headerFrames and frames and expects it to open with frames frames
+static bool check(const std::string& directory, const char* name, int headerFrames, int frames){
+	std::string path = directory + "\\" + name;
+	if (!writeSpe(path, headerFrames, frames)){
+		printf("FAIL %s: could not write %s\n", name, path.c_str());
+		return false;
+	}
+
+	PIXISReplaySource replay;
+	bool opened = replay.open(path.c_str());
+	pi64s count = replay.getFrameCount();
+	replay.close();
+	DeleteFileA(path.c_str());
+
+	if (!opened || count != frames){
+		printf("FAIL %s: header %d, %d frames written, opened %s with %lld frames\n", name, headerFrames, frames, opened ? "yes" : "no", count);
+		return false;
+	}
+	printf("ok   %s\n", name);
+	return true;
+}
+
+int main(int argc, char* argv[]){
+	std::string directory = argc > 1 ? argv[1] : ".";
+
+	bool passed = true;
+	passed &= check(directory, "complete.spe", 3, 3);
+	passed &= check(directory, "truncated.spe", 3, 2);
+	passed &= check(directory, "aborted.spe", 1000000, 3);
+	passed &= check(directory, "negative.spe", -5, 3);
+	passed &= check(directory, "unknown.spe", 0, 3);
+
+	printf(passed ? "All replay tests passed\n" : "Replay tests failed\n");
+	return passed ? 0 : 1;
+}